@@ -25,6 +25,8 @@
 #include <sstream>
 #include <filesystem>
 
+#include "isowriter.h"
+
 #define MAX_PATH 4096
 #define MAX_CMD 16384
 #define BLUE "\033[34m"
@@ -989,6 +991,34 @@ void squashfs_menu(Distro distro) {
     }
 }
 
+string get_self_path() {
+    char exe_path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    if (len <= 0) return "/proc/self/exe";
+    exe_path[len] = '\0';
+    return exe_path;
+}
+
+// Runs as "sudo <self> write-iso <tree> <iso> <volid> <isohdpfx.bin> <efi image>"
+int write_iso_image(const IsoLayout& layout, const string& iso_file_name) {
+    IsoWriter writer;
+    int last_percent = -1;
+    writer.progress = [&](uint64_t done, uint64_t total) {
+        int percent = total ? static_cast<int>(done * 100 / total) : 0;
+        if (percent == last_percent) return;
+        last_percent = percent;
+        cout << "\r" << COLOR_CYAN << "Writing ISO: " << percent << "% (" << done / 1048576 << " of "
+        << total / 1048576 << " MiB)" << COLOR_RESET << flush;
+    };
+    bool written = writer.write(layout, iso_file_name);
+    cout << endl;
+    if (!written) {
+        cerr << RED << "ISO creation failed: " << writer.error << RESET << endl;
+        return 1;
+    }
+    return 0;
+}
+
 void create_iso(Distro distro) {
     string iso_name = get_iso_name();
     if (iso_name.empty()) {
@@ -1025,31 +1055,28 @@ void create_iso(Distro distro) {
         execute_command("mkdir -p " + output_dir);
     }
 
-    oss.str("");
-    oss << "sudo xorriso -as mkisofs -o " << iso_file_name
-    << " -V 2025 -iso-level 3";
-
+    // Same hybrid layouts as xorriso -isohybrid-mbr ... -isohybrid-gpt-basdat
+    string mbr_image, efi_image;
     if (distro == UBUNTU) {
-        oss << " -isohybrid-mbr /usr/lib/ISOLINUX/isohdpfx.bin"
-        << " -c isolinux/boot.cat"
-        << " -b isolinux/isolinux.bin -no-emul-boot -boot-load-size 4 -boot-info-table"
-        << " -eltorito-alt-boot -e boot/grub/efi.img -no-emul-boot -isohybrid-gpt-basdat";
+        mbr_image = "/usr/lib/ISOLINUX/isohdpfx.bin";
+        efi_image = "boot/grub/efi.img";
     } else if (distro == DEBIAN) {
-        oss << " -isohybrid-mbr /home/$USER/.config/cmi/build-image-debian/isohdpfx.bin"
-        << " -c isolinux/boot.cat"
-        << " -b isolinux/isolinux.bin -no-emul-boot -boot-load-size 4 -boot-info-table"
-        << " -eltorito-alt-boot -e boot/grub/efi.img -no-emul-boot -isohybrid-gpt-basdat";
+        mbr_image = build_image_dir + "/isohdpfx.bin";
+        efi_image = "boot/grub/efi.img";
     } else {
-        oss << " -isohybrid-mbr /usr/lib/syslinux/bios/isohdpfx.bin"
-        << " -c isolinux/boot.cat"
-        << " -b isolinux/isolinux.bin -no-emul-boot -boot-load-size 4 -boot-info-table"
-        << " -eltorito-alt-boot -e boot/grub/efiboot.img -no-emul-boot -isohybrid-gpt-basdat";
+        mbr_image = "/usr/lib/syslinux/bios/isohdpfx.bin";
+        efi_image = "boot/grub/efiboot.img";
     }
 
-    oss << " " << build_image_dir;
-
-    string xorriso_command = oss.str();
-    execute_command(xorriso_command);
+    // The build tree has root-owned files such as the initramfs, so the
+    // writer runs as a sudo child and the ISO is handed back afterwards
+    string command = "sudo " + get_self_path() + " write-iso " + build_image_dir + " \"" + iso_file_name + "\" 2025 " +
+    mbr_image + " " + efi_image;
+    if (system(command.c_str()) != 0) {
+        error_box("ISO Error", "ISO creation failed");
+        return;
+    }
+    execute_command("sudo chown " + string(getenv("USER")) + ":" + string(getenv("USER")) + " \"" + iso_file_name + "\"");
 
     message_box("Success", "ISO creation completed.");
 
@@ -1426,6 +1453,10 @@ void setup_script_menu(Distro distro) {
 }
 
 int main(int argc, char* argv[]) {
+    if (argc == 7 && string(argv[1]) == "write-iso") {
+        return write_iso_image(IsoLayout::isolinux(argv[2], argv[4], argv[5], argv[6]), argv[3]);
+    }
+
     tcgetattr(STDIN_FILENO, &original_term);
     thread time_thread(update_time_thread);
 
@@ -24,6 +24,14 @@
 #include <pwd.h>
 #include <sstream>
 #include <filesystem>
+#include <chrono>
+#include <iomanip>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "isowriter.h"
 
 #define MAX_PATH 4096
 #define MAX_CMD 16384
@@ -438,7 +446,272 @@ void delete_clone(Distro distro) {
     }
 }
 
-void create_iso(Distro distro, const string &output_dir) {
+string get_build_image_dir(Distro distro) {
+    if (distro == UBUNTU || distro == NEON) {
+        return expand_path("/home/$USER/.config/cmi/build-image-noble");
+    } else if (distro == DEBIAN) {
+        return expand_path("/home/$USER/.config/cmi/build-image-debian");
+    }
+    return expand_path("/home/$USER/.config/cmi/build-image-arch");
+}
+
+// Same hybrid layouts as xorriso -isohybrid-mbr ... -isohybrid-gpt-basdat
+IsoLayout get_iso_layout(Distro distro, const string &build_image_dir) {
+    if (distro == UBUNTU || distro == NEON) {
+        return IsoLayout::isolinux(build_image_dir, "2025", "/usr/lib/ISOLINUX/isohdpfx.bin", "boot/grub/efi.img");
+    } else if (distro == DEBIAN) {
+        return IsoLayout::isolinux(build_image_dir, "2025", "/usr/lib/ISOLINUX/isohdpfx.bin", "boot/grub/efiboot.img");
+    }
+    return IsoLayout::isolinux(build_image_dir, "2025", "/usr/lib/syslinux/bios/isohdpfx.bin", "boot/grub/efiboot.img");
+}
+
+string format_size(uint64_t bytes) {
+    char buffer[32];
+    if (bytes >= (1ULL << 30)) {
+        snprintf(buffer, sizeof(buffer), "%.1f GiB", bytes / 1073741824.0);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%.1f MiB", bytes / 1048576.0);
+    }
+    return buffer;
+}
+
+struct VariantBuild {
+    string name;
+    string dir;
+    string iso;
+    pid_t pid = -1;
+    int pipe_fd = -1;
+    bool ok = false;
+    double seconds = 0;
+    uint64_t size = 0;
+    uint64_t reflinked = 0;
+    uint64_t copied = 0;
+    string error;
+};
+
+// A variant directory holds iso/, laid over the ISO tree (boot menus,
+// kernels.cfg, grub.cfg), and root/, laid over the live system (Calamares
+// settings, branding.desc). root/ becomes a small squashfs stacked on top
+// of the shared one by live-boot, so the big image is never rebuilt.
+bool prepare_variant(Distro distro, const VariantBuild &variant, const string &work_dir, IsoLayout &layout, string &error) {
+    string iso_overlay = variant.dir + "/iso";
+    string root_overlay = variant.dir + "/root";
+    if (dir_exists(iso_overlay)) {
+        layout.overlays.push_back(iso_overlay);
+    }
+    if (!dir_exists(root_overlay)) {
+        return true;
+    }
+    if (distro != UBUNTU && distro != NEON && distro != DEBIAN) {
+        error = "root/ overlays need live-boot, archiso only boots airootfs.sfs";
+        return false;
+    }
+
+    string layer_dir = work_dir + "/" + variant.name;
+    string layer = variant.name + ".squashfs";
+    string command = "mkdir -p " + layer_dir + "/live && mksquashfs " + root_overlay + " " + layer_dir + "/live/" + layer +
+    " -noappend -all-root -comp xz -quiet > /dev/null";
+    if (system(command.c_str()) != 0) {
+        error = "mksquashfs failed for " + root_overlay;
+        return false;
+    }
+    ofstream module(layer_dir + "/live/filesystem.module");
+    module << "filesystem.sfs\n" << layer << "\n";
+    if (!module.good()) {
+        error = "cannot write " + layer_dir + "/live/filesystem.module";
+        return false;
+    }
+    layout.overlays.push_back(layer_dir);
+    return true;
+}
+
+string get_self_path() {
+    char exe_path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    if (len <= 0) return "/proc/self/exe";
+    exe_path[len] = '\0';
+    return exe_path;
+}
+
+// Runs as "sudo cmi write-iso <tree> <iso> [--result] [overlay...]": the
+// build tree has root-owned 0600 files such as the initramfs. With
+// --result the outcome is printed as one line for create_iso_variants
+// instead of the progress.
+int write_iso(Distro distro, const string &build_image_dir, const string &iso_file_name, bool result_line,
+              const vector<string> &overlays) {
+    auto start = chrono::steady_clock::now();
+    IsoLayout layout = get_iso_layout(distro, build_image_dir);
+    layout.overlays = overlays;
+    IsoWriter writer;
+    int last_percent = -1;
+    if (!result_line) {
+        writer.progress = [&](uint64_t done, uint64_t total) {
+            int percent = total ? static_cast<int>(done * 100 / total) : 0;
+            if (percent == last_percent) return;
+            last_percent = percent;
+            cout << "\r" << COLOR_CYAN << "Writing ISO: " << percent << "% (" << done / 1048576 << " of "
+            << total / 1048576 << " MiB)" << COLOR_RESET << flush;
+        };
+    }
+    bool ok = writer.write(layout, iso_file_name);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (result_line) {
+        cout << (ok ? 1 : 0) << " " << seconds << " " << writer.totalBytes << " " << writer.reflinkedBytes << " "
+        << writer.copiedPayloadBytes << " " << writer.error << endl;
+    } else {
+        cout << endl;
+        if (!ok) cerr << RED << "ISO creation failed: " << writer.error << RESET << endl;
+    }
+    return ok ? 0 : 1;
+}
+
+// Runs in a forked child. The overlays are prepared as the user, then the
+// child becomes "sudo cmi write-iso --result" with the pipe as its stdout,
+// so the result line goes straight back to the parent. libisofs keeps
+// global state, so every variant needs a process of its own anyway.
+void build_variant(Distro distro, const VariantBuild &variant, const string &build_image_dir, const string &work_dir, int fd) {
+    IsoLayout layout;
+    string error;
+    if (prepare_variant(distro, variant, work_dir, layout, error) && dup2(fd, STDOUT_FILENO) >= 0) {
+        close(fd);
+        string self = get_self_path();
+        vector<const char*> args = {"sudo", self.c_str(), "write-iso", build_image_dir.c_str(), variant.iso.c_str(), "--result"};
+        for (const auto &overlay : layout.overlays) {
+            args.push_back(overlay.c_str());
+        }
+        args.push_back(nullptr);
+        execvp("sudo", const_cast<char* const*>(args.data()));
+        error = string("cannot run sudo: ") + strerror(errno);
+        fd = STDOUT_FILENO;
+    }
+
+    string out = "0 0 0 0 0 " + error + "\n";
+    ssize_t n = write(fd, out.data(), out.size());
+    (void)n;
+    close(fd);
+    _exit(1);
+}
+
+void read_variant_result(VariantBuild &variant) {
+    string line;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(variant.pipe_fd, buffer, sizeof(buffer))) > 0) {
+        line.append(buffer, n);
+    }
+    close(variant.pipe_fd);
+    variant.pipe_fd = -1;
+
+    istringstream in(line);
+    int ok = 0;
+    if (!(in >> ok >> variant.seconds >> variant.size >> variant.reflinked >> variant.copied)) {
+        variant.error = "writer exited without a result";
+        return;
+    }
+    getline(in >> ws, variant.error);
+    variant.ok = ok == 1;
+}
+
+void create_iso_variants(Distro distro, const string &output_dir, const string &iso_name, const string &timestamp,
+                         const vector<string> &variant_dirs) {
+    string build_image_dir = get_build_image_dir(distro);
+    string work_dir = output_dir + "/.variants";
+    execute_command("rm -rf " + work_dir + " && mkdir -p " + work_dir);
+
+    vector<VariantBuild> variants;
+    for (const auto &dir : variant_dirs) {
+        VariantBuild variant;
+        variant.dir = dir;
+        while (variant.dir.size() > 1 && variant.dir.back() == '/') {
+            variant.dir.pop_back();
+        }
+        variant.name = filesystem::path(variant.dir).filename().string();
+        if (!dir_exists(variant.dir)) {
+            cerr << RED << "Variant directory not found: " << dir << RESET << endl;
+            exit(1);
+        }
+        for (const auto &other : variants) {
+            if (other.name == variant.name) {
+                cerr << RED << "Two variants are named " << variant.name << RESET << endl;
+                exit(1);
+            }
+        }
+        variant.iso = output_dir + "/" + iso_name + "_" + variant.name + "_amd64_" + timestamp + ".iso";
+        variants.push_back(variant);
+    }
+
+    // One password prompt up front instead of one per parallel writer
+    execute_command("sudo -v");
+    cout << COLOR_CYAN << "Writing " << variants.size() << " ISO variants from one squashfs..." << RESET << endl;
+    auto start = chrono::steady_clock::now();
+    for (auto &variant : variants) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            cerr << RED << "pipe failed: " << strerror(errno) << RESET << endl;
+            exit(1);
+        }
+        cout.flush();
+        pid_t pid = fork();
+        if (pid < 0) {
+            cerr << RED << "fork failed: " << strerror(errno) << RESET << endl;
+            exit(1);
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            build_variant(distro, variant, build_image_dir, work_dir, fds[1]);
+        }
+        close(fds[1]);
+        variant.pid = pid;
+        variant.pipe_fd = fds[0];
+    }
+
+    size_t remaining = variants.size();
+    while (remaining > 0) {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (auto &variant : variants) {
+            if (variant.pid != pid) continue;
+            read_variant_result(variant);
+            variant.ok = variant.ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (variant.ok) {
+                execute_command("sudo chown " + string(getenv("USER")) + ": \"" + variant.iso + "\"");
+                cout << GREEN << "  " << variant.name << " done in " << fixed << setprecision(1) << variant.seconds << "s" << RESET << endl;
+            } else {
+                cout << RED << "  " << variant.name << " failed: " << variant.error << RESET << endl;
+            }
+            remaining--;
+        }
+    }
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    execute_command("rm -rf " + work_dir);
+
+    double serial = 0;
+    bool all_ok = true;
+    cout << "\n" << left << setw(20) << "variant" << right << setw(10) << "time" << setw(12) << "size" << setw(12) << "shared"
+    << setw(12) << "copied" << "\n";
+    for (const auto &variant : variants) {
+        serial += variant.seconds;
+        all_ok = all_ok && variant.ok;
+        cout << left << setw(20) << variant.name << right << setw(9) << fixed << setprecision(1) << variant.seconds << "s";
+        if (variant.ok) {
+            cout << setw(12) << format_size(variant.size) << setw(12) << format_size(variant.reflinked)
+            << setw(12) << format_size(variant.copied) << "  " << variant.iso;
+        } else {
+            cout << "  " << RED << "failed" << RESET;
+        }
+        cout << "\n";
+    }
+    cout << "Wall time " << fixed << setprecision(1) << wall << "s, " << serial << "s one after another" << endl;
+    if (!all_ok) {
+        exit(1);
+    }
+}
+
+void create_iso(Distro distro, const string &output_dir, const vector<string> &variant_dirs) {
     string iso_name = get_iso_name();
     if (iso_name.empty()) {
         exit(1);
@@ -453,43 +726,351 @@ void create_iso(Distro distro, const string &output_dir) {
     char timestamp[20];
     strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H%M", t);
 
+    if (!dir_exists(output_dir)) {
+        execute_command("mkdir -p " + output_dir);
+    }
+
+    if (!variant_dirs.empty()) {
+        create_iso_variants(distro, output_dir, iso_name, timestamp, variant_dirs);
+        return;
+    }
+
     string iso_file_name = output_dir + "/" + iso_name + "_amd64_" + timestamp + ".iso";
+    string command = "sudo " + get_self_path() + " write-iso " + get_build_image_dir(distro) + " \"" + iso_file_name + "\"";
+    cout.flush();
+    if (system(command.c_str()) != 0) {
+        exit(1);
+    }
+    execute_command("sudo chown " + string(getenv("USER")) + ": \"" + iso_file_name + "\"");
+}
 
-    string build_image_dir;
-    if (distro == UBUNTU || distro == NEON) {
-        build_image_dir = expand_path("/home/$USER/.config/cmi/build-image-noble");
-    } else if (distro == DEBIAN) {
-        build_image_dir = expand_path("/home/$USER/.config/cmi/build-image-debian");
+// Netboot tree: the kernel and initramfs are copied readable (mkinitcpio
+// writes 0600 images), the squashfs is linked so the tree never goes stale.
+// @CMI_HOST@ in the boot scripts is filled in by "cmi serve" from the Host
+// header, so the same tree works on the LAN and from QEMU's 10.0.2.2.
+string find_boot_file(const string &dir, const string &preferred, const string &prefix) {
+    struct stat st;
+    if (stat((dir + "/" + preferred).c_str(), &st) == 0) {
+        return dir + "/" + preferred;
+    }
+    string found;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (struct dirent* entry = readdir(d)) {
+            string name = entry->d_name;
+            if (name.rfind(prefix, 0) == 0 && (found.empty() || dir + "/" + name < found)) {
+                found = dir + "/" + name;
+            }
+        }
+        closedir(d);
+    }
+    return found;
+}
+
+void create_netboot(Distro distro, const string &output_dir) {
+    string build_image_dir = get_build_image_dir(distro);
+    bool arch = distro != UBUNTU && distro != NEON && distro != DEBIAN;
+    string kernel, initrd, squashfs_rel, cmdline;
+    if (arch) {
+        kernel = find_boot_file(build_image_dir + "/live", "vmlinuz-linux", "vmlinuz");
+        initrd = find_boot_file(build_image_dir + "/live", "initramfs-linux.img", "initramfs");
+        squashfs_rel = "arch/x86_64/airootfs.sfs";
+        // archiso_pxe_http fetches <srv><archisobasedir>/x86_64/airootfs.sfs
+        cmdline = "archisobasedir=arch archiso_http_srv=http://@CMI_HOST@/ ip=dhcp";
     } else {
-        build_image_dir = expand_path("/home/$USER/.config/cmi/build-image-arch");
+        string kernel_version = get_kernel_version();
+        kernel = find_boot_file(build_image_dir + "/live", "vmlinuz-" + kernel_version, "vmlinuz");
+        initrd = find_boot_file(build_image_dir + "/live", "initrd.img-" + kernel_version, "initrd");
+        squashfs_rel = "live/filesystem.sfs";
+        cmdline = "boot=live fetch=http://@CMI_HOST@/live/filesystem.sfs ip=dhcp";
+    }
+    string squashfs = build_image_dir + "/" + squashfs_rel;
+    struct stat st;
+    if (kernel.empty() || initrd.empty() || stat(squashfs.c_str(), &st) != 0) {
+        cerr << RED << "Kernel, initramfs or squashfs missing in " << build_image_dir
+        << " - run gen-init and create-squashfs first" << RESET << endl;
+        exit(1);
     }
 
-    if (!dir_exists(output_dir)) {
-        execute_command("mkdir -p " + output_dir);
+    string squashfs_dir = output_dir + "/" + squashfs_rel.substr(0, squashfs_rel.rfind('/'));
+    execute_command("mkdir -p " + output_dir + "/boot " + squashfs_dir);
+    execute_command("sudo install -m644 " + kernel + " " + output_dir + "/boot/vmlinuz");
+    execute_command("sudo install -m644 " + initrd + " " + output_dir + "/boot/initrd.img");
+    execute_command("sudo chown $USER: " + output_dir + "/boot/vmlinuz " + output_dir + "/boot/initrd.img");
+    execute_command("ln -sfn " + squashfs + " " + output_dir + "/" + squashfs_rel);
+
+    string title = get_iso_name().empty() ? get_distro_name(distro) : get_iso_name();
+    ofstream ipxe(output_dir + "/boot.ipxe");
+    ipxe << "#!ipxe\n"
+    << "echo Booting " << title << " from http://@CMI_HOST@/\n"
+    << "kernel http://@CMI_HOST@/boot/vmlinuz initrd=initrd.img " << cmdline << "\n"
+    << "initrd http://@CMI_HOST@/boot/initrd.img\n"
+    << "boot\n";
+    ofstream grub(output_dir + "/grub.cfg");
+    grub << "set timeout=5\n\n"
+    << "menuentry \"" << title << " (HTTP)\" {\n"
+    << "    linux (http,@CMI_HOST@)/boot/vmlinuz " << cmdline << "\n"
+    << "    initrd (http,@CMI_HOST@)/boot/initrd.img\n"
+    << "}\n";
+    if (!ipxe.good() || !grub.good()) {
+        cerr << RED << "Failed to write the boot scripts in " << output_dir << RESET << endl;
+        exit(1);
     }
 
-    string xorriso_command = "sudo xorriso -as mkisofs -o " + iso_file_name +
-    " -V 2025 -iso-level 3";
+    cout << GREEN << "Netboot tree written to " << output_dir << RESET << endl;
+    cout << COLOR_CYAN << "Serve it with:        cmi serve " << output_dir << " 8080\n"
+    << "iPXE clients chain:   http://<this host>:8080/boot.ipxe\n"
+    << "GRUB clients load:    (http,<this host>:8080)/grub.cfg\n"
+    << "Try it in QEMU:       cmi qemu-netboot 8080" << RESET << endl;
+}
 
-    if (distro == UBUNTU || distro == NEON) {
-        xorriso_command += " -isohybrid-mbr /usr/lib/ISOLINUX/isohdpfx.bin"
-        " -c isolinux/boot.cat"
-        " -b isolinux/isolinux.bin -no-emul-boot -boot-load-size 4 -boot-info-table"
-        " -eltorito-alt-boot -e boot/grub/efi.img -no-emul-boot -isohybrid-gpt-basdat";
-    } else if (distro == DEBIAN) {
-        xorriso_command += " -isohybrid-mbr /usr/lib/ISOLINUX/isohdpfx.bin"
-        " -c isolinux/boot.cat"
-        " -b isolinux/isolinux.bin -no-emul-boot -boot-load-size 4 -boot-info-table"
-        " -eltorito-alt-boot -e boot/grub/efiboot.img -no-emul-boot -isohybrid-gpt-basdat";
-    } else {
-        xorriso_command += " -isohybrid-mbr /usr/lib/syslinux/bios/isohdpfx.bin"
-        " -c isolinux/boot.cat"
-        " -b isolinux/isolinux.bin -no-emul-boot -boot-load-size 4 -boot-info-table"
-        " -eltorito-alt-boot -e boot/grub/efiboot.img -no-emul-boot -isohybrid-gpt-basdat";
+mutex serve_log_mutex;
+
+// Each client holds a thread and two descriptors; past this many the
+// accept loop waits and new connections queue in the listen backlog
+const int MAX_SERVE_CLIENTS = 64;
+atomic<int> serve_clients{0};
+
+string http_content_type(const string &path) {
+    size_t dot = path.rfind('.');
+    string ext = dot == string::npos ? "" : path.substr(dot + 1);
+    if (ext == "ipxe" || ext == "cfg" || ext == "txt") return "text/plain";
+    if (ext == "html") return "text/html";
+    return "application/octet-stream";
+}
+
+string url_decode(const string &in) {
+    string out;
+    for (size_t i = 0; i < in.size(); i++) {
+        if (in[i] == '%' && i + 2 < in.size() && isxdigit(static_cast<unsigned char>(in[i + 1])) &&
+            isxdigit(static_cast<unsigned char>(in[i + 2]))) {
+            out += static_cast<char>(stoi(in.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            out += in[i];
+        }
+    }
+    return out;
+}
+
+bool send_all(int fd, const string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Parses a single "bytes=first-last" range; multiple ranges get the whole
+// file, which RFC 9110 allows. Returns false for an unsatisfiable range.
+bool parse_range(const string &header, uint64_t size, uint64_t &first, uint64_t &last, bool &partial) {
+    partial = false;
+    first = 0;
+    last = size ? size - 1 : 0;
+    if (header.rfind("bytes=", 0) != 0 || header.find(',') != string::npos) return true;
+    string spec = header.substr(6);
+    size_t dash = spec.find('-');
+    if (dash == string::npos) return true;
+    string a = spec.substr(0, dash), b = spec.substr(dash + 1);
+    try {
+        if (a.empty()) {
+            uint64_t suffix = stoull(b);
+            if (suffix == 0 || size == 0) return false;
+            first = suffix >= size ? 0 : size - suffix;
+        } else {
+            first = stoull(a);
+            if (!b.empty()) last = min<uint64_t>(stoull(b), size - 1);
+            if (first >= size || (!b.empty() && stoull(b) < first)) return false;
+        }
+    } catch (...) {
+        return true;
+    }
+    partial = true;
+    return true;
+}
+
+void serve_client(int fd, string root, string client) {
+    timeval timeout{30, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    string buffer;
+    bool keep_alive = true;
+    while (keep_alive) {
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == string::npos) {
+            char chunk[4096];
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0 || buffer.size() > 65536) {
+                close(fd);
+                serve_clients--;
+                return;
+            }
+            buffer.append(chunk, n);
+        }
+        istringstream request(buffer.substr(0, end));
+        buffer.erase(0, end + 4);
+
+        string method, target, version, line, host, range;
+        request >> method >> target >> version;
+        getline(request, line);
+        keep_alive = version == "HTTP/1.1";
+        while (getline(request, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            size_t colon = line.find(':');
+            if (colon == string::npos) continue;
+            string name = line.substr(0, colon), value = line.substr(colon + 1);
+            for (auto &c : name) c = tolower(static_cast<unsigned char>(c));
+            value.erase(0, value.find_first_not_of(" \t"));
+            if (name == "host") host = value;
+            else if (name == "range") range = value;
+            else if (name == "connection") {
+                for (auto &c : value) c = tolower(static_cast<unsigned char>(c));
+                if (value == "close") keep_alive = false;
+                else if (value == "keep-alive") keep_alive = true;
+            }
+        }
+
+        if (host.empty()) {
+            sockaddr_in local{};
+            socklen_t local_len = sizeof(local);
+            char ip[INET_ADDRSTRLEN] = "127.0.0.1";
+            if (getsockname(fd, reinterpret_cast<sockaddr*>(&local), &local_len) == 0) {
+                inet_ntop(AF_INET, &local.sin_addr, ip, sizeof(ip));
+            }
+            host = string(ip) + ":" + to_string(ntohs(local.sin_port));
+        }
+        string path = url_decode(target.substr(0, target.find('?')));
+        int status = 200;
+        string file = root + path;
+        struct stat st{};
+        if (method != "GET" && method != "HEAD") {
+            status = 405;
+        } else if (path.empty() || path[0] != '/' || path.find("/..") != string::npos) {
+            status = 400;
+        } else if (stat(file.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            file += (file.back() == '/' ? "" : "/") + string("index.html");
+        }
+        int file_fd = -1;
+        if (status == 200) {
+            file_fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file_fd < 0) status = errno == EACCES ? 403 : 404;
+            else if (fstat(file_fd, &st) != 0 || !S_ISREG(st.st_mode)) status = 404;
+        }
+
+        // Boot scripts are small; they go out from memory with the host filled in
+        string body;
+        bool templated = status == 200 && st.st_size <= 65536 && (http_content_type(file) == "text/plain");
+        if (templated) {
+            body.resize(st.st_size);
+            if (pread(file_fd, body.data(), body.size(), 0) != static_cast<ssize_t>(body.size())) status = 500;
+            for (size_t pos = 0; (pos = body.find("@CMI_HOST@", pos)) != string::npos; pos += host.size()) {
+                body.replace(pos, 10, host);
+            }
+        }
+        uint64_t size = templated ? body.size() : static_cast<uint64_t>(st.st_size);
+
+        uint64_t first = 0, last = 0;
+        bool partial = false;
+        if (status == 200 && !parse_range(range, size, first, last, partial)) status = 416;
+        if (partial && status == 200) status = 206;
+
+        ostringstream head;
+        const char* reason = status == 200 ? "OK" : status == 206 ? "Partial Content" : status == 400 ? "Bad Request" :
+        status == 403 ? "Forbidden" : status == 404 ? "Not Found" : status == 405 ? "Method Not Allowed" :
+        status == 416 ? "Range Not Satisfiable" : "Internal Server Error";
+        uint64_t length = status == 200 || status == 206 ? (size ? last - first + 1 : 0) : 0;
+        head << "HTTP/1.1 " << status << " " << reason << "\r\n"
+        << "Server: cmi\r\nAccept-Ranges: bytes\r\n"
+        << "Content-Length: " << length << "\r\n"
+        << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n";
+        if (status == 200 || status == 206) head << "Content-Type: " << http_content_type(file) << "\r\n";
+        if (status == 206) head << "Content-Range: bytes " << first << "-" << last << "/" << size << "\r\n";
+        if (status == 416) head << "Content-Range: bytes */" << size << "\r\n";
+        if (status == 405) head << "Allow: GET, HEAD\r\n";
+        head << "\r\n";
+
+        bool ok = send_all(fd, head.str());
+        if (ok && method == "GET" && length > 0) {
+            if (templated) {
+                ok = send_all(fd, body.substr(first, length));
+            } else {
+                off_t offset = first;
+                uint64_t remaining = length;
+                while (ok && remaining > 0) {
+                    ssize_t n = sendfile(fd, file_fd, &offset, min<uint64_t>(remaining, 1 << 30));
+                    if (n < 0 && errno == EINTR) continue;
+                    ok = n > 0;
+                    if (ok) remaining -= n;
+                }
+            }
+        }
+        if (file_fd >= 0) close(file_fd);
+        {
+            lock_guard<mutex> lock(serve_log_mutex);
+            cout << client << " " << method << " " << path << " " << status << " " << length
+            << (partial ? " (range " + to_string(first) + "-" + to_string(last) + ")" : "") << endl;
+        }
+        if (!ok) break;
     }
+    close(fd);
+    serve_clients--;
+}
+
+void serve_directory(const string &dir, int port) {
+    char resolved[PATH_MAX];
+    if (!realpath(dir.c_str(), resolved) || !dir_exists(resolved)) {
+        cerr << RED << "Not a directory: " << dir << RESET << endl;
+        exit(1);
+    }
+    string root = resolved;
+    if (root == "/") root.clear();
+
+    int server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (server < 0 || bind(server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server, 128) != 0) {
+        cerr << RED << "Cannot listen on port " << port << ": " << strerror(errno) << RESET << endl;
+        exit(1);
+    }
+    cout << GREEN << "Serving " << resolved << " on port " << port << " (Ctrl+C to stop)" << RESET << endl;
+
+    while (true) {
+        if (serve_clients >= MAX_SERVE_CLIENTS) {
+            this_thread::sleep_for(chrono::milliseconds(50));
+            continue;
+        }
+        sockaddr_in peer{};
+        socklen_t peer_len = sizeof(peer);
+        int client = accept4(server, reinterpret_cast<sockaddr*>(&peer), &peer_len, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            // Out of descriptors or memory: retrying at once would spin, so
+            // give the running clients a moment to finish
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                this_thread::sleep_for(chrono::milliseconds(100));
+                continue;
+            }
+            break;
+        }
+        char ip[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+        serve_clients++;
+        thread(serve_client, client, root, string(ip)).detach();
+    }
+    close(server);
+}
 
-    xorriso_command += " " + build_image_dir;
-    execute_command(xorriso_command);
+// QEMU's user-mode network reaches the host as 10.0.2.2 and hands the
+// bootfile URL to the built-in iPXE ROM over DHCP
+void run_qemu_netboot(int port) {
+    execute_command("qemu-system-x86_64 -enable-kvm -cpu host -m 6G -boot n "
+    "-netdev user,id=net0,bootfile=http://10.0.2.2:" + to_string(port) + "/boot.ipxe "
+    "-device virtio-net-pci,netdev=net0");
 }
 
 void run_qemu() {
@@ -540,7 +1121,15 @@ void print_usage() {
     << "  create-squashfs-clone   - Clone system and create squashfs\n"
     << "  delete-clone            - Delete cloned system\n"
     << "  create-iso <out_dir>    - Create ISO image\n"
+    << "  create-iso <out_dir> <variant_dir>...\n"
+    << "                          - Create one ISO per variant overlay (iso/, root/)\n"
+    << "                            sharing the built squashfs, written concurrently\n"
+    << "  write-iso <tree> <iso> [--result] [overlay...]\n"
+    << "                          - Write the ISO as root (create-iso runs this through sudo)\n"
     << "  run-qemu                - Run QEMU with the ISO\n"
+    << "  netboot <out_dir>       - Write kernel, initramfs, squashfs and iPXE/GRUB configs for HTTP boot\n"
+    << "  serve <dir> [port]      - Serve a directory over HTTP with range requests (default port 8080)\n"
+    << "  qemu-netboot [port]     - Boot QEMU over user-mode networking from cmi serve\n"
     << "  status                  - Show current status\n"
     << "  guide                   - Show user guide\n"
     << "  changelog               - Show changelog\n"
@@ -579,9 +1168,23 @@ int main(int argc, char* argv[]) {
     else if (command == "delete-clone") delete_clone(distro);
     else if (command == "create-iso") {
         if (argc < 3) return 1;
-        create_iso(distro, argv[2]);
+        create_iso(distro, argv[2], vector<string>(argv + 3, argv + argc));
+    }
+    else if (command == "write-iso") {
+        if (argc < 4) return 1;
+        bool result_line = argc > 4 && string(argv[4]) == "--result";
+        return write_iso(distro, argv[2], argv[3], result_line, vector<string>(argv + (result_line ? 5 : 4), argv + argc));
     }
     else if (command == "run-qemu") run_qemu();
+    else if (command == "netboot") {
+        if (argc < 3) return 1;
+        create_netboot(distro, argv[2]);
+    }
+    else if (command == "serve") {
+        if (argc < 3) return 1;
+        serve_directory(argv[2], argc > 3 ? atoi(argv[3]) : 8080);
+    }
+    else if (command == "qemu-netboot") run_qemu_netboot(argc > 2 ? atoi(argv[2]) : 8080);
     else if (command == "status") show_status(distro);
     else if (command == "guide") show_guide();
     else if (command == "changelog") show_changelog();
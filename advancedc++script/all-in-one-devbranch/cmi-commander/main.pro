@@ -8,4 +8,8 @@ TARGET = cmi
 # Source Files
 SOURCES += archubuntudebian.cpp
 
+# Header Files
+INCLUDEPATH += $$PWD/../../../shared
+HEADERS += $$PWD/../../../shared/isowriter.h
 
+LIBS += -lisofs
@@ -8,4 +8,8 @@ TARGET = cmi.bin
 # Source Files
 SOURCES += archubuntudebian.cpp
 
+# Header Files
+INCLUDEPATH += $$PWD/../../shared
+HEADERS += $$PWD/../../shared/isowriter.h
 
+LIBS += -lisofs
@@ -0,0 +1,369 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "layers.h"
+
+// One slice of the root tree that is compressed into its own squashfs
+// layer. The key covers everything that ends up in the compressed bytes.
+struct ShardPlanEntry {
+    std::string key;
+    std::vector<std::string> paths;   // sorted, parent directories included
+    uint64_t bytes = 0;
+};
+
+struct ShardPlan {
+    std::vector<ShardPlanEntry> shards;
+    uint64_t hashedFiles = 0;
+    uint64_t hashedBytes = 0;
+    uint64_t memoHits = 0;
+};
+
+// Splits a tree into content-addressed shards. Cut points depend only on
+// the paths around them, so an edit somewhere in usr/share only changes
+// the keys of the shards that actually contain the edit.
+class ShardPlanner {
+public:
+    static constexpr uint64_t MIN_SHARD_BYTES = 128ULL << 20;
+    static constexpr uint64_t MAX_SHARD_BYTES = 512ULL << 20;
+    static constexpr uint64_t CUT_MODULUS = 64;
+
+    // compressorArgs is part of every key, so a change of compressor,
+    // level or block size never reuses bytes made with other settings.
+    static ShardPlan plan(const std::string& root, const TreeManifest& manifest,
+                          const std::string& compressorArgs, const std::string& memoPath) {
+        ShardPlan result;
+        std::map<std::string, uint64_t> contentHash;
+        hashFiles(root, manifest, memoPath, contentHash, result);
+        std::map<std::string, uint64_t> xattrHash;
+        hashXattrs(root, manifest, xattrHash);
+
+        ShardPlanEntry current;
+        std::set<std::string> currentPaths;
+        for (const auto& [rel, e] : manifest.entries) {
+            addWithParents(rel, currentPaths);
+            if (e.type == 'f') current.bytes += e.size;
+
+            bool cut = current.bytes >= MAX_SHARD_BYTES ||
+            (current.bytes >= MIN_SHARD_BYTES && XXH64::of(rel.data(), rel.size()) % CUT_MODULUS == 0);
+            if (cut) {
+                finish(current, currentPaths, manifest, contentHash, xattrHash, compressorArgs, result);
+            }
+        }
+        if (!currentPaths.empty()) {
+            finish(current, currentPaths, manifest, contentHash, xattrHash, compressorArgs, result);
+        }
+        return result;
+    }
+
+private:
+    static void addWithParents(const std::string& rel, std::set<std::string>& paths) {
+        if (!paths.insert(rel).second) return;
+        size_t slash = rel.rfind('/');
+        while (slash != std::string::npos) {
+            std::string parent = rel.substr(0, slash);
+            if (!paths.insert(parent).second) break;
+            slash = parent.rfind('/');
+        }
+    }
+
+    static void finish(ShardPlanEntry& shard, std::set<std::string>& paths, const TreeManifest& manifest,
+                       const std::map<std::string, uint64_t>& contentHash,
+                       const std::map<std::string, uint64_t>& xattrHash, const std::string& compressorArgs,
+                       ShardPlan& result) {
+        shard.paths.assign(paths.begin(), paths.end());
+
+        XXH64 lo(0), hi(0x9e3779b97f4a7c15ULL);
+        auto feed = [&](const std::string& s) {
+            lo.update(s);
+            lo.update("\0", 1);
+            hi.update(s);
+            hi.update("\0", 1);
+        };
+        feed(compressorArgs);
+        for (const auto& rel : shard.paths) {
+            auto it = manifest.entries.find(rel);
+            if (it == manifest.entries.end()) continue;
+            const ManifestEntry& e = it->second;
+            std::ostringstream meta;
+            meta << rel << '\t' << e.type << '\t' << e.mode << '\t' << e.uid << '\t' << e.gid;
+            // A directory's size and mtime move whenever anything below it
+            // changes, and every shard that passes through it includes it;
+            // keying on them would invalidate shards whose files are untouched
+            if (e.type != 'd') meta << '\t' << e.size << '\t' << e.mtime << '\t' << e.link;
+            if (e.type == 'f') {
+                auto h = contentHash.find(rel);
+                meta << '\t' << (h != contentHash.end() ? XXH64::hex(h->second) : "unreadable");
+            }
+            auto x = xattrHash.find(rel);
+            if (x != xattrHash.end()) meta << "\txattrs " << XXH64::hex(x->second);
+            feed(meta.str());
+        }
+        shard.key = XXH64::hex(lo.digest()) + XXH64::hex(hi.digest());
+
+        result.shards.push_back(std::move(shard));
+        shard = ShardPlanEntry();
+        paths.clear();
+    }
+
+public:
+    // Content hashes are memoised by inode, size, mtime and ctime so a
+    // nightly rebuild only reads files that were touched since the last one.
+    static void hashFiles(const std::string& root, const TreeManifest& manifest, const std::string& memoPath,
+                          std::map<std::string, uint64_t>& contentHash, ShardPlan& result) {
+        std::map<std::string, std::pair<std::string, uint64_t>> memo;
+        std::ifstream memoIn(memoPath);
+        std::string line;
+        while (std::getline(memoIn, line)) {
+            size_t a = line.find('\t');
+            size_t b = line.find('\t', a + 1);
+            if (a == std::string::npos || b == std::string::npos) continue;
+            memo[TreeManifest::unescape(line.substr(0, a))] = {line.substr(a + 1, b - a - 1),
+                std::strtoull(line.substr(b + 1).c_str(), nullptr, 16)};
+        }
+
+        std::vector<std::string> files;
+        for (const auto& kv : manifest.entries) {
+            if (kv.second.type == 'f') files.push_back(kv.first);
+        }
+
+        std::vector<uint64_t> hashes(files.size(), 0);
+        std::vector<std::string> stamps(files.size());
+        std::vector<char> ok(files.size(), 0);
+        std::atomic<size_t> next(0);
+        std::atomic<uint64_t> hashedFiles(0), hashedBytes(0), memoHits(0);
+
+        auto worker = [&]() {
+            size_t i;
+            while ((i = next.fetch_add(1)) < files.size()) {
+                std::string full = root + "/" + files[i];
+                struct stat st;
+                if (lstat(full.c_str(), &st) != 0) continue;
+                std::ostringstream stamp;
+                stamp << st.st_ino << ':' << st.st_size << ':' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec
+                << ':' << st.st_ctim.tv_sec << '.' << st.st_ctim.tv_nsec;
+                stamps[i] = stamp.str();
+
+                auto m = memo.find(files[i]);
+                if (m != memo.end() && m->second.first == stamps[i]) {
+                    hashes[i] = m->second.second;
+                    ok[i] = 1;
+                    memoHits++;
+                    continue;
+                }
+                if (XXH64::ofFile(full, hashes[i])) {
+                    ok[i] = 1;
+                    hashedFiles++;
+                    hashedBytes += static_cast<uint64_t>(st.st_size);
+                }
+            }
+        };
+
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+        for (auto& t : pool) t.join();
+
+        std::ofstream memoOut(memoPath, std::ios::trunc);
+        for (size_t i = 0; i < files.size(); i++) {
+            if (!ok[i]) continue;
+            contentHash[files[i]] = hashes[i];
+            memoOut << TreeManifest::escape(files[i]) << '\t' << stamps[i] << '\t' << XXH64::hex(hashes[i]) << '\n';
+        }
+
+        result.hashedFiles = hashedFiles;
+        result.hashedBytes = hashedBytes;
+        result.memoHits = memoHits;
+    }
+
+    // Digest of every extended attribute of every entry, as tar
+    // --xattrs-include='*' --acls stores them. ACLs and file capabilities
+    // are xattrs too, and setfacl or setcap only move ctime, which the key
+    // does not otherwise cover. Entries without xattrs get no digest.
+    static void hashXattrs(const std::string& root, const TreeManifest& manifest,
+                           std::map<std::string, uint64_t>& xattrHash) {
+        std::vector<const std::string*> paths;
+        for (const auto& kv : manifest.entries) paths.push_back(&kv.first);
+
+        std::vector<uint64_t> hashes(paths.size(), 0);
+        std::vector<char> found(paths.size(), 0);
+        std::atomic<size_t> next(0);
+
+        auto worker = [&]() {
+            std::vector<char> names(4096), value(4096);
+            size_t i;
+            while ((i = next.fetch_add(1)) < paths.size()) {
+                std::string full = root + "/" + *paths[i];
+                ssize_t len = llistxattr(full.c_str(), names.data(), names.size());
+                if (len < 0 && errno == ERANGE && (len = llistxattr(full.c_str(), nullptr, 0)) > 0) {
+                    names.resize(static_cast<size_t>(len));
+                    len = llistxattr(full.c_str(), names.data(), names.size());
+                }
+                if (len < 0 && errno != ENOTSUP) {
+                    // Unlistable: key it as such rather than as "no xattrs"
+                    hashes[i] = XXH64::of("unreadable", 10);
+                    found[i] = 1;
+                    continue;
+                }
+                if (len <= 0) continue;
+
+                std::vector<std::string> keys;
+                for (const char* p = names.data(); p < names.data() + len; p += strlen(p) + 1) keys.push_back(p);
+                std::sort(keys.begin(), keys.end());
+                XXH64 h(0);
+                for (const auto& key : keys) {
+                    ssize_t n = lgetxattr(full.c_str(), key.c_str(), value.data(), value.size());
+                    if (n < 0 && errno == ERANGE && (n = lgetxattr(full.c_str(), key.c_str(), nullptr, 0)) > 0) {
+                        value.resize(static_cast<size_t>(n));
+                        n = lgetxattr(full.c_str(), key.c_str(), value.data(), value.size());
+                    }
+                    std::string size = n < 0 ? std::string("unreadable") : std::to_string(n);
+                    h.update(key);
+                    h.update("\0", 1);
+                    h.update(size);
+                    h.update("\0", 1);
+                    if (n > 0) h.update(value.data(), static_cast<size_t>(n));
+                }
+                hashes[i] = h.digest();
+                found[i] = 1;
+            }
+        };
+
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+        for (auto& t : pool) t.join();
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            if (found[i]) xattrHash[*paths[i]] = hashes[i];
+        }
+    }
+};
+
+// Persistent store of compressed shard images keyed by ShardPlanEntry::key,
+// capped in size with least-recently-used eviction.
+class CompressedShardCache {
+public:
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t hitBytes = 0;
+    uint64_t missBytes = 0;
+    uint64_t evicted = 0;
+
+    explicit CompressedShardCache(const std::string& dir) : dir_(dir) {
+        load();
+    }
+
+    std::string objectPath(const std::string& key) const {
+        return dir_ + "/" + key + ".sfs";
+    }
+
+    bool contains(const std::string& key) {
+        auto it = index_.find(key);
+        if (it == index_.end()) return false;
+        struct stat st;
+        if (stat(objectPath(key).c_str(), &st) != 0) {
+            index_.erase(it);
+            return false;
+        }
+        it->second.lastUsed = time(nullptr);
+        return true;
+    }
+
+    void recordHit(uint64_t uncompressedBytes) {
+        hits++;
+        hitBytes += uncompressedBytes;
+    }
+
+    void recordMiss(uint64_t uncompressedBytes) {
+        misses++;
+        missBytes += uncompressedBytes;
+    }
+
+    // Registers an object the caller has already placed at objectPath(key).
+    void insert(const std::string& key) {
+        struct stat st;
+        if (stat(objectPath(key).c_str(), &st) != 0) return;
+        index_[key] = {static_cast<uint64_t>(st.st_size), time(nullptr)};
+    }
+
+    uint64_t totalBytes() const {
+        uint64_t total = 0;
+        for (const auto& kv : index_) total += kv.second.size;
+        return total;
+    }
+
+    // Drops least recently used objects until the cache fits in capBytes.
+    // Objects used by the current build are never evicted.
+    std::vector<std::string> evict(uint64_t capBytes, const std::set<std::string>& pinned) {
+        std::vector<std::pair<time_t, std::string>> order;
+        for (const auto& kv : index_) {
+            if (!pinned.count(kv.first)) order.push_back({kv.second.lastUsed, kv.first});
+        }
+        std::sort(order.begin(), order.end());
+
+        std::vector<std::string> removed;
+        uint64_t total = totalBytes();
+        for (const auto& o : order) {
+            if (total <= capBytes) break;
+            total -= index_[o.second].size;
+            removed.push_back(objectPath(o.second));
+            index_.erase(o.second);
+            evicted++;
+        }
+        return removed;
+    }
+
+    double hitRate() const {
+        uint64_t total = hitBytes + missBytes;
+        return total == 0 ? 0.0 : 100.0 * static_cast<double>(hitBytes) / static_cast<double>(total);
+    }
+
+    bool save() const {
+        std::ofstream out(dir_ + "/index.txt", std::ios::trunc);
+        if (!out.is_open()) return false;
+        for (const auto& kv : index_) {
+            out << kv.first << '\t' << kv.second.size << '\t' << kv.second.lastUsed << '\n';
+        }
+        return out.good();
+    }
+
+private:
+    struct IndexEntry {
+        uint64_t size;
+        time_t lastUsed;
+    };
+
+    std::string dir_;
+    std::map<std::string, IndexEntry> index_;
+
+    void load() {
+        std::ifstream in(dir_ + "/index.txt");
+        std::string key;
+        uint64_t size;
+        long long lastUsed;
+        while (in >> key >> size >> lastUsed) {
+            index_[key] = {size, static_cast<time_t>(lastUsed)};
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "squashfs.h"
+
+// Record of the segment images a build has finished, so an interrupted
+// build can pick up where it stopped. Each line names a segment, the
+// content key it was built from, and the size and tail hash of the image;
+// an image is only trusted again if all of those still match and its
+// superblock and metadata tables read back.
+class BuildJournal {
+public:
+    static constexpr uint64_t TAIL_BYTES = 64ULL << 10;
+
+    struct Entry {
+        std::string key;
+        uint64_t size = 0;
+        uint64_t tailHash = 0;
+    };
+
+    explicit BuildJournal(const std::string& path) : path_(path) {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string verb, hash;
+            size_t index = 0;
+            Entry e;
+            if (fields >> verb >> index >> e.key >> e.size >> hash && verb == "done") {
+                e.tailHash = std::strtoull(hash.c_str(), nullptr, 16);
+                entries_[index] = e;
+            }
+        }
+    }
+
+    // True when segment index was finished from the same key and the
+    // image on disk is still the one that was recorded
+    bool completed(size_t index, const std::string& key, const std::string& image, std::string& why) const {
+        auto it = entries_.find(index);
+        if (it == entries_.end() || it->second.key != key) {
+            why = "not built yet";
+            return false;
+        }
+        uint64_t size = 0, tail = 0;
+        if (!tailHash(image, size, tail)) {
+            why = "image missing";
+            return false;
+        }
+        if (size != it->second.size || tail != it->second.tailHash) {
+            why = "image changed since the checkpoint";
+            return false;
+        }
+        SquashfsReader reader;
+        if (!reader.open(image, why)) return false;
+        if (reader.super().bytesUsed > size) {
+            why = "image is truncated";
+            return false;
+        }
+        return true;
+    }
+
+    // Appends and flushes a finished segment; the line is on disk before
+    // the build moves on
+    bool record(size_t index, const std::string& key, const std::string& image) {
+        Entry e;
+        e.key = key;
+        if (!tailHash(image, e.size, e.tailHash)) return false;
+        entries_[index] = e;
+        FILE* f = fopen(path_.c_str(), "a");
+        if (!f) return false;
+        bool ok = fprintf(f, "done %zu %s %lu %s\n", index, key.c_str(), static_cast<unsigned long>(e.size),
+                          XXH64::hex(e.tailHash).c_str()) > 0;
+        ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+        return fclose(f) == 0 && ok;
+    }
+
+    // Starts a new journal; called when nothing from the last one is reusable
+    void reset() {
+        entries_.clear();
+        std::ofstream(path_, std::ios::trunc);
+    }
+
+private:
+    std::string path_;
+    std::map<size_t, Entry> entries_;
+
+    static bool tailHash(const std::string& path, uint64_t& size, uint64_t& hash) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size = static_cast<uint64_t>(st.st_size);
+        uint64_t len = std::min(size, TAIL_BYTES);
+        std::string tail(len, '\0');
+        bool ok = pread(fd, tail.data(), len, static_cast<off_t>(size - len)) == static_cast<ssize_t>(len);
+        close(fd);
+        uint64_t seed = size;
+        hash = XXH64::of(tail.data(), tail.size(), seed);
+        return ok;
+    }
+};
+
+#endif
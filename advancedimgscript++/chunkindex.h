@@ -0,0 +1,149 @@
+#ifndef CHUNKINDEX_H
+#define CHUNKINDEX_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+
+struct Chunk {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    uint64_t hash = 0;
+};
+
+// Content-defined chunks of a file, published as <iso>.cmidx so a client
+// holding last week's ISO only downloads the chunks that changed. Cut
+// points come from a FastCDC gear hash with normalized chunking, so an
+// insertion only moves the boundaries next to it.
+//
+// Format, one record per line:
+//   cmidx 1 <file size> <min> <avg> <max>
+//   <length> <xxh64>
+class ChunkIndex {
+public:
+    static constexpr uint32_t MIN_CHUNK = 16u << 10;
+    static constexpr uint32_t AVG_CHUNK = 64u << 10;
+    static constexpr uint32_t MAX_CHUNK = 256u << 10;
+
+    uint64_t size = 0;
+    std::vector<Chunk> chunks;
+
+    // Chunks a file through a read-only mapping
+    bool build(const std::string& path) {
+        chunks.clear();
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size = static_cast<uint64_t>(st.st_size);
+        if (size == 0) {
+            close(fd);
+            return true;
+        }
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return false;
+        madvise(map, size, MADV_SEQUENTIAL);
+
+        const uint8_t* data = static_cast<const uint8_t*>(map);
+        for (uint64_t offset = 0; offset < size; ) {
+            uint32_t length = cut(data + offset, size - offset);
+            chunks.push_back({offset, length, XXH64::of(data + offset, length)});
+            offset += length;
+        }
+        munmap(map, size);
+        return true;
+    }
+
+    std::string serialize() const {
+        std::ostringstream out;
+        out << "cmidx 1 " << size << " " << MIN_CHUNK << " " << AVG_CHUNK << " " << MAX_CHUNK << "\n";
+        for (const auto& c : chunks) out << c.length << " " << XXH64::hex(c.hash) << "\n";
+        return out.str();
+    }
+
+    bool save(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        std::ofstream out(tmp, std::ios::trunc);
+        out << serialize();
+        out.close();
+        return out.good() && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    // Rejects indexes cut with other parameters; their chunks would never
+    // match ours
+    bool parse(const std::string& text) {
+        chunks.clear();
+        std::istringstream in(text);
+        std::string magic;
+        int version = 0;
+        uint32_t minChunk = 0, avgChunk = 0, maxChunk = 0;
+        if (!(in >> magic >> version >> size >> minChunk >> avgChunk >> maxChunk) || magic != "cmidx" || version != 1 ||
+            minChunk != MIN_CHUNK || avgChunk != AVG_CHUNK || maxChunk != MAX_CHUNK) {
+            return false;
+        }
+        uint64_t offset = 0;
+        uint32_t length;
+        std::string hex;
+        while (in >> length >> hex) {
+            if (length == 0 || length > MAX_CHUNK || hex.size() != 16) return false;
+            chunks.push_back({offset, length, std::strtoull(hex.c_str(), nullptr, 16)});
+            offset += length;
+        }
+        return offset == size;
+    }
+
+private:
+    // Bits set in the masks; more bits before the average size make early
+    // cuts rarer, fewer after make late ones likelier
+    static constexpr uint64_t MASK_SMALL = 0x9292524a49490000ULL;  // 18 bits
+    static constexpr uint64_t MASK_LARGE = 0x8912224448910000ULL;  // 14 bits
+
+    static const uint64_t* gear() {
+        static const std::vector<uint64_t> table = [] {
+            std::vector<uint64_t> t(256);
+            uint64_t x = 0x636d696d67ULL;  // fixed so every build cuts the same way
+            for (auto& v : t) {
+                x += 0x9e3779b97f4a7c15ULL;
+                uint64_t z = x;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                v = z ^ (z >> 31);
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    static uint32_t cut(const uint8_t* p, uint64_t available) {
+        if (available <= MIN_CHUNK) return static_cast<uint32_t>(available);
+        uint64_t end = available < MAX_CHUNK ? available : MAX_CHUNK;
+        uint64_t normal = available < AVG_CHUNK ? available : AVG_CHUNK;
+        const uint64_t* g = gear();
+        uint64_t h = 0;
+        uint64_t i = MIN_CHUNK;
+        for (; i < normal; i++) {
+            h = (h << 1) + g[p[i]];
+            if (!(h & MASK_SMALL)) return static_cast<uint32_t>(i + 1);
+        }
+        for (; i < end; i++) {
+            h = (h << 1) + g[p[i]];
+            if (!(h & MASK_LARGE)) return static_cast<uint32_t>(i + 1);
+        }
+        return static_cast<uint32_t>(end);
+    }
+};
+
+#endif
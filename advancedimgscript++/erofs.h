@@ -0,0 +1,280 @@
+#ifndef EROFS_H
+#define EROFS_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Metadata-only reader for EROFS images: walks directories and decodes
+// inodes, but does not decompress file data.
+struct ErofsSuperblock {
+    uint32_t magic;
+    uint32_t checksum;
+    uint32_t featureCompat;
+    uint8_t blkszBits;
+    uint8_t sbExtslots;
+    uint16_t rootNid;
+    uint64_t inos;
+    uint64_t buildTime;
+    uint32_t buildTimeNsec;
+    uint32_t blocks;
+    uint32_t metaBlkaddr;
+    uint32_t xattrBlkaddr;
+    uint8_t uuid[16];
+    uint8_t volumeName[16];
+    uint32_t featureIncompat;
+    uint16_t availableComprAlgs;
+    uint16_t extraDevices;
+    uint16_t devtSlotoff;
+    uint8_t dirblkbits;
+    uint8_t reserved[49];
+} __attribute__((packed));
+
+struct ErofsInode {
+    uint64_t nid = 0;
+    uint16_t layout = 0;        // 0 plain, 1/3 compressed, 2 inline tail, 4 chunk based
+    uint32_t mode = 0;          // full st_mode
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint64_t mtime = 0;
+    uint64_t size = 0;
+    uint32_t nlink = 1;
+    uint32_t u = 0;             // block address, rdev or compressed block count
+    uint32_t ino = 0;
+    uint64_t dataOffset = 0;    // position of the inline tail / index area
+};
+
+struct ErofsEntry {
+    std::string path;
+    ErofsInode inode;
+};
+
+class ErofsReader {
+public:
+    static constexpr uint32_t MAGIC = 0xE0F5E1E2;
+    static constexpr uint64_t SUPERBLOCK_OFFSET = 1024;
+    static constexpr uint16_t LAYOUT_PLAIN = 0;
+    static constexpr uint16_t LAYOUT_INLINE = 2;
+
+    ErofsReader() = default;
+    ErofsReader(const ErofsReader&) = delete;
+    ErofsReader& operator=(const ErofsReader&) = delete;
+
+    ~ErofsReader() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    static bool isErofs(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        uint32_t magic = 0;
+        bool ok = pread(fd, &magic, 4, SUPERBLOCK_OFFSET) == 4 && magic == MAGIC;
+        close(fd);
+        return ok;
+    }
+
+    bool open(const std::string& path, std::string& error) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        fstat(fd_, &st);
+        fileSize_ = static_cast<uint64_t>(st.st_size);
+        if (!readAt(SUPERBLOCK_OFFSET, &sb_, sizeof(sb_)) || sb_.magic != MAGIC) {
+            error = "not an EROFS image";
+            return false;
+        }
+        if (sb_.blkszBits < 9 || sb_.blkszBits > 16) {
+            error = "unsupported EROFS block size";
+            return false;
+        }
+        blockSize_ = 1u << sb_.blkszBits;
+        return true;
+    }
+
+    const ErofsSuperblock& super() const {
+        return sb_;
+    }
+
+    uint32_t blockSize() const {
+        return blockSize_;
+    }
+
+    bool readInode(uint64_t nid, ErofsInode& inode, std::string& error) const {
+        uint64_t pos = static_cast<uint64_t>(sb_.metaBlkaddr) * blockSize_ + (nid << 5);
+        uint8_t raw[64];
+        if (pos + 32 > fileSize_ || !readAt(pos, raw, 32)) {
+            error = "inode " + std::to_string(nid) + " is outside the image";
+            return false;
+        }
+        uint16_t format, xattrCount;
+        memcpy(&format, raw, 2);
+        memcpy(&xattrCount, raw + 2, 2);
+        bool extended = format & 1;
+        inode.nid = nid;
+        inode.layout = (format >> 1) & 0x7;
+
+        size_t inodeSize = extended ? 64 : 32;
+        if (extended) {
+            if (!readAt(pos, raw, 64)) {
+                error = "truncated inode " + std::to_string(nid);
+                return false;
+            }
+            uint16_t mode;
+            uint32_t nsec;
+            memcpy(&mode, raw + 4, 2);
+            memcpy(&inode.size, raw + 8, 8);
+            memcpy(&inode.u, raw + 16, 4);
+            memcpy(&inode.ino, raw + 20, 4);
+            memcpy(&inode.uid, raw + 24, 4);
+            memcpy(&inode.gid, raw + 28, 4);
+            memcpy(&inode.mtime, raw + 32, 8);
+            memcpy(&nsec, raw + 40, 4);
+            memcpy(&inode.nlink, raw + 44, 4);
+            inode.mode = mode;
+        } else {
+            uint16_t mode, nlink, uid, gid;
+            uint32_t size;
+            memcpy(&mode, raw + 4, 2);
+            memcpy(&nlink, raw + 6, 2);
+            memcpy(&size, raw + 8, 4);
+            memcpy(&inode.u, raw + 16, 4);
+            memcpy(&inode.ino, raw + 20, 4);
+            memcpy(&uid, raw + 24, 2);
+            memcpy(&gid, raw + 26, 2);
+            inode.mode = mode;
+            inode.nlink = nlink;
+            inode.size = size;
+            inode.uid = uid;
+            inode.gid = gid;
+            inode.mtime = sb_.buildTime;
+        }
+        size_t xattrSize = xattrCount ? 12 + (xattrCount - 1) * 4 : 0;
+        inode.dataOffset = pos + inodeSize + xattrSize;
+        return true;
+    }
+
+    // Reads the data of an uncompressed inode (directories and symlinks)
+    bool readPlainData(const ErofsInode& inode, std::vector<uint8_t>& out, std::string& error) const {
+        if (inode.layout != LAYOUT_PLAIN && inode.layout != LAYOUT_INLINE) {
+            error = "inode " + std::to_string(inode.nid) + " uses data layout " + std::to_string(inode.layout);
+            return false;
+        }
+        if (inode.size > (64ULL << 20)) {
+            error = "inode " + std::to_string(inode.nid) + " is too large to read as metadata";
+            return false;
+        }
+        out.resize(inode.size);
+        uint64_t fullBlocks = inode.layout == LAYOUT_INLINE ? inode.size / blockSize_ : (inode.size + blockSize_ - 1) / blockSize_;
+        uint64_t fromBlocks = std::min<uint64_t>(inode.size, fullBlocks * blockSize_);
+        uint64_t base = static_cast<uint64_t>(inode.u) * blockSize_;
+        if (fromBlocks > 0 && (base + fromBlocks > fileSize_ || !readAt(base, out.data(), fromBlocks))) {
+            error = "data of inode " + std::to_string(inode.nid) + " is outside the image";
+            return false;
+        }
+        uint64_t tail = inode.size - fromBlocks;
+        if (tail > 0 && (inode.dataOffset + tail > fileSize_ || !readAt(inode.dataOffset, out.data() + fromBlocks, tail))) {
+            error = "inline data of inode " + std::to_string(inode.nid) + " is outside the image";
+            return false;
+        }
+        return true;
+    }
+
+    // Walks every directory; the root itself is not included.
+    bool readTree(std::vector<ErofsEntry>& out, std::string& error) const {
+        ErofsInode root;
+        if (!readInode(sb_.rootNid, root, error)) return false;
+        if (!S_ISDIR(root.mode)) {
+            error = "root inode is not a directory";
+            return false;
+        }
+        std::set<uint64_t> active;
+        return walkDir(root, "", out, active, 0, error);
+    }
+
+private:
+    int fd_ = -1;
+    uint64_t fileSize_ = 0;
+    uint32_t blockSize_ = 4096;
+    ErofsSuperblock sb_{};
+
+    bool readAt(uint64_t pos, void* buf, size_t len) const {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(fd_, static_cast<char*>(buf) + done, len - done, static_cast<off_t>(pos + done));
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool walkDir(const ErofsInode& dir, const std::string& prefix, std::vector<ErofsEntry>& out,
+                 std::set<uint64_t>& active, int depth, std::string& error) const {
+        if (depth > 256 || !active.insert(dir.nid).second) {
+            error = "directory loop at /" + prefix;
+            return false;
+        }
+        std::vector<uint8_t> data;
+        if (!readPlainData(dir, data, error)) {
+            error = "/" + prefix + ": " + error;
+            return false;
+        }
+
+        std::vector<size_t> subdirs;
+        for (size_t blockStart = 0; blockStart < data.size(); blockStart += blockSize_) {
+            size_t blockLen = std::min<size_t>(blockSize_, data.size() - blockStart);
+            const uint8_t* block = data.data() + blockStart;
+            uint16_t firstNameOff = 0;
+            if (blockLen < 12) break;
+            memcpy(&firstNameOff, block + 8, 2);
+            size_t count = firstNameOff / 12;
+            if (count == 0 || firstNameOff > blockLen) {
+                error = "bad directory block in /" + prefix;
+                return false;
+            }
+            for (size_t i = 0; i < count; i++) {
+                uint64_t nid;
+                uint16_t nameOff, nextOff;
+                memcpy(&nid, block + i * 12, 8);
+                memcpy(&nameOff, block + i * 12 + 8, 2);
+                if (i + 1 < count) memcpy(&nextOff, block + (i + 1) * 12 + 8, 2);
+                else nextOff = static_cast<uint16_t>(blockLen);
+                if (nameOff > nextOff || nextOff > blockLen) {
+                    error = "bad directory entry in /" + prefix;
+                    return false;
+                }
+                std::string name(reinterpret_cast<const char*>(block + nameOff), nextOff - nameOff);
+                name = name.substr(0, name.find('\0'));
+                if (name == "." || name == ".." || name.empty()) continue;
+
+                ErofsEntry entry;
+                entry.path = prefix.empty() ? name : prefix + "/" + name;
+                if (!readInode(nid, entry.inode, error)) {
+                    error = entry.path + ": " + error;
+                    return false;
+                }
+                if (S_ISDIR(entry.inode.mode)) subdirs.push_back(out.size());
+                out.push_back(std::move(entry));
+            }
+        }
+
+        for (size_t idx : subdirs) {
+            ErofsInode child = out[idx].inode;
+            std::string path = out[idx].path;
+            if (!walkDir(child, path, out, active, depth + 1, error)) return false;
+        }
+        active.erase(dir.nid);
+        return true;
+    }
+};
+
+#endif
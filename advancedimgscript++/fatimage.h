@@ -0,0 +1,605 @@
+#ifndef FATIMAGE_H
+#define FATIMAGE_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+
+// Writes a FAT image of one or more directories without mounting it, for
+// the EFI system partition of the ISO. The image is exactly as large as
+// its contents: the cluster count is worked out first and the FAT type
+// follows from it (FAT12 below 4085 clusters, FAT16 below 65525, FAT32
+// above), the way every FAT driver decides it when reading.
+//
+// Names follow mtools: a name that fits 8.3 in one case per part gets
+// only a short entry with the lowercase flags, anything else gets VFAT
+// long name entries and a NAME~N alias. Entries are sorted and the volume
+// serial is derived from the directory entries, so the same input always
+// gives the same image.
+class FatImage {
+public:
+    std::string label = "EFIBOOT";
+    time_t timestamp = 0;   // every date in the image; 0 keeps the files' mtimes
+    std::string error;
+
+    // Filled in by write()
+    int fatBits = 0;
+    uint32_t clusterCount = 0;
+    uint64_t imageSize = 0;
+
+    // Adds the contents of dir at path inside the image ("" for the root).
+    // Later additions replace files of the same name and merge directories.
+    bool add(const std::string& dir, const std::string& path) {
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return fail(dir + " is not a directory");
+        root_.mtime = std::max(root_.mtime, st.st_mtime);
+        Node* node = &root_;
+        size_t start = 0;
+        while (start < path.size()) {
+            size_t slash = path.find('/', start);
+            std::string part = path.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+            start = slash == std::string::npos ? path.size() : slash + 1;
+            if (part.empty()) continue;
+            Node& child = insert(*node, part);
+            if (!child.dir) {
+                child = Node();
+                child.name = part;
+                child.dir = true;
+            }
+            child.mtime = st.st_mtime;
+            node = &child;
+        }
+        return scan(*node, dir, 0);
+    }
+
+    bool write(const std::string& output) {
+        uint64_t rootEntries = 0;
+        if (!prepare(root_, true, rootEntries)) return false;
+        if (!geometry(rootEntries)) return false;
+
+        int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return fail("cannot create " + output + ": " + strerror(errno));
+        bool ok = ftruncate(fd, static_cast<off_t>(imageSize)) == 0;
+        if (!ok) fail("cannot size " + output + ": " + strerror(errno));
+        fat_.assign(static_cast<size_t>(fatSectors_) * SECTOR, 0);
+        setFat(0, fatBits == 12 ? 0xFF8 : fatBits == 16 ? 0xFFF8 : 0x0FFFFFF8);
+        setFat(1, eoc());
+        nextCluster_ = 2;
+        entriesHash_.reset();
+        allocate(root_, true);
+
+        ok = ok && writeDir(fd, root_, nullptr) && writeFiles(fd, root_);
+        ok = ok && writeBoot(fd);
+        for (uint32_t i = 0; ok && i < NUM_FATS; i++) {
+            uint64_t offset = (reserved_ + static_cast<uint64_t>(i) * fatSectors_) * SECTOR;
+            ok = pwriteAll(fd, fat_.data(), fat_.size(), offset);
+        }
+        ok = ok && fsync(fd) == 0;
+        if (close(fd) != 0) ok = false;
+        if (!ok) {
+            if (error.empty()) fail("cannot write " + output + ": " + strerror(errno));
+            unlink(output.c_str());
+        }
+        return ok;
+    }
+
+private:
+    static constexpr uint32_t SECTOR = 512;
+    static constexpr uint32_t NUM_FATS = 2;
+    static constexpr uint32_t ENTRY = 32;
+    static constexpr uint8_t ATTR_VOLUME = 0x08;
+    static constexpr uint8_t ATTR_DIR = 0x10;
+    static constexpr uint8_t ATTR_ARCHIVE = 0x20;
+    static constexpr uint8_t ATTR_LFN = 0x0F;
+
+    struct Node {
+        std::string name;
+        std::string source;
+        bool dir = false;
+        uint64_t size = 0;
+        time_t mtime = 0;
+        std::vector<Node> children;
+        char shortName[11] = {};
+        uint8_t caseFlags = 0;
+        std::vector<uint16_t> longName;  // empty when the short entry is enough
+        uint32_t entries = 0;            // directory entries this directory holds
+        uint32_t cluster = 0;
+        uint32_t clusters = 0;
+    };
+
+    Node root_ = [] {
+        Node n;
+        n.dir = true;
+        return n;
+    }();
+    std::vector<uint8_t> fat_;
+    uint32_t sectorsPerCluster_ = 1;
+    uint32_t reserved_ = 1;
+    uint32_t rootDirEntries_ = 0;
+    uint32_t fatSectors_ = 0;
+    uint32_t nextCluster_ = 2;
+    XXH64 entriesHash_;
+
+    bool fail(const std::string& message) {
+        error = message;
+        return false;
+    }
+
+    static std::string upper(const std::string& s) {
+        std::string u = s;
+        for (auto& c : u) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        return u;
+    }
+
+    // FAT names are case-insensitive, so "EFI" and "efi" are the same entry
+    static Node& insert(Node& parent, const std::string& name) {
+        for (auto& child : parent.children) {
+            if (upper(child.name) == upper(name)) return child;
+        }
+        parent.children.emplace_back();
+        parent.children.back().name = name;
+        return parent.children.back();
+    }
+
+    bool scan(Node& node, const std::string& dir, int depth) {
+        if (depth > 32) return fail(dir + " is nested too deeply");
+        DIR* d = opendir(dir.c_str());
+        if (!d) return fail("cannot read " + dir + ": " + strerror(errno));
+        std::vector<std::string> names;
+        while (struct dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name != "." && name != "..") names.push_back(name);
+        }
+        closedir(d);
+        std::sort(names.begin(), names.end());
+
+        for (const auto& name : names) {
+            std::string full = dir + "/" + name;
+            struct stat st;
+            // Symlinks are followed; FAT has no way to store them
+            if (stat(full.c_str(), &st) != 0) return fail("cannot stat " + full + ": " + strerror(errno));
+            if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) continue;
+            Node& child = insert(node, name);
+            if (S_ISDIR(st.st_mode)) {
+                if (!child.dir) {
+                    child = Node();
+                    child.name = name;
+                    child.dir = true;
+                }
+                child.mtime = st.st_mtime;
+                if (!scan(child, full, depth + 1)) return false;
+            } else {
+                if (static_cast<uint64_t>(st.st_size) > 0xFFFFFFFFULL) return fail(full + " is too large for FAT");
+                child = Node();
+                child.name = name;
+                child.source = full;
+                child.size = static_cast<uint64_t>(st.st_size);
+                child.mtime = st.st_mtime;
+            }
+        }
+        return true;
+    }
+
+    static bool shortChar(unsigned char c) {
+        return c != 0 && (isalnum(c) || strchr("$%'-_@~`!(){}^#&", c) != nullptr);
+    }
+
+    // 8.3 without an alias when each part is in one case, like mtools
+    static bool directShortName(const std::string& name, char out[11], uint8_t& caseFlags) {
+        size_t dot = name.rfind('.');
+        std::string base = dot == std::string::npos ? name : name.substr(0, dot);
+        std::string ext = dot == std::string::npos ? "" : name.substr(dot + 1);
+        if (base.empty() || base.size() > 8 || ext.size() > 3 || (dot != std::string::npos && ext.empty())) return false;
+        caseFlags = 0;
+        for (int part = 0; part < 2; part++) {
+            const std::string& s = part == 0 ? base : ext;
+            bool lower = false, upperCase = false;
+            for (unsigned char c : s) {
+                if (!shortChar(c)) return false;
+                lower = lower || islower(c);
+                upperCase = upperCase || isupper(c);
+            }
+            if (lower && upperCase) return false;
+            if (lower) caseFlags |= part == 0 ? 0x08 : 0x10;
+        }
+        memset(out, ' ', 11);
+        std::string u = upper(base), e = upper(ext);
+        memcpy(out, u.data(), u.size());
+        memcpy(out + 8, e.data(), e.size());
+        return true;
+    }
+
+    static std::string shortBasis(const std::string& s, size_t max) {
+        std::string out;
+        for (unsigned char c : s) {
+            if (c == ' ' || c == '.') continue;
+            out += shortChar(c) ? static_cast<char>(toupper(c)) : '_';
+            if (out.size() == max) break;
+        }
+        return out;
+    }
+
+    static bool utf16(const std::string& s, std::vector<uint16_t>& out) {
+        out.clear();
+        for (size_t i = 0; i < s.size(); ) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            uint32_t cp;
+            int extra = c < 0x80 ? 0 : (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : -1;
+            if (extra < 0 || i + extra + 1 > s.size()) return false;
+            cp = extra == 0 ? c : c & (0x3F >> extra);
+            for (int k = 1; k <= extra; k++) {
+                unsigned char cc = static_cast<unsigned char>(s[i + k]);
+                if ((cc & 0xC0) != 0x80) return false;
+                cp = (cp << 6) | (cc & 0x3F);
+            }
+            i += 1 + extra;
+            if (cp >= 0x10000) {
+                cp -= 0x10000;
+                out.push_back(static_cast<uint16_t>(0xD800 | (cp >> 10)));
+                out.push_back(static_cast<uint16_t>(0xDC00 | (cp & 0x3FF)));
+            } else {
+                out.push_back(static_cast<uint16_t>(cp));
+            }
+        }
+        return !out.empty() && out.size() <= 255;
+    }
+
+    // Names every child of dir and counts the entries it needs. Direct 8.3
+    // names are taken first so an alias never steals one.
+    bool prepare(Node& dir, bool isRoot, uint64_t& rootEntries) {
+        std::sort(dir.children.begin(), dir.children.end(), [](const Node& a, const Node& b) { return a.name < b.name; });
+        std::set<std::string> used;
+        std::vector<Node*> aliased;
+        for (auto& child : dir.children) {
+            if (directShortName(child.name, child.shortName, child.caseFlags)) {
+                used.insert(std::string(child.shortName, 11));
+                child.longName.clear();
+            } else {
+                aliased.push_back(&child);
+            }
+        }
+        for (Node* child : aliased) {
+            if (!utf16(child->name, child->longName)) return fail("cannot store the name " + child->name + " in FAT");
+            size_t dot = child->name.rfind('.');
+            std::string base = shortBasis(dot == std::string::npos || dot == 0 ? child->name : child->name.substr(0, dot), 8);
+            std::string ext = dot == std::string::npos || dot == 0 ? "" : shortBasis(child->name.substr(dot + 1), 3);
+            if (base.empty()) base = "_";
+            bool found = false;
+            for (int n = 1; n < 1000000 && !found; n++) {
+                std::string tail = "~" + std::to_string(n);
+                std::string candidate = base.substr(0, 8 - tail.size()) + tail;
+                char name[11];
+                memset(name, ' ', 11);
+                memcpy(name, candidate.data(), candidate.size());
+                memcpy(name + 8, ext.data(), ext.size());
+                if (used.insert(std::string(name, 11)).second) {
+                    memcpy(child->shortName, name, 11);
+                    found = true;
+                }
+            }
+            if (!found) return fail("no free short name for " + child->name);
+            child->caseFlags = 0;
+        }
+
+        // . and .. in subdirectories, the volume label in the root
+        uint64_t entries = isRoot ? (label.empty() ? 0 : 1) : 2;
+        for (auto& child : dir.children) {
+            entries += 1 + (child.longName.size() + 12) / 13;
+            if (child.dir && !prepare(child, false, rootEntries)) return false;
+        }
+        if (entries > 65536) return fail("too many entries in " + (dir.name.empty() ? std::string("/") : dir.name));
+        dir.entries = static_cast<uint32_t>(entries);
+        if (isRoot) rootEntries = entries;
+        return true;
+    }
+
+    uint64_t clustersFor(const Node& dir, bool isRoot, bool rootInData, uint64_t clusterBytes) const {
+        uint64_t total = 0;
+        if (!isRoot || rootInData) total += std::max<uint64_t>(1, (dir.entries * uint64_t(ENTRY) + clusterBytes - 1) / clusterBytes);
+        for (const auto& child : dir.children) {
+            if (child.dir) total += clustersFor(child, false, rootInData, clusterBytes);
+            else total += (child.size + clusterBytes - 1) / clusterBytes;
+        }
+        return total;
+    }
+
+    // The smallest cluster size that keeps FAT12/16 is picked, so little is
+    // lost to slack; only trees of gigabytes end up on FAT32
+    bool geometry(uint64_t rootEntries) {
+        uint64_t count = 0;
+        for (uint32_t spc = 1; spc <= 64; spc *= 2) {
+            count = std::max<uint64_t>(1, clustersFor(root_, true, false, uint64_t(spc) * SECTOR));
+            if (count < 65525) {
+                sectorsPerCluster_ = spc;
+                fatBits = count < 4085 ? 12 : 16;
+                break;
+            }
+        }
+        if (fatBits == 0) {
+            sectorsPerCluster_ = 8;
+            count = std::max<uint64_t>(65525, clustersFor(root_, true, true, uint64_t(sectorsPerCluster_) * SECTOR));
+            if (count >= 0x0FFFFFF5) return fail("the ESP contents are too large for FAT32");
+            fatBits = 32;
+        }
+        clusterCount = static_cast<uint32_t>(count);
+        reserved_ = fatBits == 32 ? 32 : 1;
+        rootDirEntries_ = fatBits == 32 ? 0 : static_cast<uint32_t>(std::max<uint64_t>(512, (rootEntries + 15) / 16 * 16));
+        uint64_t fatBytes = fatBits == 12 ? (uint64_t(clusterCount) + 2) * 3 / 2 + 1 : (uint64_t(clusterCount) + 2) * (fatBits / 8);
+        fatSectors_ = static_cast<uint32_t>((fatBytes + SECTOR - 1) / SECTOR);
+        uint64_t sectors = reserved_ + uint64_t(NUM_FATS) * fatSectors_ + rootDirSectors() + uint64_t(clusterCount) * sectorsPerCluster_;
+        if (sectors > 0xFFFFFFFFULL) return fail("the ESP contents are too large for FAT32");
+        imageSize = sectors * SECTOR;
+        return true;
+    }
+
+    uint32_t rootDirSectors() const {
+        return rootDirEntries_ * ENTRY / SECTOR;
+    }
+
+    uint64_t dataOffset() const {
+        return (reserved_ + uint64_t(NUM_FATS) * fatSectors_ + rootDirSectors()) * SECTOR;
+    }
+
+    uint64_t clusterOffset(uint32_t cluster) const {
+        return dataOffset() + uint64_t(cluster - 2) * sectorsPerCluster_ * SECTOR;
+    }
+
+    uint32_t eoc() const {
+        return fatBits == 12 ? 0xFFF : fatBits == 16 ? 0xFFFF : 0x0FFFFFFF;
+    }
+
+    void setFat(uint32_t cluster, uint32_t value) {
+        if (fatBits == 12) {
+            size_t off = cluster + cluster / 2;
+            if (cluster & 1) {
+                fat_[off] = static_cast<uint8_t>((fat_[off] & 0x0F) | ((value << 4) & 0xF0));
+                fat_[off + 1] = static_cast<uint8_t>(value >> 4);
+            } else {
+                fat_[off] = static_cast<uint8_t>(value);
+                fat_[off + 1] = static_cast<uint8_t>((fat_[off + 1] & 0xF0) | ((value >> 8) & 0x0F));
+            }
+        } else if (fatBits == 16) {
+            put16(&fat_[cluster * 2], static_cast<uint16_t>(value));
+        } else {
+            put32(&fat_[cluster * 4], value);
+        }
+    }
+
+    uint32_t chain(uint32_t clusters) {
+        if (clusters == 0) return 0;
+        uint32_t first = nextCluster_;
+        for (uint32_t i = 0; i < clusters; i++) setFat(first + i, i + 1 == clusters ? eoc() : first + i + 1);
+        nextCluster_ += clusters;
+        return first;
+    }
+
+    // Every directory and file is one contiguous run: the directory, then
+    // its files, then its subdirectories
+    void allocate(Node& dir, bool isRoot) {
+        uint64_t clusterBytes = uint64_t(sectorsPerCluster_) * SECTOR;
+        if (!isRoot || fatBits == 32) {
+            dir.clusters = static_cast<uint32_t>(std::max<uint64_t>(1, (dir.entries * uint64_t(ENTRY) + clusterBytes - 1) / clusterBytes));
+            dir.cluster = chain(dir.clusters);
+        }
+        for (auto& child : dir.children) {
+            if (child.dir) continue;
+            child.clusters = static_cast<uint32_t>((child.size + clusterBytes - 1) / clusterBytes);
+            child.cluster = chain(child.clusters);
+        }
+        for (auto& child : dir.children) {
+            if (child.dir) allocate(child, false);
+        }
+    }
+
+    static void put16(uint8_t* p, uint16_t v) {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+    }
+
+    static void put32(uint8_t* p, uint32_t v) {
+        put16(p, static_cast<uint16_t>(v));
+        put16(p + 2, static_cast<uint16_t>(v >> 16));
+    }
+
+    void fatDate(time_t t, uint16_t& date, uint16_t& time) const {
+        struct tm tm = {};
+        if (timestamp) {
+            time_t fixed = timestamp;
+            gmtime_r(&fixed, &tm);
+        } else {
+            localtime_r(&t, &tm);
+        }
+        if (tm.tm_year < 80) {
+            date = (1 << 5) | 1;
+            time = 0;
+            return;
+        }
+        if (tm.tm_year > 207) tm.tm_year = 207;
+        date = static_cast<uint16_t>(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+        time = static_cast<uint16_t>((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    }
+
+    void shortEntry(uint8_t* e, const char name[11], uint8_t attr, uint8_t caseFlags, uint32_t cluster, uint32_t size,
+                    time_t mtime) const {
+        memcpy(e, name, 11);
+        e[11] = attr;
+        e[12] = caseFlags;
+        uint16_t date, time;
+        fatDate(mtime, date, time);
+        put16(e + 14, time);
+        put16(e + 16, date);
+        put16(e + 18, date);
+        put16(e + 20, static_cast<uint16_t>(fatBits == 32 ? cluster >> 16 : 0));
+        put16(e + 22, time);
+        put16(e + 24, date);
+        put16(e + 26, static_cast<uint16_t>(cluster));
+        put32(e + 28, size);
+    }
+
+    static uint8_t checksum(const char name[11]) {
+        uint8_t sum = 0;
+        for (int i = 0; i < 11; i++) sum = static_cast<uint8_t>(((sum & 1) << 7) + (sum >> 1) + static_cast<uint8_t>(name[i]));
+        return sum;
+    }
+
+    // Long name entries go last part first, each holding 13 UTF-16 units
+    // padded with one 0x0000 and then 0xFFFF
+    static void longEntries(uint8_t*& e, const Node& node) {
+        static const int slots[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+        uint8_t sum = checksum(node.shortName);
+        size_t parts = (node.longName.size() + 12) / 13;
+        for (size_t part = parts; part-- > 0; e += ENTRY) {
+            e[0] = static_cast<uint8_t>((part + 1) | (part + 1 == parts ? 0x40 : 0));
+            e[11] = ATTR_LFN;
+            e[13] = sum;
+            for (size_t k = 0; k < 13; k++) {
+                size_t i = part * 13 + k;
+                uint16_t unit = i < node.longName.size() ? node.longName[i] : i == node.longName.size() ? 0x0000 : 0xFFFF;
+                put16(e + slots[k], unit);
+            }
+        }
+    }
+
+    bool writeDir(int fd, Node& dir, const Node* parent) {
+        bool isRoot = parent == nullptr;
+        size_t bytes = isRoot && fatBits != 32 ? size_t(rootDirEntries_) * ENTRY : size_t(dir.clusters) * sectorsPerCluster_ * SECTOR;
+        std::vector<uint8_t> buf(bytes, 0);
+        uint8_t* e = buf.data();
+        if (isRoot) {
+            if (!label.empty()) {
+                shortEntry(e, volumeLabel().data(), ATTR_VOLUME, 0, 0, 0, dir.mtime);
+                e += ENTRY;
+            }
+        } else {
+            shortEntry(e, ".          ", ATTR_DIR, 0, dir.cluster, 0, dir.mtime);
+            e += ENTRY;
+            uint32_t up = parent == &root_ ? 0 : parent->cluster;
+            shortEntry(e, "..         ", ATTR_DIR, 0, up, 0, parent->mtime);
+            e += ENTRY;
+        }
+        for (auto& child : dir.children) {
+            if (!child.longName.empty()) longEntries(e, child);
+            shortEntry(e, child.shortName, child.dir ? ATTR_DIR : ATTR_ARCHIVE, child.caseFlags, child.cluster,
+                       child.dir ? 0 : static_cast<uint32_t>(child.size), child.mtime);
+            e += ENTRY;
+        }
+        uint64_t offset = isRoot && fatBits != 32 ? (reserved_ + uint64_t(NUM_FATS) * fatSectors_) * SECTOR : clusterOffset(dir.cluster);
+        if (!pwriteAll(fd, buf.data(), buf.size(), offset)) return false;
+        entriesHash_.update(buf.data(), buf.size());
+        for (auto& child : dir.children) {
+            if (child.dir && !writeDir(fd, child, &dir)) return false;
+        }
+        return true;
+    }
+
+    bool writeFiles(int fd, const Node& dir) {
+        std::vector<char> buf(1 << 20);
+        for (const auto& child : dir.children) {
+            if (child.dir) {
+                if (!writeFiles(fd, child)) return false;
+                continue;
+            }
+            if (child.size == 0) continue;
+            int in = open(child.source.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in < 0) return fail("cannot read " + child.source + ": " + strerror(errno));
+            uint64_t offset = clusterOffset(child.cluster), done = 0;
+            while (done < child.size) {
+                ssize_t n = read(in, buf.data(), static_cast<size_t>(std::min<uint64_t>(buf.size(), child.size - done)));
+                if (n <= 0 || !pwriteAll(fd, buf.data(), static_cast<size_t>(n), offset + done)) {
+                    close(in);
+                    return fail(child.source + (n == 0 ? " shrank while it was copied" : ": " + std::string(strerror(errno))));
+                }
+                done += static_cast<uint64_t>(n);
+            }
+            close(in);
+        }
+        return true;
+    }
+
+    std::string volumeLabel() const {
+        std::string l = upper(label).substr(0, 11);
+        l.resize(11, ' ');
+        return l;
+    }
+
+    // Taken from the directory entries rather than the clock, as mtools does
+    uint32_t serial() const {
+        return static_cast<uint32_t>(entriesHash_.digest());
+    }
+
+    // Boot sector with a BPB; the code only halts, the ESP is never booted
+    // through it. FAT32 also gets the FSInfo sector and the backup at 6.
+    bool writeBoot(int fd) {
+        std::vector<uint8_t> boot(SECTOR, 0);
+        uint8_t* b = boot.data();
+        uint64_t sectors = imageSize / SECTOR;
+        b[0] = 0xEB;
+        b[1] = fatBits == 32 ? 0x58 : 0x3C;
+        b[2] = 0x90;
+        memcpy(b + 3, "MSWIN4.1", 8);
+        put16(b + 11, SECTOR);
+        b[13] = static_cast<uint8_t>(sectorsPerCluster_);
+        put16(b + 14, static_cast<uint16_t>(reserved_));
+        b[16] = NUM_FATS;
+        put16(b + 17, static_cast<uint16_t>(rootDirEntries_));
+        put16(b + 19, static_cast<uint16_t>(fatBits != 32 && sectors < 65536 ? sectors : 0));
+        b[21] = 0xF8;
+        put16(b + 22, static_cast<uint16_t>(fatBits == 32 ? 0 : fatSectors_));
+        put16(b + 24, 32);
+        put16(b + 26, 64);
+        put32(b + 32, static_cast<uint32_t>(fatBits != 32 && sectors < 65536 ? 0 : sectors));
+        uint8_t* ext = b + 36;
+        if (fatBits == 32) {
+            put32(b + 36, fatSectors_);
+            put32(b + 44, 2);
+            put16(b + 48, 1);
+            put16(b + 50, 6);
+            ext = b + 64;
+        }
+        ext[0] = 0x80;
+        ext[2] = 0x29;
+        put32(ext + 3, serial());
+        memcpy(ext + 7, label.empty() ? "NO NAME    " : volumeLabel().data(), 11);
+        memcpy(ext + 18, fatBits == 12 ? "FAT12   " : fatBits == 16 ? "FAT16   " : "FAT32   ", 8);
+        static const uint8_t halt[] = {0xFA, 0xF4, 0xEB, 0xFD};  // cli; hlt; jmp $-1
+        memcpy(ext + 26, halt, sizeof(halt));
+        b[510] = 0x55;
+        b[511] = 0xAA;
+        if (!pwriteAll(fd, b, SECTOR, 0)) return false;
+        if (fatBits != 32) return true;
+
+        std::vector<uint8_t> info(SECTOR, 0);
+        put32(&info[0], 0x41615252);
+        put32(&info[484], 0x61417272);
+        put32(&info[488], clusterCount + 2 - nextCluster_);
+        put32(&info[492], nextCluster_ < clusterCount + 2 ? nextCluster_ : 0xFFFFFFFF);
+        put32(&info[508], 0xAA550000);
+        return pwriteAll(fd, info.data(), SECTOR, SECTOR) && pwriteAll(fd, b, SECTOR, 6 * SECTOR) &&
+        pwriteAll(fd, info.data(), SECTOR, 7 * SECTOR);
+    }
+
+    static bool pwriteAll(int fd, const void* data, size_t len, uint64_t offset) {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t n = pwrite(fd, p, len, static_cast<off_t>(offset));
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Streaming XXH64. Fast non-cryptographic content hash used for cache keys
+// and manifests; output matches the reference xxhash implementation.
+class XXH64 {
+public:
+    explicit XXH64(uint64_t seed = 0) {
+        reset(seed);
+    }
+
+    void reset(uint64_t seed = 0) {
+        seed_ = seed;
+        v_[0] = seed + P1 + P2;
+        v_[1] = seed + P2;
+        v_[2] = seed;
+        v_[3] = seed - P1;
+        total_ = 0;
+        bufLen_ = 0;
+    }
+
+    void update(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_ += len;
+
+        if (bufLen_ + len < 32) {
+            memcpy(buf_ + bufLen_, p, len);
+            bufLen_ += len;
+            return;
+        }
+
+        if (bufLen_ > 0) {
+            size_t fill = 32 - bufLen_;
+            memcpy(buf_ + bufLen_, p, fill);
+            consume(buf_);
+            p += fill;
+            len -= fill;
+            bufLen_ = 0;
+        }
+
+        while (len >= 32) {
+            consume(p);
+            p += 32;
+            len -= 32;
+        }
+
+        memcpy(buf_, p, len);
+        bufLen_ = len;
+    }
+
+    void update(const std::string& s) {
+        update(s.data(), s.size());
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total_ >= 32) {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+            for (int i = 0; i < 4; i++) {
+                h ^= round(0, v_[i]);
+                h = h * P1 + P4;
+            }
+        } else {
+            h = seed_ + P5;
+        }
+        h += total_;
+
+        const uint8_t* p = buf_;
+        size_t len = bufLen_;
+        while (len >= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * P1 + P4;
+            p += 8;
+            len -= 8;
+        }
+        if (len >= 4) {
+            h ^= static_cast<uint64_t>(read32(p)) * P1;
+            h = rotl(h, 23) * P2 + P3;
+            p += 4;
+            len -= 4;
+        }
+        while (len > 0) {
+            h ^= (*p) * P5;
+            h = rotl(h, 11) * P1;
+            p++;
+            len--;
+        }
+
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    static uint64_t of(const void* data, size_t len, uint64_t seed = 0) {
+        XXH64 h(seed);
+        h.update(data, len);
+        return h.digest();
+    }
+
+    static std::string hex(uint64_t value) {
+        char out[17];
+        snprintf(out, sizeof(out), "%016llx", static_cast<unsigned long long>(value));
+        return out;
+    }
+
+    // Hashes a whole file; returns false if it cannot be read.
+    static bool ofFile(const std::string& path, uint64_t& result, uint64_t seed = 0) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) return false;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        XXH64 h(seed);
+        std::vector<uint8_t> chunk(1 << 20);
+        ssize_t n;
+        while ((n = read(fd, chunk.data(), chunk.size())) > 0) {
+            h.update(chunk.data(), static_cast<size_t>(n));
+        }
+        close(fd);
+        if (n < 0) return false;
+        result = h.digest();
+        return true;
+    }
+
+private:
+    static constexpr uint64_t P1 = 11400714785074694791ULL;
+    static constexpr uint64_t P2 = 14029467366897019727ULL;
+    static constexpr uint64_t P3 = 1609587929392839161ULL;
+    static constexpr uint64_t P4 = 9650029242287828579ULL;
+    static constexpr uint64_t P5 = 2870177450012600261ULL;
+
+    uint64_t seed_;
+    uint64_t v_[4];
+    uint64_t total_;
+    uint8_t buf_[32];
+    size_t bufLen_;
+
+    static uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t round(uint64_t acc, uint64_t input) {
+        acc += input * P2;
+        acc = rotl(acc, 31);
+        return acc * P1;
+    }
+
+    static uint64_t read64(const uint8_t* p) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    }
+
+    static uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    void consume(const uint8_t* p) {
+        v_[0] = round(v_[0], read64(p));
+        v_[1] = round(v_[1], read64(p + 8));
+        v_[2] = round(v_[2], read64(p + 16));
+        v_[3] = round(v_[3], read64(p + 24));
+    }
+};
+
+#endif
@@ -0,0 +1,436 @@
+#ifndef HWPROFILE_H
+#define HWPROFILE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+
+#include "layers.h"
+
+// What a set of target machines needs from the kernel: device modaliases,
+// loaded modules, extra firmware and broad hardware classes. Collected on
+// each machine with "cmiimg hw-profile collect"; several profiles merge.
+struct HardwareProfile {
+    std::set<std::string> modaliases;
+    std::set<std::string> modules;
+    std::set<std::string> firmware;
+    std::set<std::string> classes;
+
+    bool empty() const {
+        return modaliases.empty() && modules.empty() && firmware.empty() && classes.empty();
+    }
+
+    // Profile of the running machine in the profile file format
+    static std::string collect() {
+        std::ostringstream out;
+        struct utsname uts;
+        uname(&uts);
+        out << "# cmi hardware profile\nhost " << uts.nodename << "\nkernel " << uts.release << "\n";
+
+        std::set<std::string> aliases;
+        auto readAlias = [&](const std::string& path) {
+            std::ifstream in(path);
+            std::string alias;
+            if (std::getline(in, alias) && !alias.empty()) aliases.insert(alias);
+        };
+        readAlias("/sys/devices/system/cpu/modalias");
+        if (DIR* buses = opendir("/sys/bus")) {
+            while (struct dirent* bus = readdir(buses)) {
+                std::string devicesDir = std::string("/sys/bus/") + bus->d_name + "/devices";
+                if (bus->d_name[0] == '.') continue;
+                DIR* devices = opendir(devicesDir.c_str());
+                if (!devices) continue;
+                while (struct dirent* dev = readdir(devices)) {
+                    if (dev->d_name[0] != '.') readAlias(devicesDir + "/" + dev->d_name + "/modalias");
+                }
+                closedir(devices);
+            }
+            closedir(buses);
+        }
+        for (const auto& alias : aliases) out << "modalias " << alias << "\n";
+
+        std::ifstream modules("/proc/modules");
+        std::string line;
+        while (std::getline(modules, line)) {
+            out << "module " << line.substr(0, line.find(' ')) << "\n";
+        }
+        return out.str();
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in.is_open()) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t space = line.find(' ');
+            if (line.empty() || line[0] == '#' || space == std::string::npos) continue;
+            std::string kind = line.substr(0, space), value = line.substr(space + 1);
+            if (kind == "modalias") modaliases.insert(value);
+            else if (kind == "module") modules.insert(normalize(value));
+            else if (kind == "firmware") firmware.insert(value);
+            else if (kind == "class") classes.insert(value);
+        }
+        return true;
+    }
+
+    // Loads every *.profile in dir
+    size_t loadDir(const std::string& dir) {
+        size_t loaded = 0;
+        if (DIR* d = opendir(dir.c_str())) {
+            while (struct dirent* e = readdir(d)) {
+                std::string name = e->d_name;
+                if (name.size() > 8 && name.compare(name.size() - 8, 8, ".profile") == 0 && load(dir + "/" + name)) loaded++;
+            }
+            closedir(d);
+        }
+        return loaded;
+    }
+
+    // Module names use '_' and '-' interchangeably
+    static std::string normalize(std::string name) {
+        for (char& c : name) {
+            if (c == '-') c = '_';
+        }
+        return name;
+    }
+};
+
+struct PrunePlan {
+    std::vector<std::string> kernels;
+    std::vector<std::string> paths;     // files to leave out, relative to the root
+    size_t modules = 0;
+    size_t modulesPruned = 0;
+    uint64_t moduleBytes = 0;
+    uint64_t moduleBytesPruned = 0;
+    size_t firmware = 0;
+    size_t firmwarePruned = 0;
+    uint64_t firmwareBytes = 0;
+    uint64_t firmwareBytesPruned = 0;
+    bool firmwareChecked = true;        // false when modinfo was not available
+};
+
+// Works out which kernel modules and firmware files the profiled hardware
+// can never load. A module is kept if a device alias matches it, it was
+// loaded on a profiled machine, its hardware class was chosen, it is on
+// the safety or keep list, or a kept module depends on it. Firmware is
+// kept if a kept module declares it.
+class HardwarePruner {
+public:
+    // Hardware classes: module directories under kernel/ and firmware prefixes
+    struct HardwareClass {
+        std::vector<std::string> modulePrefixes;
+        std::vector<std::string> firmwarePrefixes;
+    };
+
+    static const std::map<std::string, HardwareClass>& classes() {
+        static const std::map<std::string, HardwareClass> table = {
+            {"gpu-amd", {{"drivers/gpu/drm/amd/", "drivers/gpu/drm/radeon/"}, {"amdgpu/", "radeon/"}}},
+            {"gpu-intel", {{"drivers/gpu/drm/i915/", "drivers/gpu/drm/xe/"}, {"i915/", "xe/"}}},
+            {"gpu-nvidia", {{"drivers/gpu/drm/nouveau/"}, {"nvidia/"}}},
+            {"wifi-intel", {{"drivers/net/wireless/intel/"}, {"iwlwifi-", "intel/iwlwifi/"}}},
+            {"wifi-realtek", {{"drivers/net/wireless/realtek/"}, {"rtlwifi/", "rtw88/", "rtw89/"}}},
+            {"wifi-atheros", {{"drivers/net/wireless/ath/"}, {"ath9k_htc/", "ath10k/", "ath11k/", "ath12k/"}}},
+            {"wifi-mediatek", {{"drivers/net/wireless/mediatek/"}, {"mediatek/"}}},
+            {"wifi-broadcom", {{"drivers/net/wireless/broadcom/"}, {"brcm/", "cypress/"}}},
+            {"ethernet", {{"drivers/net/ethernet/", "drivers/net/usb/", "drivers/net/phy/"}, {"rtl_nic/", "bnx2/", "tigon/"}}},
+            {"bluetooth", {{"drivers/bluetooth/", "net/bluetooth/"}, {"intel/ibt-", "rtl_bt/", "qca/"}}},
+            {"sound", {{"sound/"}, {"intel/sof", "intel/avs/", "cirrus/"}}},
+            {"vm", {{"drivers/gpu/drm/virtio/", "drivers/gpu/drm/vmwgfx/", "drivers/gpu/drm/qxl/", "drivers/hv/",
+                     "drivers/net/vmxnet3/", "drivers/net/hyperv/", "drivers/virt/"}, {}}},
+        };
+        return table;
+    }
+
+    // Always kept: storage, filesystems, input and the core of everything
+    // the live system needs to boot and reach a desktop on unknown hardware
+    static std::vector<std::string> safetyList() {
+        return {
+            "kernel/fs/", "kernel/crypto/", "kernel/lib/", "kernel/arch/", "kernel/block/", "kernel/net/",
+            "kernel/drivers/ata/", "kernel/drivers/scsi/", "kernel/drivers/nvme/", "kernel/drivers/md/",
+            "kernel/drivers/block/", "kernel/drivers/cdrom/", "kernel/drivers/mmc/", "kernel/drivers/usb/host/",
+            "kernel/drivers/usb/storage/", "kernel/drivers/usb/core/", "kernel/drivers/usb/common/",
+            "kernel/drivers/hid/", "kernel/drivers/input/", "kernel/drivers/virtio/", "kernel/drivers/char/",
+            "kernel/drivers/firmware/", "kernel/drivers/video/", "kernel/drivers/gpu/drm/drm",
+            "kernel/drivers/gpu/drm/display/", "kernel/drivers/gpu/drm/tiny/", "kernel/drivers/gpu/drm/virtio/",
+            "kernel/sound/core/", "firmware/regulatory.db", "firmware/amd-ucode/", "firmware/intel-ucode/",
+        };
+    }
+
+    // keep holds module names, module path prefixes ("kernel/drivers/x/")
+    // and firmware prefixes ("firmware/brcm/")
+    static PrunePlan plan(const std::string& root, const HardwareProfile& profile, const std::vector<std::string>& keep) {
+        PrunePlan result;
+        std::vector<std::string> keepList = safetyList();
+        keepList.insert(keepList.end(), keep.begin(), keep.end());
+
+        std::set<std::string> modulePrefixes, keepNames, firmwarePrefixes;
+        for (const auto& k : keepList) {
+            if (k.compare(0, 9, "firmware/") == 0) firmwarePrefixes.insert(k.substr(9));
+            else if (k.find('/') != std::string::npos) modulePrefixes.insert(k);
+            else keepNames.insert(HardwareProfile::normalize(k));
+        }
+        for (const auto& name : profile.classes) {
+            auto it = classes().find(name);
+            if (it == classes().end()) continue;
+            for (const auto& p : it->second.modulePrefixes) modulePrefixes.insert("kernel/" + p);
+            for (const auto& p : it->second.firmwarePrefixes) firmwarePrefixes.insert(p);
+        }
+
+        std::set<std::string> firmwareNeeded(profile.firmware.begin(), profile.firmware.end());
+        std::string modulesDir = root + "/usr/lib/modules";
+        DIR* kernels = opendir(modulesDir.c_str());
+        if (!kernels) return result;
+        while (struct dirent* e = readdir(kernels)) {
+            std::string kver = e->d_name;
+            if (kver[0] == '.' || !fileExists(modulesDir + "/" + kver + "/modules.dep")) continue;
+            result.kernels.push_back(kver);
+            planKernel(root, kver, profile, modulePrefixes, keepNames, firmwareNeeded, result);
+        }
+        closedir(kernels);
+        std::sort(result.kernels.begin(), result.kernels.end());
+
+        if (result.firmwareChecked) planFirmware(root, firmwareNeeded, firmwarePrefixes, result);
+        std::sort(result.paths.begin(), result.paths.end());
+        return result;
+    }
+
+    // Drops pruned files from a manifest so shard, delta and verification
+    // builds see the same tree as the pruned image
+    static size_t filter(std::map<std::string, ManifestEntry>& entries, const std::set<std::string>& pruned) {
+        size_t removed = 0;
+        for (const auto& path : pruned) removed += entries.erase(path);
+        return removed;
+    }
+
+    static std::string summary(const PrunePlan& plan) {
+        std::ostringstream out;
+        out << "Hardware pruning: " << (plan.modules - plan.modulesPruned) << " of " << plan.modules << " modules kept ("
+        << humanBytes(plan.moduleBytesPruned) << " of " << humanBytes(plan.moduleBytes) << " left out)";
+        if (plan.firmwareChecked) {
+            out << ", " << (plan.firmware - plan.firmwarePruned) << " of " << plan.firmware << " firmware files kept ("
+            << humanBytes(plan.firmwareBytesPruned) << " of " << humanBytes(plan.firmwareBytes) << " left out)";
+        } else {
+            out << ", all firmware kept (modinfo not found)";
+        }
+        return out.str();
+    }
+
+private:
+    static bool fileExists(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0;
+    }
+
+    static std::string humanBytes(uint64_t bytes) {
+        std::ostringstream out;
+        if (bytes < (1ULL << 30)) out << std::fixed << std::setprecision(1) << bytes / 1048576.0 << " MiB";
+        else out << std::fixed << std::setprecision(2) << bytes / 1073741824.0 << " GiB";
+        return out.str();
+    }
+
+    static std::string moduleName(const std::string& path) {
+        size_t slash = path.rfind('/');
+        std::string file = path.substr(slash == std::string::npos ? 0 : slash + 1);
+        return HardwareProfile::normalize(file.substr(0, file.find(".ko")));
+    }
+
+    static void planKernel(const std::string& root, const std::string& kver, const HardwareProfile& profile,
+                           const std::set<std::string>& modulePrefixes, const std::set<std::string>& keepNames,
+                           std::set<std::string>& firmwareNeeded, PrunePlan& result) {
+        std::string base = "usr/lib/modules/" + kver;
+
+        // modules.dep: "kernel/x/y.ko.zst: kernel/a.ko.zst kernel/b.ko.zst"
+        std::map<std::string, std::string> pathOf;
+        std::map<std::string, std::vector<std::string>> depsOf;
+        std::ifstream dep(root + "/" + base + "/modules.dep");
+        std::string line;
+        while (std::getline(dep, line)) {
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            std::string path = line.substr(0, colon);
+            std::string name = moduleName(path);
+            pathOf[name] = path;
+            std::istringstream deps(line.substr(colon + 1));
+            std::string d;
+            while (deps >> d) depsOf[name].push_back(moduleName(d));
+        }
+
+        std::set<std::string> wanted;
+        for (const auto& [name, path] : pathOf) {
+            bool keep = profile.modules.count(name) || keepNames.count(name);
+            for (auto it = modulePrefixes.begin(); !keep && it != modulePrefixes.end(); ++it) {
+                keep = path.compare(0, it->size(), *it) == 0;
+            }
+            if (keep) wanted.insert(name);
+        }
+
+        // modules.alias: "alias pci:v00008086d*sv*sd*bc03sc*i* i915"
+        std::ifstream aliases(root + "/" + base + "/modules.alias");
+        while (std::getline(aliases, line)) {
+            std::istringstream fields(line);
+            std::string kind, pattern, name;
+            if (!(fields >> kind >> pattern >> name) || kind != "alias") continue;
+            name = HardwareProfile::normalize(name);
+            if (wanted.count(name)) continue;
+            for (const auto& alias : profile.modaliases) {
+                if (fnmatch(pattern.c_str(), alias.c_str(), 0) == 0) {
+                    wanted.insert(name);
+                    break;
+                }
+            }
+        }
+
+        std::vector<std::string> stack(wanted.begin(), wanted.end());
+        while (!stack.empty()) {
+            std::string name = stack.back();
+            stack.pop_back();
+            for (const auto& d : depsOf[name]) {
+                if (wanted.insert(d).second) stack.push_back(d);
+            }
+        }
+
+        std::vector<std::string> keptNames;
+        for (const auto& [name, path] : pathOf) {
+            struct stat st;
+            uint64_t bytes = lstat((root + "/" + base + "/" + path).c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+            result.modules++;
+            result.moduleBytes += bytes;
+            if (wanted.count(name)) {
+                keptNames.push_back(name);
+                continue;
+            }
+            result.modulesPruned++;
+            result.moduleBytesPruned += bytes;
+            result.paths.push_back(base + "/" + path);
+        }
+
+        // Firmware the kept modules declare
+        std::string cmd = "modinfo -b " + root + " -k " + kver + " -F firmware";
+        for (const auto& name : keptNames) cmd += " " + name;
+        FILE* pipe = popen((cmd + " 2>/dev/null").c_str(), "r");
+        if (!pipe) {
+            result.firmwareChecked = false;
+            return;
+        }
+        char buf[4096];
+        size_t found = 0;
+        while (fgets(buf, sizeof(buf), pipe)) {
+            std::string name = buf;
+            while (!name.empty() && (name.back() == '\n' || name.back() == ' ')) name.pop_back();
+            if (!name.empty()) {
+                firmwareNeeded.insert(name);
+                found++;
+            }
+        }
+        int status = pclose(pipe);
+        // modinfo missing (127) would otherwise leave every firmware file unclaimed
+        if (WEXITSTATUS(status) == 127 || (found == 0 && !keptNames.empty() && WEXITSTATUS(status) != 0)) {
+            result.firmwareChecked = false;
+        }
+    }
+
+    static void planFirmware(const std::string& root, const std::set<std::string>& needed,
+                             const std::set<std::string>& prefixes, PrunePlan& result) {
+        std::string dir = root + "/usr/lib/firmware";
+        std::vector<std::pair<std::string, uint64_t>> files;
+        std::map<std::string, std::string> links;
+        collectFirmware(dir, "", files, links, 0);
+
+        auto plain = [](std::string rel) {
+            for (const char* ext : {".zst", ".xz"}) {
+                size_t n = strlen(ext);
+                if (rel.size() > n && rel.compare(rel.size() - n, n, ext) == 0) return rel.substr(0, rel.size() - n);
+            }
+            return rel;
+        };
+        std::set<std::string> kept;
+        for (const auto& [rel, bytes] : files) {
+            std::string name = plain(rel);
+            bool keep = needed.count(name) > 0;
+            for (auto it = prefixes.begin(); !keep && it != prefixes.end(); ++it) keep = name.compare(0, it->size(), *it) == 0;
+            for (auto it = needed.begin(); !keep && it != needed.end(); ++it) {
+                keep = it->find_first_of("*?[") != std::string::npos && fnmatch(it->c_str(), name.c_str(), 0) == 0;
+            }
+            if (keep) kept.insert(rel);
+        }
+        // A kept symlink keeps what it points at
+        std::vector<std::string> stack(kept.begin(), kept.end());
+        while (!stack.empty()) {
+            auto link = links.find(stack.back());
+            stack.pop_back();
+            if (link != links.end() && kept.insert(link->second).second) stack.push_back(link->second);
+        }
+
+        for (const auto& [rel, bytes] : files) {
+            result.firmware++;
+            result.firmwareBytes += bytes;
+            if (kept.count(rel)) continue;
+            result.firmwarePruned++;
+            result.firmwareBytesPruned += bytes;
+            result.paths.push_back("usr/lib/firmware/" + rel);
+        }
+    }
+
+    // Files and symlinks under the firmware directory; links maps a
+    // symlink to its target relative to the firmware directory
+    static void collectFirmware(const std::string& dir, const std::string& rel, std::vector<std::pair<std::string, uint64_t>>& files,
+                                std::map<std::string, std::string>& links, int depth) {
+        if (depth > 16) return;
+        DIR* d = opendir((dir + (rel.empty() ? "" : "/" + rel)).c_str());
+        if (!d) return;
+        while (struct dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name == "." || name == "..") continue;
+            std::string child = rel.empty() ? name : rel + "/" + name;
+            struct stat st;
+            if (lstat((dir + "/" + child).c_str(), &st) != 0) continue;
+            if (S_ISDIR(st.st_mode)) {
+                collectFirmware(dir, child, files, links, depth + 1);
+                continue;
+            }
+            files.emplace_back(child, static_cast<uint64_t>(st.st_size));
+            if (S_ISLNK(st.st_mode)) {
+                char target[4096];
+                ssize_t n = readlink((dir + "/" + child).c_str(), target, sizeof(target) - 1);
+                if (n <= 0) continue;
+                target[n] = '\0';
+                if (target[0] != '/') links[child] = resolve(rel, target);
+            }
+        }
+        closedir(d);
+    }
+
+    // Joins a relative symlink target onto the link's directory
+    static std::string resolve(const std::string& linkDir, const std::string& target) {
+        std::vector<std::string> parts;
+        std::istringstream in((linkDir.empty() ? "" : linkDir + "/") + target);
+        std::string part;
+        while (std::getline(in, part, '/')) {
+            if (part.empty() || part == ".") continue;
+            if (part == "..") {
+                if (!parts.empty()) parts.pop_back();
+            } else {
+                parts.push_back(part);
+            }
+        }
+        std::string out;
+        for (const auto& p : parts) out += (out.empty() ? "" : "/") + p;
+        return out;
+    }
+};
+
+#endif
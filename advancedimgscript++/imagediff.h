@@ -0,0 +1,427 @@
+#ifndef IMAGEDIFF_H
+#define IMAGEDIFF_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "squashfs.h"
+#include "erofs.h"
+#include "profile.h"
+
+// One path of an image as far as the diff cares about it.
+struct DiffNode {
+    char type = 'f';            // f d l b c p s
+    uint32_t mode = 0;          // permission bits
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint64_t mtime = 0;
+    uint64_t size = 0;
+    uint64_t stored = 0;        // bytes the file occupies in the image
+    uint64_t signature = 0;     // hash of the compressed block size list
+    uint64_t content = 0;       // hash of the data, only with --content
+    uint64_t tail = 0;          // hash of the data the signature cannot see
+    bool hasTail = false;       // a squashfs fragment tail or an uncompressed EROFS file
+    bool unverified = false;    // that data could not be read
+    std::string target;         // symlink target or major:minor
+    size_t entry = 0;           // index into ImageTree::squashfs or ImageTree::erofsEntries
+};
+
+struct ImageTree {
+    std::string image;
+    std::string format;         // squashfs or erofs
+    std::string layout;         // compressor and block size; signatures only compare within one layout
+    uint64_t imageBytes = 0;
+    std::map<std::string, DiffNode> nodes;
+    std::unique_ptr<SquashfsReader> reader;
+    std::vector<SquashfsEntry> squashfs;
+    std::unique_ptr<ErofsReader> erofs;
+    std::vector<ErofsEntry> erofsEntries;
+};
+
+struct DiffChange {
+    char kind = '~';            // + added, - removed, ~ data changed, m metadata only
+    std::string path;
+    std::string what;
+    int64_t sizeDelta = 0;
+    int64_t storedDelta = 0;
+};
+
+struct ImageDiffResult {
+    std::vector<DiffChange> changes;
+    uint64_t added = 0;
+    uint64_t removed = 0;
+    uint64_t changed = 0;
+    uint64_t metadataOnly = 0;
+    uint64_t unchanged = 0;
+    uint64_t hashedFiles = 0;
+    uint64_t tailFiles = 0;
+    int64_t sizeDelta = 0;
+    int64_t storedDelta = 0;
+    int64_t imageDelta = 0;
+    bool comparableStorage = true;
+    bool contentChecked = false;
+    std::map<std::string, int64_t> storedByTopDir;
+
+    std::string toJson(const ImageTree& oldTree, const ImageTree& newTree) const {
+        std::ostringstream out;
+        out << "{\n  \"old\": " << ImageProfile::jsonString(oldTree.image)
+        << ",\n  \"new\": " << ImageProfile::jsonString(newTree.image)
+        << ",\n  \"image_delta\": " << imageDelta << ",\n  \"size_delta\": " << sizeDelta
+        << ",\n  \"stored_delta\": " << storedDelta << ",\n  \"added\": " << added << ",\n  \"removed\": " << removed
+        << ",\n  \"changed\": " << changed << ",\n  \"metadata_only\": " << metadataOnly
+        << ",\n  \"unchanged\": " << unchanged << ",\n  \"changes\": [";
+        for (size_t i = 0; i < changes.size(); i++) {
+            const DiffChange& c = changes[i];
+            out << (i ? ",\n" : "\n") << "    {\"kind\": \"" << c.kind << "\", \"path\": " << ImageProfile::jsonString(c.path)
+            << ", \"what\": " << ImageProfile::jsonString(c.what) << ", \"size_delta\": " << c.sizeDelta
+            << ", \"stored_delta\": " << c.storedDelta << "}";
+        }
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+};
+
+// Compares two squashfs or EROFS images from their inode and directory
+// tables. A file whose compressed block sizes and metadata all match is
+// taken as unchanged without reading its blocks. Data the block list does
+// not describe, a squashfs fragment tail or an uncompressed EROFS file, is
+// read and hashed; a same-size edit there changes nothing in the tables,
+// and with -all-time not even the mtime. contentCheck decompresses files of
+// equal size on both sides instead.
+class ImageDiff {
+public:
+    static bool load(const std::string& image, ImageTree& tree, std::string& error) {
+        tree.image = image;
+        struct stat st;
+        if (stat(image.c_str(), &st) != 0) {
+            error = "cannot stat " + image;
+            return false;
+        }
+        tree.imageBytes = static_cast<uint64_t>(st.st_size);
+        if (ErofsReader::isErofs(image)) return loadErofs(image, tree, error);
+        return loadSquashfs(image, tree, error);
+    }
+
+    // Loads both images on their own threads.
+    static bool loadPair(const std::string& oldImage, const std::string& newImage,
+                         ImageTree& oldTree, ImageTree& newTree, std::string& error) {
+        std::string oldError, newError;
+        bool oldOk = false, newOk = false;
+        std::thread other([&]() { oldOk = load(oldImage, oldTree, oldError); });
+        newOk = load(newImage, newTree, newError);
+        other.join();
+        if (!oldOk) error = oldImage + ": " + oldError;
+        else if (!newOk) error = newImage + ": " + newError;
+        return oldOk && newOk;
+    }
+
+    static ImageDiffResult diff(ImageTree& oldTree, ImageTree& newTree, bool contentCheck) {
+        ImageDiffResult result;
+        result.imageDelta = static_cast<int64_t>(newTree.imageBytes) - static_cast<int64_t>(oldTree.imageBytes);
+        result.comparableStorage = oldTree.format == newTree.format && oldTree.layout == newTree.layout;
+        // File data can only be read back from squashfs
+        contentCheck = contentCheck && oldTree.reader && newTree.reader;
+        result.contentChecked = contentCheck;
+        if (contentCheck) {
+            hashCandidates(oldTree, newTree);
+            for (const auto& kv : newTree.nodes) {
+                auto o = oldTree.nodes.find(kv.first);
+                if (o != oldTree.nodes.end() && kv.second.type == 'f' && o->second.type == 'f' && o->second.size == kv.second.size) {
+                    result.hashedFiles++;
+                }
+            }
+        } else if (result.comparableStorage) {
+            result.tailFiles = hashTails(oldTree, newTree);
+        }
+
+        // Both maps are sorted by path, so one merge pass finds every difference
+        auto o = oldTree.nodes.begin();
+        auto n = newTree.nodes.begin();
+        while (o != oldTree.nodes.end() || n != newTree.nodes.end()) {
+            if (n == newTree.nodes.end() || (o != oldTree.nodes.end() && o->first < n->first)) {
+                addChange(result, '-', o->first, "", &o->second, nullptr);
+                ++o;
+            } else if (o == oldTree.nodes.end() || n->first < o->first) {
+                addChange(result, '+', n->first, "", nullptr, &n->second);
+                ++n;
+            } else {
+                std::string what;
+                bool data = compare(o->second, n->second, result.comparableStorage, contentCheck, what);
+                if (what.empty()) result.unchanged++;
+                else addChange(result, data ? '~' : 'm', n->first, what, &o->second, &n->second);
+                ++o;
+                ++n;
+            }
+        }
+        return result;
+    }
+
+private:
+    static char modeType(uint32_t mode) {
+        if (S_ISDIR(mode)) return 'd';
+        if (S_ISLNK(mode)) return 'l';
+        if (S_ISBLK(mode)) return 'b';
+        if (S_ISCHR(mode)) return 'c';
+        if (S_ISFIFO(mode)) return 'p';
+        if (S_ISSOCK(mode)) return 's';
+        return 'f';
+    }
+
+    static char squashfsType(uint16_t type) {
+        switch (type) {
+            case SquashfsReader::TYPE_DIR: return 'd';
+            case SquashfsReader::TYPE_FILE: return 'f';
+            case SquashfsReader::TYPE_SYMLINK: return 'l';
+            case SquashfsReader::TYPE_BLKDEV: return 'b';
+            case SquashfsReader::TYPE_CHRDEV: return 'c';
+            case SquashfsReader::TYPE_FIFO: return 'p';
+            default: return 's';
+        }
+    }
+
+    static bool loadSquashfs(const std::string& image, ImageTree& tree, std::string& error) {
+        tree.format = "squashfs";
+        tree.reader = std::make_unique<SquashfsReader>();
+        if (!tree.reader->open(image, error) || !tree.reader->readTree(tree.squashfs, error)) return false;
+        const SquashfsSuperblock& sb = tree.reader->super();
+        tree.layout = std::string(SquashfsReader::compressorName(sb.compression)) + "/" + std::to_string(sb.blockSize);
+
+        for (size_t i = 0; i < tree.squashfs.size(); i++) {
+            const SquashfsInode& in = tree.squashfs[i].inode;
+            DiffNode node;
+            node.type = squashfsType(in.type);
+            node.mode = in.mode;
+            node.uid = in.uid;
+            node.gid = in.gid;
+            node.mtime = in.mtime;
+            node.entry = i;
+            if (node.type == 'l') node.target = in.target;
+            if (node.type == 'b' || node.type == 'c') node.target = std::to_string(in.devMajor()) + ":" + std::to_string(in.devMinor());
+            if (node.type == 'f') {
+                node.size = in.fileSize;
+                XXH64 h;
+                for (uint32_t sizeWord : in.blockSizes) {
+                    h.update(&sizeWord, sizeof(sizeWord));
+                    node.stored += sizeWord & (SquashfsReader::BLOCK_UNCOMPRESSED - 1);
+                }
+                uint64_t tail = in.hasFragment() ? in.fileSize - static_cast<uint64_t>(in.blockSizes.size()) * sb.blockSize : 0;
+                h.update(&tail, sizeof(tail));
+                node.stored += tail;
+                node.signature = h.digest();
+                node.hasTail = tail > 0;
+            }
+            tree.nodes[tree.squashfs[i].path] = node;
+        }
+        return true;
+    }
+
+    static bool loadErofs(const std::string& image, ImageTree& tree, std::string& error) {
+        tree.format = "erofs";
+        tree.erofs = std::make_unique<ErofsReader>();
+        ErofsReader& reader = *tree.erofs;
+        std::vector<ErofsEntry>& entries = tree.erofsEntries;
+        if (!reader.open(image, error) || !reader.readTree(entries, error)) return false;
+        tree.layout = "erofs/" + std::to_string(reader.super().availableComprAlgs) + "/" + std::to_string(reader.blockSize());
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            const ErofsEntry& e = entries[i];
+            const ErofsInode& in = e.inode;
+            DiffNode node;
+            node.type = modeType(in.mode);
+            node.entry = i;
+            node.mode = in.mode & 07777;
+            node.uid = in.uid;
+            node.gid = in.gid;
+            node.mtime = in.mtime;
+            if (node.type == 'l') {
+                std::vector<uint8_t> target;
+                if (reader.readPlainData(in, target, error)) node.target.assign(target.begin(), target.end());
+                error.clear();
+            }
+            if (node.type == 'b' || node.type == 'c') {
+                uint32_t major = (in.u & 0xfff00) >> 8;
+                uint32_t minor = (in.u & 0xff) | ((in.u >> 12) & 0xfff00);
+                node.target = std::to_string(major) + ":" + std::to_string(minor);
+            }
+            if (node.type == 'f') {
+                node.size = in.size;
+                bool compressed = in.layout == 1 || in.layout == 3;
+                node.stored = compressed ? static_cast<uint64_t>(in.u) * reader.blockSize() : in.size;
+                // Compressed inodes record how many blocks they take; that is
+                // all EROFS offers without walking the cluster index
+                uint64_t sig[2] = {in.layout, compressed ? in.u : 0};
+                node.signature = XXH64::of(sig, sizeof(sig));
+                node.hasTail = !compressed && in.size > 0;
+            }
+            tree.nodes[e.path] = node;
+        }
+        return true;
+    }
+
+    // Returns true when the data differs, with what naming the first difference.
+    static bool compare(const DiffNode& a, const DiffNode& b, bool comparableStorage, bool contentCheck, std::string& what) {
+        if (a.type != b.type) {
+            what = "type";
+            return true;
+        }
+        if (a.type == 'f') {
+            if (a.size != b.size) what = "size";
+            else if (contentCheck && a.content != b.content) what = "content";
+            else if (!contentCheck && comparableStorage && a.signature != b.signature) what = "blocks";
+            else if (!contentCheck && comparableStorage && (a.unverified || b.unverified)) what = "unverified";
+            else if (!contentCheck && comparableStorage && a.tail != b.tail) what = "data";
+            if (!what.empty()) return true;
+        }
+        if (a.target != b.target) {
+            what = a.type == 'l' ? "target" : "device";
+            return true;
+        }
+        // Directory mtimes follow their contents and would only add noise
+        if (a.type == 'd') {
+            if (a.mode != b.mode) what = "mode";
+            else if (a.uid != b.uid || a.gid != b.gid) what = "owner";
+            return false;
+        }
+        if (a.mode != b.mode) what = "mode";
+        else if (a.uid != b.uid || a.gid != b.gid) what = "owner";
+        else if (a.mtime != b.mtime) what = "mtime";
+        return false;
+    }
+
+    static void addChange(ImageDiffResult& result, char kind, const std::string& path, const std::string& what,
+                          const DiffNode* before, const DiffNode* after) {
+        DiffChange c;
+        c.kind = kind;
+        c.path = path;
+        c.what = what;
+        c.sizeDelta = static_cast<int64_t>(after ? after->size : 0) - static_cast<int64_t>(before ? before->size : 0);
+        c.storedDelta = static_cast<int64_t>(after ? after->stored : 0) - static_cast<int64_t>(before ? before->stored : 0);
+        result.sizeDelta += c.sizeDelta;
+        result.storedDelta += c.storedDelta;
+        result.storedByTopDir[path.substr(0, path.find('/'))] += c.storedDelta;
+        if (kind == '+') result.added++;
+        else if (kind == '-') result.removed++;
+        else if (kind == '~') result.changed++;
+        else result.metadataOnly++;
+        result.changes.push_back(std::move(c));
+    }
+
+    // Hashes the tails of files that match in size and signature on both
+    // sides. Files sharing a squashfs fragment block are grouped, so each
+    // block is decompressed once; an uncompressed EROFS file is its own
+    // group. Returns how many paths needed it.
+    static uint64_t hashTails(ImageTree& oldTree, ImageTree& newTree) {
+        struct Group {
+            ImageTree* tree;
+            uint32_t fragment;
+            std::vector<DiffNode*> nodes;
+        };
+        std::vector<Group> groups;
+        std::map<std::pair<ImageTree*, uint32_t>, size_t> byFragment;
+        auto add = [&](ImageTree& tree, DiffNode& node) {
+            if (!node.hasTail) return;
+            if (!tree.reader) {
+                groups.push_back({&tree, 0, {&node}});
+                return;
+            }
+            uint32_t fragment = tree.squashfs[node.entry].inode.fragment;
+            auto it = byFragment.find({&tree, fragment});
+            if (it == byFragment.end()) {
+                it = byFragment.emplace(std::make_pair(&tree, fragment), groups.size()).first;
+                groups.push_back({&tree, fragment, {}});
+            }
+            groups[it->second].nodes.push_back(&node);
+        };
+
+        uint64_t files = 0;
+        for (auto& kv : newTree.nodes) {
+            auto o = oldTree.nodes.find(kv.first);
+            if (o == oldTree.nodes.end() || kv.second.type != 'f' || o->second.type != 'f' ||
+                o->second.size != kv.second.size || o->second.signature != kv.second.signature) continue;
+            if (!kv.second.hasTail && !o->second.hasTail) continue;
+            add(newTree, kv.second);
+            add(oldTree, o->second);
+            files++;
+        }
+
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            size_t g;
+            std::vector<uint8_t> data;
+            while ((g = next.fetch_add(1)) < groups.size()) {
+                ImageTree& tree = *groups[g].tree;
+                std::string error;
+                if (!tree.reader) {
+                    // Plain EROFS data past what readPlainData takes stays unverified
+                    DiffNode& node = *groups[g].nodes[0];
+                    if (tree.erofs->readPlainData(tree.erofsEntries[node.entry].inode, data, error)) {
+                        node.tail = XXH64::of(data.data(), data.size());
+                    } else {
+                        node.unverified = true;
+                    }
+                    continue;
+                }
+                bool ok = tree.reader->readFragment(groups[g].fragment, data, error);
+                uint64_t blockSize = tree.reader->super().blockSize;
+                for (DiffNode* node : groups[g].nodes) {
+                    const SquashfsInode& in = tree.squashfs[node->entry].inode;
+                    uint64_t len = in.fileSize - static_cast<uint64_t>(in.blockSizes.size()) * blockSize;
+                    if (ok && in.fragmentOffset + len <= data.size()) node->tail = XXH64::of(data.data() + in.fragmentOffset, len);
+                    else node->unverified = true;
+                }
+            }
+        };
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+        for (auto& t : pool) t.join();
+        return files;
+    }
+
+    // Hashes the data of files present on both sides with the same size.
+    static void hashCandidates(ImageTree& oldTree, ImageTree& newTree) {
+        std::vector<std::pair<ImageTree*, DiffNode*>> work;
+        for (auto& kv : newTree.nodes) {
+            auto o = oldTree.nodes.find(kv.first);
+            if (o == oldTree.nodes.end() || kv.second.type != 'f' || o->second.type != 'f' || o->second.size != kv.second.size) continue;
+            work.push_back({&newTree, &kv.second});
+            work.push_back({&oldTree, &o->second});
+        }
+        std::sort(work.begin(), work.end(), [](const auto& a, const auto& b) {
+            return a.second->size > b.second->size;
+        });
+
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            size_t w;
+            while ((w = next.fetch_add(1)) < work.size()) {
+                ImageTree& tree = *work[w].first;
+                DiffNode& node = *work[w].second;
+                XXH64 h;
+                std::string error;
+                bool ok = tree.reader->readFile(tree.squashfs[node.entry].inode, [&](const uint8_t* data, size_t len) {
+                    h.update(data, len);
+                    return true;
+                }, error);
+                // An unreadable file must never look unchanged
+                node.content = ok ? h.digest() : reinterpret_cast<uintptr_t>(&node);
+            }
+        };
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+        for (auto& t : pool) t.join();
+    }
+};
+
+#endif
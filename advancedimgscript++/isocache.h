@@ -0,0 +1,154 @@
+#ifndef ISOCACHE_H
+#define ISOCACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "isowriter.h"
+
+// Remembers which build tree and layout produced the last ISO, so an
+// unchanged tree does not have to be written again. The key covers the
+// layout, every path with its size and mtime, the contents of small files
+// and, for big files, the hash recorded next to them in <file>.sha512.
+class IsoCache {
+public:
+    static constexpr uint64_t SMALL_FILE = 1ULL << 20;
+
+    struct Record {
+        std::string key;
+        std::string iso;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+    };
+
+    explicit IsoCache(const std::string& path) : path_(path) {}
+
+    // Empty if part of the tree could not be read
+    static std::string key(const IsoLayout& layout) {
+        std::ostringstream desc;
+        desc << "layout " << static_cast<int>(layout.boot) << "\n" << layout.volumeId << "\n" << layout.applicationId << "\n"
+        << layout.publisherId << "\n" << layout.preparerId << "\n" << layout.biosImage << "\n" << layout.catalog << "\n"
+        << layout.efiImage << "\n" << static_cast<long long>(layout.timestamp) << "\n";
+        uint64_t hash = 0;
+        if (!XXH64::ofFile(layout.mbrImage, hash)) return "";
+        desc << "mbr " << XXH64::hex(hash) << "\n";
+        // The appended EFI partition of the GRUB2 layout may live outside the tree
+        if (layout.efiImage.compare(0, 1, "/") == 0) {
+            if (!XXH64::ofFile(layout.efiImage, hash)) return "";
+            desc << "efi " << XXH64::hex(hash) << "\n";
+        }
+        // The persistence image is formatted once and kept, so its size and
+        // mtime are enough; hashing it would read hundreds of MiB of zeros
+        if (!layout.persistImage.empty()) {
+            struct stat st;
+            if (stat(layout.persistImage.c_str(), &st) != 0) return "";
+            desc << "persist " << layout.persistImage << " " << st.st_size << " " << st.st_mtim.tv_sec << "."
+            << st.st_mtim.tv_nsec << "\n";
+        }
+        if (!describe(layout.tree, "", desc, 0)) return "";
+        for (const auto& overlay : layout.overlays) {
+            desc << "overlay\n";
+            if (!describe(overlay, "", desc, 0)) return "";
+        }
+        std::string all = desc.str();
+        return XXH64::hex(XXH64::of(all.data(), all.size()));
+    }
+
+    bool load(Record& record) const {
+        std::ifstream in(path_);
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t space = line.find(' ');
+            if (space == std::string::npos) continue;
+            std::string field = line.substr(0, space), value = line.substr(space + 1);
+            if (field == "key") record.key = value;
+            else if (field == "iso") record.iso = value;
+            else if (field == "size") record.size = std::strtoull(value.c_str(), nullptr, 10);
+            else if (field == "mtime") record.mtime = std::strtoll(value.c_str(), nullptr, 10);
+        }
+        return !record.key.empty() && !record.iso.empty();
+    }
+
+    bool save(const std::string& key, const std::string& iso) const {
+        struct stat st;
+        if (stat(iso.c_str(), &st) != 0) return false;
+        std::ofstream out(path_, std::ios::trunc);
+        out << "key " << key << "\niso " << iso << "\nsize " << st.st_size << "\nmtime " << st.st_mtime << "\n";
+        return out.good();
+    }
+
+    // The recorded ISO, if it was built from key and has not been touched since
+    bool find(const std::string& key, std::string& iso) const {
+        Record record;
+        if (key.empty() || !load(record) || record.key != key) return false;
+        struct stat st;
+        if (stat(record.iso.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) != record.size ||
+            static_cast<int64_t>(st.st_mtime) != record.mtime) {
+            return false;
+        }
+        iso = record.iso;
+        return true;
+    }
+
+    void forget() const {
+        unlink(path_.c_str());
+    }
+
+private:
+    std::string path_;
+
+    static bool describe(const std::string& root, const std::string& rel, std::ostringstream& desc, int depth) {
+        if (depth > 32) return false;
+        std::string dirPath = rel.empty() ? root : root + "/" + rel;
+        DIR* dir = opendir(dirPath.c_str());
+        if (!dir) return false;
+        std::vector<std::string> names;
+        while (struct dirent* e = readdir(dir)) {
+            std::string name = e->d_name;
+            if (name != "." && name != "..") names.push_back(name);
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+
+        for (const auto& name : names) {
+            std::string child = rel.empty() ? name : rel + "/" + name;
+            std::string full = root + "/" + child;
+            struct stat st;
+            if (lstat(full.c_str(), &st) != 0) return false;
+            if (S_ISDIR(st.st_mode)) {
+                desc << "d " << child << " " << (st.st_mode & 07777) << "\n";
+                if (!describe(root, child, desc, depth + 1)) return false;
+            } else if (S_ISLNK(st.st_mode)) {
+                char target[4096];
+                ssize_t n = readlink(full.c_str(), target, sizeof(target) - 1);
+                if (n < 0) return false;
+                desc << "l " << child << " " << std::string(target, static_cast<size_t>(n)) << "\n";
+            } else if (S_ISREG(st.st_mode)) {
+                desc << "f " << child << " " << (st.st_mode & 07777) << " " << st.st_size << " "
+                << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec;
+                uint64_t hash = 0;
+                if (static_cast<uint64_t>(st.st_size) <= SMALL_FILE) {
+                    if (!XXH64::ofFile(full, hash)) return false;
+                    desc << " " << XXH64::hex(hash);
+                } else {
+                    std::ifstream sum(full + ".sha512");
+                    std::string recorded;
+                    if (sum >> recorded) desc << " sha512:" << recorded;
+                }
+                desc << "\n";
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+// The kernels selected for the ISO, kept in the config as a comma separated
+// list of /boot/vmlinuz-* paths. The first one is the default and keeps the
+// vmlinuz-x86_64 / initramfs-x86_64.img names the shipped grub.cfg expects;
+// the others are copied as vmlinuz-<name> and initramfs-<name>.img.
+class KernelSet {
+public:
+    static constexpr const char* DEFAULT_KERNEL = "vmlinuz-x86_64";
+    static constexpr const char* DEFAULT_INITRAMFS = "initramfs-x86_64.img";
+    static constexpr const char* BEGIN_MARK = "# cmi kernels begin - generated, edit the first entry instead";
+    static constexpr const char* END_MARK = "# cmi kernels end";
+
+    static std::vector<std::string> parse(const std::string& list) {
+        std::vector<std::string> kernels;
+        std::istringstream in(list);
+        std::string path;
+        while (std::getline(in, path, ',')) {
+            if (!path.empty() && std::find(kernels.begin(), kernels.end(), path) == kernels.end()) kernels.push_back(path);
+        }
+        return kernels;
+    }
+
+    static std::string join(const std::vector<std::string>& kernels) {
+        std::string list;
+        for (const auto& k : kernels) list += (list.empty() ? "" : ",") + k;
+        return list;
+    }
+
+    // /boot/vmlinuz-linux-lts -> linux-lts
+    static std::string name(const std::string& path) {
+        std::string base = path.substr(path.rfind('/') + 1);
+        if (base.compare(0, 8, "vmlinuz-") == 0) base.erase(0, 8);
+        return base.empty() ? "linux" : base;
+    }
+
+    static std::string kernelFile(const std::vector<std::string>& kernels, size_t i) {
+        return i == 0 ? DEFAULT_KERNEL : "vmlinuz-" + name(kernels[i]);
+    }
+
+    static std::string initramfsFile(const std::vector<std::string>& kernels, size_t i) {
+        return i == 0 ? DEFAULT_INITRAMFS : "initramfs-" + name(kernels[i]) + ".img";
+    }
+
+    // Rewrites the generated section of a grub config: one copy of the first
+    // menuentry that boots the default kernel per extra kernel, with the file
+    // names swapped and the kernel name added to the title. Returns false if
+    // the config has no such entry.
+    static bool bootEntries(const std::string& cfg, const std::vector<std::string>& kernels, std::string& out) {
+        std::string text = stripGenerated(cfg);
+        std::string entry;
+        if (!findDefaultEntry(text, entry)) return false;
+
+        std::string generated;
+        for (size_t i = 1; i < kernels.size(); i++) {
+            std::string copy = entry;
+            replaceAll(copy, DEFAULT_KERNEL, kernelFile(kernels, i));
+            replaceAll(copy, DEFAULT_INITRAMFS, initramfsFile(kernels, i));
+            size_t open = copy.find_first_of("\"'");
+            size_t close = open == std::string::npos ? open : copy.find(copy[open], open + 1);
+            if (close != std::string::npos) copy.insert(close, " (" + name(kernels[i]) + ")");
+            generated += copy + "\n";
+        }
+        out = text;
+        if (!generated.empty()) {
+            if (!out.empty() && out.back() != '\n') out += "\n";
+            out += std::string(BEGIN_MARK) + "\n" + generated + END_MARK + "\n";
+        }
+        return true;
+    }
+
+private:
+    static std::string stripGenerated(const std::string& cfg) {
+        size_t begin = cfg.find(BEGIN_MARK);
+        if (begin == std::string::npos) return cfg;
+        size_t end = cfg.find(END_MARK, begin);
+        if (end != std::string::npos) end = cfg.find('\n', end);
+        end = end == std::string::npos ? cfg.size() : end + 1;
+        return cfg.substr(0, begin) + cfg.substr(end);
+    }
+
+    static bool findDefaultEntry(const std::string& text, std::string& entry) {
+        size_t pos = 0;
+        while ((pos = text.find("menuentry", pos)) != std::string::npos) {
+            size_t lineStart = text.rfind('\n', pos);
+            lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+            if (text.find_first_not_of(" \t", lineStart) != pos) {
+                pos += 9;
+                continue;
+            }
+            size_t brace = text.find('{', pos);
+            if (brace == std::string::npos) return false;
+            int depth = 0;
+            size_t end = brace;
+            for (; end < text.size(); end++) {
+                if (text[end] == '{') depth++;
+                else if (text[end] == '}' && --depth == 0) break;
+            }
+            if (end >= text.size()) return false;
+            std::string block = text.substr(lineStart, end + 1 - lineStart);
+            if (block.find(DEFAULT_KERNEL) != std::string::npos) {
+                entry = block;
+                return true;
+            }
+            pos = end;
+        }
+        return false;
+    }
+
+    static void replaceAll(std::string& s, const std::string& from, const std::string& to) {
+        for (size_t pos = 0; (pos = s.find(from, pos)) != std::string::npos; pos += to.size()) s.replace(pos, from.size(), to);
+    }
+};
+
+#endif
@@ -0,0 +1,367 @@
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+// One entry of a tree manifest. Paths are relative to the scanned root
+// and never start with a slash ("usr/lib/libc.so.6").
+struct ManifestEntry {
+    char type = 'f';          // f=file d=dir l=symlink c=char b=block p=fifo s=socket
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::string link;         // symlink target, or "major:minor" for devices
+
+    bool sameAs(const ManifestEntry& other) const {
+        return type == other.type && mode == other.mode && uid == other.uid &&
+        gid == other.gid && size == other.size && mtime == other.mtime && link == other.link;
+    }
+};
+
+// Metadata snapshot of a directory tree, used to work out what changed
+// between two builds without reading any file contents.
+class TreeManifest {
+public:
+    std::map<std::string, ManifestEntry> entries;
+
+    // Excludes use the same spelling as the mksquashfs -e list:
+    // "dir/*" keeps the directory but drops its contents, anything else
+    // drops that exact path.
+    static bool isExcluded(const std::string& rel, const std::vector<std::string>& excludes) {
+        for (const auto& e : excludes) {
+            if (e.size() > 2 && e.compare(e.size() - 2, 2, "/*") == 0) {
+                std::string dir = e.substr(0, e.size() - 2);
+                if (rel.size() > dir.size() && rel.compare(0, dir.size(), dir) == 0 && rel[dir.size()] == '/') {
+                    return true;
+                }
+            } else if (rel == e || (rel.size() > e.size() && rel.compare(0, e.size(), e) == 0 && rel[e.size()] == '/')) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool scan(const std::string& root, const std::vector<std::string>& excludes) {
+        entries.clear();
+        int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return false;
+        scanDir(fd, "", excludes, 0);
+        close(fd);
+        return true;
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out.is_open()) return false;
+        out << "# cmi manifest v1\n";
+        for (const auto& [rel, e] : entries) {
+            out << e.type << '\t' << e.mode << '\t' << e.uid << '\t' << e.gid << '\t'
+            << e.size << '\t' << e.mtime << '\t' << escape(rel) << '\t' << escape(e.link) << '\n';
+        }
+        return out.good();
+    }
+
+    bool load(const std::string& path) {
+        entries.clear();
+        std::ifstream in(path);
+        if (!in.is_open()) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::vector<std::string> f;
+            size_t start = 0, tab;
+            while ((tab = line.find('\t', start)) != std::string::npos) {
+                f.push_back(line.substr(start, tab - start));
+                start = tab + 1;
+            }
+            f.push_back(line.substr(start));
+            if (f.size() != 8 || f[0].empty()) continue;
+            ManifestEntry e;
+            e.type = f[0][0];
+            e.mode = static_cast<uint32_t>(std::strtoul(f[1].c_str(), nullptr, 10));
+            e.uid = static_cast<uint32_t>(std::strtoul(f[2].c_str(), nullptr, 10));
+            e.gid = static_cast<uint32_t>(std::strtoul(f[3].c_str(), nullptr, 10));
+            e.size = std::strtoull(f[4].c_str(), nullptr, 10);
+            e.mtime = std::strtoll(f[5].c_str(), nullptr, 10);
+            e.link = unescape(f[7]);
+            entries[unescape(f[6])] = e;
+        }
+        return true;
+    }
+
+    uint64_t totalBytes() const {
+        uint64_t total = 0;
+        for (const auto& kv : entries) {
+            if (kv.second.type == 'f') total += kv.second.size;
+        }
+        return total;
+    }
+
+    static std::string escape(const std::string& s) {
+        std::string out;
+        out.reserve(s.size());
+        for (char c : s) {
+            if (c == '\\') out += "\\\\";
+            else if (c == '\t') out += "\\t";
+            else if (c == '\n') out += "\\n";
+            else out += c;
+        }
+        return out;
+    }
+
+    static std::string unescape(const std::string& s) {
+        std::string out;
+        out.reserve(s.size());
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] == '\\' && i + 1 < s.size()) {
+                char n = s[++i];
+                out += (n == 't') ? '\t' : (n == 'n') ? '\n' : n;
+            } else {
+                out += s[i];
+            }
+        }
+        return out;
+    }
+
+private:
+    void scanDir(int dirfd, const std::string& prefix, const std::vector<std::string>& excludes, int depth) {
+        if (depth > 256) return;
+        int dupfd = dup(dirfd);
+        if (dupfd < 0) return;
+        DIR* dir = fdopendir(dupfd);
+        if (!dir) {
+            close(dupfd);
+            return;
+        }
+
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != nullptr) {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+            std::string rel = prefix.empty() ? std::string(ent->d_name) : prefix + "/" + ent->d_name;
+            if (isExcluded(rel, excludes)) continue;
+
+            struct stat st;
+            if (fstatat(dirfd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+            ManifestEntry e;
+            e.mode = st.st_mode & 07777;
+            e.uid = st.st_uid;
+            e.gid = st.st_gid;
+            e.mtime = st.st_mtime;
+
+            if (S_ISREG(st.st_mode)) {
+                e.type = 'f';
+                e.size = static_cast<uint64_t>(st.st_size);
+            } else if (S_ISDIR(st.st_mode)) {
+                e.type = 'd';
+            } else if (S_ISLNK(st.st_mode)) {
+                e.type = 'l';
+                std::vector<char> buf(static_cast<size_t>(st.st_size > 0 ? st.st_size : 255) + 1);
+                ssize_t n = readlinkat(dirfd, ent->d_name, buf.data(), buf.size() - 1);
+                if (n >= 0) e.link.assign(buf.data(), static_cast<size_t>(n));
+                e.size = e.link.size();
+            } else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+                e.type = S_ISCHR(st.st_mode) ? 'c' : 'b';
+                e.link = std::to_string(major(st.st_rdev)) + ":" + std::to_string(minor(st.st_rdev));
+            } else if (S_ISFIFO(st.st_mode)) {
+                e.type = 'p';
+            } else {
+                e.type = 's';
+            }
+            entries[rel] = e;
+
+            if (e.type == 'd') {
+                int child = openat(dirfd, ent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (child >= 0) {
+                    scanDir(child, rel, excludes, depth + 1);
+                    close(child);
+                }
+            }
+        }
+        closedir(dir);
+    }
+};
+
+// Result of comparing the manifest a base image was built from with the
+// current source tree.
+struct LayerDelta {
+    std::vector<std::string> changed;   // new or modified entries, parents included
+    std::vector<std::string> deleted;   // topmost removed paths, one whiteout each
+    uint64_t changedBytes = 0;
+};
+
+// Layered output: a base image from an earlier build plus one delta image
+// holding what changed since. LiveOS/layers.list names the images top
+// layer first; the cmi_layers initcpio hook stacks them with overlayfs.
+class LayerManager {
+public:
+    static LayerDelta diff(const TreeManifest& base, const TreeManifest& current) {
+        LayerDelta delta;
+        std::set<std::string> wanted;
+
+        for (const auto& [rel, e] : current.entries) {
+            auto it = base.entries.find(rel);
+            if (it != base.entries.end() && it->second.sameAs(e)) continue;
+            wanted.insert(rel);
+            if (e.type == 'f') delta.changedBytes += e.size;
+
+            // Overlayfs takes directory attributes from the topmost layer,
+            // so every parent of a changed entry must be carried with its
+            // real metadata rather than synthesised by mksquashfs.
+            size_t slash = rel.rfind('/');
+            while (slash != std::string::npos) {
+                std::string parent = rel.substr(0, slash);
+                if (!wanted.insert(parent).second) break;
+                slash = parent.rfind('/');
+            }
+        }
+
+        for (const auto& kv : base.entries) {
+            const std::string& rel = kv.first;
+            if (current.entries.count(rel)) continue;
+            // Children of a removed directory are hidden by its whiteout.
+            size_t slash = rel.rfind('/');
+            if (slash != std::string::npos && !current.entries.count(rel.substr(0, slash))) continue;
+            delta.deleted.push_back(rel);
+
+            while (slash != std::string::npos) {
+                std::string parent = rel.substr(0, slash);
+                if (!wanted.insert(parent).second) break;
+                slash = parent.rfind('/');
+            }
+        }
+
+        delta.changed.assign(wanted.begin(), wanted.end());
+        return delta;
+    }
+
+    // NUL separated list for "tar --null --no-recursion -T".
+    static bool writeTarList(const std::vector<std::string>& paths, const std::string& listFile) {
+        std::ofstream out(listFile, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        for (const auto& p : paths) {
+            out << p << '\0';
+        }
+        return out.good();
+    }
+
+    // Overlayfs whiteouts are 0:0 character devices; mksquashfs creates
+    // them from pseudo definitions so no device nodes touch the disk.
+    static bool writeWhiteouts(const std::vector<std::string>& deleted, const std::string& pseudoFile) {
+        std::ofstream out(pseudoFile, std::ios::trunc);
+        if (!out.is_open()) return false;
+        for (const auto& p : deleted) {
+            out << quotePseudo(p) << " c 0000 0 0 0 0\n";
+        }
+        return out.good();
+    }
+
+    static std::vector<std::string> readLayers(const std::string& liveosDir) {
+        std::vector<std::string> layers;
+        std::ifstream in(liveosDir + "/layers.list");
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty()) layers.push_back(line);
+        }
+        return layers;
+    }
+
+    static bool writeLayers(const std::string& path, const std::vector<std::string>& layers) {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out.is_open()) return false;
+        for (const auto& l : layers) {
+            out << l << "\n";
+        }
+        return out.good();
+    }
+
+    static std::string installHook() {
+        return R"(#!/bin/bash
+
+build() {
+    add_module squashfs
+    add_module overlay
+    add_module loop
+    add_module ext4
+    add_module btrfs
+    add_runscript
+}
+
+help() {
+    cat <<HELPEOF
+Mounts the images listed in LiveOS/layers.list (top layer first) from the
+boot medium labelled cmi_layers=<label> as one overlayfs root. With
+cmi_persist=<label> the changes go to that partition instead of RAM.
+HELPEOF
+}
+)";
+    }
+
+    static std::string runtimeHook() {
+        return R"(#!/usr/bin/ash
+
+run_hook() {
+    [ -n "${cmi_layers}" ] || return 0
+    mount_handler="cmi_layers_mount_handler"
+}
+
+cmi_layers_mount_handler() {
+    local newroot="$1" media="/run/cmi/media" lower="" layer n=0 dev
+
+    mkdir -p "${media}" /run/cmi/cow
+    dev=$(resolve_device "LABEL=${cmi_layers}")
+    if ! mount -r "${dev}" "${media}"; then
+        launch_interactive_shell
+    fi
+
+    while read -r layer; do
+        [ -n "${layer}" ] || continue
+        mkdir -p "/run/cmi/layer${n}"
+        mount -r -t squashfs -o loop "${media}/LiveOS/${layer}" "/run/cmi/layer${n}"
+        lower="${lower:+${lower}:}/run/cmi/layer${n}"
+        n=$((n + 1))
+    done < "${media}/LiveOS/layers.list"
+
+    if [ -z "${cmi_persist}" ] || ! dev=$(resolve_device "LABEL=${cmi_persist}") || ! mount "${dev}" /run/cmi/cow; then
+        mount -t tmpfs -o size=75% cmi_cow /run/cmi/cow
+    fi
+    mkdir -p /run/cmi/cow/upper /run/cmi/cow/work
+    mount -t overlay -o "lowerdir=${lower},upperdir=/run/cmi/cow/upper,workdir=/run/cmi/cow/work" cmi_root "${newroot}"
+}
+)";
+    }
+
+private:
+    static std::string quotePseudo(const std::string& p) {
+        bool plain = true;
+        for (char c : p) {
+            if (c == ' ' || c == '"' || c == '\\' || c == '\t') {
+                plain = false;
+                break;
+            }
+        }
+        if (plain) return p;
+        std::string out = "\"";
+        for (char c : p) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+};
+
+#endif
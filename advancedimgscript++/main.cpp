@@ -19,6 +19,8 @@
 #include <thread>
 #include <sstream>
 #include <iomanip>
+#include <chrono>
+#include <unordered_map>
 
 // REMOVED Qt includes
 // #include <QFile>
@@ -28,6 +30,24 @@
 
 // ADD THIS: Include our resource manager
 #include "resources.h"
+#include "layers.h"
+#include "blockcache.h"
+#include "planner.h"
+#include "verify.h"
+#include "profile.h"
+#include "imagediff.h"
+#include "tiers.h"
+#include "workers.h"
+#include "checkpoint.h"
+#include "multisink.h"
+#include "tarstream.h"
+#include "readbench.h"
+#include "hwprofile.h"
+#include "isowriter.h"
+#include "isocache.h"
+#include "kernels.h"
+#include "chunkindex.h"
+#include "fatimage.h"
 
 // Forward declarations
 void saveConfig();
@@ -35,6 +55,8 @@ void execute_command(const std::string& cmd, bool continueOnError = false);
 void printCheckbox(bool checked);
 std::string getUserInput(const std::string& prompt);
 void clearScreen();
+std::string getLayerStateDir();
+double secondsSince(const std::chrono::steady_clock::time_point& start);
 int getch();
 int kbhit();
 
@@ -54,6 +76,37 @@ const std::string SQUASHFS_COMPRESSION = "zstd";
 const std::vector<std::string> SQUASHFS_COMPRESSION_ARGS = {"-Xcompression-level", "22"};
 std::string BUILD_DIR = "/home/$USER/.config/cmi/build-image-arch-img";
 std::string USERNAME = "";
+const std::string DELTA_IMG_NAME = "rootfs-delta.img";
+const std::string HOT_IMG_NAME = "rootfs-hot.img";
+const std::string COLD_IMG_NAME = "rootfs-cold.img";
+const std::string USER_IMG_PREFIX = "rootfs-user-";
+
+// Extra lines for the summary printed after an image build
+std::vector<std::string> BUILD_SUMMARY;
+
+// Paths left out of every image, same spelling as the mksquashfs -e list
+const std::vector<std::string> SQUASHFS_EXCLUDES = {
+    "etc/udev/rules.d/70-persistent-cd.rules",
+    "etc/udev/rules.d/70-persistent-net.rules",
+    "etc/mtab",
+    "etc/fstab",
+    "dev/*",
+    "proc/*",
+    "sys/*",
+    "tmp/*",
+    "run/*",
+    "mnt/*",
+    "media/*",
+    "lost+found",
+    "clone_system_temp"
+};
+
+// Exclude list from planHardwarePrune for the current build, empty when
+// nothing is pruned
+std::string PRUNE_LIST;
+
+// Paths from a --prune list; helper commands leave them out of manifests
+std::set<std::string> PRUNED_PATHS;
 
 // Configuration state
 struct ConfigState {
@@ -69,6 +122,22 @@ struct ConfigState {
     bool calamares1Edited = false;
     bool calamares2Edited = false;
     bool filesExtracted = false; // NEW: Track if files have been extracted
+    bool layeredImages = false; // Build a delta image on top of the previous base
+    bool shardCache = false; // Reuse compressed shards from earlier builds
+    bool resumableBuilds = false; // Build in segments so an interrupted build can continue
+    bool verifyImages = true; // Check finished images against the source
+    bool tieredImages = false; // Boot files in a fast image, the rest at maximum compression
+    bool hwPrune = false; // Leave out modules and firmware the profiled hardware never loads
+    std::string hwClasses; // e.g. "gpu-amd,wifi-intel"; added to the collected profiles
+    bool persistence = false; // Append a partition that keeps the live session's changes
+    std::string persistFs = "ext4"; // ext4 or btrfs
+    int persistMB = 512; // Size in the ISO; grown to fill the stick when written to USB
+    bool reproducible = false; // Pin dates to SOURCE_DATE_EPOCH so rebuilds are bit-identical
+    std::string espDir; // Contents of the EFI partition; empty uses the tree's EFI directory
+    int shardCacheGB = 20;
+    int hotSetMB = 768;
+    std::string hotCompression = "lz4"; // lz4 or none
+    std::string compressionWorkers; // e.g. "local:2,ssh:builder"; empty compresses here
 
     bool isReadyForISO() const {
         return !isoTag.empty() && !isoName.empty() && !outputDir.empty() &&
@@ -281,6 +350,24 @@ void execute_command(const std::string& cmd, bool continueOnError) {
     }
 }
 
+// For "tar | mksquashfs" and the like: without pipefail only the last
+// command counts, and an image missing whatever tar could not read
+// would pass as finished. bash, since older dash has no pipefail.
+std::string pipefailCommand(const std::string& cmd) {
+    std::string quoted = "'";
+    for (char c : cmd) quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    quoted += "'";
+    return "bash -o pipefail -c " + quoted;
+}
+
+int runPipeline(const std::string& cmd) {
+    std::cout << COLOR_CYAN;
+    fflush(stdout);
+    int status = system(pipefailCommand(cmd).c_str());
+    std::cout << COLOR_RESET;
+    return status;
+}
+
 void printCheckbox(bool checked) {
     if (checked) {
         std::cout << COLOR_GREEN << "[✓]" << COLOR_RESET;
@@ -433,6 +520,30 @@ std::string getUserInput(const std::string& prompt) {
     return input;
 }
 
+// Adds a boot entry per extra kernel to kernels.cfg, or to grub.cfg when
+// the entries live there, by copying the default kernel's entry
+void updateKernelBootEntries() {
+    std::vector<std::string> kernels = KernelSet::parse(config.vmlinuzPath);
+    for (const std::string cfgName : {"kernels.cfg", "grub.cfg"}) {
+        std::string cfgPath = BUILD_DIR + "/boot/grub/" + cfgName;
+        std::ifstream in(cfgPath);
+        std::string cfg((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::string updated;
+        if (!KernelSet::bootEntries(cfg, kernels, updated)) continue;
+        if (updated == cfg) return;
+        std::string tmpPath = getLayerStateDir() + "/" + cfgName;
+        std::ofstream(tmpPath, std::ios::trunc) << updated;
+        execute_command("sudo cp " + tmpPath + " " + cfgPath, true);
+        std::cout << COLOR_CYAN << "Boot entries for " << kernels.size() << " kernel" << (kernels.size() == 1 ? "" : "s")
+        << " written to " << cfgPath << COLOR_RESET << std::endl;
+        return;
+    }
+    if (kernels.size() > 1) {
+        std::cerr << COLOR_YELLOW << "No boot entry for " << KernelSet::DEFAULT_KERNEL << " found - add the extra kernels by hand"
+        << COLOR_RESET << std::endl;
+    }
+}
+
 void selectVmlinuz() {
     DIR *dir;
     struct dirent *ent;
@@ -456,32 +567,54 @@ void selectVmlinuz() {
         return;
     }
 
+    std::sort(vmlinuzFiles.begin(), vmlinuzFiles.end());
     std::cout << COLOR_GREEN << "Available vmlinuz files:" << COLOR_RESET << std::endl;
     for (size_t i = 0; i < vmlinuzFiles.size(); i++) {
         std::cout << COLOR_GREEN << (i+1) << ") " << vmlinuzFiles[i] << COLOR_RESET << std::endl;
     }
 
-    std::string selection = getUserInput("Select vmlinuz file (1-" + std::to_string(vmlinuzFiles.size()) + "): ");
-    try {
-        int choice = std::stoi(selection);
-        if (choice > 0 && choice <= static_cast<int>(vmlinuzFiles.size())) {
-            config.vmlinuzPath = vmlinuzFiles[choice-1];
-
-            std::string destPath = BUILD_DIR + "/boot/vmlinuz-x86_64";
-            std::string copyCmd = "sudo cp " + config.vmlinuzPath + " " + destPath;
-            execute_command(copyCmd);
-
-            std::cout << COLOR_CYAN << "Selected: " << config.vmlinuzPath << COLOR_RESET << std::endl;
-            std::cout << COLOR_CYAN << "Copied to: " << destPath << COLOR_RESET << std::endl;
-            saveConfig();
-        } else {
-            std::cerr << COLOR_RED << "Invalid selection!" << COLOR_RESET << std::endl;
+    std::string selection = getUserInput("Select vmlinuz files, the default first (e.g. 1 or 2,1,3; 'all'): ");
+    std::vector<std::string> kernels;
+    if (selection == "all") {
+        kernels = vmlinuzFiles;
+    } else {
+        std::replace(selection.begin(), selection.end(), ',', ' ');
+        std::istringstream picks(selection);
+        std::string pick;
+        while (picks >> pick) {
+            try {
+                int choice = std::stoi(pick);
+                if (choice < 1 || choice > static_cast<int>(vmlinuzFiles.size())) {
+                    std::cerr << COLOR_RED << "Invalid selection!" << COLOR_RESET << std::endl;
+                    return;
+                }
+                kernels.push_back(vmlinuzFiles[choice-1]);
+            } catch (...) {
+                std::cerr << COLOR_RED << "Invalid input!" << COLOR_RESET << std::endl;
+                return;
+            }
         }
-    } catch (...) {
-        std::cerr << COLOR_RED << "Invalid input!" << COLOR_RESET << std::endl;
     }
+    kernels = KernelSet::parse(KernelSet::join(kernels));
+    if (kernels.empty()) {
+        std::cerr << COLOR_RED << "Invalid selection!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    execute_command("sudo rm -f " + BUILD_DIR + "/boot/vmlinuz-linux* " + BUILD_DIR + "/boot/initramfs-linux*", true);
+    for (size_t i = 0; i < kernels.size(); i++) {
+        std::string destPath = BUILD_DIR + "/boot/" + KernelSet::kernelFile(kernels, i);
+        execute_command("sudo cp " + kernels[i] + " " + destPath);
+        std::cout << COLOR_CYAN << "Selected: " << kernels[i] << " -> " << destPath << COLOR_RESET << std::endl;
+    }
+    config.vmlinuzPath = KernelSet::join(kernels);
+    config.mkinitcpioGenerated = false;
+    saveConfig();
 }
 
+// One mkinitcpio per selected kernel, a few at a time. Each run gets a copy
+// of the live mkinitcpio.conf that compresses with zstd on its share of the
+// cores, so the jobs together use the whole machine without oversubscribing.
 void generateMkinitcpio() {
     if (config.vmlinuzPath.empty()) {
         std::cerr << COLOR_RED << "Please select vmlinuz first!" << COLOR_RESET << std::endl;
@@ -493,8 +626,51 @@ void generateMkinitcpio() {
         return;
     }
 
-    std::cout << COLOR_CYAN << "Generating initramfs..." << COLOR_RESET << std::endl;
-    execute_command("cd " + BUILD_DIR + " && sudo mkinitcpio -c mkinitcpio.conf -g " + BUILD_DIR + "/boot/initramfs-x86_64.img");
+    std::vector<std::string> kernels = KernelSet::parse(config.vmlinuzPath);
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t parallel = std::min<size_t>(kernels.size(), std::max(1u, cores / 4));
+    unsigned threads = std::max(1u, static_cast<unsigned>(cores / parallel));
+
+    std::string stateDir = getLayerStateDir();
+    std::string conf = stateDir + "/mkinitcpio-mt.conf";
+    {
+        std::ifstream in(BUILD_DIR + "/mkinitcpio.conf");
+        std::ofstream out(conf, std::ios::trunc);
+        out << in.rdbuf() << "\nCOMPRESSION=\"zstd\"\nCOMPRESSION_OPTIONS=(-T" << threads << ")\n";
+        if (!out.good()) {
+            std::cerr << COLOR_RED << "Failed to write " << conf << COLOR_RESET << std::endl;
+            return;
+        }
+    }
+
+    std::cout << COLOR_CYAN << "Generating " << kernels.size() << " initramfs image" << (kernels.size() == 1 ? "" : "s") << ", "
+    << parallel << " at a time with " << threads << " zstd threads each..." << COLOR_RESET << std::endl;
+    std::vector<int> status(kernels.size(), -1);
+    std::vector<double> seconds(kernels.size(), 0);
+    std::atomic<size_t> next(0);
+    std::mutex printLock;
+    auto run = [&]() {
+        for (size_t i; (i = next++) < kernels.size(); ) {
+            std::string log = stateDir + "/mkinitcpio-" + KernelSet::name(kernels[i]) + ".log";
+            auto start = std::chrono::steady_clock::now();
+            status[i] = system(("cd " + BUILD_DIR + " && sudo mkinitcpio -c " + conf + " -k " + kernels[i] + " -g " + BUILD_DIR +
+            "/boot/" + KernelSet::initramfsFile(kernels, i) + " > " + log + " 2>&1").c_str());
+            seconds[i] = secondsSince(start);
+            std::lock_guard<std::mutex> guard(printLock);
+            std::cout << (status[i] == 0 ? COLOR_GREEN : COLOR_RED) << "  " << KernelSet::name(kernels[i]) << ": "
+            << (status[i] == 0 ? "done" : "failed, see " + log) << " in " << std::fixed << std::setprecision(1) << seconds[i] << "s"
+            << COLOR_RESET << std::endl;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < parallel; i++) pool.emplace_back(run);
+    for (auto& t : pool) t.join();
+
+    if (std::count(status.begin(), status.end(), 0) != static_cast<long>(kernels.size())) {
+        std::cerr << COLOR_RED << "mkinitcpio failed - fix the errors above and generate again" << COLOR_RESET << std::endl;
+        return;
+    }
+    updateKernelBootEntries();
 
     config.mkinitcpioGenerated = true;
     saveConfig();
@@ -644,6 +820,22 @@ void saveConfig() {
         configFile << "calamares1Edited=" << (config.calamares1Edited ? "1" : "0") << "\n";
         configFile << "calamares2Edited=" << (config.calamares2Edited ? "1" : "0") << "\n";
         configFile << "filesExtracted=" << (config.filesExtracted ? "1" : "0") << "\n"; // NEW: Save files extracted state
+        configFile << "layeredImages=" << (config.layeredImages ? "1" : "0") << "\n";
+        configFile << "shardCache=" << (config.shardCache ? "1" : "0") << "\n";
+        configFile << "shardCacheGB=" << config.shardCacheGB << "\n";
+        configFile << "resumableBuilds=" << (config.resumableBuilds ? "1" : "0") << "\n";
+        configFile << "hwPrune=" << (config.hwPrune ? "1" : "0") << "\n";
+        configFile << "hwClasses=" << config.hwClasses << "\n";
+        configFile << "persistence=" << (config.persistence ? "1" : "0") << "\n";
+        configFile << "persistFs=" << config.persistFs << "\n";
+        configFile << "persistMB=" << config.persistMB << "\n";
+        configFile << "reproducible=" << (config.reproducible ? "1" : "0") << "\n";
+        configFile << "espDir=" << config.espDir << "\n";
+        configFile << "verifyImages=" << (config.verifyImages ? "1" : "0") << "\n";
+        configFile << "tieredImages=" << (config.tieredImages ? "1" : "0") << "\n";
+        configFile << "hotSetMB=" << config.hotSetMB << "\n";
+        configFile << "hotCompression=" << config.hotCompression << "\n";
+        configFile << "compressionWorkers=" << config.compressionWorkers << "\n";
         configFile.close();
     } else {
         std::cerr << COLOR_RED << "Failed to save configuration to " << configPath << COLOR_RESET << std::endl;
@@ -673,6 +865,22 @@ void loadConfig() {
                 else if (key == "calamares1Edited") config.calamares1Edited = (value == "1");
                 else if (key == "calamares2Edited") config.calamares2Edited = (value == "1");
                 else if (key == "filesExtracted") config.filesExtracted = (value == "1"); // NEW: Load files extracted state
+                else if (key == "layeredImages") config.layeredImages = (value == "1");
+                else if (key == "shardCache") config.shardCache = (value == "1");
+                else if (key == "shardCacheGB") config.shardCacheGB = std::max(1, std::atoi(value.c_str()));
+                else if (key == "resumableBuilds") config.resumableBuilds = (value == "1");
+                else if (key == "hwPrune") config.hwPrune = (value == "1");
+                else if (key == "hwClasses") config.hwClasses = value;
+                else if (key == "persistence") config.persistence = (value == "1");
+                else if (key == "persistFs") config.persistFs = (value == "btrfs" ? "btrfs" : "ext4");
+                else if (key == "persistMB") config.persistMB = std::max(128, std::atoi(value.c_str()));
+                else if (key == "reproducible") config.reproducible = (value == "1");
+                else if (key == "espDir") config.espDir = value;
+                else if (key == "verifyImages") config.verifyImages = (value == "1");
+                else if (key == "tieredImages") config.tieredImages = (value == "1");
+                else if (key == "hotSetMB") config.hotSetMB = std::max(16, std::atoi(value.c_str()));
+                else if (key == "hotCompression") config.hotCompression = (value == "none" ? "none" : "lz4");
+                else if (key == "compressionWorkers") config.compressionWorkers = value;
             }
         }
         configFile.close();
@@ -772,24 +980,118 @@ bool mountSystemToCloneDir(const std::string& cloneDir) {
     return true;
 }
 
+// Reproducible builds pin every date to SOURCE_DATE_EPOCH. Without the
+// variable the last package change stands in, so rebuilding an unchanged
+// system gives the same timestamps.
+bool reproducibleBuild() {
+    return config.reproducible || getenv("SOURCE_DATE_EPOCH");
+}
+
+// mksquashfs parameters for the current build, fitted to this machine
+SquashfsPlan SQUASHFS_PLAN;
+bool squashfsPlanned = false;
+
+// Sizes threads, caches and compression level to the free memory and CPUs
+// and records the choice in ~/.config/cmi/resource-plan.log. The level is
+// only lowered when neither the shard cache nor a reproducible build
+// depends on it.
+void planSquashfsResources(const CompressorSpec& spec = CompressorSpec()) {
+    SQUASHFS_PLAN = ResourcePlanner::plan(spec, config.shardCache || reproducibleBuild());
+    squashfsPlanned = true;
+
+    std::cout << COLOR_CYAN << "mksquashfs: " << SQUASHFS_PLAN.processors << " of " << SQUASHFS_PLAN.cpus
+    << " CPUs, " << SQUASHFS_PLAN.cacheMB << "M cache, " << SQUASHFS_PLAN.compressorArgs() << COLOR_RESET << std::endl;
+    if (SQUASHFS_PLAN.downgraded()) {
+        std::cout << COLOR_YELLOW << "Not enough memory for the requested compression window, using "
+        << SQUASHFS_PLAN.compressorArgs() << " instead" << COLOR_RESET << std::endl;
+    }
+
+    std::ofstream log("/home/" + USERNAME + "/.config/cmi/resource-plan.log", std::ios::app);
+    time_t now = time(nullptr);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    log << stamp << " " << SQUASHFS_PLAN.describe() << "\n";
+    BUILD_SUMMARY.push_back("mksquashfs parameters: " + SQUASHFS_PLAN.compressorArgs() + " " + SQUASHFS_PLAN.resourceArgs());
+}
+
+time_t sourceDateEpoch() {
+    if (const char* env = getenv("SOURCE_DATE_EPOCH")) {
+        char* end = nullptr;
+        long long epoch = std::strtoll(env, &end, 10);
+        if (end != env && *end == '\0' && epoch > 0) return static_cast<time_t>(epoch);
+    }
+    struct stat st;
+    if (stat("/var/lib/pacman/local", &st) == 0) return st.st_mtime;
+    return 1;
+}
+
+// mksquashfs already sorts directories and orders its threads' output;
+// the dates are what is left. -all-time sets every file date to the
+// epoch rather than clamping only newer ones (mksquashfs cannot clamp),
+// so the live system shows all files dated at the epoch.
+std::string reproducibleSquashfsArgs() {
+    if (!reproducibleBuild()) return "";
+    std::string epoch = std::to_string(static_cast<long long>(sourceDateEpoch()));
+    return " -mkfs-time " + epoch + " -all-time " + epoch;
+}
+
+// Passes the epoch to sudo children, which lose the environment
+std::string reproducibleEnv() {
+    if (!reproducibleBuild()) return "";
+    return "env SOURCE_DATE_EPOCH=" + std::to_string(static_cast<long long>(sourceDateEpoch())) + " ";
+}
+
+// Compressor settings shared by full and delta images
+std::string squashfsCompressionArgs() {
+    if (!squashfsPlanned) planSquashfsResources();
+    return SQUASHFS_PLAN.compressorArgs() + reproducibleSquashfsArgs();
+}
+
+// Shards are cached by content, so their bytes must follow from the shard
+// key alone: the epoch would tie every cached shard to the last package
+// change. Inode dates stay those of the files, which the key covers, and
+// the superblock date is fixed.
+std::string shardCompressionArgs() {
+    if (!squashfsPlanned) planSquashfsResources();
+    return SQUASHFS_PLAN.compressorArgs() + (reproducibleBuild() ? " -mkfs-time 0" : "");
+}
+
+// Threads and memory for mksquashfs; never part of a cache key since they
+// do not change the output
+std::string squashfsResourceArgs() {
+    if (!squashfsPlanned) planSquashfsResources();
+    return SQUASHFS_PLAN.resourceArgs();
+}
+
+// Builds the "-e" list from SQUASHFS_EXCLUDES, swapping the clone
+// directory name for the mount point actually in use
+std::vector<std::string> squashfsExcludes(const std::string& mountName = "clone_system_temp") {
+    std::vector<std::string> excludes;
+    for (const auto& e : SQUASHFS_EXCLUDES) {
+        excludes.push_back(e == "clone_system_temp" ? mountName : e);
+    }
+    return excludes;
+}
+
+std::string squashfsExcludeArgs(const std::string& mountName = "clone_system_temp") {
+    std::string args;
+    for (const auto& e : squashfsExcludes(mountName)) {
+        args += " -e " + e;
+    }
+    if (!PRUNE_LIST.empty()) args += " -ef " + PRUNE_LIST;
+    return args;
+}
+
+// Passes the prune list on to helper commands that scan the source tree
+std::string pruneArg() {
+    return PRUNE_LIST.empty() ? "" : " --prune " + PRUNE_LIST;
+}
+
 // UPDATED: Create SquashFS with exact rsync exclusions
 bool createSquashFS(const std::string& inputDir, const std::string& outputFile) {
     // EXACT SAME EXCLUDES as original rsync command
     std::string command = "sudo mksquashfs " + inputDir + " " + outputFile +
-    " -noappend -comp zstd -Xcompression-level 22 -b 256K " +
-    "-e etc/udev/rules.d/70-persistent-cd.rules " +
-    "-e etc/udev/rules.d/70-persistent-net.rules " +
-    "-e etc/mtab " +
-    "-e etc/fstab " +
-    "-e dev/* " +
-    "-e proc/* " +
-    "-e sys/* " +
-    "-e tmp/* " +
-    "-e run/* " +
-    "-e mnt/* " +
-    "-e media/* " +
-    "-e lost+found " +
-    "-e clone_system_temp";
+    " -noappend " + squashfsCompressionArgs() + " " + squashfsResourceArgs() + squashfsExcludeArgs();
 
     execute_command(command, true);
     return true;
@@ -801,13 +1103,18 @@ bool createChecksum(const std::string& filename) {
     return true;
 }
 
-void printFinalMessage(const std::string& outputFile) {
+void printFinalMessage(const std::vector<std::string>& outputFiles) {
     std::cout << std::endl;
-    std::cout << COLOR_CYAN << "SquashFS image created successfully: " << outputFile << COLOR_RESET << std::endl;
-    std::cout << COLOR_CYAN << "Checksum file: " << outputFile + ".sha512" << COLOR_RESET << std::endl;
-    std::cout << COLOR_CYAN << "Size: ";
-    execute_command("sudo du -h " + outputFile + " | cut -f1", true);
-    std::cout << COLOR_RESET;
+    for (const auto& outputFile : outputFiles) {
+        std::cout << COLOR_CYAN << "SquashFS image created successfully: " << outputFile << COLOR_RESET << std::endl;
+        std::cout << COLOR_CYAN << "Checksum file: " << outputFile + ".sha512" << COLOR_RESET << std::endl;
+        std::cout << COLOR_CYAN << "Size: ";
+        execute_command("sudo du -h " + outputFile + " | cut -f1", true);
+        std::cout << COLOR_RESET;
+    }
+    for (const auto& line : BUILD_SUMMARY) {
+        std::cout << COLOR_CYAN << line << COLOR_RESET << std::endl;
+    }
 }
 
 std::string getOutputDirectory() {
@@ -828,227 +1135,1351 @@ std::string expandPath(const std::string& path) {
     return result;
 }
 
-bool createISO() {
-    if (!config.allCheckboxesChecked()) {
-        std::cerr << COLOR_RED << "Cannot create ISO - all setup steps must be completed first!" << COLOR_RESET << std::endl;
-        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-        getch();
-        return false;
+std::string formatBytes(uint64_t bytes) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4) {
+        value /= 1024.0;
+        unit++;
     }
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << " " << units[unit];
+    return oss.str();
+}
 
-    if (!config.isReadyForISO()) {
-        std::cerr << COLOR_RED << "Cannot create ISO - setup is incomplete!" << COLOR_RESET << std::endl;
-        return false;
-    }
+std::string formatDelta(int64_t bytes) {
+    return (bytes < 0 ? "-" : "+") + formatBytes(static_cast<uint64_t>(bytes < 0 ? -bytes : bytes));
+}
 
-    std::cout << COLOR_CYAN << "\nStarting ISO creation process...\n" << COLOR_RESET;
+bool fileExists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
 
-    std::string expandedOutputDir = expandPath(config.outputDir);
+uint64_t fileSize(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+}
 
-    execute_command("mkdir -p " + expandedOutputDir, true);
+double secondsSince(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-    std::string xorrisoCmd = "sudo xorriso -as mkisofs "
-    "--modification-date=\"$(date +%Y%m%d%H%M%S00)\" "
-    "--protective-msdos-label "
-    "-volid \"" + config.isoTag + "\" "
-    "-appid \"claudemods Linux Live/Rescue CD\" "
-    "-publisher \"claudemods claudemods101@gmail.com >\" "
-    "-preparer \"Prepared by user\" "
-    "-r -graft-points -no-pad "
-    "--sort-weight 0 / "
-    "--sort-weight 1 /boot "
-    "--grub2-mbr " + BUILD_DIR + "/boot/grub/i386-pc/boot_hybrid.img "
-    "-partition_offset 16 "
-    "-b boot/grub/i386-pc/eltorito.img "
-    "-c boot.catalog "
-    "-no-emul-boot -boot-load-size 4 -boot-info-table --grub2-boot-info "
-    "-eltorito-alt-boot "
-    "-append_partition 2 0xef " + BUILD_DIR + "/boot/efi.img "
-    "-e --interval:appended_partition_2:all:: "
-    "-no-emul-boot "
-    "-iso-level 3 "
-    "-o \"" + expandedOutputDir + "/" + config.isoName + "\" " +
-    BUILD_DIR;
-
-    execute_command(xorrisoCmd, true);
+// Path of the running binary, used to re-run helper commands under sudo
+std::string selfExecutable() {
+    char path[4096];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0) return "cmiimg";
+    path[len] = '\0';
+    return path;
+}
 
-    std::string isoPath = expandedOutputDir + "/" + config.isoName;
-    std::string chownCmd = "sudo chown " + USERNAME + ":" + USERNAME + " \"" + isoPath + "\"";
-    execute_command(chownCmd, true);
+std::string getLayerStateDir() {
+    return "/home/" + USERNAME + "/.config/cmi/layers";
+}
 
-    std::cout << COLOR_CYAN << "ISO created successfully at " << isoPath << COLOR_RESET << std::endl;
-    std::cout << COLOR_GREEN << "Ownership changed to current user: " << USERNAME << COLOR_RESET << std::endl;
+// Content hash memo shared by shard planning and image verification
+std::string getFileHashMemo() {
+    return getLayerStateDir() + "/filehash.memo";
+}
 
+// Records metadata and content hashes of the tree the images are built
+// from, for verifyBuiltImages
+bool recordSourceManifest(const std::string& root, const std::string& mountName = "clone_system_temp") {
+    std::string stateDir = getLayerStateDir();
+    execute_command("mkdir -p " + stateDir, true);
+    std::cout << COLOR_CYAN << "Recording source manifest for verification..." << COLOR_RESET << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    int status = system(("sudo " + selfExecutable() + " hash-manifest " + root + " " + stateDir + "/verify.manifest " +
+    stateDir + "/verify.hashes " + getFileHashMemo() + " " + mountName + pruneArg()).c_str());
+    if (status != 0) {
+        std::cerr << COLOR_YELLOW << "Failed to record the source manifest - the image will not be verified" << COLOR_RESET << std::endl;
+        return false;
+    }
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << "Source manifest: " << secondsSince(start) << "s";
+    BUILD_SUMMARY.push_back(line.str());
     return true;
 }
 
-void showGuide() {
-    std::string readmePath = "/home/" + USERNAME + "/.config/cmi/readme.txt";
-    execute_command("mkdir -p /home/" + USERNAME + "/.config/cmi", true);
+// Decompresses every block of the images and compares them with the
+// recorded source manifest. complete=false for delta layers.
+bool verifyBuiltImages(const std::vector<std::string>& images, bool complete, const std::string& sourceRoot) {
+    std::string stateDir = getLayerStateDir();
+    std::string command = "sudo " + reproducibleEnv() + selfExecutable() + " verify " + (complete ? "full " : "layer ") + sourceRoot + " " +
+    stateDir + "/verify.manifest " + stateDir + "/verify.hashes";
+    for (const auto& image : images) command += " " + image;
+
+    std::cout << COLOR_CYAN << "Verifying image contents..." << COLOR_RESET << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = system(command.c_str()) == 0;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << "Verification: " << (ok ? "passed" : "FAILED") << " in " << secondsSince(start) << "s";
+    BUILD_SUMMARY.push_back(line.str());
+    return ok;
+}
 
-    std::cout << COLOR_CYAN;
-    execute_command("nano " + readmePath, true);
-    std::cout << COLOR_RESET;
+double readBuildStat(const std::string& key) {
+    std::ifstream statsFile(getLayerStateDir() + "/build.stats");
+    std::string line;
+    while (std::getline(statsFile, line)) {
+        if (line.compare(0, key.size() + 1, key + "=") == 0) {
+            return std::atof(line.c_str() + key.size() + 1);
+        }
+    }
+    return 0.0;
 }
 
-void installISOToUSB() {
-    if (config.outputDir.empty()) {
-        std::cerr << COLOR_RED << "Output directory not set!" << COLOR_RESET << std::endl;
-        return;
+void writeBuildStat(const std::string& key, double value) {
+    std::string statsPath = getLayerStateDir() + "/build.stats";
+    std::vector<std::string> lines;
+    std::ifstream in(statsPath);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, key.size() + 1, key + "=") != 0) lines.push_back(line);
     }
+    in.close();
+    lines.push_back(key + "=" + std::to_string(value));
+    std::ofstream out(statsPath, std::ios::trunc);
+    for (const auto& l : lines) out << l << "\n";
+}
 
-    DIR *dir;
-    struct dirent *ent;
-    std::vector<std::string> isoFiles;
+std::string getHwProfileDir() {
+    return "/home/" + USERNAME + "/.config/cmi/hw-profiles";
+}
 
-    std::string expandedOutputDir = expandPath(config.outputDir);
-    if ((dir = opendir(expandedOutputDir.c_str())) != nullptr) {
-        while ((ent = readdir(dir)) != nullptr) {
-            std::string filename = ent->d_name;
-            if (filename.find(".iso") != std::string::npos) {
-                isoFiles.push_back(filename);
-            }
-        }
-        closedir(dir);
-    } else {
-        std::cerr << COLOR_RED << "Could not open output directory: " << expandedOutputDir << COLOR_RESET << std::endl;
-        return;
-    }
+std::string getHwKeepPath() {
+    return "/home/" + USERNAME + "/.config/cmi/hw-keep.list";
+}
 
-    if (isoFiles.empty()) {
-        std::cerr << COLOR_RED << "No ISO files found in output directory!" << COLOR_RESET << std::endl;
-        return;
+// Works out which kernel modules and firmware files the profiled machines
+// can do without and writes them to the prune list that the image builds
+// and manifest scans leave out. Runs before anything else reads the tree.
+bool planHardwarePrune(const std::string& root) {
+    PRUNE_LIST.clear();
+    if (!config.hwPrune) return false;
+    execute_command("mkdir -p " + getHwProfileDir(), true);
+    if (!fileExists(getHwKeepPath())) {
+        std::ofstream(getHwKeepPath()) << "# Modules (name or kernel/ path prefix) and firmware/ prefixes to always keep, one per line\n";
     }
 
-    std::cout << COLOR_GREEN << "Available ISO files:" << COLOR_RESET << std::endl;
-    for (size_t i = 0; i < isoFiles.size(); i++) {
-        std::cout << COLOR_GREEN << (i+1) << ") " << isoFiles[i] << COLOR_RESET << std::endl;
+    HardwareProfile profile;
+    size_t profiles = profile.loadDir(getHwProfileDir());
+    std::string classList = config.hwClasses;
+    std::replace(classList.begin(), classList.end(), ',', ' ');
+    std::istringstream classes(classList);
+    std::string hwClass;
+    while (classes >> hwClass) {
+        if (HardwarePruner::classes().count(hwClass)) profile.classes.insert(hwClass);
+        else std::cerr << COLOR_YELLOW << "Unknown hardware class: " << hwClass << COLOR_RESET << std::endl;
+    }
+    if (profile.empty()) {
+        std::cerr << COLOR_YELLOW << "No hardware profiles in " << getHwProfileDir()
+        << " and no hardware classes set - building without pruning" << COLOR_RESET << std::endl;
+        return false;
     }
 
-    std::string selection = getUserInput("Select ISO file (1-" + std::to_string(isoFiles.size()) + "): ");
-    int choice;
-    try {
-        choice = std::stoi(selection);
-        if (choice < 1 || choice > static_cast<int>(isoFiles.size())) {
-            std::cerr << COLOR_RED << "Invalid selection!" << COLOR_RESET << std::endl;
-            return;
-        }
-    } catch (...) {
-        std::cerr << COLOR_RED << "Invalid input!" << COLOR_RESET << std::endl;
-        return;
+    std::vector<std::string> keep;
+    std::ifstream keepFile(getHwKeepPath());
+    std::string line;
+    while (std::getline(keepFile, line)) {
+        if (!line.empty() && line[0] != '#') keep.push_back(line);
     }
 
-    std::string selectedISO = expandedOutputDir + "/" + isoFiles[choice-1];
+    std::cout << COLOR_CYAN << "Planning hardware pruning for " << profiles << " profile(s)..." << COLOR_RESET << std::endl;
+    PrunePlan plan = HardwarePruner::plan(root, profile, keep);
+    if (plan.kernels.empty()) {
+        std::cerr << COLOR_YELLOW << "No kernel modules found in " << root << "/usr/lib/modules - building without pruning" << COLOR_RESET << std::endl;
+        return false;
+    }
 
-    std::cout << COLOR_CYAN << "\nAvailable drives:" << COLOR_RESET << std::endl;
-    execute_command("lsblk -d -o NAME,SIZE,MODEL | grep -v 'loop'", true);
+    std::string listPath = getLayerStateDir() + "/prune.list";
+    execute_command("mkdir -p " + getLayerStateDir(), true);
+    std::ofstream list(listPath, std::ios::trunc);
+    for (const auto& path : plan.paths) list << path << "\n";
+    list.close();
+    if (!list) {
+        std::cerr << COLOR_RED << "Failed to write " << listPath << " - building without pruning" << COLOR_RESET << std::endl;
+        return false;
+    }
+    PRUNE_LIST = listPath;
 
-    std::string targetDrive = getUserInput("Enter target drive (e.g., /dev/sda): ");
-    if (targetDrive.empty()) {
-        std::cerr << COLOR_RED << "No drive specified!" << COLOR_RESET << std::endl;
-        return;
+    std::string summary = HardwarePruner::summary(plan);
+    std::cout << COLOR_CYAN << summary << COLOR_RESET << std::endl;
+    if (!plan.firmwareChecked) {
+        std::cerr << COLOR_YELLOW << "modinfo is not installed, so no firmware can be pruned" << COLOR_RESET << std::endl;
     }
+    BUILD_SUMMARY.push_back(summary);
+    return true;
+}
 
-    std::cout << COLOR_RED << "\nWARNING: This will overwrite all data on " << targetDrive << "!" << COLOR_RESET << std::endl;
-    std::string confirm = getUserInput("Are you sure you want to continue? (y/N): ");
-    if (confirm != "y" && confirm != "Y") {
-        std::cout << COLOR_CYAN << "Operation cancelled." << COLOR_RESET << std::endl;
-        return;
+// Full builds are timed separately with and without pruning, so the
+// summary can show what pruning saved
+void recordPruneBuildTime(double seconds) {
+    bool pruned = !PRUNE_LIST.empty();
+    writeBuildStat(pruned ? "pruned_seconds" : "unpruned_seconds", seconds);
+    double unpruned = readBuildStat("unpruned_seconds");
+    if (!pruned || unpruned <= 0) return;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << "Build time: " << seconds << "s with hardware pruning, "
+    << unpruned << "s for the last build without";
+    BUILD_SUMMARY.push_back(line.str());
+}
+
+// The scan has to see root-only directories, so it runs as a sudo child
+bool writeManifest(const std::string& rootDir, const std::string& manifestPath) {
+    std::string command = "sudo " + selfExecutable() + " manifest " + rootDir + " " + manifestPath + pruneArg();
+    execute_command(command, true);
+    if (!fileExists(manifestPath)) {
+        std::cerr << COLOR_RED << "Failed to write manifest: " << manifestPath << COLOR_RESET << std::endl;
+        return false;
     }
+    return true;
+}
 
-    std::cout << COLOR_CYAN << "\nWriting " << selectedISO << " to " << targetDrive << "..." << COLOR_RESET << std::endl;
-    std::string ddCommand = "sudo dd if=" + selectedISO + " of=" + targetDrive + " bs=4M status=progress oflag=sync";
-    execute_command(ddCommand, true);
+// Layers added with "Add Files to Existing Image", newest first; they stay
+// on top of whatever the builds write until they are removed
+std::string getUserLayersPath() {
+    return getLayerStateDir() + "/user-layers.list";
+}
 
-    std::cout << COLOR_GREEN << "\nISO successfully written to USB drive!" << COLOR_RESET << std::endl;
-    std::cout << COLOR_GREEN << "Press any key to continue..." << COLOR_RESET;
-    getch();
+std::vector<std::string> userLayers() {
+    std::vector<std::string> layers;
+    std::ifstream in(getUserLayersPath());
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && fileExists(getOutputDirectory() + "/" + line)) layers.push_back(line);
+    }
+    return layers;
 }
 
-void runCMIInstaller() {
-    execute_command("cmirsyncinstaller", true);
-    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-    getch();
+bool writeLayersList(const std::vector<std::string>& layers) {
+    std::string listPath = getOutputDirectory() + "/layers.list";
+    std::string tmpPath = getLayerStateDir() + "/layers.list";
+    std::vector<std::string> stacked = userLayers();
+    for (const auto& layer : layers) {
+        if (layer.compare(0, USER_IMG_PREFIX.size(), USER_IMG_PREFIX) != 0) stacked.push_back(layer);
+    }
+    if (!LayerManager::writeLayers(tmpPath, stacked)) return false;
+    execute_command("sudo cp " + tmpPath + " " + listPath, true);
+    return true;
 }
 
-void runCalamares() {
-    execute_command("sudo calamares", true);
-    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-    getch();
+// A full rebuild replaces the base, so any delta on top of it is stale.
+// Segment images named in keep survive so a resumed build can reuse them.
+void discardLayers(const std::set<std::string>& keep = {}) {
+    std::string outputDir = getOutputDirectory();
+    std::string segments = outputDir + "/rootfs-[0-9]*.img*";
+    if (!keep.empty()) {
+        segments.clear();
+        if (DIR* dir = opendir(outputDir.c_str())) {
+            while (struct dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name.rfind("rootfs-", 0) != 0 || name.size() < 8 || !isdigit(static_cast<unsigned char>(name[7]))) continue;
+                if (keep.count(name)) continue;
+                segments += " " + outputDir + "/" + name;
+            }
+            closedir(dir);
+        }
+    }
+    execute_command("sudo rm -f " + outputDir + "/layers.list " + outputDir + "/" + DELTA_IMG_NAME + " " +
+    segments + " " + outputDir + "/" + HOT_IMG_NAME + "* " + outputDir + "/" + COLD_IMG_NAME + "* " +
+    getLayerStateDir() + "/base.manifest " + getLayerStateDir() + "/delta.manifest", true);
 }
 
-void updateScript() {
-    std::cout << COLOR_CYAN << "\nUpdating script from GitHub..." << COLOR_RESET << std::endl;
-    execute_command("bash -c \"$(curl -fsSL https://raw.githubusercontent.com/claudemods/claudemods-multi-iso-konsole-script/main/advancedimgscript++/installer/patch.sh )\"");
-    std::cout << COLOR_GREEN << "\nScript updated successfully!" << COLOR_RESET << std::endl;
-    std::cout << COLOR_GREEN << "Press any key to continue..." << COLOR_RESET;
-    getch();
+bool usesLayers() {
+    return config.layeredImages || config.shardCache || config.tieredImages || config.resumableBuilds ||
+    config.persistence || !userLayers().empty();
 }
 
-bool isDeviceMounted(const std::string& device) {
-    std::string command = "mount | grep " + device + " > /dev/null 2>&1";
-    return system(command.c_str()) == 0;
+// Installs the cmi_layers initcpio hook and adds it to the live mkinitcpio.conf
+void installLayersHook() {
+    std::string stateDir = getLayerStateDir();
+    std::ofstream(stateDir + "/cmi_layers.install") << LayerManager::installHook();
+    std::ofstream(stateDir + "/cmi_layers.hook") << LayerManager::runtimeHook();
+    execute_command("sudo install -Dm644 " + stateDir + "/cmi_layers.install /etc/initcpio/install/cmi_layers", true);
+    execute_command("sudo install -Dm644 " + stateDir + "/cmi_layers.hook /etc/initcpio/hooks/cmi_layers", true);
+
+    std::string mkinitcpioConf = BUILD_DIR + "/mkinitcpio.conf";
+    if (system(("grep -q '^HOOKS=.*cmi_layers' " + mkinitcpioConf).c_str()) != 0) {
+        execute_command("sudo sed -i 's/^HOOKS=(\\(.*\\))/HOOKS=(\\1 cmi_layers)/' " + mkinitcpioConf, true);
+        config.mkinitcpioGenerated = false;
+        saveConfig();
+        std::cout << COLOR_YELLOW << "cmi_layers hook added to " << mkinitcpioConf
+        << " - regenerate mkinitcpio before creating the ISO." << COLOR_RESET << std::endl;
+    }
 }
 
-bool mountDevice(const std::string& device, const std::string& mountPoint) {
-    std::cout << COLOR_CYAN << "Mounting " << device << " to " << mountPoint << "..." << COLOR_RESET << std::endl;
-    execute_command("sudo mkdir -p " + mountPoint, true);
-    std::string mountCmd = "sudo mount " + device + " " + mountPoint;
-    return system(mountCmd.c_str()) == 0;
+// Single-image builds write no layers.list, but added files still have
+// to be stacked on top of the new rootfs.img, and only the cmi_layers
+// hook knows how to put the overlay on a persistence partition
+void restackUserLayers() {
+    if (userLayers().empty() && !config.persistence) return;
+    writeLayersList({FINAL_IMG_NAME});
+    installLayersHook();
 }
 
-// UPDATED: Clone current system using bind mount with unmount after completion
-void cloneCurrentSystem(const std::string& cloneDir) {
-    if (!config.allCheckboxesChecked()) {
-        std::cerr << COLOR_RED << "Cannot create image - all setup steps must be completed first!" << COLOR_RESET << std::endl;
-        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-        getch();
-        return;
+const std::string PERSIST_LABEL = "cmi-persist";
+
+// Keeps the cmi_layers= and cmi_persist= kernel parameters in kernels.cfg
+// in step with the settings; the hook finds the boot medium by the ISO
+// label and the persistence partition by PERSIST_LABEL. Rewritten here
+// rather than with sed, since the ISO label is free text and would end up
+// inside a sed expression.
+void updateLayersBootEntries() {
+    std::string kernelsCfg = BUILD_DIR + "/boot/grub/kernels.cfg";
+    std::ifstream in(kernelsCfg);
+    if (!in.is_open()) return;
+    std::string params;
+    if (usesLayers() && fileExists(getOutputDirectory() + "/layers.list")) {
+        params = " cmi_layers=" + config.isoTag;
+        if (config.persistence) params += " cmi_persist=" + PERSIST_LABEL;
     }
 
-    if (!mountSystemToCloneDir(cloneDir)) {
-        std::cerr << COLOR_RED << "Failed to mount system!" << COLOR_RESET << std::endl;
-        return;
+    std::string cfg((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::istringstream lines(cfg);
+    std::string updated, line;
+    while (std::getline(lines, line)) {
+        for (const std::string key : {" cmi_layers=", " cmi_persist="}) {
+            for (size_t pos; (pos = line.find(key)) != std::string::npos; ) {
+                size_t end = line.find(' ', pos + 1);
+                line.erase(pos, end == std::string::npos ? std::string::npos : end - pos);
+            }
+        }
+        size_t first = line.find_first_not_of(" \t");
+        if (first != std::string::npos && line.compare(first, 5, "linux") == 0 &&
+            first + 5 < line.size() && (line[first + 5] == ' ' || line[first + 5] == '\t')) {
+            line += params;
+        }
+        updated += line + "\n";
     }
+    if (updated == cfg) return;
+    std::string tmpPath = getLayerStateDir() + "/kernels.cfg";
+    std::ofstream(tmpPath, std::ios::trunc) << updated;
+    execute_command("sudo cp " + tmpPath + " " + kernelsCfg, true);
+}
 
-    // Create SquashFS directly from the mounted bind
+// Builds the base layer if there is none yet, otherwise a delta image with
+// only new and changed entries plus whiteouts for removed ones. Returns the
+// image that was written, or an empty string on failure.
+std::string createLayeredImage(const std::string& cloneDir) {
     std::string outputDir = getOutputDirectory();
-    std::string finalImgPath = outputDir + "/" + FINAL_IMG_NAME;
+    std::string baseImg = outputDir + "/" + FINAL_IMG_NAME;
+    std::string deltaImg = outputDir + "/" + DELTA_IMG_NAME;
+    std::string stateDir = getLayerStateDir();
+    std::string baseManifest = stateDir + "/base.manifest";
+    std::string deltaManifest = stateDir + "/delta.manifest";
+    execute_command("mkdir -p " + stateDir, true);
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (!fileExists(baseImg) || !fileExists(baseManifest)) {
+        std::cout << COLOR_CYAN << "No base image yet - building the full base layer..." << COLOR_RESET << std::endl;
+        discardLayers();
+        if (!writeManifest(cloneDir, baseManifest)) return "";
+        createSquashFS(cloneDir, baseImg);
+        writeLayersList({FINAL_IMG_NAME});
+        double seconds = secondsSince(start);
+        writeBuildStat("full_seconds", seconds);
+        installLayersHook();
+        std::cout << COLOR_GREEN << "Base layer built in " << std::fixed << std::setprecision(1) << seconds
+        << "s (" << formatBytes(fileSize(baseImg)) << ")" << COLOR_RESET << std::endl;
+        return baseImg;
+    }
 
-    createSquashFS(cloneDir, finalImgPath);
+    std::cout << COLOR_CYAN << "Scanning for changes since the base image..." << COLOR_RESET << std::endl;
+    if (!writeManifest(cloneDir, deltaManifest)) return "";
 
-    // Unmount the bind mount after SquashFS creation
-    std::cout << COLOR_CYAN << "Unmounting bind mount..." << COLOR_RESET << std::endl;
-    execute_command("sudo umount " + cloneDir, true);
+    TreeManifest base, current;
+    if (!base.load(baseManifest) || !current.load(deltaManifest)) {
+        std::cerr << COLOR_RED << "Failed to read layer manifests!" << COLOR_RESET << std::endl;
+        return "";
+    }
+    LayerDelta delta = LayerManager::diff(base, current);
+    std::cout << COLOR_CYAN << "Changed or new: " << delta.changed.size() << " entries ("
+    << formatBytes(delta.changedBytes) << "), removed: " << delta.deleted.size() << COLOR_RESET << std::endl;
+
+    if (delta.changed.empty() && delta.deleted.empty()) {
+        std::cout << COLOR_GREEN << "No changes since the base image - dropping the delta layer." << COLOR_RESET << std::endl;
+        execute_command("sudo rm -f " + deltaImg, true);
+        writeLayersList({FINAL_IMG_NAME});
+        return baseImg;
+    }
 
-    createChecksum(finalImgPath);
-    printFinalMessage(finalImgPath);
+    std::string listFile = stateDir + "/delta.list";
+    std::string pseudoFile = stateDir + "/delta.pf";
+    if (!LayerManager::writeTarList(delta.changed, listFile) || !LayerManager::writeWhiteouts(delta.deleted, pseudoFile)) {
+        std::cerr << COLOR_RED << "Failed to write delta file lists to " << stateDir << COLOR_RESET << std::endl;
+        return "";
+    }
 
-    std::cout << COLOR_GREEN << "Current system cloned successfully using bind mount!" << COLOR_RESET << std::endl;
+    // Built under a temporary name; a failed delta must not be stacked on
+    // the base and shipped
+    std::string partial = deltaImg + ".partial";
+    std::string command = "sudo tar -C " + cloneDir + " --numeric-owner --xattrs --xattrs-include='*' --acls "
+    "--no-recursion --null -T " + listFile + " -cf - | sudo mksquashfs - " + partial +
+    " -tar -noappend " + squashfsCompressionArgs() + " " + squashfsResourceArgs() + (delta.deleted.empty() ? "" : " -pf " + pseudoFile);
+    if (runPipeline(command) != 0 || system(("sudo mv " + partial + " " + deltaImg).c_str()) != 0) {
+        execute_command("sudo rm -f " + partial + " " + deltaImg, true);
+        writeLayersList({FINAL_IMG_NAME});
+        std::cerr << COLOR_RED << "Building the delta image failed!" << COLOR_RESET << std::endl;
+        return "";
+    }
+
+    writeLayersList({DELTA_IMG_NAME, FINAL_IMG_NAME});
+
+    double seconds = secondsSince(start);
+    writeBuildStat("delta_seconds", seconds);
+    double fullSeconds = readBuildStat("full_seconds");
+    uint64_t baseSize = fileSize(baseImg);
+    uint64_t deltaSize = fileSize(deltaImg);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << COLOR_GREEN << "Delta build time: " << seconds << "s";
+    if (fullSeconds > 0) std::cout << " (last full build: " << fullSeconds << "s)";
+    std::cout << COLOR_RESET << std::endl;
+    std::cout << COLOR_GREEN << "Delta image: " << formatBytes(deltaSize) << ", base image: " << formatBytes(baseSize)
+    << ", ISO payload: " << formatBytes(baseSize + deltaSize) << COLOR_RESET << std::endl;
+    return deltaImg;
 }
 
-// Clone another drive
-void cloneAnotherDrive(const std::string& cloneDir) {
-    if (!config.allCheckboxesChecked()) {
-        std::cerr << COLOR_RED << "Cannot create image - all setup steps must be completed first!" << COLOR_RESET << std::endl;
-        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-        getch();
-        return;
-    }
+std::string getShardCacheDir() {
+    return "/home/" + USERNAME + "/.config/cmi/shard-cache";
+}
 
-    std::cout << COLOR_CYAN << "\nAvailable drives:" << COLOR_RESET << std::endl;
-    execute_command("lsblk -f -o NAME,FSTYPE,SIZE,MOUNTPOINT | grep -v 'loop'", true);
+// Sends shard jobs to the configured compression workers. Jobs left with
+// done == false have to be compressed locally.
+void runCompressionWorkers(std::vector<ShardJob>& jobs) {
+    std::vector<std::string> workers = WorkerPool::parseSpec(config.compressionWorkers);
+    if (workers.empty() || jobs.empty()) return;
+
+    std::string affinityPath = getShardCacheDir() + "/workers.map";
+    WorkerPool pool;
+    pool.selfPath = selfExecutable();
+    if (const char* token = getenv("CMI_WORKER_TOKEN")) pool.token = token;
+    std::ifstream affinityIn(affinityPath);
+    std::string key, worker;
+    while (affinityIn >> key >> worker) pool.affinity[key] = worker;
+    affinityIn.close();
+
+    std::mutex printLock;
+    size_t finished = 0;
+    pool.onProgress = [&](const ShardJob& job, const std::string& error) {
+        std::lock_guard<std::mutex> guard(printLock);
+        if (!error.empty()) {
+            std::cout << COLOR_YELLOW << "Shard " << job.index << " failed on " << error << COLOR_RESET << std::endl;
+            return;
+        }
+        finished++;
+        std::cout << COLOR_CYAN << "[" << finished << "/" << jobs.size() << "] shard " << job.index << " ("
+        << formatBytes(job.bytes) << ") done" << COLOR_RESET << std::endl;
+    };
 
-    std::string drive = getUserInput("Enter drive to clone (e.g., /dev/sda2): ");
-    if (drive.empty()) {
-        std::cerr << COLOR_RED << "No drive specified!" << COLOR_RESET << std::endl;
-        return;
+    std::cout << COLOR_CYAN << "Compressing " << jobs.size() << " shards on " << workers.size() << " workers..." << COLOR_RESET << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<WorkerStats> stats = pool.run(jobs, workers);
+
+    size_t remote = 0;
+    for (const auto& job : jobs) {
+        if (!job.done) continue;
+        pool.affinity[job.key] = job.worker.substr(0, job.worker.find('#'));
+        remote++;
     }
+    std::ofstream affinityOut(affinityPath, std::ios::trunc);
+    for (const auto& kv : pool.affinity) affinityOut << kv.first << " " << kv.second << "\n";
 
-    std::string checkCmd = "ls " + drive + " > /dev/null 2>&1";
-    if (system(checkCmd.c_str()) != 0) {
-        std::cerr << COLOR_RED << "Drive " << drive + " does not exist!" << COLOR_RESET << std::endl;
-        return;
+    for (const auto& w : stats) {
+        std::cout << (w.dead ? COLOR_RED : COLOR_CYAN) << "  " << w.name << ": " << w.shards << " shards ("
+        << w.cacheHits << " from its cache), " << formatBytes(w.bytesSent) << " sent, " << w.failures << " failures"
+        << (w.dead ? ", unreachable" : "") << COLOR_RESET << std::endl;
+    }
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(1) << "Compression workers: " << remote << "/" << jobs.size()
+    << " shards built remotely in " << secondsSince(start) << "s, " << pool.retries << " retries, "
+    << (jobs.size() - remote) << " left for local compression";
+    BUILD_SUMMARY.push_back(summary.str());
+}
+
+// Splits the clone into content-addressed shards and compresses only the
+// shards whose key is not in the cache yet; every shard becomes one layer.
+// Finished shards are checkpointed in a build journal, so a build that was
+// interrupted keeps the shard images it had already written. Without the
+// cache this is just a resumable full build.
+std::vector<std::string> createCachedShardImages(const std::string& cloneDir, bool useCache) {
+    std::string outputDir = getOutputDirectory();
+    std::string stateDir = getLayerStateDir() + "/shards";
+    std::string cacheDir = getShardCacheDir();
+    execute_command("mkdir -p " + stateDir + " " + cacheDir, true);
+
+    auto start = std::chrono::steady_clock::now();
+    std::cout << COLOR_CYAN << "Hashing the clone and planning shards..." << COLOR_RESET << std::endl;
+    std::string planPath = stateDir + "/shard.plan";
+    execute_command("sudo rm -f " + planPath, true);
+    execute_command("sudo " + selfExecutable() + " shard-plan " + cloneDir + " " + stateDir + " " + getFileHashMemo() +
+    " '" + shardCompressionArgs() + "'" + pruneArg(), true);
+
+    struct PlannedShard {
+        std::string key;
+        uint64_t bytes;
+        std::string listFile;
+    };
+    std::vector<PlannedShard> planned;
+    std::ifstream planFile(planPath);
+    std::string line;
+    while (std::getline(planFile, line)) {
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+        if (kind == "shard") {
+            PlannedShard shard;
+            fields >> shard.key >> shard.bytes >> shard.listFile;
+            planned.push_back(shard);
+        } else if (kind == "stats") {
+            uint64_t hashedFiles = 0, hashedBytes = 0, memoHits = 0;
+            fields >> hashedFiles >> hashedBytes >> memoHits;
+            std::cout << COLOR_CYAN << "Hashed " << hashedFiles << " files (" << formatBytes(hashedBytes)
+            << "), " << memoHits << " unchanged files skipped" << COLOR_RESET << std::endl;
+        }
+    }
+    if (planned.empty()) {
+        std::cerr << COLOR_RED << "Shard planning failed!" << COLOR_RESET << std::endl;
+        return {};
+    }
+
+    // Shards finished by an interrupted build are kept if the plan still
+    // has the same content at the same position and the image checks out
+    BuildJournal journal(stateDir + "/build.journal");
+    std::vector<bool> resumed(planned.size(), false);
+    std::set<std::string> keep;
+    for (size_t i = 0; i < planned.size(); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "rootfs-%03zu.img", i);
+        std::string why;
+        if (journal.completed(i, planned[i].key, outputDir + "/" + name, why)) {
+            resumed[i] = true;
+            keep.insert(name);
+        }
+    }
+    if (keep.empty()) journal.reset();
+    else std::cout << COLOR_GREEN << "Resuming: " << keep.size() << " of " << planned.size()
+    << " shards already complete" << COLOR_RESET << std::endl;
+
+    discardLayers(keep);
+    CompressedShardCache cache(cacheDir);
+    std::vector<std::string> images;
+    std::vector<std::string> layerNames;
+    std::set<std::string> pinned;
+    std::string tarCommand = "sudo tar -C " + cloneDir + " --numeric-owner --xattrs --xattrs-include='*' --acls "
+    "--no-recursion --null -T ";
+    // Directory dates are not part of a shard key, so they are pinned in
+    // the stream rather than taken from whichever build made the shard
+    std::string dirTimes = " -cf - | " + selfExecutable() + " tar-dir-times";
+    // Copies or moves an image through a temporary name, so neither the
+    // output directory nor the cache ever holds a truncated shard
+    auto placeShard = [](const std::string& tool, const std::string& from, const std::string& to) {
+        if (system((tool + " " + from + " " + to + ".partial && sudo mv " + to + ".partial " + to).c_str()) == 0) return true;
+        execute_command("sudo rm -f " + to + ".partial", true);
+        return false;
+    };
+
+    std::vector<ShardJob> jobs;
+    std::map<size_t, size_t> jobOf;
+    if (!config.compressionWorkers.empty()) {
+        for (size_t i = 0; i < planned.size(); i++) {
+            if (resumed[i] || (useCache && cache.contains(planned[i].key))) continue;
+            ShardJob job;
+            job.index = i;
+            job.key = planned[i].key;
+            job.args = shardCompressionArgs();
+            job.tarCommand = pipefailCommand(tarCommand + planned[i].listFile + dirTimes);
+            job.output = stateDir + "/remote-" + planned[i].key + ".sfs";
+            job.bytes = planned[i].bytes;
+            jobOf[i] = jobs.size();
+            jobs.push_back(job);
+        }
+        runCompressionWorkers(jobs);
+    }
+
+    for (size_t i = 0; i < planned.size(); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "rootfs-%03zu.img", i);
+        std::string dest = outputDir + "/" + name;
+        const PlannedShard& shard = planned[i];
+        pinned.insert(shard.key);
+
+        if (resumed[i]) {
+            std::cout << COLOR_GREEN << "[" << (i + 1) << "/" << planned.size() << "] " << name
+            << " already built (" << formatBytes(shard.bytes) << ")" << COLOR_RESET << std::endl;
+            images.push_back(dest);
+            layerNames.push_back(name);
+            continue;
+        } else if (useCache && cache.contains(shard.key) &&
+            placeShard("sudo cp --reflink=auto", cache.objectPath(shard.key), dest)) {
+            // A cache object that cannot be copied falls through to a local build
+            std::cout << COLOR_GREEN << "[" << (i + 1) << "/" << planned.size() << "] " << name
+            << " from cache (" << formatBytes(shard.bytes) << ")" << COLOR_RESET << std::endl;
+            cache.recordHit(shard.bytes);
+        } else if (jobOf.count(i) && jobs[jobOf[i]].done &&
+            placeShard(useCache ? "sudo cp" : "sudo mv", jobs[jobOf[i]].output, dest)) {
+            const ShardJob& job = jobs[jobOf[i]];
+            std::cout << COLOR_GREEN << "[" << (i + 1) << "/" << planned.size() << "] " << name
+            << " from " << job.worker << " (" << formatBytes(shard.bytes) << ")" << COLOR_RESET << std::endl;
+            if (useCache) {
+                if (placeShard("sudo mv", job.output, cache.objectPath(shard.key))) cache.insert(shard.key);
+                else execute_command("sudo rm -f " + job.output, true);
+                cache.recordMiss(shard.bytes);
+            }
+        } else {
+            std::cout << COLOR_CYAN << "[" << (i + 1) << "/" << planned.size() << "] " << name
+            << " compressing " << formatBytes(shard.bytes) << "..." << COLOR_RESET << std::endl;
+            // Written under a temporary name so a half-written image is
+            // never mistaken for a finished shard
+            std::string partial = dest + ".partial";
+            std::string cmd = tarCommand + shard.listFile + dirTimes + " | sudo mksquashfs - " + partial +
+            " -tar -noappend -quiet " + shardCompressionArgs() + " " + squashfsResourceArgs();
+            std::cout << COLOR_CYAN;
+            fflush(stdout);
+            int status = runPipeline(cmd);
+            std::cout << COLOR_RESET;
+            if (status != 0 || system(("sudo mv " + partial + " " + dest).c_str()) != 0) {
+                execute_command("sudo rm -f " + partial, true);
+                std::cerr << COLOR_RED << "Compressing " << name << " failed or was interrupted after "
+                << images.size() << " of " << planned.size() << " shards - run the build again to resume"
+                << COLOR_RESET << std::endl;
+                return {};
+            }
+            if (useCache) {
+                if (placeShard("sudo cp --reflink=auto", dest, cache.objectPath(shard.key))) cache.insert(shard.key);
+                cache.recordMiss(shard.bytes);
+            }
+        }
+        if (!journal.record(i, shard.key, dest)) {
+            std::cerr << COLOR_YELLOW << "Could not checkpoint " << name << "; it will be rebuilt if the build is resumed"
+            << COLOR_RESET << std::endl;
+        }
+        images.push_back(dest);
+        layerNames.push_back(name);
+    }
+
+    writeLayersList(layerNames);
+    installLayersHook();
+
+    if (!keep.empty()) {
+        BUILD_SUMMARY.push_back("Resumed build: " + std::to_string(keep.size()) + " of " +
+        std::to_string(planned.size()) + " shards kept from the interrupted run");
+    }
+    if (!useCache) return images;
+
+    uint64_t capBytes = static_cast<uint64_t>(config.shardCacheGB) << 30;
+    for (const auto& path : cache.evict(capBytes, pinned)) {
+        execute_command("sudo rm -f " + path, true);
+    }
+    cache.save();
+
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(1) << "Shard cache: " << cache.hits << "/" << planned.size()
+    << " shards reused, hit rate " << cache.hitRate() << "% of data, " << cache.evicted << " evicted, cache size "
+    << formatBytes(cache.totalBytes()) << " of " << config.shardCacheGB << " GiB, build " << secondsSince(start) << "s";
+    BUILD_SUMMARY.push_back(summary.str());
+    return images;
+}
+
+std::string getHotSeedsPath() {
+    return "/home/" + USERNAME + "/.config/cmi/hot-files.list";
+}
+
+// Decides which files go into the hot image. Runs before anything else
+// reads the clone, since the trace relies on access times since boot.
+bool planHotSet(const std::string& cloneDir, const std::string& mountName, bool traceBoot) {
+    std::string stateDir = getLayerStateDir() + "/tiers";
+    execute_command("mkdir -p " + stateDir, true);
+    if (!fileExists(getHotSeedsPath())) {
+        std::ofstream(getHotSeedsPath()) << "# Extra files or directories (ending in /) for the hot image, one per line\n";
+    }
+
+    std::cout << COLOR_CYAN << "Selecting boot files for the hot image..." << COLOR_RESET << std::endl;
+    execute_command("sudo rm -f " + stateDir + "/hot.plan", true);
+    execute_command("sudo " + selfExecutable() + " hot-set " + cloneDir + " " + stateDir + " " + std::to_string(config.hotSetMB) +
+    " " + getHotSeedsPath() + " " + mountName + (traceBoot ? " trace" : "") + pruneArg(), true);
+    if (!fileExists(stateDir + "/hot.plan")) {
+        std::cerr << COLOR_RED << "Hot set planning failed!" << COLOR_RESET << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Builds the boot files into a quickly decompressed hot image and the rest
+// into a cold image at full compression; the cmi_layers hook stacks them
+std::vector<std::string> createTieredImages(const std::string& cloneDir) {
+    std::string outputDir = getOutputDirectory();
+    std::string stateDir = getLayerStateDir() + "/tiers";
+    std::string hotImg = outputDir + "/" + HOT_IMG_NAME;
+    std::string coldImg = outputDir + "/" + COLD_IMG_NAME;
+
+    std::ifstream planFile(stateDir + "/hot.plan");
+    std::string planLine;
+    std::getline(planFile, planLine);
+    std::cout << COLOR_CYAN << planLine << COLOR_RESET << std::endl;
+
+    // The hot and cold images replace rootfs.img, which would only pad the ISO
+    discardLayers();
+    execute_command("sudo rm -f " + outputDir + "/" + FINAL_IMG_NAME + " " + outputDir + "/" + FINAL_IMG_NAME + ".sha512", true);
+    CompressorSpec hotSpec;
+    hotSpec.name = config.hotCompression;
+    hotSpec.blockSize = 128ULL << 10;
+    if (hotSpec.name == "lz4") hotSpec.extra = "-Xhc";
+    SquashfsPlan hotPlan = ResourcePlanner::plan(hotSpec, reproducibleBuild());
+
+    std::string tarCommand = "sudo tar -C " + cloneDir + " --numeric-owner --xattrs --xattrs-include='*' --acls "
+    "--no-recursion --null -T ";
+    auto start = std::chrono::steady_clock::now();
+    std::cout << COLOR_CYAN << "Building the hot image (" << hotPlan.compressorArgs() << ")..." << COLOR_RESET << std::endl;
+    // Each tier is built under a temporary name so a failed build never
+    // leaves a truncated image behind for layers.list to point at
+    bool built = runPipeline(tarCommand + stateDir + "/hot.list -cf - | sudo mksquashfs - " + hotImg + ".partial -tar -noappend -quiet " +
+    hotPlan.compressorArgs() + reproducibleSquashfsArgs() + " " + hotPlan.resourceArgs()) == 0;
+    double hotSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    std::cout << COLOR_CYAN << "Building the cold image (" << squashfsCompressionArgs() << ")..." << COLOR_RESET << std::endl;
+    built = built && runPipeline(tarCommand + stateDir + "/cold.list -cf - | sudo mksquashfs - " + coldImg + ".partial -tar -noappend " +
+    squashfsCompressionArgs() + " " + squashfsResourceArgs()) == 0;
+    double coldSeconds = secondsSince(start);
+
+    if (!built || system(("sudo mv " + hotImg + ".partial " + hotImg + " && sudo mv " + coldImg + ".partial " + coldImg).c_str()) != 0) {
+        execute_command("sudo rm -f " + hotImg + ".partial " + coldImg + ".partial " + hotImg + " " + coldImg, true);
+        std::cerr << COLOR_RED << "Building the tiered images failed!" << COLOR_RESET << std::endl;
+        return {};
+    }
+    writeLayersList({HOT_IMG_NAME, COLD_IMG_NAME});
+    installLayersHook();
+
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(1) << "Tiered images: hot " << formatBytes(fileSize(hotImg)) << " ("
+    << hotSpec.name << ", " << hotSeconds << "s), cold " << formatBytes(fileSize(coldImg)) << " (" << coldSeconds
+    << "s); compare boot times with 'cmiimg boot-time report'";
+    BUILD_SUMMARY.push_back(planLine);
+    BUILD_SUMMARY.push_back(summary.str());
+    return {hotImg, coldImg};
+}
+
+// Flattens base + delta into a new base through a read-only overlay mount
+bool mergeLayeredImages() {
+    std::string outputDir = getOutputDirectory();
+    std::string baseImg = outputDir + "/" + FINAL_IMG_NAME;
+    std::string deltaImg = outputDir + "/" + DELTA_IMG_NAME;
+    std::string stateDir = getLayerStateDir();
+
+    if (!fileExists(deltaImg)) {
+        std::cout << COLOR_YELLOW << "Nothing to merge - no delta image in " << outputDir << COLOR_RESET << std::endl;
+        return false;
+    }
+
+    std::string mergeRoot = "/mnt/cmi_merge";
+    execute_command("sudo mkdir -p " + mergeRoot + "/base " + mergeRoot + "/delta " + mergeRoot + "/merged", true);
+
+    planSquashfsResources();
+    auto start = std::chrono::steady_clock::now();
+    bool mounted = system(("sudo mount -t squashfs -o loop,ro " + baseImg + " " + mergeRoot + "/base").c_str()) == 0 &&
+    system(("sudo mount -t squashfs -o loop,ro " + deltaImg + " " + mergeRoot + "/delta").c_str()) == 0 &&
+    system(("sudo mount -t overlay -o lowerdir=" + mergeRoot + "/delta:" + mergeRoot + "/base cmi_merge " + mergeRoot + "/merged").c_str()) == 0;
+
+    int status = -1;
+    if (mounted) {
+        std::cout << COLOR_CYAN << "Merging " << DELTA_IMG_NAME << " into " << FINAL_IMG_NAME << "..." << COLOR_RESET << std::endl;
+        status = system(("sudo mksquashfs " + mergeRoot + "/merged " + baseImg + ".new -noappend " +
+        squashfsCompressionArgs() + " " + squashfsResourceArgs()).c_str());
+    } else {
+        std::cerr << COLOR_RED << "Failed to mount the layers for merging!" << COLOR_RESET << std::endl;
+    }
+
+    execute_command("sudo umount " + mergeRoot + "/merged " + mergeRoot + "/delta " + mergeRoot + "/base 2>/dev/null", true);
+
+    if (status != 0) {
+        execute_command("sudo rm -f " + baseImg + ".new", true);
+        return false;
+    }
+
+    execute_command("sudo mv " + baseImg + ".new " + baseImg, true);
+    execute_command("sudo rm -f " + deltaImg, true);
+    execute_command("sudo mv " + stateDir + "/delta.manifest " + stateDir + "/base.manifest", true);
+    writeLayersList({FINAL_IMG_NAME});
+
+    double seconds = secondsSince(start);
+    writeBuildStat("full_seconds", seconds);
+    std::cout << COLOR_GREEN << "Layers merged in " << std::fixed << std::setprecision(1) << seconds << "s, new base: "
+    << formatBytes(fileSize(baseImg)) << COLOR_RESET << std::endl;
+    return true;
+}
+
+std::string getPersistImagePath() {
+    return "/home/" + USERNAME + "/.config/cmi/persist.img";
+}
+
+std::string getPersistFs(const std::string& device) {
+    std::string fs;
+    if (FILE* fp = popen(("sudo blkid -s TYPE -o value " + device + " 2>/dev/null").c_str(), "r")) {
+        char buffer[64];
+        if (fgets(buffer, sizeof(buffer), fp)) fs = buffer;
+        pclose(fp);
+    }
+    while (!fs.empty() && isspace(static_cast<unsigned char>(fs.back()))) fs.pop_back();
+    return fs;
+}
+
+// Formats the persistence image once; an unchanged image keeps its mtime
+// so the ISO cache still matches. Returns the image path, or an empty
+// string when persistence is off or the image could not be made.
+std::string preparePersistImage() {
+    if (!config.persistence) return "";
+    std::string image = getPersistImagePath();
+    uint64_t size = static_cast<uint64_t>(config.persistMB) << 20;
+    if (fileExists(image) && fileSize(image) == size && getPersistFs(image) == config.persistFs) return image;
+
+    std::cout << COLOR_CYAN << "Formatting " << formatBytes(size) << " " << config.persistFs << " persistence image..."
+    << COLOR_RESET << std::endl;
+    unlink(image.c_str());
+    std::string mkfs = config.persistFs == "btrfs" ? "mkfs.btrfs -q -f -L " + PERSIST_LABEL : "mkfs.ext4 -q -F -L " + PERSIST_LABEL;
+    if (system(("truncate -s " + std::to_string(size) + " " + image + " && " + mkfs + " " + image).c_str()) != 0) {
+        std::cerr << COLOR_RED << "Failed to format the persistence image - building without it" << COLOR_RESET << std::endl;
+        unlink(image.c_str());
+        return "";
+    }
+    return image;
+}
+
+// dd copies the partition at its ISO size; this grows it to the end of
+// the stick. Sticks written from ISOs without persistence are left alone.
+void growPersistPartition(const std::string& drive) {
+    std::string partition = drive + (isdigit(static_cast<unsigned char>(drive.back())) ? "p3" : "3");
+    execute_command("sudo partprobe " + drive + " 2>/dev/null; sudo udevadm settle", true);
+    std::string label;
+    if (FILE* fp = popen(("sudo blkid -s LABEL -o value " + partition + " 2>/dev/null").c_str(), "r")) {
+        char buffer[64];
+        if (fgets(buffer, sizeof(buffer), fp)) label = buffer;
+        pclose(fp);
+    }
+    while (!label.empty() && isspace(static_cast<unsigned char>(label.back()))) label.pop_back();
+    if (label != PERSIST_LABEL) return;
+
+    std::cout << COLOR_CYAN << "\nGrowing the persistence partition to fill " << drive << "..." << COLOR_RESET << std::endl;
+    std::string fs = getPersistFs(partition);
+    if (system(("echo ', +' | sudo sfdisk --no-reread -q -N 3 " + drive + " && sudo partprobe " + drive +
+        " && sudo udevadm settle").c_str()) != 0) {
+        std::cerr << COLOR_RED << "Could not grow partition 3 - persistence keeps its ISO size" << COLOR_RESET << std::endl;
+        return;
+    }
+    bool grown;
+    if (fs == "btrfs") {
+        std::string mnt = "/tmp/cmi-persist";
+        grown = system(("sudo mkdir -p " + mnt + " && sudo mount " + partition + " " + mnt +
+        " && sudo btrfs filesystem resize max " + mnt + " > /dev/null; rc=$?; sudo umount " + mnt + "; exit $rc").c_str()) == 0;
+    } else {
+        grown = system(("sudo e2fsck -f -p " + partition + " && sudo resize2fs " + partition).c_str()) == 0;
+    }
+    if (grown) {
+        std::cout << COLOR_GREEN << "Persistence partition " << partition << " now fills the drive" << COLOR_RESET << std::endl;
+    } else {
+        std::cerr << COLOR_RED << "Could not grow the " << fs << " filesystem on " << partition << COLOR_RESET << std::endl;
+    }
+}
+
+std::string getEspImagePath() {
+    return "/home/" + USERNAME + "/.config/cmi/efi.img";
+}
+
+// Rebuilds boot/efi.img from the EFI directory of the tree, or from the
+// configured ESP directory, so the EFI partition follows GRUB and kernel
+// changes instead of the image shipped in the zip. It is only copied into
+// the tree when its bytes change, so an unchanged ESP keeps the ISO cache.
+bool buildEspImage() {
+    std::string source = config.espDir.empty() ? BUILD_DIR + "/EFI" : expandPath(config.espDir);
+    struct stat st;
+    if (stat(source.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        if (!config.espDir.empty()) {
+            std::cerr << COLOR_RED << "ESP directory " << source << " not found" << COLOR_RESET << std::endl;
+            return false;
+        }
+        std::cout << COLOR_YELLOW << "No EFI directory in the build tree - keeping the shipped boot/efi.img" << COLOR_RESET << std::endl;
+        return true;
+    }
+
+    FatImage esp;
+    if (reproducibleBuild()) esp.timestamp = sourceDateEpoch();
+    std::string image = getEspImagePath();
+    if (!esp.add(source, config.espDir.empty() ? "EFI" : "") || !esp.write(image)) {
+        std::cerr << COLOR_RED << "Failed to build the EFI image: " << esp.error << COLOR_RESET << std::endl;
+        return false;
+    }
+
+    std::string target = BUILD_DIR + "/boot/efi.img";
+    uint64_t built = 0, current = 0;
+    if (XXH64::ofFile(image, built) && XXH64::ofFile(target, current) && built == current && fileSize(image) == fileSize(target)) {
+        std::cout << COLOR_GREEN << "EFI image unchanged (FAT" << esp.fatBits << ", " << formatBytes(esp.imageSize) << ")"
+        << COLOR_RESET << std::endl;
+        return true;
+    }
+    if (system(("sudo install -m 644 " + image + " " + target).c_str()) != 0) {
+        std::cerr << COLOR_RED << "Failed to install " << target << COLOR_RESET << std::endl;
+        return false;
+    }
+    std::cout << COLOR_GREEN << "Built EFI image from " << source << ": FAT" << esp.fatBits << ", " << formatBytes(esp.imageSize)
+    << COLOR_RESET << std::endl;
+    return true;
+}
+
+std::string getIsoCachePath() {
+    return "/home/" + USERNAME + "/.config/cmi/iso-cache";
+}
+
+// Puts an ISO that is still current under its new name: shared extents
+// where the filesystem supports it, otherwise a rename
+bool reuseIso(const std::string& from, const std::string& to) {
+    if (from == to) {
+        std::cout << COLOR_GREEN << "Nothing changed since the last ISO - keeping " << to << COLOR_RESET << std::endl;
+        return true;
+    }
+    int src = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    int dst = src < 0 ? -1 : open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool cloned = dst >= 0 && ioctl(dst, FICLONE, src) == 0;
+    if (src >= 0) close(src);
+    if (dst >= 0) close(dst);
+    if (cloned) {
+        std::cout << COLOR_GREEN << "Nothing changed since " << from << " - reflinked it to " << to << COLOR_RESET << std::endl;
+        return true;
+    }
+    unlink(to.c_str());
+    if (rename(from.c_str(), to.c_str()) == 0) {
+        std::cout << COLOR_GREEN << "Nothing changed since the last ISO - renamed " << from << " to " << to << COLOR_RESET << std::endl;
+        return true;
+    }
+    return false;
+}
+
+// Writes <iso>.sha512 and the chunk index that delta-fetch clients start from
+void publishIsoIndex(const std::string& isoPath) {
+    createChecksum(isoPath);
+    auto start = std::chrono::steady_clock::now();
+    ChunkIndex index;
+    if (!index.build(isoPath) || !index.save(isoPath + ".cmidx")) {
+        std::cerr << COLOR_YELLOW << "Could not write the chunk index " << isoPath << ".cmidx" << COLOR_RESET << std::endl;
+        return;
+    }
+    std::cout << COLOR_CYAN << "Chunk index: " << index.chunks.size() << " chunks in " << isoPath << ".cmidx (" << std::fixed
+    << std::setprecision(1) << secondsSince(start) << "s)" << COLOR_RESET << std::endl;
+}
+
+// curl handles https and redirects; a range request that comes back with
+// the wrong length means the server ignored Range
+bool httpFetch(const std::string& url, std::string& body, uint64_t first = 0, uint64_t length = 0) {
+    std::string quoted = "'";
+    for (char c : url) quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    quoted += "'";
+    std::string command = "curl -fsSL";
+    if (length) command += " -r " + std::to_string(first) + "-" + std::to_string(first + length - 1);
+    FILE* fp = popen((command + " " + quoted).c_str(), "r");
+    if (!fp) return false;
+    body.clear();
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) body.append(buffer, n);
+    return pclose(fp) == 0 && (!length || body.size() == length);
+}
+
+// Rebuilds the ISO at url from an older local one: chunks already present
+// locally are copied, the rest is fetched with range requests of up to
+// 16 MiB, four at a time. Every chunk is checked against the index and
+// the result against <url>.sha512. The index hashes only catch transfer
+// errors, so a missing .sha512 fails the fetch unless requireChecksum is off.
+int deltaFetchIso(const std::string& url, const std::string& oldIso, std::string output, bool requireChecksum = true) {
+    if (output.empty()) output = url.substr(url.rfind('/') + 1);
+    std::string indexText;
+    ChunkIndex remote;
+    if (!httpFetch(url + ".cmidx", indexText) || !remote.parse(indexText)) {
+        std::cerr << COLOR_RED << "No usable chunk index at " << url << ".cmidx" << COLOR_RESET << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    ChunkIndex local;
+    if (!local.build(oldIso)) {
+        std::cerr << COLOR_RED << "Cannot read " << oldIso << COLOR_RESET << std::endl;
+        return 1;
+    }
+    std::unordered_map<uint64_t, const Chunk*> have;
+    for (const auto& c : local.chunks) have.emplace(c.hash, &c);
+
+    std::string part = output + ".part";
+    int in = open(oldIso.c_str(), O_RDONLY | O_CLOEXEC);
+    int out = open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (in < 0 || out < 0 || ftruncate(out, static_cast<off_t>(remote.size)) != 0) {
+        std::cerr << COLOR_RED << "Cannot create " << part << ": " << strerror(errno) << COLOR_RESET << std::endl;
+        if (in >= 0) close(in);
+        if (out >= 0) close(out);
+        return 1;
+    }
+
+    constexpr uint64_t MAX_RUN = 16u << 20;
+    std::vector<std::pair<size_t, size_t>> runs;  // [first, last) chunk indexes to download
+    uint64_t reused = 0;
+    std::vector<char> buffer(ChunkIndex::MAX_CHUNK);
+    bool ok = true;
+    for (size_t i = 0; i < remote.chunks.size() && ok; i++) {
+        const Chunk& c = remote.chunks[i];
+        auto it = have.find(c.hash);
+        if (it != have.end() && it->second->length == c.length) {
+            ok = pread(in, buffer.data(), c.length, static_cast<off_t>(it->second->offset)) == static_cast<ssize_t>(c.length) &&
+            pwrite(out, buffer.data(), c.length, static_cast<off_t>(c.offset)) == static_cast<ssize_t>(c.length);
+            reused += c.length;
+            continue;
+        }
+        if (!runs.empty() && runs.back().second == i &&
+            remote.chunks[i].offset + c.length - remote.chunks[runs.back().first].offset <= MAX_RUN) {
+            runs.back().second = i + 1;
+        } else {
+            runs.push_back({i, i + 1});
+        }
+    }
+    close(in);
+    std::cout << COLOR_CYAN << formatBytes(reused) << " of " << formatBytes(remote.size) << " found in " << oldIso << ", fetching "
+    << formatBytes(remote.size - reused) << " in " << runs.size() << " requests..." << COLOR_RESET << std::endl;
+
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> fetched(0);
+    std::atomic<bool> failed(!ok);
+    std::mutex printLock;
+    auto fetchRuns = [&]() {
+        std::string body;
+        for (size_t r; !failed && (r = next++) < runs.size(); ) {
+            const Chunk& first = remote.chunks[runs[r].first];
+            const Chunk& last = remote.chunks[runs[r].second - 1];
+            uint64_t length = last.offset + last.length - first.offset;
+            bool good = httpFetch(url, body, first.offset, length);
+            for (size_t i = runs[r].first; good && i < runs[r].second; i++) {
+                const Chunk& c = remote.chunks[i];
+                good = XXH64::of(body.data() + (c.offset - first.offset), c.length) == c.hash;
+            }
+            good = good && pwrite(out, body.data(), length, static_cast<off_t>(first.offset)) == static_cast<ssize_t>(length);
+            std::lock_guard<std::mutex> guard(printLock);
+            if (!good) {
+                std::cerr << COLOR_RED << "\nBytes " << first.offset << "-" << first.offset + length - 1
+                << " failed to download or did not match the index" << COLOR_RESET << std::endl;
+                failed = true;
+                return;
+            }
+            fetched += length;
+            std::cout << "\r" << COLOR_CYAN << formatBytes(fetched) << " fetched   " << COLOR_RESET << std::flush;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < std::min<size_t>(4, runs.size()); i++) pool.emplace_back(fetchRuns);
+    for (auto& t : pool) t.join();
+    if (!runs.empty()) std::cout << std::endl;
+    ok = !failed && fsync(out) == 0;
+    close(out);
+
+    std::string sums;
+    if (ok && !httpFetch(url + ".sha512", sums)) {
+        if (requireChecksum) {
+            std::cerr << COLOR_RED << "No checksum at " << url << ".sha512 (use --no-checksum to accept the ISO unchecked)"
+            << COLOR_RESET << std::endl;
+            ok = false;
+        } else {
+            std::cerr << COLOR_YELLOW << "No checksum at " << url << ".sha512 - only the chunk index was checked"
+            << COLOR_RESET << std::endl;
+        }
+    } else if (ok) {
+        std::string expected = sums.substr(0, sums.find_first_of(" \t\n"));
+        std::string actual;
+        if (FILE* fp = popen(("sha512sum '" + part + "'").c_str(), "r")) {
+            char line[256];
+            if (fgets(line, sizeof(line), fp)) actual = std::string(line).substr(0, expected.size());
+            pclose(fp);
+        }
+        ok = !expected.empty() && actual == expected;
+        if (!ok) std::cerr << COLOR_RED << "SHA-512 of the rebuilt ISO does not match " << url << ".sha512" << COLOR_RESET << std::endl;
+    }
+    if (!ok || rename(part.c_str(), output.c_str()) != 0) {
+        unlink(part.c_str());
+        std::cerr << COLOR_RED << "Delta fetch failed" << COLOR_RESET << std::endl;
+        return 1;
+    }
+    std::cout << COLOR_GREEN << "Rebuilt " << output << ": " << formatBytes(reused) << " reused, " << formatBytes(fetched)
+    << " downloaded (" << std::fixed << std::setprecision(1) << (remote.size ? 100.0 * fetched / remote.size : 0)
+    << "%) in " << secondsSince(start) << "s" << COLOR_RESET << std::endl;
+    return 0;
+}
+
+bool createISO() {
+    if (!config.allCheckboxesChecked()) {
+        std::cerr << COLOR_RED << "Cannot create ISO - all setup steps must be completed first!" << COLOR_RESET << std::endl;
+        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+        getch();
+        return false;
+    }
+
+    if (!config.isReadyForISO()) {
+        std::cerr << COLOR_RED << "Cannot create ISO - setup is incomplete!" << COLOR_RESET << std::endl;
+        return false;
+    }
+
+    std::cout << COLOR_CYAN << "\nStarting ISO creation process...\n" << COLOR_RESET;
+
+    std::string expandedOutputDir = expandPath(config.outputDir);
+
+    execute_command("mkdir -p " + expandedOutputDir, true);
+
+    updateKernelBootEntries();
+    updateLayersBootEntries();
+    if (!buildEspImage()) {
+        std::cerr << COLOR_RED << "ISO creation failed!" << COLOR_RESET << std::endl;
+        return false;
+    }
+
+    std::string isoPath = expandedOutputDir + "/" + config.isoName;
+    IsoLayout layout = IsoLayout::grub2(BUILD_DIR, config.isoTag);
+    layout.persistImage = preparePersistImage();
+    if (reproducibleBuild()) layout.timestamp = sourceDateEpoch();
+    IsoCache cache(getIsoCachePath());
+    std::string key = IsoCache::key(layout);
+    std::string previous;
+    if (cache.find(key, previous) && reuseIso(previous, isoPath)) {
+        cache.save(key, isoPath);
+        publishIsoIndex(isoPath);
+        std::cout << COLOR_CYAN << "ISO available at " << isoPath << COLOR_RESET << std::endl;
+        std::cout << COLOR_CYAN << "ISO size: " << formatBytes(fileSize(isoPath)) << COLOR_RESET << std::endl;
+        return true;
+    }
+
+    // The build tree has root-owned files, so the writer runs as a sudo child
+    std::string command = "sudo " + reproducibleEnv() + selfExecutable() + " write-iso grub2 " + BUILD_DIR + " \"" + isoPath + "\" \"" +
+    config.isoTag + "\"";
+    if (!layout.persistImage.empty()) command += " " + layout.persistImage;
+    if (system(command.c_str()) != 0) {
+        std::cerr << COLOR_RED << "ISO creation failed!" << COLOR_RESET << std::endl;
+        cache.forget();
+        return false;
+    }
+
+    std::string chownCmd = "sudo chown " + USERNAME + ":" + USERNAME + " \"" + isoPath + "\"";
+    execute_command(chownCmd, true);
+    publishIsoIndex(isoPath);
+
+    std::cout << COLOR_CYAN << "ISO created successfully at " << isoPath << COLOR_RESET << std::endl;
+    std::cout << COLOR_CYAN << "ISO size: " << formatBytes(fileSize(isoPath)) << COLOR_RESET << std::endl;
+    std::cout << COLOR_GREEN << "Ownership changed to current user: " << USERNAME << COLOR_RESET << std::endl;
+    if (!key.empty()) cache.save(key, isoPath);
+
+    return true;
+}
+
+void showGuide() {
+    std::string readmePath = "/home/" + USERNAME + "/.config/cmi/readme.txt";
+    execute_command("mkdir -p /home/" + USERNAME + "/.config/cmi", true);
+
+    std::cout << COLOR_CYAN;
+    execute_command("nano " + readmePath, true);
+    std::cout << COLOR_RESET;
+}
+
+void installISOToUSB() {
+    if (config.outputDir.empty()) {
+        std::cerr << COLOR_RED << "Output directory not set!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    DIR *dir;
+    struct dirent *ent;
+    std::vector<std::string> isoFiles;
+
+    std::string expandedOutputDir = expandPath(config.outputDir);
+    if ((dir = opendir(expandedOutputDir.c_str())) != nullptr) {
+        while ((ent = readdir(dir)) != nullptr) {
+            std::string filename = ent->d_name;
+            if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".iso") == 0) {
+                isoFiles.push_back(filename);
+            }
+        }
+        closedir(dir);
+    } else {
+        std::cerr << COLOR_RED << "Could not open output directory: " << expandedOutputDir << COLOR_RESET << std::endl;
+        return;
+    }
+
+    if (isoFiles.empty()) {
+        std::cerr << COLOR_RED << "No ISO files found in output directory!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::cout << COLOR_GREEN << "Available ISO files:" << COLOR_RESET << std::endl;
+    for (size_t i = 0; i < isoFiles.size(); i++) {
+        std::cout << COLOR_GREEN << (i+1) << ") " << isoFiles[i] << COLOR_RESET << std::endl;
+    }
+
+    std::string selection = getUserInput("Select ISO file (1-" + std::to_string(isoFiles.size()) + "): ");
+    int choice;
+    try {
+        choice = std::stoi(selection);
+        if (choice < 1 || choice > static_cast<int>(isoFiles.size())) {
+            std::cerr << COLOR_RED << "Invalid selection!" << COLOR_RESET << std::endl;
+            return;
+        }
+    } catch (...) {
+        std::cerr << COLOR_RED << "Invalid input!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::string selectedISO = expandedOutputDir + "/" + isoFiles[choice-1];
+
+    std::cout << COLOR_CYAN << "\nAvailable drives:" << COLOR_RESET << std::endl;
+    execute_command("lsblk -d -o NAME,SIZE,MODEL | grep -v 'loop'", true);
+
+    std::string targetDrive = getUserInput("Enter target drive (e.g., /dev/sda): ");
+    if (targetDrive.empty()) {
+        std::cerr << COLOR_RED << "No drive specified!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::cout << COLOR_RED << "\nWARNING: This will overwrite all data on " << targetDrive << "!" << COLOR_RESET << std::endl;
+    std::string confirm = getUserInput("Are you sure you want to continue? (y/N): ");
+    if (confirm != "y" && confirm != "Y") {
+        std::cout << COLOR_CYAN << "Operation cancelled." << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::cout << COLOR_CYAN << "\nWriting " << selectedISO << " to " << targetDrive << "..." << COLOR_RESET << std::endl;
+    std::string ddCommand = "sudo dd if=" + selectedISO + " of=" + targetDrive + " bs=4M status=progress oflag=sync";
+    execute_command(ddCommand, true);
+    growPersistPartition(targetDrive);
+
+    std::cout << COLOR_GREEN << "\nISO successfully written to USB drive!" << COLOR_RESET << std::endl;
+    std::cout << COLOR_GREEN << "Press any key to continue..." << COLOR_RESET;
+    getch();
+}
+
+void runCMIInstaller() {
+    execute_command("cmirsyncinstaller", true);
+    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+    getch();
+}
+
+void runCalamares() {
+    execute_command("sudo calamares", true);
+    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+    getch();
+}
+
+void updateScript() {
+    std::cout << COLOR_CYAN << "\nUpdating script from GitHub..." << COLOR_RESET << std::endl;
+    execute_command("bash -c \"$(curl -fsSL https://raw.githubusercontent.com/claudemods/claudemods-multi-iso-konsole-script/main/advancedimgscript++/installer/patch.sh )\"");
+    std::cout << COLOR_GREEN << "\nScript updated successfully!" << COLOR_RESET << std::endl;
+    std::cout << COLOR_GREEN << "Press any key to continue..." << COLOR_RESET;
+    getch();
+}
+
+bool isDeviceMounted(const std::string& device) {
+    std::string command = "mount | grep " + device + " > /dev/null 2>&1";
+    return system(command.c_str()) == 0;
+}
+
+bool mountDevice(const std::string& device, const std::string& mountPoint) {
+    std::cout << COLOR_CYAN << "Mounting " << device << " to " << mountPoint << "..." << COLOR_RESET << std::endl;
+    execute_command("sudo mkdir -p " + mountPoint, true);
+    std::string mountCmd = "sudo mount " + device + " " + mountPoint;
+    return system(mountCmd.c_str()) == 0;
+}
+
+// UPDATED: Clone current system using bind mount with unmount after completion
+void cloneCurrentSystem(const std::string& cloneDir) {
+    if (!config.allCheckboxesChecked()) {
+        std::cerr << COLOR_RED << "Cannot create image - all setup steps must be completed first!" << COLOR_RESET << std::endl;
+        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+        getch();
+        return;
+    }
+
+    if (!mountSystemToCloneDir(cloneDir)) {
+        std::cerr << COLOR_RED << "Failed to mount system!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    // Create SquashFS directly from the mounted bind
+    std::string outputDir = getOutputDirectory();
+    std::vector<std::string> images;
+    BUILD_SUMMARY.clear();
+    planSquashfsResources();
+    planHardwarePrune(cloneDir);
+
+    bool tiered = config.tieredImages && planHotSet(cloneDir, "clone_system_temp", true);
+    bool verify = config.verifyImages && recordSourceManifest(cloneDir);
+
+    if (tiered) {
+        images = createTieredImages(cloneDir);
+    } else if (config.shardCache || config.resumableBuilds) {
+        images = createCachedShardImages(cloneDir, config.shardCache);
+    } else if (config.layeredImages) {
+        std::string layerImg = createLayeredImage(cloneDir);
+        if (!layerImg.empty()) images.push_back(layerImg);
+    } else {
+        discardLayers();
+        images.push_back(outputDir + "/" + FINAL_IMG_NAME);
+        auto start = std::chrono::steady_clock::now();
+        createSquashFS(cloneDir, images.back());
+        recordPruneBuildTime(secondsSince(start));
+        restackUserLayers();
+    }
+
+    // Verify while the source is still mounted so changes made by the
+    // running system during the build can be told apart from corruption
+    bool verified = true;
+    if (verify && !images.empty()) {
+        bool complete = images.size() > 1 || images[0].find(DELTA_IMG_NAME) == std::string::npos;
+        verified = verifyBuiltImages(images, complete, cloneDir);
+    }
+
+    // Unmount the bind mount after SquashFS creation
+    std::cout << COLOR_CYAN << "Unmounting bind mount..." << COLOR_RESET << std::endl;
+    execute_command("sudo umount " + cloneDir, true);
+
+    if (images.empty()) {
+        std::cerr << COLOR_RED << "Image creation failed!" << COLOR_RESET << std::endl;
+        return;
+    }
+    if (!verified) {
+        std::cerr << COLOR_RED << "Image verification failed - the image does not match the system it was built from!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    for (const auto& image : images) {
+        createChecksum(image);
+    }
+    printFinalMessage(images);
+
+    std::cout << COLOR_GREEN << "Current system cloned successfully using bind mount!" << COLOR_RESET << std::endl;
+}
+
+// Clone another drive
+void cloneAnotherDrive(const std::string& cloneDir) {
+    if (!config.allCheckboxesChecked()) {
+        std::cerr << COLOR_RED << "Cannot create image - all setup steps must be completed first!" << COLOR_RESET << std::endl;
+        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+        getch();
+        return;
+    }
+
+    std::cout << COLOR_CYAN << "\nAvailable drives:" << COLOR_RESET << std::endl;
+    execute_command("lsblk -f -o NAME,FSTYPE,SIZE,MOUNTPOINT | grep -v 'loop'", true);
+
+    std::string drive = getUserInput("Enter drive to clone (e.g., /dev/sda2): ");
+    if (drive.empty()) {
+        std::cerr << COLOR_RED << "No drive specified!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::string checkCmd = "ls " + drive + " > /dev/null 2>&1";
+    if (system(checkCmd.c_str()) != 0) {
+        std::cerr << COLOR_RED << "Drive " << drive + " does not exist!" << COLOR_RESET << std::endl;
+        return;
     }
 
     std::string tempMountPoint = "/mnt/temp_clone_mount";
@@ -1071,97 +2502,838 @@ void cloneAnotherDrive(const std::string& cloneDir) {
         }
     }
 
-    std::cout << COLOR_CYAN << "Creating SquashFS from " << drive << "..." << COLOR_RESET << std::endl;
-
-    std::string outputDir = getOutputDirectory();
-    std::string finalImgPath = outputDir + "/" + FINAL_IMG_NAME;
-
-    // Create SquashFS directly from the mounted drive with exclusions
-    std::string command = "sudo mksquashfs " + tempMountPoint + " " + finalImgPath +
-    " -noappend -comp xz -b 256K -Xbcj x86 " +
-    "-e etc/udev/rules.d/70-persistent-cd.rules " +
-    "-e etc/udev/rules.d/70-persistent-net.rules " +
-    "-e etc/mtab " +
-    "-e etc/fstab " +
-    "-e dev/* " +
-    "-e proc/* " +
-    "-e sys/* " +
-    "-e tmp/* " +
-    "-e run/* " +
-    "-e mnt/* " +
-    "-e media/* " +
-    "-e lost+found " +
-    "-e temp_clone_mount";
-
-    execute_command(command, true);
-
-    if (!isDeviceMounted(drive) || system(("mount | grep " + drive + " | grep " + tempMountPoint).c_str()) == 0) {
-        execute_command("sudo umount " + tempMountPoint, true);
-        execute_command("sudo rmdir " + tempMountPoint, true);
+    std::cout << COLOR_CYAN << "Creating SquashFS from " << drive << "..." << COLOR_RESET << std::endl;
+
+    std::string outputDir = getOutputDirectory();
+    std::string finalImgPath = outputDir + "/" + FINAL_IMG_NAME;
+    discardLayers();
+    BUILD_SUMMARY.clear();
+
+    CompressorSpec xzSpec;
+    xzSpec.name = "xz";
+    xzSpec.extra = "-Xbcj x86";
+    planSquashfsResources(xzSpec);
+    planHardwarePrune(tempMountPoint);
+    // Access times on another drive say nothing about this boot, so only
+    // the seed list picks the hot files
+    bool tiered = config.tieredImages && planHotSet(tempMountPoint, "temp_clone_mount", false);
+    bool verify = config.verifyImages && recordSourceManifest(tempMountPoint, "temp_clone_mount");
+
+    std::vector<std::string> images;
+    if (tiered) {
+        images = createTieredImages(tempMountPoint);
+    } else {
+        // Create SquashFS directly from the mounted drive with exclusions
+        std::string command = "sudo mksquashfs " + tempMountPoint + " " + finalImgPath +
+        " -noappend " + squashfsCompressionArgs() + " " + SQUASHFS_PLAN.resourceArgs() + squashfsExcludeArgs("temp_clone_mount");
+
+        auto start = std::chrono::steady_clock::now();
+        execute_command(command, true);
+        recordPruneBuildTime(secondsSince(start));
+        images.push_back(finalImgPath);
+        restackUserLayers();
+    }
+    bool verified = !verify || (!images.empty() && verifyBuiltImages(images, true, tempMountPoint));
+
+    if (!isDeviceMounted(drive) || system(("mount | grep " + drive + " | grep " + tempMountPoint).c_str()) == 0) {
+        execute_command("sudo umount " + tempMountPoint, true);
+        execute_command("sudo rmdir " + tempMountPoint, true);
+    }
+
+    if (!verified) {
+        std::cerr << COLOR_RED << "Image verification failed - the image does not match " << drive << "!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    if (images.empty()) {
+        std::cerr << COLOR_RED << "Image creation failed!" << COLOR_RESET << std::endl;
+        return;
+    }
+    for (const auto& image : images) {
+        createChecksum(image);
+    }
+    printFinalMessage(images);
+
+    std::cout << COLOR_GREEN << "Drive " << drive << " cloned successfully!" << COLOR_RESET << std::endl;
+}
+
+void cloneFolderOrFile(const std::string& cloneDir) {
+    if (!config.allCheckboxesChecked()) {
+        std::cerr << COLOR_RED << "Cannot create image - all setup steps must be completed first!" << COLOR_RESET << std::endl;
+        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+        getch();
+        return;
+    }
+
+    std::cout << COLOR_CYAN << "\nClone Folder or File" << COLOR_RESET << std::endl;
+    std::cout << COLOR_YELLOW << "Enter the path to a folder or file you want to clone." << COLOR_RESET << std::endl;
+    std::cout << COLOR_YELLOW << "Examples:" << COLOR_RESET << std::endl;
+    std::cout << COLOR_YELLOW << "  - Folder: /home/" << USERNAME << "/Documents" << COLOR_RESET << std::endl;
+    std::cout << COLOR_YELLOW << "  - File: /home/" << USERNAME << "/file.txt" << COLOR_RESET << std::endl;
+
+    std::string sourcePath = getUserInput("Enter folder or file path to clone: ");
+    if (sourcePath.empty()) {
+        std::cerr << COLOR_RED << "No path specified!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::string checkCmd = "sudo test -e " + sourcePath + " > /dev/null 2>&1";
+    if (system(checkCmd.c_str()) != 0) {
+        std::cerr << COLOR_RED << "Source path does not exist: " << sourcePath << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::string userfilesDir = cloneDir + "/home/userfiles";
+    execute_command("sudo mkdir -p " + userfilesDir, true);
+
+    std::cout << COLOR_CYAN << "Cloning " << sourcePath << " to " << userfilesDir << "..." << COLOR_RESET << std::endl;
+
+    std::string rsyncCmd = "sudo rsync -aHAXSr --numeric-ids --info=progress2 " +
+    sourcePath + " " + userfilesDir + "/";
+
+    execute_command(rsyncCmd, true);
+
+    std::cout << COLOR_GREEN << "Successfully cloned " << sourcePath << " to " << userfilesDir << "!" << COLOR_RESET << std::endl;
+
+    std::string listCmd = "sudo ls -la " + userfilesDir + " | head -20";
+    std::cout << COLOR_CYAN << "Contents of userfiles directory:" << COLOR_RESET << std::endl;
+    execute_command(listCmd, true);
+}
+
+// Adds a folder or file to the image that is already built without
+// rebuilding it. mksquashfs can only append at the image root, so the
+// files go into a small image of their own under home/userfiles/ that the
+// cmi_layers hook stacks on top of the existing images.
+void addFilesToImage() {
+    std::string outputDir = getOutputDirectory();
+    std::vector<std::string> base = LayerManager::readLayers(outputDir);
+    if (base.empty() && fileExists(outputDir + "/" + FINAL_IMG_NAME)) base.push_back(FINAL_IMG_NAME);
+    if (base.empty()) {
+        std::cerr << COLOR_RED << "No image built yet - clone a system first!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    std::string sourcePath = getUserInput("Enter folder or file path to add to the image: ");
+    while (sourcePath.size() > 1 && sourcePath.back() == '/') sourcePath.pop_back();
+    if (sourcePath.empty()) {
+        std::cerr << COLOR_RED << "No path specified!" << COLOR_RESET << std::endl;
+        return;
+    }
+    if (system(("sudo test -e " + sourcePath + " > /dev/null 2>&1").c_str()) != 0) {
+        std::cerr << COLOR_RED << "Source path does not exist: " << sourcePath << COLOR_RESET << std::endl;
+        return;
+    }
+    size_t slash = sourcePath.rfind('/');
+    std::string parent = slash == std::string::npos ? "." : slash == 0 ? "/" : sourcePath.substr(0, slash);
+    std::string name = sourcePath.substr(slash == std::string::npos ? 0 : slash + 1);
+
+    std::vector<std::string> added = userLayers();
+    int next = 0;
+    for (const auto& layer : added) {
+        next = std::max(next, std::atoi(layer.c_str() + USER_IMG_PREFIX.size()) + 1);
+    }
+    char layerName[48];
+    snprintf(layerName, sizeof(layerName), "%s%03d.img", USER_IMG_PREFIX.c_str(), next);
+    std::string layerImg = outputDir + "/" + layerName;
+
+    // Parents the tar stream does not carry (home, home/userfiles) are
+    // created root-owned 0755, as they are on the system
+    auto start = std::chrono::steady_clock::now();
+    std::cout << COLOR_CYAN << "Adding " << sourcePath << " as " << layerName << "..." << COLOR_RESET << std::endl;
+    // pipefail: a tar that dies part way must not leave a short but valid layer
+    int status = runPipeline("sudo tar -C " + parent + " --numeric-owner --xattrs --xattrs-include='*' --acls "
+    "--transform='s,^,home/userfiles/,S' -cf - " + name + " | sudo mksquashfs - " + layerImg + " -tar -noappend -quiet "
+    "-default-mode 0755 -default-uid 0 -default-gid 0 " + squashfsCompressionArgs() + " " + squashfsResourceArgs());
+    if (status != 0 || !fileExists(layerImg)) {
+        execute_command("sudo rm -f " + layerImg, true);
+        std::cerr << COLOR_RED << "Failed to build the layer for " << sourcePath << "!" << COLOR_RESET << std::endl;
+        return;
+    }
+
+    added.insert(added.begin(), layerName);
+    LayerManager::writeLayers(getUserLayersPath(), added);
+    writeLayersList(base);
+    installLayersHook();
+    createChecksum(layerImg);
+
+    std::cout << COLOR_GREEN << "Added " << sourcePath << " to the image as /home/userfiles/" << name << " in "
+    << std::fixed << std::setprecision(1) << secondsSince(start) << "s (" << formatBytes(fileSize(layerImg))
+    << " layer, no rebuild)" << COLOR_RESET << std::endl;
+}
+
+// Drops every layer added with addFilesToImage
+void removeAddedFiles() {
+    std::string outputDir = getOutputDirectory();
+    std::vector<std::string> added = userLayers();
+    if (added.empty()) {
+        std::cout << COLOR_YELLOW << "No added files in the image" << COLOR_RESET << std::endl;
+        return;
+    }
+    for (const auto& layer : added) {
+        execute_command("sudo rm -f " + outputDir + "/" + layer + " " + outputDir + "/" + layer + ".sha512", true);
+    }
+    std::ofstream(getUserLayersPath(), std::ios::trunc);
+
+    std::vector<std::string> base = LayerManager::readLayers(outputDir);
+    if (base.size() == 1 && base[0] == FINAL_IMG_NAME && !usesLayers()) {
+        execute_command("sudo rm -f " + outputDir + "/layers.list", true);
+    } else {
+        writeLayersList(base);
+    }
+    std::cout << COLOR_GREEN << "Removed " << added.size() << " added file layer(s)" << COLOR_RESET << std::endl;
+}
+
+void showCloneOptionsMenu() {
+    std::vector<std::string> items = {
+        "Clone Current System (as it is now)",
+        "Clone Another Drive (e.g., /dev/sda2)",
+        "Clone Folder or File",
+        "Add Files to Existing Image (no rebuild)",
+        "Remove Added Files from Image",
+        "Back to Main Menu"
+    };
+
+    int selected = 0;
+    int key;
+
+    while (true) {
+        key = showMenu("Clone Options - Select Source:", items, selected);
+
+        switch (key) {
+            case 'A':
+                if (selected > 0) selected--;
+                break;
+            case 'B':
+                if (selected < static_cast<int>(items.size()) - 1) selected++;
+                break;
+            case '\n':
+                if (config.cloneDir.empty()) {
+                    std::cerr << COLOR_RED << "Clone directory not set! Please set it in Setup Scripts menu." << COLOR_RESET << std::endl;
+                    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                    getch();
+                    break;
+                }
+
+                std::string cloneDir = expandPath(config.cloneDir);
+                execute_command("sudo mkdir -p " + cloneDir, true);
+
+                switch (selected) {
+                    case 0:
+                        cloneCurrentSystem(cloneDir);
+                        break;
+                    case 1:
+                        cloneAnotherDrive(cloneDir);
+                        break;
+                    case 2:
+                        cloneFolderOrFile(cloneDir);
+                        std::cout << COLOR_YELLOW << "Folder/File cloned to " << cloneDir << "/home/userfiles" << COLOR_RESET << std::endl;
+                        std::cout << COLOR_YELLOW << "You can now create an ISO that includes these files." << COLOR_RESET << std::endl;
+                        break;
+                    case 3:
+                        addFilesToImage();
+                        break;
+                    case 4:
+                        removeAddedFiles();
+                        break;
+                    case 5:
+                        return;
+                }
+
+                if (selected != 5) {
+                    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                    getch();
+                }
+                break;
+        }
+    }
+}
+
+// Images making up the current build: the layers if there is a
+// layers.list, otherwise the single rootfs.img
+std::vector<std::string> currentImages() {
+    std::string outputDir = getOutputDirectory();
+    std::vector<std::string> images;
+    for (const auto& layer : LayerManager::readLayers(outputDir)) {
+        images.push_back(outputDir + "/" + layer);
+    }
+    if (images.empty() && fileExists(outputDir + "/" + FINAL_IMG_NAME)) {
+        images.push_back(outputDir + "/" + FINAL_IMG_NAME);
+    }
+    return images;
+}
+
+bool buildImageProfile(const std::vector<std::string>& images, ImageProfile& profile) {
+    for (const auto& image : images) {
+        ImageProfile one;
+        std::string error;
+        std::cout << COLOR_CYAN << "Profiling " << image << "..." << COLOR_RESET << std::endl;
+        if (!ImageProfiler::profile(image, one, error)) {
+            std::cerr << COLOR_RED << image << ": " << error << COLOR_RESET << std::endl;
+            return false;
+        }
+        profile.add(one);
+    }
+    return !images.empty();
+}
+
+// Sortable table of an image profile. Left/right picks the sort column,
+// up/down scrolls, v switches between directories and packages.
+void showProfileTable(const ImageProfile& profile) {
+    const std::vector<std::string> columns = {"Name", "Files", "Size", "Compressed", "Ratio", "Dedup", "CPU %"};
+    int sortColumn = 3;
+    bool packages = false;
+    size_t offset = 0;
+    const size_t pageRows = 20;
+
+    while (true) {
+        std::vector<ProfileRow> rows = packages ? profile.packages : profile.dirs;
+        std::sort(rows.begin(), rows.end(), [&](const ProfileRow& a, const ProfileRow& b) {
+            switch (sortColumn) {
+                case 0: return a.name < b.name;
+                case 1: return a.files > b.files;
+                case 2: return a.bytes > b.bytes;
+                case 4: return a.ratio() > b.ratio();
+                case 5: return a.dedupSaved > b.dedupSaved;
+                case 6: return a.cpuSeconds > b.cpuSeconds;
+                default: return a.compressed > b.compressed;
+            }
+        });
+        offset = std::min(offset, rows.size() > pageRows ? rows.size() - pageRows : 0);
+
+        clearScreen();
+        std::cout << COLOR_CYAN << "Image composition - " << (packages ? "packages" : "top-level directories")
+        << " (" << profile.compressor << ", " << formatBytes(profile.imageBytes) << ", metadata "
+        << formatBytes(profile.metadataBytes) << ", CPU estimated from " << std::fixed << std::setprecision(1)
+        << profile.sampledFraction * 100 << "% of blocks)" << COLOR_RESET << "\n\n";
+
+        std::cout << COLOR_YELLOW;
+        for (size_t c = 0; c < columns.size(); c++) {
+            std::string title = columns[c] + (static_cast<int>(c) == sortColumn ? "*" : "");
+            if (c == 0) std::cout << std::left << std::setw(32) << title;
+            else std::cout << std::right << std::setw(12) << title;
+        }
+        std::cout << COLOR_RESET << "\n";
+
+        for (size_t i = offset; i < rows.size() && i < offset + pageRows; i++) {
+            const ProfileRow& r = rows[i];
+            double share = profile.cpuSeconds > 0 ? 100.0 * r.cpuSeconds / profile.cpuSeconds : 0.0;
+            std::cout << COLOR_NORMAL << std::left << std::setw(32) << r.name.substr(0, 31) << std::right
+            << std::setw(12) << r.files << std::setw(12) << formatBytes(r.bytes) << std::setw(12) << formatBytes(r.compressed)
+            << std::setw(12) << std::setprecision(2) << r.ratio() << std::setw(12) << formatBytes(r.dedupSaved)
+            << std::setw(12) << std::setprecision(1) << share << COLOR_RESET << "\n";
+        }
+        std::cout << std::left << COLOR_CYAN << "\n  " << (offset + 1) << "-" << std::min(rows.size(), offset + pageRows)
+        << " of " << rows.size() << "   Left/Right: sort   Up/Down: scroll   v: directories/packages   q: back"
+        << COLOR_RESET << std::endl;
+
+        int key = getch();
+        if (key == 'q' || key == '\n') return;
+        if (key == 'v') {
+            packages = !packages;
+            offset = 0;
+        } else if (key == 'C') {
+            sortColumn = (sortColumn + 1) % static_cast<int>(columns.size());
+        } else if (key == 'D') {
+            sortColumn = (sortColumn + static_cast<int>(columns.size()) - 1) % static_cast<int>(columns.size());
+        } else if (key == 'A' && offset > 0) {
+            offset--;
+        } else if (key == 'B') {
+            offset++;
+        }
+    }
+}
+
+void profileCurrentImages() {
+    std::vector<std::string> images = currentImages();
+    if (images.empty()) {
+        std::cout << COLOR_YELLOW << "No image found in " << getOutputDirectory() << COLOR_RESET << std::endl;
+        return;
+    }
+    ImageProfile profile;
+    if (!buildImageProfile(images, profile)) return;
+
+    std::string jsonPath = "/home/" + USERNAME + "/.config/cmi/image-profile.json";
+    std::ofstream json(jsonPath, std::ios::trunc);
+    json << profile.toJson();
+    json.close();
+    showProfileTable(profile);
+    std::cout << COLOR_GREEN << "Profile saved to " << jsonPath << COLOR_RESET << std::endl;
+}
+
+// Mounts an image read-only for benchmarking: the kernel driver when
+// running as root, squashfuse or erofsfuse otherwise
+bool mountBenchImage(const std::string& image, const std::string& mountPoint, bool& fuse) {
+    bool erofs = ErofsReader::isErofs(image);
+    fuse = geteuid() != 0;
+    std::string cmd = fuse ? std::string(erofs ? "erofsfuse " : "squashfuse ") + image + " " + mountPoint :
+    "mount -t " + std::string(erofs ? "erofs" : "squashfs") + " -o loop,ro " + image + " " + mountPoint;
+    return system((cmd + " 2>/dev/null").c_str()) == 0;
+}
+
+void unmountBenchImage(const std::string& mountPoint, bool fuse) {
+    std::string cmd = fuse ? "fusermount3 -u " + mountPoint + " 2>/dev/null || fusermount -u " + mountPoint :
+    "umount " + mountPoint;
+    execute_command(cmd, true);
+}
+
+std::string describeImageFormat(const std::string& image) {
+    std::string error;
+    if (ErofsReader::isErofs(image)) {
+        ErofsReader reader;
+        if (!reader.open(image, error)) return "erofs";
+        return "erofs, " + formatBytes(reader.blockSize()) + " blocks";
+    }
+    SquashfsReader reader;
+    if (!reader.open(image, error)) return "unreadable: " + error;
+    return std::string("squashfs ") + SquashfsReader::compressorName(reader.super().compression) + ", " +
+    formatBytes(reader.super().blockSize) + " blocks";
+}
+
+// Replays a read workload against each image, first with nothing cached
+// (fresh mount, image file dropped from the page cache) and then again
+// warm. Without a trace the workload is random 4K/64K reads over usr/lib.
+int benchImages(const std::vector<std::string>& images, const std::string& tracePath, size_t reads) {
+    char mountTemplate[] = "/tmp/cmi-bench-XXXXXX";
+    if (!mkdtemp(mountTemplate)) {
+        std::cerr << COLOR_RED << "Cannot create a mount point for the benchmark" << COLOR_RESET << std::endl;
+        return 1;
+    }
+    std::string mountPoint = mountTemplate;
+    int failures = 0;
+
+    for (const auto& image : images) {
+        bool fuse = false;
+        if (!mountBenchImage(image, mountPoint, fuse)) {
+            std::cerr << COLOR_RED << "Cannot mount " << image << (fuse ? " (is squashfuse/erofsfuse installed?)" : "")
+            << COLOR_RESET << std::endl;
+            failures++;
+            continue;
+        }
+        std::vector<ReadOp> ops = tracePath.empty() ? ReadWorkload::randomReads(mountPoint, "usr/lib", reads) :
+        ReadWorkload::fromTrace(mountPoint, tracePath);
+        unmountBenchImage(mountPoint, fuse);
+        if (ops.empty()) {
+            std::cout << COLOR_YELLOW << image << ": nothing to read (" << (tracePath.empty() ? "no files under usr/lib" :
+            "no traced files in this image") << ")" << COLOR_RESET << std::endl;
+            continue;
+        }
+
+        // Listing the tree warmed the metadata, so remount before the cold run
+        ReadBench::dropImageCache(image);
+        if (!mountBenchImage(image, mountPoint, fuse)) {
+            failures++;
+            continue;
+        }
+        std::vector<ReadBenchResult> results;
+        results.push_back(ReadBench::run(mountPoint, ops, "cold"));
+        results.push_back(ReadBench::run(mountPoint, ops, "warm"));
+        unmountBenchImage(mountPoint, fuse);
+
+        std::cout << COLOR_CYAN << ReadBench::table(image, describeImageFormat(image) + (fuse ? ", FUSE" : ", kernel") +
+        ", " + (tracePath.empty() ? "random 4K/64K reads of usr/lib" : "boot trace"), results) << COLOR_RESET;
+    }
+    rmdir(mountPoint.c_str());
+    return failures == 0 ? 0 : 1;
+}
+
+// Benchmarks the images of the current build through the kernel driver
+void benchCurrentImages() {
+    std::vector<std::string> images = currentImages();
+    if (images.empty()) {
+        std::cout << COLOR_YELLOW << "No image found in " << getOutputDirectory() << COLOR_RESET << std::endl;
+        return;
+    }
+    std::string hotList = getLayerStateDir() + "/tiers/hot.list";
+    std::string traceArg;
+    if (fileExists(hotList)) {
+        std::string choice = getUserInput("Replay the recorded boot trace instead of random reads? (yes/no): ");
+        if (choice == "yes" || choice == "y") traceArg = " --trace " + hotList;
+    }
+    std::string cmd = "sudo " + selfExecutable() + " image-bench" + traceArg;
+    for (const auto& image : images) cmd += " " + image;
+    execute_command(cmd, true);
+}
+
+int diffImages(const std::string& oldImage, const std::string& newImage, bool contentCheck, const std::string& jsonPath) {
+    auto start = std::chrono::steady_clock::now();
+    ImageTree oldTree, newTree;
+    std::string error;
+    if (!ImageDiff::loadPair(oldImage, newImage, oldTree, newTree, error)) {
+        std::cerr << COLOR_RED << error << COLOR_RESET << std::endl;
+        return 1;
+    }
+    ImageDiffResult result = ImageDiff::diff(oldTree, newTree, contentCheck);
+    double seconds = secondsSince(start);
+
+    for (const auto& c : result.changes) {
+        std::string color = c.kind == '+' ? COLOR_GREEN : c.kind == '-' ? COLOR_RED : c.kind == '~' ? COLOR_YELLOW : COLOR_CYAN;
+        std::cout << color << c.kind << " " << c.path;
+        if (!c.what.empty()) std::cout << " (" << c.what << ")";
+        if (c.sizeDelta != 0) std::cout << " " << formatDelta(c.sizeDelta);
+        std::cout << COLOR_RESET << std::endl;
+    }
+
+    std::vector<std::pair<std::string, int64_t>> topDirs(result.storedByTopDir.begin(), result.storedByTopDir.end());
+    std::sort(topDirs.begin(), topDirs.end(), [](const auto& a, const auto& b) {
+        return std::llabs(a.second) > std::llabs(b.second);
+    });
+
+    std::cout << COLOR_CYAN << "\n" << oldTree.format << " " << oldImage << " -> " << newTree.format << " " << newImage << "\n"
+    << "Added: " << result.added << ", removed: " << result.removed << ", changed: " << result.changed
+    << ", metadata only: " << result.metadataOnly << ", unchanged: " << result.unchanged << "\n"
+    << "Image size: " << formatDelta(result.imageDelta) << ", file data: " << formatDelta(result.sizeDelta)
+    << ", compressed data: " << formatDelta(result.storedDelta) << "\n";
+    for (size_t i = 0; i < topDirs.size() && i < 10 && topDirs[i].second != 0; i++) {
+        std::cout << "  /" << std::left << std::setw(20) << topDirs[i].first << std::right << formatDelta(topDirs[i].second) << "\n";
+    }
+    std::cout << "Compared in " << std::fixed << std::setprecision(2) << seconds << "s";
+    if (result.contentChecked) std::cout << " (" << result.hashedFiles << " files decompressed)";
+    else if (result.tailFiles > 0) std::cout << " (" << result.tailFiles << " fragment tails or uncompressed files read)";
+    std::cout << COLOR_RESET << std::endl;
+
+    if (contentCheck && !result.contentChecked) {
+        std::cout << COLOR_YELLOW << "--content needs two squashfs images; compared metadata only" << COLOR_RESET << std::endl;
+    } else if (!result.contentChecked && !result.comparableStorage) {
+        std::cout << COLOR_YELLOW << "The images use different compressors or block sizes, so files were matched by size "
+        << "and metadata only; use --content to compare data" << COLOR_RESET << std::endl;
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream json(jsonPath, std::ios::trunc);
+        json << result.toJson(oldTree, newTree);
+        if (!json.good()) {
+            std::cerr << COLOR_RED << "Failed to write " << jsonPath << COLOR_RESET << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+std::string getBootTimeLogPath() {
+    return "/home/" + USERNAME + "/.config/cmi/boot-times.log";
+}
+
+// Layout of the live system this is running on, from the boot medium
+std::string currentBootLayout() {
+    std::ifstream cmdline("/proc/cmdline");
+    std::string args;
+    std::getline(cmdline, args);
+    if (args.find("cmi_layers=") == std::string::npos) return "single";
+    std::vector<std::string> layers = LayerManager::readLayers("/run/cmi/media/LiveOS");
+    if (std::find(layers.begin(), layers.end(), HOT_IMG_NAME) != layers.end()) return "tiered";
+    return "layered";
+}
+
+// Records how long this boot took; run it from a desktop autostart entry so
+// the uptime marks the moment the desktop came up
+int recordBootTime(const std::string& logPath, const std::string& label) {
+    BootTimeSample sample;
+    std::string analyze;
+    FILE* fp = popen("systemd-analyze time 2>/dev/null", "r");
+    if (fp) {
+        char buf[512];
+        while (fgets(buf, sizeof(buf), fp)) analyze += buf;
+        pclose(fp);
+    }
+    if (!BootTimeLog::parseAnalyze(analyze, sample)) {
+        std::cerr << COLOR_RED << "systemd-analyze has no boot timing yet - is the system still starting?" << COLOR_RESET << std::endl;
+        return 1;
+    }
+    std::ifstream uptime("/proc/uptime");
+    uptime >> sample.desktop;
+    sample.layout = currentBootLayout();
+    sample.label = label;
+    if (!BootTimeLog::append(logPath, sample)) {
+        std::cerr << COLOR_RED << "Failed to write " << logPath << COLOR_RESET << std::endl;
+        return 1;
+    }
+    std::cout << COLOR_GREEN << std::fixed << std::setprecision(2) << sample.layout << " boot: " << sample.total()
+    << "s to userspace done, desktop at " << sample.desktop << "s" << COLOR_RESET << std::endl;
+    return 0;
+}
+
+void showBootTimeReport(const std::vector<std::string>& logs) {
+    std::vector<BootTimeSample> samples;
+    for (const auto& log : logs) {
+        std::vector<BootTimeSample> more = BootTimeLog::load(log);
+        samples.insert(samples.end(), more.begin(), more.end());
+    }
+    if (samples.empty()) {
+        std::cout << COLOR_YELLOW << "No boot times recorded yet. Boot each ISO layout and run 'cmiimg boot-time record' "
+        << "on the desktop, then copy the log lines into " << getBootTimeLogPath() << COLOR_RESET << std::endl;
+        return;
+    }
+    std::cout << COLOR_CYAN << BootTimeLog::report(samples) << COLOR_RESET;
+}
+
+std::string getExportDirectory() {
+    return "/home/" + USERNAME + "/.config/cmi/export";
+}
+
+// tar stream of a tree with the same exclusions as the SquashFS builds,
+// plus extraExcludes given relative to root
+std::string exportTarCommand(const std::string& root, const std::string& mountName = "clone_system_temp",
+                             const std::vector<std::string>& extraExcludes = {}) {
+    std::string cmd = "sudo tar -C " + root + " --numeric-owner --xattrs --xattrs-include='*' --acls";
+    for (const auto& e : squashfsExcludes(mountName)) {
+        cmd += " --exclude='./" + e + "'";
+    }
+    for (const auto& e : extraExcludes) {
+        cmd += " --exclude='./" + e + "'";
+    }
+    return cmd + " -cf - .";
+}
+
+// Encoders for a comma separated list of sfs, tar.zst and erofs; every
+// one of them reads a tar stream on stdin. sfsArgs replaces the
+// configured SquashFS compressor settings when given.
+std::vector<ExportSink> exportSinks(const std::string& formats, const std::string& outDir, const std::string& suffix = "",
+                                    const std::string& sudo = "sudo ", const std::string& sfsArgs = "") {
+    std::vector<ExportSink> sinks;
+    std::istringstream list(formats);
+    std::string format;
+    while (std::getline(list, format, ',')) {
+        ExportSink sink;
+        sink.format = format;
+        if (format == "sfs") {
+            sink.output = outDir + "/airootfs.sfs" + suffix;
+            sink.command = sudo + "mksquashfs - " + sink.output + " -tar -noappend -quiet " +
+            (sfsArgs.empty() ? squashfsCompressionArgs() : sfsArgs) + " " + squashfsResourceArgs();
+        } else if (format == "tar.zst") {
+            sink.output = outDir + "/rootfs.tar.zst" + suffix;
+            sink.command = sudo + "zstd -q -f -T0 -o " + sink.output;
+        } else if (format == "erofs") {
+            sink.output = outDir + "/rootfs.erofs" + suffix;
+            sink.command = sudo + "mkfs.erofs --quiet -zlz4hc --tar=f " + sink.output;
+        } else {
+            std::cerr << COLOR_YELLOW << "Unknown export format '" << format << "' skipped" << COLOR_RESET << std::endl;
+            continue;
+        }
+        sinks.push_back(sink);
+    }
+    return sinks;
+}
+
+// Writes every requested format from one read of the tree. With compare
+// set, each format is then built again on its own (with a warm page
+// cache, which favours the sequential runs) to show the difference.
+int exportFormats(const std::string& root, const std::string& outDir, const std::string& formats, bool compare,
+                  const std::string& mountName = "clone_system_temp", std::vector<std::string> extraExcludes = {}) {
+    std::vector<ExportSink> sinks = exportSinks(formats, outDir);
+    if (sinks.empty()) {
+        std::cerr << COLOR_RED << "No export formats selected (use sfs, tar.zst, erofs)" << COLOR_RESET << std::endl;
+        return 1;
+    }
+    execute_command("sudo mkdir -p " + outDir, true);
+    // An output directory inside the tree would be read while it is written
+    if (outDir.compare(0, root.size() + 1, root + "/") == 0) extraExcludes.push_back(outDir.substr(root.size() + 1));
+    std::string source = exportTarCommand(root, mountName, extraExcludes);
+    std::cout << COLOR_CYAN << "Exporting " << root << " to " << sinks.size() << " formats in one pass..." << COLOR_RESET << std::endl;
+
+    TarFanout fanout;
+    bool ok = fanout.run(source, sinks);
+    if (!fanout.sourceError.empty()) {
+        std::cerr << COLOR_RED << "Reading the tree failed: " << fanout.sourceError << COLOR_RESET << std::endl;
+    }
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& sink : sinks) {
+        if (sink.failed) {
+            std::cerr << COLOR_RED << sink.format << " failed: " << sink.error << COLOR_RESET << std::endl;
+            continue;
+        }
+        std::cout << COLOR_GREEN << std::left << std::setw(8) << sink.format << std::right << " " << sink.output << " "
+        << formatBytes(fileSize(sink.output)) << ", done after " << sink.finishedAfter << "s, held the reader back "
+        << sink.stallSeconds << "s" << COLOR_RESET << std::endl;
+    }
+    std::cout << COLOR_CYAN << "Single pass: read " << formatBytes(fanout.bytesRead) << " once in " << fanout.seconds
+    << "s" << COLOR_RESET << std::endl;
+
+    if (compare && ok) {
+        double sequential = 0;
+        std::string times;
+        for (const auto& sink : exportSinks(formats, outDir, ".seq")) {
+            auto start = std::chrono::steady_clock::now();
+            int status = system((source + " | " + sink.command).c_str());
+            double took = secondsSince(start);
+            execute_command("sudo rm -f " + sink.output, true);
+            if (status != 0) {
+                std::cerr << COLOR_YELLOW << "Sequential " << sink.format << " run failed; no comparison" << COLOR_RESET << std::endl;
+                return ok ? 0 : 1;
+            }
+            sequential += took;
+            std::ostringstream part;
+            part << std::fixed << std::setprecision(1) << (times.empty() ? "" : ", ") << sink.format << " " << took << "s";
+            times += part.str();
+        }
+        std::cout << COLOR_CYAN << "Sequential: " << sequential << "s (" << times << "), single pass saved "
+        << (sequential - fanout.seconds) << "s (" << (sequential > 0 ? 100.0 * (sequential - fanout.seconds) / sequential : 0.0)
+        << "%)" << COLOR_RESET << std::endl;
+    }
+    return ok ? 0 : 1;
+}
+
+// Writes a squashfs image to stdout as a tar stream; the producer half of
+// transcode
+int writeImageAsTar(const std::string& image) {
+    SquashfsReader reader;
+    std::string error;
+    SquashfsTarStream stream;
+    if (!reader.open(image, error) || !stream.write(reader, STDOUT_FILENO, error)) {
+        std::cerr << COLOR_RED << image << ": " << error << COLOR_RESET << std::endl;
+        return 1;
     }
-
-    createChecksum(finalImgPath);
-    printFinalMessage(finalImgPath);
-
-    std::cout << COLOR_GREEN << "Drive " << drive << " cloned successfully!" << COLOR_RESET << std::endl;
+    return 0;
 }
 
-void cloneFolderOrFile(const std::string& cloneDir) {
-    if (!config.allCheckboxesChecked()) {
-        std::cerr << COLOR_RED << "Cannot create image - all setup steps must be completed first!" << COLOR_RESET << std::endl;
-        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-        getch();
-        return;
+// Re-encodes a squashfs image into other formats or compressors by reading
+// it directly and streaming its files into the encoders, with no mount and
+// no extracted copy. Runs without root: ownership comes from the stream.
+// With bench set, the same image is also put through unsquashfs and
+// mksquashfs for comparison.
+int transcodeImage(const std::string& image, const std::string& outDir, const std::string& formats,
+                   const std::string& sfsArgs, bool bench) {
+    SquashfsReader reader;
+    std::string error;
+    if (!reader.open(image, error)) {
+        std::cerr << COLOR_RED << image << ": " << error << COLOR_RESET << std::endl;
+        return 1;
     }
+    std::cout << COLOR_CYAN << "Transcoding " << image << " (" << SquashfsReader::compressorName(reader.super().compression)
+    << ", " << formatBytes(fileSize(image)) << ")" << COLOR_RESET << std::endl;
 
-    std::cout << COLOR_CYAN << "\nClone Folder or File" << COLOR_RESET << std::endl;
-    std::cout << COLOR_YELLOW << "Enter the path to a folder or file you want to clone." << COLOR_RESET << std::endl;
-    std::cout << COLOR_YELLOW << "Examples:" << COLOR_RESET << std::endl;
-    std::cout << COLOR_YELLOW << "  - Folder: /home/" << USERNAME << "/Documents" << COLOR_RESET << std::endl;
-    std::cout << COLOR_YELLOW << "  - File: /home/" << USERNAME << "/file.txt" << COLOR_RESET << std::endl;
+    std::vector<ExportSink> sinks = exportSinks(formats, outDir, "", "", sfsArgs);
+    if (sinks.empty()) {
+        std::cerr << COLOR_RED << "No output formats selected (use sfs, tar.zst, erofs)" << COLOR_RESET << std::endl;
+        return 1;
+    }
+    execute_command("mkdir -p " + outDir, true);
+    TarFanout fanout;
+    bool ok = fanout.run(selfExecutable() + " image-tar " + image, sinks);
+    if (!fanout.sourceError.empty()) {
+        std::cerr << COLOR_RED << "Reading the image failed: " << fanout.sourceError << COLOR_RESET << std::endl;
+    }
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& sink : sinks) {
+        if (sink.failed) {
+            std::cerr << COLOR_RED << sink.format << " failed: " << sink.error << COLOR_RESET << std::endl;
+            continue;
+        }
+        std::cout << COLOR_GREEN << std::left << std::setw(8) << sink.format << std::right << " " << sink.output << " "
+        << formatBytes(fileSize(sink.output)) << ", done after " << sink.finishedAfter << "s" << COLOR_RESET << std::endl;
+    }
+    double mbps = fanout.seconds > 0 ? fanout.bytesRead / 1048576.0 / fanout.seconds : 0;
+    std::cout << COLOR_CYAN << "Transcode: " << formatBytes(fanout.bytesRead) << " streamed in " << fanout.seconds << "s ("
+    << mbps << " MB/s), nothing written but the outputs" << COLOR_RESET << std::endl;
+    if (!ok || !bench) return ok ? 0 : 1;
+
+    // The round trip needs root to keep ownership, and disk for the tree
+    std::string scratch = outDir + "/.transcode-bench";
+    std::string output = outDir + "/roundtrip.sfs";
+    execute_command("sudo rm -rf " + scratch, true);
+    auto start = std::chrono::steady_clock::now();
+    int status = system(("sudo unsquashfs -q -n -d " + scratch + " " + image + " >/dev/null").c_str());
+    double extract = secondsSince(start);
+    uint64_t extracted = 0;
+    if (status == 0) {
+        FILE* du = popen(("sudo du -sb " + scratch + " 2>/dev/null").c_str(), "r");
+        if (du) {
+            unsigned long long bytes = 0;
+            if (fscanf(du, "%llu", &bytes) == 1) extracted = bytes;
+            pclose(du);
+        }
+        status = system(("sudo mksquashfs " + scratch + " " + output + " -noappend -quiet " +
+        (sfsArgs.empty() ? squashfsCompressionArgs() : sfsArgs) + " " + squashfsResourceArgs()).c_str());
+    }
+    double total = secondsSince(start);
+    execute_command("sudo rm -rf " + scratch + " " + output, true);
+    if (status != 0) {
+        std::cerr << COLOR_YELLOW << "unsquashfs + mksquashfs round trip failed; no comparison" << COLOR_RESET << std::endl;
+        return 0;
+    }
+    std::cout << COLOR_CYAN << "Round trip: " << total << "s (unsquashfs " << extract << "s, mksquashfs " << (total - extract)
+    << "s), " << formatBytes(extracted) << " written to disk in between" << COLOR_RESET << std::endl;
+    std::cout << COLOR_CYAN << "Transcode took " << (total > 0 ? 100.0 * fanout.seconds / total : 0.0)
+    << "% of the round trip time" << COLOR_RESET << std::endl;
+    return 0;
+}
 
-    std::string sourcePath = getUserInput("Enter folder or file path to clone: ");
-    if (sourcePath.empty()) {
-        std::cerr << COLOR_RED << "No path specified!" << COLOR_RESET << std::endl;
+// Exports the running system through the same bind mount the clone uses
+void exportCurrentSystem() {
+    if (config.cloneDir.empty()) {
+        std::cerr << COLOR_RED << "Set the clone directory first!" << COLOR_RESET << std::endl;
         return;
     }
+    std::string formats = getUserInput("Formats, comma separated (sfs,tar.zst,erofs): ");
+    if (formats.empty()) formats = "sfs,tar.zst,erofs";
+    std::string outDir = expandPath(getUserInput("Output directory (empty for " + getExportDirectory() + "): "));
+    if (outDir.empty()) outDir = getExportDirectory();
+    std::string compare = getUserInput("Time a sequential build of each format for comparison? (yes/no): ");
+
+    // The bind mount shows the whole system, including the export itself,
+    // the clone directory and cmi's caches and build trees
+    std::string cloneDir = expandPath(config.cloneDir);
+    std::vector<std::string> excludes = {"home/" + USERNAME + "/.config/cmi"};
+    for (const auto& path : {outDir, cloneDir}) {
+        if (path.size() > 1 && path[0] == '/') excludes.push_back(path.substr(1));
+    }
+    if (!mountSystemToCloneDir(cloneDir)) return;
+    exportFormats(cloneDir, outDir, formats, compare == "yes" || compare == "y", "clone_system_temp", excludes);
+    execute_command("sudo umount " + cloneDir, true);
+}
 
-    std::string checkCmd = "sudo test -e " + sourcePath + " > /dev/null 2>&1";
-    if (system(checkCmd.c_str()) != 0) {
-        std::cerr << COLOR_RED << "Source path does not exist: " << sourcePath << COLOR_RESET << std::endl;
+// Saves this machine's profile for hardware pruning; on other target
+// machines run "cmiimg hw-profile collect <host>.profile" and copy the
+// file into the same directory
+void collectHardwareProfile() {
+    execute_command("mkdir -p " + getHwProfileDir(), true);
+    char host[256] = "this-machine";
+    gethostname(host, sizeof(host) - 1);
+    std::string path = getHwProfileDir() + "/" + host + ".profile";
+    std::ofstream(path, std::ios::trunc) << HardwareProfile::collect();
+
+    HardwareProfile profile;
+    if (!profile.load(path)) {
+        std::cerr << COLOR_RED << "Failed to write " << path << COLOR_RESET << std::endl;
         return;
     }
-
-    std::string userfilesDir = cloneDir + "/home/userfiles";
-    execute_command("sudo mkdir -p " + userfilesDir, true);
-
-    std::cout << COLOR_CYAN << "Cloning " << sourcePath << " to " << userfilesDir << "..." << COLOR_RESET << std::endl;
-
-    std::string rsyncCmd = "sudo rsync -aHAXSr --numeric-ids --info=progress2 " +
-    sourcePath + " " + userfilesDir + "/";
-
-    execute_command(rsyncCmd, true);
-
-    std::cout << COLOR_GREEN << "Successfully cloned " << sourcePath << " to " << userfilesDir << "!" << COLOR_RESET << std::endl;
-
-    std::string listCmd = "sudo ls -la " + userfilesDir + " | head -20";
-    std::cout << COLOR_CYAN << "Contents of userfiles directory:" << COLOR_RESET << std::endl;
-    execute_command(listCmd, true);
+    std::cout << COLOR_GREEN << "Hardware profile written to " << path << " (" << profile.modaliases.size()
+    << " devices, " << profile.modules.size() << " loaded modules)" << COLOR_RESET << std::endl;
+    std::cout << COLOR_CYAN << "For other target machines run 'cmiimg hw-profile collect <host>.profile' there and copy the file to "
+    << getHwProfileDir() << COLOR_RESET << std::endl;
 }
 
-void showCloneOptionsMenu() {
-    std::vector<std::string> items = {
-        "Clone Current System (as it is now)",
-        "Clone Another Drive (e.g., /dev/sda2)",
-        "Clone Folder or File",
-        "Back to Main Menu"
-    };
-
+void showImageOptionsMenu() {
     int selected = 0;
     int key;
 
     while (true) {
-        key = showMenu("Clone Options - Select Source:", items, selected);
+        std::vector<std::string> items = {
+            std::string("Layered Base + Delta Images: ") + (config.layeredImages ? "ON" : "OFF"),
+            "Merge Layered Images",
+            std::string("Compressed Shard Cache: ") + (config.shardCache ? "ON" : "OFF"),
+            "Shard Cache Size: " + std::to_string(config.shardCacheGB) + " GiB",
+            std::string("Verify Images After Build: ") + (config.verifyImages ? "ON" : "OFF"),
+            "Image Composition Profile",
+            std::string("Hot/Cold Tiered Images: ") + (config.tieredImages ? "ON" : "OFF"),
+            "Hot Image Compression: " + config.hotCompression,
+            "Hot Image Size Limit: " + std::to_string(config.hotSetMB) + " MiB",
+            "Boot Time Comparison",
+            "Compression Workers: " + (config.compressionWorkers.empty() ? std::string("OFF") : config.compressionWorkers),
+            std::string("Resumable Builds: ") + (config.resumableBuilds ? "ON" : "OFF"),
+            "Multi-Format Export",
+            "Image Read Benchmark",
+            std::string("Hardware Pruning: ") + (config.hwPrune ? "ON" : "OFF"),
+            "Hardware Classes: " + (config.hwClasses.empty() ? std::string("none") : config.hwClasses),
+            "Collect This Machine's Hardware Profile",
+            std::string("Persistence Partition: ") + (config.persistence ? "ON" : "OFF"),
+            "Persistence Filesystem: " + config.persistFs,
+            "Persistence Size In ISO: " + std::to_string(config.persistMB) + " MiB",
+            std::string("Reproducible Builds: ") + (config.reproducible ? "ON" : "OFF"),
+            "ESP Source Directory: " + (config.espDir.empty() ? std::string("tree's EFI directory") : config.espDir),
+            "Back to Main Menu"
+        };
+
+        key = showMenu("Image Options:", items, selected);
 
         switch (key) {
             case 'A':
@@ -1171,36 +3343,148 @@ void showCloneOptionsMenu() {
                 if (selected < static_cast<int>(items.size()) - 1) selected++;
                 break;
             case '\n':
-                if (config.cloneDir.empty()) {
-                    std::cerr << COLOR_RED << "Clone directory not set! Please set it in Setup Scripts menu." << COLOR_RESET << std::endl;
-                    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-                    getch();
-                    break;
-                }
-
-                std::string cloneDir = expandPath(config.cloneDir);
-                execute_command("sudo mkdir -p " + cloneDir, true);
-
                 switch (selected) {
                     case 0:
-                        cloneCurrentSystem(cloneDir);
+                        config.layeredImages = !config.layeredImages;
+                        if (config.layeredImages) config.shardCache = config.tieredImages = config.resumableBuilds = false;
+                        saveConfig();
                         break;
                     case 1:
-                        cloneAnotherDrive(cloneDir);
+                        mergeLayeredImages();
+                        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                        getch();
                         break;
                     case 2:
-                        cloneFolderOrFile(cloneDir);
-                        std::cout << COLOR_YELLOW << "Folder/File cloned to " << cloneDir << "/home/userfiles" << COLOR_RESET << std::endl;
-                        std::cout << COLOR_YELLOW << "You can now create an ISO that includes these files." << COLOR_RESET << std::endl;
+                        config.shardCache = !config.shardCache;
+                        if (config.shardCache) config.layeredImages = config.tieredImages = false;
+                        saveConfig();
                         break;
-                    case 3:
+                    case 3: {
+                        std::string size = getUserInput("Enter shard cache size in GiB (e.g., 20): ");
+                        try {
+                            config.shardCacheGB = std::max(1, std::stoi(size));
+                            saveConfig();
+                        } catch (...) {
+                            std::cerr << COLOR_RED << "Invalid input!" << COLOR_RESET << std::endl;
+                        }
+                        break;
+                    }
+                    case 4:
+                        config.verifyImages = !config.verifyImages;
+                        saveConfig();
+                        break;
+                    case 5:
+                        profileCurrentImages();
+                        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                        getch();
+                        break;
+                    case 6:
+                        config.tieredImages = !config.tieredImages;
+                        if (config.tieredImages) config.layeredImages = config.shardCache = config.resumableBuilds = false;
+                        saveConfig();
+                        break;
+                    case 7:
+                        config.hotCompression = config.hotCompression == "lz4" ? "none" : "lz4";
+                        saveConfig();
+                        break;
+                    case 8: {
+                        std::string size = getUserInput("Enter the hot image size limit in MiB (e.g., 768): ");
+                        try {
+                            config.hotSetMB = std::max(16, std::stoi(size));
+                            saveConfig();
+                        } catch (...) {
+                            std::cerr << COLOR_RED << "Invalid input!" << COLOR_RESET << std::endl;
+                        }
+                        break;
+                    }
+                    case 9:
+                        showBootTimeReport({getBootTimeLogPath()});
+                        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                        getch();
+                        break;
+                    case 10:
+                        std::cout << COLOR_CYAN << "Workers compress cache-missed shards (needs the shard cache)." << std::endl
+                        << "local:N starts N workers here, ssh:[user@]host runs 'cmiimg worker --stdio' there," << std::endl
+                        << "tcp:host:port connects to 'cmiimg worker --listen [address:]port'," << std::endl
+                        << "with the same CMI_WORKER_TOKEN set on both machines." << COLOR_RESET << std::endl;
+                        config.compressionWorkers = getUserInput("Enter workers, comma separated (empty for none): ");
+                        saveConfig();
+                        break;
+                    case 11:
+                        config.resumableBuilds = !config.resumableBuilds;
+                        if (config.resumableBuilds) config.layeredImages = config.tieredImages = false;
+                        saveConfig();
+                        break;
+                    case 12:
+                        exportCurrentSystem();
+                        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                        getch();
+                        break;
+                    case 13:
+                        benchCurrentImages();
+                        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                        getch();
+                        break;
+                    case 14:
+                        config.hwPrune = !config.hwPrune;
+                        saveConfig();
+                        break;
+                    case 15: {
+                        std::string known;
+                        for (const auto& [name, hwClass] : HardwarePruner::classes()) known += (known.empty() ? "" : ", ") + name;
+                        std::cout << COLOR_CYAN << "Classes keep every driver of that kind, for machines without a profile:" << std::endl
+                        << known << COLOR_RESET << std::endl;
+                        config.hwClasses = getUserInput("Enter classes, comma separated (empty for none): ");
+                        saveConfig();
+                        break;
+                    }
+                    case 16:
+                        collectHardwareProfile();
+                        std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                        getch();
+                        break;
+                    case 17:
+                        config.persistence = !config.persistence;
+                        if (config.persistence) {
+                            installLayersHook();
+                            std::cout << COLOR_CYAN << "Rebuild the image so it boots through cmi_layers, which mounts the"
+                            << " persistence partition." << COLOR_RESET << std::endl;
+                            std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                            getch();
+                        }
+                        saveConfig();
+                        break;
+                    case 18:
+                        config.persistFs = config.persistFs == "ext4" ? "btrfs" : "ext4";
+                        saveConfig();
+                        break;
+                    case 19: {
+                        std::string size = getUserInput("Enter the persistence size in the ISO in MiB (min 128): ");
+                        try {
+                            config.persistMB = std::max(128, std::stoi(size));
+                            saveConfig();
+                        } catch (...) {
+                            std::cerr << COLOR_RED << "Invalid input!" << COLOR_RESET << std::endl;
+                        }
+                        break;
+                    }
+                    case 20:
+                        config.reproducible = !config.reproducible;
+                        if (config.reproducible) {
+                            std::cout << COLOR_CYAN << "Dates are pinned to SOURCE_DATE_EPOCH, or to the last package change ("
+                            << sourceDateEpoch() << "). 'cmiimg verify-repro' builds twice and compares." << COLOR_RESET << std::endl;
+                            std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
+                            getch();
+                        }
+                        saveConfig();
+                        break;
+                    case 21:
+                        config.espDir = getUserInput("Enter a directory holding the EFI partition contents (empty for the tree's EFI directory): ");
+                        saveConfig();
+                        break;
+                    case 22:
                         return;
                 }
-
-                if (selected != 3) {
-                    std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
-                    getch();
-                }
                 break;
         }
     }
@@ -1253,6 +3537,7 @@ void showMainMenu() {
         "Setup Scripts",
         "Create Image",
         "Create ISO",
+        "Image Options",
         "Show Disk Usage",
         "Install ISO to USB",
         "CMI BTRFS/EXT4 Installer",
@@ -1301,23 +3586,26 @@ void showMainMenu() {
                         createISO();
                         break;
                     case 5:
+                        showImageOptionsMenu();
+                        break;
+                    case 6:
                         execute_command("df -h");
                         std::cout << COLOR_GREEN << "\nPress any key to continue..." << COLOR_RESET;
                         getch();
                         break;
-                    case 6:
+                    case 7:
                         installISOToUSB();
                         break;
-                    case 7:
+                    case 8:
                         runCMIInstaller();
                         break;
-                    case 8:
+                    case 9:
                         runCalamares();
                         break;
-                    case 9:
+                    case 10:
                         updateScript();
                         break;
-                    case 10:
+                    case 11:
                         return;
                 }
                 break;
@@ -1325,6 +3613,515 @@ void showMainMenu() {
     }
 }
 
+// First byte at which two files differ, or -1 if they are identical
+int64_t firstDifference(const std::string& a, const std::string& b) {
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    if (!fa || !fb) return 0;
+    std::vector<char> ba(1 << 20), bb(1 << 20);
+    int64_t offset = 0;
+    while (true) {
+        fa.read(ba.data(), ba.size());
+        fb.read(bb.data(), bb.size());
+        std::streamsize na = fa.gcount(), nb = fb.gcount();
+        std::streamsize n = std::min(na, nb);
+        for (std::streamsize i = 0; i < n; i++) {
+            if (ba[i] != bb[i]) return offset + i;
+        }
+        if (na != nb) return offset + n;
+        if (na == 0) return -1;
+        offset += na;
+    }
+}
+
+// Builds the image of root, and the ISO of the build tree when there is
+// one, twice with the reproducible settings and compares the results.
+// Mismatching outputs stay in the state directory for diffoscope.
+int verifyReproducible(const std::string& root) {
+    std::string epoch = std::to_string(static_cast<long long>(sourceDateEpoch()));
+    setenv("SOURCE_DATE_EPOCH", epoch.c_str(), 1);
+    std::string dir = getLayerStateDir() + "/repro";
+    execute_command("sudo rm -rf " + dir + " && mkdir -p " + dir, true);
+    std::cout << COLOR_CYAN << "Building twice with SOURCE_DATE_EPOCH=" << epoch << COLOR_RESET << std::endl;
+
+    // The running system is read through the same bind mount as a real
+    // build, which hides /proc, /sys, /run and other mounts. cmi's own
+    // state (where image a sits while b is built) and the logs written
+    // meanwhile are left out; -wildcards makes the dev/* style excludes match.
+    std::string source = root;
+    std::string excludes;
+    bool mounted = false;
+    if (root == "/") {
+        std::string cloneDir = expandPath(config.cloneDir);
+        if (!cloneDir.empty() && mountSystemToCloneDir(cloneDir)) {
+            source = cloneDir;
+            mounted = true;
+        }
+        excludes = " -wildcards" + squashfsExcludeArgs() + " -e home/" + USERNAME + "/.config/cmi -e 'var/log/*'";
+    } else if (dir.compare(0, root.size() + 1, root + "/") == 0) {
+        excludes = " -e " + dir.substr(root.size() + 1);
+    }
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> outputs;
+    std::vector<std::string> images;
+    for (const char* run : {"a", "b"}) {
+        std::string image = dir + "/rootfs-" + run + ".img";
+        auto start = std::chrono::steady_clock::now();
+        std::string command = "sudo mksquashfs " + source + " " + image + " -noappend -quiet " + squashfsCompressionArgs() + " " +
+        squashfsResourceArgs() + excludes;
+        if (system(command.c_str()) != 0) {
+            std::cerr << COLOR_RED << "mksquashfs failed" << COLOR_RESET << std::endl;
+            if (mounted) execute_command("sudo umount " + source, true);
+            return 1;
+        }
+        std::cout << COLOR_CYAN << "Image " << run << ": " << formatBytes(fileSize(image)) << " in " << std::fixed
+        << std::setprecision(1) << secondsSince(start) << "s" << COLOR_RESET << std::endl;
+        images.push_back(image);
+    }
+    if (mounted) execute_command("sudo umount " + source, true);
+    outputs.push_back({"SquashFS image", images});
+
+    if (fileExists(BUILD_DIR + "/boot/grub/grub.cfg")) {
+        std::vector<std::string> isos;
+        for (const char* run : {"a", "b"}) {
+            std::string iso = dir + "/image-" + run + ".iso";
+            if (system(("sudo " + reproducibleEnv() + selfExecutable() + " write-iso grub2 " + BUILD_DIR + " " + iso + " \"" +
+                config.isoTag + "\" > /dev/null").c_str()) != 0) {
+                std::cerr << COLOR_RED << "Writing the ISO failed" << COLOR_RESET << std::endl;
+                return 1;
+            }
+            isos.push_back(iso);
+        }
+        outputs.push_back({"ISO", isos});
+    }
+
+    bool identical = true;
+    for (const auto& [name, files] : outputs) {
+        int64_t diff = firstDifference(files[0], files[1]);
+        if (diff < 0) {
+            std::cout << COLOR_GREEN << name << ": identical (" << formatBytes(fileSize(files[0])) << ")" << COLOR_RESET << std::endl;
+            execute_command("sudo rm -f " + files[0] + " " + files[1], true);
+        } else {
+            identical = false;
+            std::cout << COLOR_RED << name << ": differs from byte " << diff << " - kept " << files[0] << " and " << files[1]
+            << COLOR_RESET << std::endl;
+        }
+    }
+    return identical ? 0 : 1;
+}
+
+// Writes the ISO in-process with a progress line; the boot layout lives
+// in isowriter.h so every variant gets the same flags
+int writeIsoImage(const IsoLayout& layout, const std::string& output) {
+    std::cout << COLOR_CYAN << "Writing " << output << "..." << COLOR_RESET << std::endl;
+    IsoWriter writer;
+    int lastPercent = -1;
+    auto start = std::chrono::steady_clock::now();
+    writer.progress = [&](uint64_t done, uint64_t total) {
+        int percent = total ? static_cast<int>(done * 100 / total) : 0;
+        if (percent == lastPercent) return;
+        lastPercent = percent;
+        double seconds = secondsSince(start);
+        std::cout << "\r" << COLOR_CYAN << percent << "% (" << formatBytes(done) << " of " << formatBytes(total) << ", "
+        << std::fixed << std::setprecision(0) << (seconds > 0 ? done / 1048576.0 / seconds : 0) << " MB/s)   " << COLOR_RESET << std::flush;
+    };
+    bool ok = writer.write(layout, output);
+    std::cout << std::endl;
+    if (!ok) {
+        std::cerr << COLOR_RED << "ISO creation failed: " << writer.error << COLOR_RESET << std::endl;
+        return 1;
+    }
+    std::cout << COLOR_GREEN << "Wrote " << formatBytes(writer.bytesWritten) << " in " << std::fixed << std::setprecision(1)
+    << writer.seconds << "s" << COLOR_RESET << std::endl;
+    if (writer.reflinkedBytes > 0) {
+        std::cout << COLOR_CYAN << formatBytes(writer.reflinkedBytes) << " of the squashfs shared with the build tree (reflink), "
+        << formatBytes(writer.bytesWritten - writer.reflinkedBytes) << " written" << COLOR_RESET << std::endl;
+    } else if (writer.copiedPayloadBytes > 0) {
+        std::cout << COLOR_YELLOW << "The filesystem cannot share extents, so the squashfs was copied" << COLOR_RESET << std::endl;
+    }
+    return 0;
+}
+
+void printUsage() {
+    std::cout << "Usage: cmiimg [command]\n\n"
+    << "Without a command the interactive menu is started.\n\n"
+    << "Available commands:\n"
+    << COLOR_CYAN
+    << "  merge                   - Flatten rootfs-delta.img into rootfs.img\n"
+    << "  manifest <dir> <file>   - Write a metadata manifest of <dir>\n"
+    << "  shard-plan <dir> <state> <memo> <args>\n"
+    << "                          - Hash <dir> and plan compressed-shard layers\n"
+    << "  hash-manifest <dir> <manifest> <hashes> <memo> [mount]\n"
+    << "                          - Record metadata and content hashes of <dir>\n"
+    << "  verify <full|layer> <source> <manifest> <hashes> <image>...\n"
+    << "                          - Check images block by block against a manifest\n"
+    << "  profile <json> [image...]\n"
+    << "                          - Write where the bytes of the images go as JSON\n"
+    << "  image-diff [--content] [--json <file>] <old> <new>\n"
+    << "                          - List added, removed and changed paths between two images\n"
+    << "  hot-set <dir> <state> <limitMB> <seeds> <mount> [trace]\n"
+    << "                          - Split <dir> into hot and cold tar lists\n"
+    << "  worker <--stdio | --listen [address:]port> [--cache dir | --no-cache] [--share n]\n"
+    << "                          - Compress shards sent by another cmiimg; --listen binds\n"
+    << "                            127.0.0.1 unless given an address, and needs\n"
+    << "                            CMI_WORKER_TOKEN to listen anywhere else\n"
+    << "  boot-time record [log] [label]\n"
+    << "                          - Log how long this live boot took\n"
+    << "  boot-time report [log...]\n"
+    << "                          - Compare boot-to-desktop time per image layout\n"
+    << "  export [--compare] [--formats sfs,tar.zst,erofs] <dir> <outdir>\n"
+    << "                          - Write several image formats from one read of <dir>\n"
+    << "  transcode [--formats sfs,tar.zst,erofs] [--sfs-args <args>] [--bench] <image> <outdir>\n"
+    << "                          - Re-encode a SquashFS image without extracting it\n"
+    << "  image-tar <image>       - Write a SquashFS image to stdout as a tar stream\n"
+    << "  tar-dir-times           - Copy a tar stream from stdin to stdout with directory dates zeroed\n"
+    << "  image-bench [--trace <list>] [--reads n] <image>...\n"
+    << "                          - Time cold and warm reads from mounted images\n"
+    << "  write-iso grub2 <tree> <iso> <volid> [persistence image]\n"
+    << "  write-iso isolinux <tree> <iso> <volid> <isohdpfx.bin> <efi image in tree>\n"
+    << "                          - Write a hybrid BIOS/UEFI ISO of <tree>\n"
+    << "  verify-repro [dir]      - Build the image of <dir> (default /) and the ISO twice and compare\n"
+    << "  esp-image <dir> <image> [label]\n"
+    << "                          - Write a FAT EFI partition image holding <dir> (createISO does this)\n"
+    << "  chunk-index <iso>       - Write <iso>.cmidx for delta downloads (createISO does this)\n"
+    << "  delta-fetch [--no-checksum] <iso url> <old iso> [output]\n"
+    << "                          - Rebuild a published ISO from an older one, downloading only changed chunks\n"
+    << "  hw-profile collect [file]\n"
+    << "                          - Record this machine's devices and modules for pruning\n"
+    << "\nHelper commands that scan a tree accept --prune <list> to leave the listed paths out.\n"
+    << COLOR_RESET;
+}
+
+// Manifest scan for helper commands, minus the paths of a --prune list
+bool scanSourceTree(TreeManifest& manifest, const std::string& root, const std::vector<std::string>& excludes) {
+    if (!manifest.scan(root, excludes)) return false;
+    HardwarePruner::filter(manifest.entries, PRUNED_PATHS);
+    return true;
+}
+
+int runCommandLine(int argc, char *argv[]) {
+    // --prune <list> can follow any command; the listed paths are left out
+    // of manifest scans so they match a hardware-pruned image
+    std::vector<char*> args;
+    for (int i = 0; i < argc; i++) {
+        if (std::string(argv[i]) == "--prune" && i + 1 < argc) {
+            std::ifstream list(argv[++i]);
+            std::string path;
+            while (std::getline(list, path)) {
+                if (!path.empty()) PRUNED_PATHS.insert(path);
+            }
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    argc = static_cast<int>(args.size());
+    args.push_back(nullptr);
+    argv = args.data();
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+    std::string command = argv[1];
+
+    if (command == "merge") {
+        loadConfig();
+        return mergeLayeredImages() ? 0 : 1;
+    }
+    if (command == "manifest" && argc >= 4) {
+        TreeManifest manifest;
+        if (!scanSourceTree(manifest, argv[2], SQUASHFS_EXCLUDES) || !manifest.save(argv[3])) {
+            std::cerr << COLOR_RED << "Failed to write manifest of " << argv[2] << COLOR_RESET << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "shard-plan" && argc >= 6) {
+        std::string stateDir = argv[3];
+        TreeManifest manifest;
+        if (!scanSourceTree(manifest, argv[2], SQUASHFS_EXCLUDES)) return 1;
+        ShardPlan plan = ShardPlanner::plan(argv[2], manifest, argv[5], argv[4]);
+
+        std::ofstream planFile(stateDir + "/shard.plan", std::ios::trunc);
+        planFile << "stats " << plan.hashedFiles << " " << plan.hashedBytes << " " << plan.memoHits << "\n";
+        for (size_t i = 0; i < plan.shards.size(); i++) {
+            std::string listFile = stateDir + "/shard-" + std::to_string(i) + ".list";
+            LayerManager::writeTarList(plan.shards[i].paths, listFile);
+            planFile << "shard " << plan.shards[i].key << " " << plan.shards[i].bytes << " " << listFile << "\n";
+        }
+        return planFile.good() ? 0 : 1;
+    }
+    if (command == "hash-manifest" && argc >= 6) {
+        TreeManifest manifest;
+        ContentHashes hashes;
+        ShardPlan stats;
+        if (!scanSourceTree(manifest, argv[2], squashfsExcludes(argc >= 7 ? argv[6] : "clone_system_temp"))) return 1;
+        ShardPlanner::hashFiles(argv[2], manifest, argv[5], hashes.hashes, stats);
+        if (!manifest.save(argv[3]) || !hashes.save(argv[4])) {
+            std::cerr << COLOR_RED << "Failed to write manifest of " << argv[2] << COLOR_RESET << std::endl;
+            return 1;
+        }
+        std::cout << COLOR_CYAN << manifest.entries.size() << " entries, " << stats.hashedFiles << " files hashed ("
+        << formatBytes(stats.hashedBytes) << "), " << stats.memoHits << " unchanged" << COLOR_RESET << std::endl;
+        return 0;
+    }
+    if (command == "verify" && argc >= 7) {
+        TreeManifest manifest;
+        ContentHashes hashes;
+        if (!manifest.load(argv[4]) || !hashes.load(argv[5])) {
+            std::cerr << COLOR_RED << "Cannot read manifest " << argv[4] << COLOR_RESET << std::endl;
+            return 1;
+        }
+        std::vector<std::string> images(argv + 6, argv + argc);
+        auto start = std::chrono::steady_clock::now();
+        // Reproducible images carry the epoch as every inode date
+        time_t pinnedTime = getenv("SOURCE_DATE_EPOCH") ? sourceDateEpoch() : 0;
+        VerifyReport report = ImageVerifier::verify(images, manifest, hashes, std::string(argv[2]) == "full", argv[3], pinnedTime);
+        double seconds = secondsSince(start);
+
+        std::cout << COLOR_CYAN << report.entries << " entries, " << report.files << " files, " << report.blocks
+        << " blocks, " << formatBytes(report.bytes) << " checked in " << std::fixed << std::setprecision(1) << seconds << "s ("
+        << formatBytes(static_cast<uint64_t>(static_cast<double>(report.bytes) / std::max(seconds, 0.001))) << "/s)"
+        << COLOR_RESET << std::endl;
+        if (!report.changedDuringBuild.empty()) {
+            std::cout << COLOR_YELLOW << report.changedDuringBuild.size() << " paths changed on the running system during the build:" << COLOR_RESET << std::endl;
+            for (size_t i = 0; i < report.changedDuringBuild.size() && i < 10; i++) {
+                std::cout << COLOR_YELLOW << "  " << report.changedDuringBuild[i] << COLOR_RESET << std::endl;
+            }
+        }
+        for (const auto& error : report.errors) {
+            std::cerr << COLOR_RED << error << COLOR_RESET << std::endl;
+        }
+        if (report.ok()) std::cout << COLOR_GREEN << "Image verification passed" << COLOR_RESET << std::endl;
+        return report.ok() ? 0 : 1;
+    }
+
+    if (command == "profile" && argc >= 3) {
+        loadConfig();
+        std::vector<std::string> images(argv + 3, argv + argc);
+        if (images.empty()) images = currentImages();
+        ImageProfile profile;
+        if (!buildImageProfile(images, profile)) return 1;
+        std::ofstream json(argv[2], std::ios::trunc);
+        json << profile.toJson();
+        return json.good() ? 0 : 1;
+    }
+
+    if (command == "worker" && argc >= 3) {
+        CompressionWorker worker;
+        const char* home = getenv("HOME");
+        worker.cacheDir = std::string(home ? home : "/tmp") + "/.cache/cmi-worker";
+        unsigned share = 1;
+        int port = 0;
+        std::string address = "127.0.0.1";
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--listen" && i + 1 < argc) {
+                std::string spec = argv[++i];
+                size_t colon = spec.rfind(':');
+                if (colon != std::string::npos) {
+                    address = spec.substr(0, colon);
+                    if (address.size() > 1 && address.front() == '[' && address.back() == ']') {
+                        address = address.substr(1, address.size() - 2);
+                    }
+                }
+                port = std::atoi(spec.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+            }
+            else if (arg == "--cache" && i + 1 < argc) worker.cacheDir = argv[++i];
+            else if (arg == "--no-cache") worker.cacheDir.clear();
+            else if (arg == "--share" && i + 1 < argc) share = std::max(1, std::atoi(argv[++i]));
+        }
+        for (size_t slash = 1; !worker.cacheDir.empty() && slash != std::string::npos; ) {
+            slash = worker.cacheDir.find('/', slash + 1);
+            mkdir(worker.cacheDir.substr(0, slash).c_str(), 0755);
+        }
+        SquashfsPlan plan = ResourcePlanner::plan(CompressorSpec());
+        plan.processors = std::max(1u, plan.processors / share);
+        plan.cacheMB = std::max<uint64_t>(ResourcePlanner::MIN_CACHE_MB, plan.cacheMB / share);
+        worker.resourceArgs = plan.resourceArgs();
+        if (port > 0) {
+            // ssh workers are already authenticated; only the socket needs a token
+            if (const char* token = getenv("CMI_WORKER_TOKEN")) worker.token = token;
+            if (worker.token.empty() && !CompressionWorker::isLoopback(address)) {
+                std::cerr << "Set CMI_WORKER_TOKEN before listening on " << address << std::endl;
+                return 1;
+            }
+            if (worker.token.empty()) std::cerr << "No CMI_WORKER_TOKEN set - the worker cache is off" << std::endl;
+            std::cerr << "cmiimg worker listening on " << address << " port " << port << std::endl;
+            return worker.listenOn(address, port);
+        }
+        return worker.serve(0, 1);
+    }
+    if (command == "hot-set" && argc >= 7) {
+        std::string stateDir = argv[3];
+        TreeManifest manifest;
+        if (!scanSourceTree(manifest, argv[2], squashfsExcludes(argv[6]))) return 1;
+        std::vector<std::string> seeds = HotSetPlanner::defaultSeeds();
+        std::vector<std::string> userSeeds = HotSetPlanner::readSeeds(argv[5]);
+        seeds.insert(seeds.end(), userSeeds.begin(), userSeeds.end());
+
+        time_t bootTime = 0;
+        if (argc >= 8 && std::string(argv[7]) == "trace") {
+            std::ifstream stat("/proc/stat");
+            std::string key;
+            while (stat >> key) {
+                if (key == "btime") {
+                    stat >> bootTime;
+                    break;
+                }
+            }
+        }
+        uint64_t limit = std::strtoull(argv[4], nullptr, 10) << 20;
+        HotSet set = HotSetPlanner::plan(argv[2], manifest, seeds, limit, bootTime);
+        if (!LayerManager::writeTarList(set.hot, stateDir + "/hot.list") || !LayerManager::writeTarList(set.cold, stateDir + "/cold.list")) {
+            return 1;
+        }
+
+        std::ofstream plan(stateDir + "/hot.plan", std::ios::trunc);
+        plan << "Hot set: " << (set.seeded + set.libraries + set.traced) << " files, " << formatBytes(set.hotBytes)
+        << " (" << set.seeded << " boot files, " << set.libraries << " libraries, " << set.traced << " read since boot";
+        if (set.traceIgnored) plan << ", boot trace skipped because most files were read since boot";
+        if (set.skipped) plan << ", " << set.skipped << " over the limit";
+        plan << "); cold set: " << formatBytes(set.coldBytes) << "\n";
+        return plan.good() ? 0 : 1;
+    }
+    if (command == "boot-time" && argc >= 3 && std::string(argv[2]) == "record") {
+        return recordBootTime(argc >= 4 ? argv[3] : getBootTimeLogPath(), argc >= 5 ? argv[4] : "");
+    }
+    if (command == "boot-time" && argc >= 3 && std::string(argv[2]) == "report") {
+        std::vector<std::string> logs(argv + 3, argv + argc);
+        if (logs.empty()) logs.push_back(getBootTimeLogPath());
+        showBootTimeReport(logs);
+        return 0;
+    }
+    if (command == "image-diff") {
+        bool contentCheck = false;
+        std::string jsonPath;
+        std::vector<std::string> images;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--content") contentCheck = true;
+            else if (arg == "--json" && i + 1 < argc) jsonPath = argv[++i];
+            else images.push_back(arg);
+        }
+        if (images.size() == 2) return diffImages(images[0], images[1], contentCheck, jsonPath);
+    }
+    if (command == "export") {
+        bool compare = false;
+        std::string formats = "sfs,tar.zst,erofs";
+        std::vector<std::string> dirs;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--compare") compare = true;
+            else if (arg == "--formats" && i + 1 < argc) formats = argv[++i];
+            else dirs.push_back(arg);
+        }
+        if (dirs.size() == 2) return exportFormats(dirs[0], dirs[1], formats, compare);
+    }
+    if (command == "image-bench") {
+        std::string tracePath;
+        size_t reads = 2000;
+        std::vector<std::string> images;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+            else if (arg == "--reads" && i + 1 < argc) reads = std::max(1, std::atoi(argv[++i]));
+            else images.push_back(arg);
+        }
+        if (!images.empty()) return benchImages(images, tracePath, reads);
+    }
+    if (command == "image-tar" && argc == 3) {
+        return writeImageAsTar(argv[2]);
+    }
+    if (command == "tar-dir-times" && argc == 2) {
+        std::string error;
+        if (!TarDirectoryTimes::filter(STDIN_FILENO, STDOUT_FILENO, 0, error)) {
+            std::cerr << COLOR_RED << "tar-dir-times: " << error << COLOR_RESET << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "transcode") {
+        bool bench = false;
+        std::string formats = "sfs", sfsArgs;
+        std::vector<std::string> paths;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--bench") bench = true;
+            else if (arg == "--formats" && i + 1 < argc) formats = argv[++i];
+            else if (arg == "--sfs-args" && i + 1 < argc) sfsArgs = argv[++i];
+            else paths.push_back(arg);
+        }
+        if (paths.size() == 2) return transcodeImage(paths[0], paths[1], formats, sfsArgs, bench);
+    }
+    if (command == "verify-repro" && argc <= 3) {
+        return verifyReproducible(argc == 3 ? argv[2] : "/");
+    }
+    if (command == "delta-fetch") {
+        bool requireChecksum = true;
+        std::vector<std::string> args;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--no-checksum") requireChecksum = false;
+            else args.push_back(arg);
+        }
+        if (args.size() == 2 || args.size() == 3) {
+            return deltaFetchIso(args[0], args[1], args.size() == 3 ? args[2] : "", requireChecksum);
+        }
+    }
+    if (command == "esp-image" && (argc == 4 || argc == 5)) {
+        FatImage esp;
+        if (argc == 5) esp.label = argv[4];
+        if (getenv("SOURCE_DATE_EPOCH")) esp.timestamp = sourceDateEpoch();
+        if (!esp.add(argv[2], "") || !esp.write(argv[3])) {
+            std::cerr << COLOR_RED << "Failed to write " << argv[3] << ": " << esp.error << COLOR_RESET << std::endl;
+            return 1;
+        }
+        std::cout << COLOR_GREEN << "FAT" << esp.fatBits << " image of " << esp.clusterCount << " clusters, "
+        << formatBytes(esp.imageSize) << ", written to " << argv[3] << COLOR_RESET << std::endl;
+        return 0;
+    }
+    if (command == "chunk-index" && argc == 3) {
+        ChunkIndex index;
+        if (!index.build(argv[2]) || !index.save(std::string(argv[2]) + ".cmidx")) {
+            std::cerr << COLOR_RED << "Failed to index " << argv[2] << COLOR_RESET << std::endl;
+            return 1;
+        }
+        std::cout << COLOR_GREEN << index.chunks.size() << " chunks written to " << argv[2] << ".cmidx" << COLOR_RESET << std::endl;
+        return 0;
+    }
+    if (command == "write-iso" && argc >= 6) {
+        std::string boot = argv[2];
+        if (boot == "grub2" && (argc == 6 || argc == 7)) {
+            IsoLayout layout = IsoLayout::grub2(argv[3], argv[5]);
+            if (argc == 7) layout.persistImage = argv[6];
+            if (getenv("SOURCE_DATE_EPOCH")) layout.timestamp = sourceDateEpoch();
+            return writeIsoImage(layout, argv[4]);
+        }
+        if (boot == "isolinux" && argc == 8) {
+            IsoLayout layout = IsoLayout::isolinux(argv[3], argv[5], argv[6], argv[7]);
+            if (getenv("SOURCE_DATE_EPOCH")) layout.timestamp = sourceDateEpoch();
+            return writeIsoImage(layout, argv[4]);
+        }
+    }
+    if (command == "hw-profile" && argc >= 3 && std::string(argv[2]) == "collect") {
+        std::string profile = HardwareProfile::collect();
+        if (argc == 3) {
+            std::cout << profile;
+            return 0;
+        }
+        std::ofstream out(argv[3], std::ios::trunc);
+        out << profile;
+        if (!out.good()) {
+            std::cerr << COLOR_RED << "Failed to write " << argv[3] << COLOR_RESET << std::endl;
+            return 1;
+        }
+        std::cout << COLOR_GREEN << "Hardware profile written to " << argv[3] << COLOR_RESET << std::endl;
+        return 0;
+    }
+
+    printUsage();
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
     // REMOVED: QCoreApplication app(argc, argv);
 
@@ -1338,6 +4135,10 @@ int main(int argc, char *argv[]) {
 
     BUILD_DIR = "/home/" + USERNAME + "/.config/cmi/build-image-arch-img";
 
+    if (argc > 1) {
+        return runCommandLine(argc, argv);
+    }
+
     std::string configDir = "/home/" + USERNAME + "/.config/cmi";
     execute_command("mkdir -p " + configDir, true);
 
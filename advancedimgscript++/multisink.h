@@ -0,0 +1,168 @@
+#ifndef MULTISINK_H
+#define MULTISINK_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// One encoder fed by the shared tar stream, e.g. mksquashfs -tar
+struct ExportSink {
+    std::string format;
+    std::string command;        // shell command reading a tar stream on stdin
+    std::string output;
+
+    uint64_t bytesIn = 0;
+    double stallSeconds = 0;    // time the reader spent waiting for this sink
+    double finishedAfter = 0;   // seconds from the start until it exited
+    bool failed = false;
+    std::string error;
+};
+
+// Reads a tar stream once and hands every chunk to all sinks. Chunks live
+// in a fixed ring, so the reader can only run depth chunks ahead of the
+// slowest sink; a sink that fails is dropped without stopping the others.
+class TarFanout {
+public:
+    size_t chunkSize = 1 << 20;
+    size_t depth = 64;
+
+    uint64_t bytesRead = 0;
+    double seconds = 0;
+    std::string sourceError;
+
+    bool run(const std::string& sourceCommand, std::vector<ExportSink>& sinks) {
+        struct sigaction ignore{}, previous{};
+        ignore.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignore, &previous);
+        auto start = std::chrono::steady_clock::now();
+
+        slots_.assign(depth, std::vector<char>(chunkSize));
+        lengths_.assign(depth, 0);
+        produced_ = 0;
+        eof_ = false;
+        positions_.assign(sinks.size(), 0);
+        live_.assign(sinks.size(), true);
+
+        std::vector<std::thread> threads;
+        for (size_t s = 0; s < sinks.size(); s++) {
+            threads.emplace_back([&, s]() { drain(sinks[s], s, start); });
+        }
+
+        // "e" keeps each pipe out of the other children, or a sink would
+        // never see end of file while a sibling still held its write end
+        FILE* source = popen(sourceCommand.c_str(), "re");
+        if (!source) sourceError = "cannot start " + sourceCommand;
+        while (source) {
+            size_t slot = produced_ % depth;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (true) {
+                    size_t slowest = SIZE_MAX;
+                    for (size_t s = 0; s < sinks.size(); s++) {
+                        if (live_[s] && (slowest == SIZE_MAX || positions_[s] < positions_[slowest])) slowest = s;
+                    }
+                    if (slowest == SIZE_MAX || produced_ - positions_[slowest] < depth) break;
+                    auto waitStart = std::chrono::steady_clock::now();
+                    changed_.wait(lock);
+                    sinks[slowest].stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+                }
+            }
+            size_t n = fread(slots_[slot].data(), 1, chunkSize, source);
+            if (n == 0) break;
+            std::lock_guard<std::mutex> lock(mutex_);
+            lengths_[slot] = n;
+            bytesRead += n;
+            produced_++;
+            changed_.notify_all();
+        }
+        if (source) {
+            int status = pclose(source);
+            if (status != 0) sourceError = "tar exited with status " + std::to_string(WEXITSTATUS(status));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            eof_ = true;
+            changed_.notify_all();
+        }
+        for (auto& t : threads) t.join();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sigaction(SIGPIPE, &previous, nullptr);
+
+        bool ok = sourceError.empty();
+        for (const auto& sink : sinks) ok = ok && !sink.failed;
+        return ok;
+    }
+
+private:
+    std::vector<std::vector<char>> slots_;
+    std::vector<size_t> lengths_;
+    std::vector<size_t> positions_;
+    std::vector<bool> live_;
+    size_t produced_ = 0;
+    bool eof_ = false;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+
+    void drain(ExportSink& sink, size_t index, std::chrono::steady_clock::time_point start) {
+        FILE* pipe = popen(sink.command.c_str(), "we");
+        if (!pipe) {
+            sink.failed = true;
+            sink.error = "cannot start " + sink.command;
+        }
+        int fd = pipe ? fileno(pipe) : -1;
+        while (pipe) {
+            const char* data;
+            size_t len;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [&]() { return positions_[index] < produced_ || eof_; });
+                if (positions_[index] == produced_) break;
+                size_t slot = positions_[index] % depth;
+                data = slots_[slot].data();
+                len = lengths_[slot];
+            }
+            // The slot cannot be refilled until this sink's position moves on
+            size_t done = 0;
+            while (done < len) {
+                ssize_t n = write(fd, data + done, len - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                done += static_cast<size_t>(n);
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (done < len) {
+                sink.failed = true;
+                sink.error = "stopped reading after " + std::to_string(sink.bytesIn + done) + " bytes";
+                break;
+            }
+            sink.bytesIn += len;
+            positions_[index]++;
+            changed_.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            live_[index] = false;
+            changed_.notify_all();
+        }
+        if (pipe) {
+            int status = pclose(pipe);
+            if (status != 0 && !sink.failed) {
+                sink.failed = true;
+                sink.error = "exited with status " + std::to_string(WEXITSTATUS(status));
+            }
+        }
+        sink.finishedAfter = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
+
+// What the caller would like mksquashfs to use before any budgeting.
+struct CompressorSpec {
+    std::string name = "zstd";  // zstd, xz, lz4, or none for uncompressed
+    int level = 22;             // zstd level; ignored for xz
+    uint64_t blockSize = 256ULL << 10;
+    int dictPercent = 100;      // xz dictionary size as % of block size
+    std::string extra;          // passed through untouched, e.g. "-Xbcj x86"
+};
+
+// Limits seen by this process and the mksquashfs parameters chosen for them.
+struct SquashfsPlan {
+    CompressorSpec requested;
+    CompressorSpec chosen;
+    unsigned cpus = 1;
+    uint64_t memAvailable = 0;
+    uint64_t cgroupLimit = 0;   // 0 when there is no cgroup memory limit
+    uint64_t budget = 0;
+    uint64_t perThreadBytes = 0;
+    unsigned processors = 1;
+    uint64_t cacheMB = 0;
+
+    // Options that change the compressed bytes
+    std::string compressorArgs() const {
+        std::ostringstream out;
+        if (chosen.name == "none") out << "-noI -noD -noF -noX";
+        else out << "-comp " << chosen.name;
+        if (chosen.name == "zstd") out << " -Xcompression-level " << chosen.level;
+        out << " -b " << (chosen.blockSize >> 10) << "K";
+        if (chosen.name == "xz") out << " -Xdict-size " << chosen.dictPercent << "%";
+        if (!chosen.extra.empty()) out << " " << chosen.extra;
+        return out.str();
+    }
+
+    // Options that only change how mksquashfs runs. The queues are
+    // allocated on top of -mem, so both come out of cacheMB: half for the
+    // block caches, the other half split between the queues.
+    std::string resourceArgs() const {
+        std::ostringstream out;
+        out << "-processors " << processors << " -mem " << cacheMB / 2 << "M"
+        << " -read-queue " << std::max<uint64_t>(4, cacheMB / 8)
+        << " -write-queue " << std::max<uint64_t>(4, cacheMB / 8)
+        << " -fragment-queue " << std::max<uint64_t>(4, cacheMB / 4);
+        return out.str();
+    }
+
+    bool downgraded() const {
+        return chosen.level != requested.level || chosen.dictPercent != requested.dictPercent;
+    }
+
+    std::string describe() const {
+        std::ostringstream out;
+        out << "cpus=" << cpus << " mem_available=" << (memAvailable >> 20) << "M"
+        << " cgroup_limit=" << (cgroupLimit ? std::to_string(cgroupLimit >> 20) + "M" : std::string("none"))
+        << " budget=" << (budget >> 20) << "M per_thread=" << (perThreadBytes >> 20) << "M"
+        << " | " << compressorArgs() << " " << resourceArgs();
+        return out.str();
+    }
+};
+
+// Fits mksquashfs threads, caches and compression level into the memory
+// and CPUs actually available, instead of its defaults of every CPU and a
+// quarter of physical RAM, which ignore both cgroups and other load.
+// With pinLevel the compressor settings are left as requested and only
+// threads give way: the shard cache keys on them and reproducible builds
+// must not depend on how much memory happened to be free.
+class ResourcePlanner {
+public:
+    static constexpr uint64_t MIN_CACHE_MB = 64;
+    static constexpr uint64_t MAX_CACHE_MB = 4096;
+    static constexpr int MIN_ZSTD_LEVEL = 9;
+    static constexpr int MIN_XZ_DICT_PERCENT = 25;
+
+    static SquashfsPlan plan(const CompressorSpec& spec, bool pinLevel = false) {
+        SquashfsPlan p;
+        p.requested = spec;
+        p.chosen = spec;
+        p.cpus = onlineCpus();
+        p.memAvailable = memAvailable();
+        p.cgroupLimit = cgroupMemoryHeadroom();
+
+        uint64_t usable = p.memAvailable;
+        if (p.cgroupLimit != 0) usable = std::min(usable, p.cgroupLimit);
+        // Leave room for the page cache feeding the reader and for the desktop
+        p.budget = usable / 10 * 7;
+
+        p.cacheMB = std::clamp<uint64_t>((p.budget / 3) >> 20, MIN_CACHE_MB, MAX_CACHE_MB);
+        uint64_t cacheBytes = p.cacheMB << 20;
+        uint64_t threadBudget = p.budget > cacheBytes ? p.budget - cacheBytes : 0;
+
+        // Give up compression ratio before giving up more than half the cores
+        unsigned wanted = std::max(1u, p.cpus / 2);
+        for (;;) {
+            p.perThreadBytes = perThreadBytes(p.chosen);
+            uint64_t fits = threadBudget / p.perThreadBytes;
+            p.processors = static_cast<unsigned>(std::clamp<uint64_t>(fits, 1, p.cpus));
+            if (p.processors >= wanted || pinLevel || !lowerOneStep(p.chosen)) break;
+        }
+        return p;
+    }
+
+    // Online CPUs this process may run on, capped by a cgroup cpu.max quota
+    static unsigned onlineCpus() {
+        unsigned cpus = 0;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) cpus = CPU_COUNT(&set);
+        if (cpus == 0) cpus = static_cast<unsigned>(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)));
+
+        std::ifstream cpuMax(cgroupDir() + "/cpu.max");
+        std::string quota;
+        uint64_t period = 0;
+        if (cpuMax >> quota >> period && quota != "max" && period > 0) {
+            uint64_t q = std::strtoull(quota.c_str(), nullptr, 10);
+            cpus = std::min<unsigned>(cpus, static_cast<unsigned>(std::max<uint64_t>(1, (q + period - 1) / period)));
+        }
+        return cpus;
+    }
+
+    static uint64_t memAvailable() {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string key;
+        uint64_t kb;
+        std::string unit;
+        while (meminfo >> key >> kb) {
+            std::getline(meminfo, unit);
+            if (key == "MemAvailable:") return kb << 10;
+        }
+        return static_cast<uint64_t>(sysconf(_SC_AVPHYS_PAGES)) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    // Smallest memory.max - memory.current along our cgroup v2 path, or the
+    // v1 limit. 0 means unlimited.
+    static uint64_t cgroupMemoryHeadroom() {
+        uint64_t headroom = 0;
+        std::string dir = cgroupDir();
+        while (dir.size() >= std::string("/sys/fs/cgroup").size()) {
+            uint64_t limit = readNumber(dir + "/memory.max");
+            if (limit != 0) {
+                uint64_t current = readNumber(dir + "/memory.current");
+                uint64_t room = limit > current ? limit - current : 0;
+                headroom = headroom == 0 ? room : std::min(headroom, room);
+            }
+            if (dir == "/sys/fs/cgroup") break;
+            dir = dir.substr(0, dir.rfind('/'));
+        }
+        if (headroom == 0) {
+            uint64_t v1 = readNumber("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+            // v1 reports "no limit" as a huge page-aligned number
+            if (v1 != 0 && v1 < (1ULL << 60)) {
+                uint64_t used = readNumber("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+                headroom = v1 > used ? v1 - used : 1;
+            }
+        }
+        return headroom;
+    }
+
+    // Rough working set of one compressor thread: input and output block
+    // plus the match finder, which grows with the window the level asks for.
+    // mksquashfs compresses each block on its own, so the window never
+    // exceeds the block size.
+    static uint64_t perThreadBytes(const CompressorSpec& spec) {
+        uint64_t block = spec.blockSize;
+        if (spec.name == "xz") {
+            uint64_t dict = std::max<uint64_t>(block * spec.dictPercent / 100, 8192);
+            return 2 * block + dict * 23 / 2 + (4ULL << 20);
+        }
+        if (spec.name == "zstd") {
+            uint64_t window = std::min<uint64_t>(block, 1ULL << zstdWindowLog(spec.level));
+            uint64_t factor = spec.level >= 16 ? 12 : spec.level >= 6 ? 8 : 4;
+            return 2 * block + window * factor + (1ULL << 20);
+        }
+        return 3 * block + (1ULL << 20);
+    }
+
+private:
+    static int zstdWindowLog(int level) {
+        if (level >= 20) return 27;
+        if (level >= 16) return 25;
+        if (level >= 10) return 23;
+        return 21;
+    }
+
+    static bool lowerOneStep(CompressorSpec& spec) {
+        if (spec.name == "zstd" && spec.level > MIN_ZSTD_LEVEL) {
+            spec.level = std::max(MIN_ZSTD_LEVEL, spec.level - 3);
+            return true;
+        }
+        if (spec.name == "xz" && spec.dictPercent > MIN_XZ_DICT_PERCENT) {
+            spec.dictPercent = std::max(MIN_XZ_DICT_PERCENT, spec.dictPercent / 2);
+            return true;
+        }
+        return false;
+    }
+
+    static std::string cgroupDir() {
+        std::ifstream cgroup("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(cgroup, line)) {
+            if (line.compare(0, 3, "0::") == 0) {
+                std::string rel = line.substr(3);
+                if (rel == "/") rel.clear();
+                return "/sys/fs/cgroup" + rel;
+            }
+        }
+        return "/sys/fs/cgroup";
+    }
+
+    static uint64_t readNumber(const std::string& path) {
+        std::ifstream in(path);
+        std::string value;
+        if (!(in >> value) || value == "max") return 0;
+        return std::strtoull(value.c_str(), nullptr, 10);
+    }
+};
+
+#endif
@@ -0,0 +1,387 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <tuple>
+
+#include "squashfs.h"
+
+// One line of the composition table: a top-level directory or a package.
+struct ProfileRow {
+    std::string name;
+    uint64_t files = 0;
+    uint64_t bytes = 0;         // uncompressed
+    uint64_t compressed = 0;    // data blocks plus a share of each fragment
+    uint64_t dedupSaved = 0;    // bytes not stored again (hardlinks, duplicates)
+    double cpuSeconds = 0;      // estimated compression CPU time
+    uint64_t sampledBytes = 0;
+    double sampledSeconds = 0;
+
+    double ratio() const {
+        return compressed == 0 ? 0.0 : static_cast<double>(bytes) / static_cast<double>(compressed);
+    }
+};
+
+struct ImageProfile {
+    std::string image;
+    std::string compressor;
+    uint64_t imageBytes = 0;
+    uint64_t metadataBytes = 0;
+    double sampledFraction = 0;
+    double cpuSeconds = 0;
+    std::vector<ProfileRow> dirs;
+    std::vector<ProfileRow> packages;
+
+    // Folds another image into this one, e.g. all layers of a layered build
+    void add(const ImageProfile& other) {
+        if (image.empty()) {
+            *this = other;
+            return;
+        }
+        image += "," + other.image;
+        imageBytes += other.imageBytes;
+        metadataBytes += other.metadataBytes;
+        cpuSeconds += other.cpuSeconds;
+        sampledFraction = std::min(sampledFraction, other.sampledFraction);
+        auto merge = [](std::vector<ProfileRow>& into, const std::vector<ProfileRow>& from) {
+            for (const auto& row : from) {
+                auto it = std::find_if(into.begin(), into.end(), [&](const ProfileRow& r) { return r.name == row.name; });
+                if (it == into.end()) {
+                    into.push_back(row);
+                    continue;
+                }
+                it->files += row.files;
+                it->bytes += row.bytes;
+                it->compressed += row.compressed;
+                it->dedupSaved += row.dedupSaved;
+                it->cpuSeconds += row.cpuSeconds;
+            }
+        };
+        merge(dirs, other.dirs);
+        merge(packages, other.packages);
+    }
+
+    static std::string jsonString(const std::string& s) {
+        std::ostringstream out;
+        out << '"';
+        for (unsigned char c : s) {
+            if (c == '"' || c == '\\') out << '\\' << c;
+            else if (c < 0x20) out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+            else out << c;
+        }
+        out << '"';
+        return out.str();
+    }
+
+    std::string toJson() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(4);
+        out << "{\n  \"image\": " << jsonString(image) << ",\n  \"compressor\": " << jsonString(compressor)
+        << ",\n  \"image_bytes\": " << imageBytes << ",\n  \"metadata_bytes\": " << metadataBytes
+        << ",\n  \"sampled_fraction\": " << sampledFraction << ",\n  \"estimated_cpu_seconds\": " << cpuSeconds;
+        auto rows = [&](const char* key, std::vector<ProfileRow> list) {
+            std::sort(list.begin(), list.end(), [](const ProfileRow& a, const ProfileRow& b) {
+                return a.compressed > b.compressed;
+            });
+            out << ",\n  \"" << key << "\": [";
+            for (size_t i = 0; i < list.size(); i++) {
+                const ProfileRow& r = list[i];
+                out << (i ? ",\n" : "\n") << "    {\"name\": " << jsonString(r.name) << ", \"files\": " << r.files
+                << ", \"bytes\": " << r.bytes << ", \"compressed_bytes\": " << r.compressed
+                << ", \"ratio\": " << r.ratio() << ", \"dedup_saved_bytes\": " << r.dedupSaved
+                << ", \"cpu_seconds\": " << r.cpuSeconds
+                << ", \"cpu_share\": " << (cpuSeconds > 0 ? r.cpuSeconds / cpuSeconds : 0.0) << "}";
+            }
+            out << (list.empty() ? "]" : "\n  ]");
+        };
+        rows("directories", dirs);
+        rows("packages", packages);
+        out << "\n}\n";
+        return out.str();
+    }
+};
+
+// Works out where the bytes of an image come from without mounting it.
+// Sizes come straight from the block lists. Compression time is not
+// stored anywhere, so a deterministic sample of blocks is recompressed
+// with the image's own compressor and the measured CPU time is scaled up
+// per directory and package.
+class ImageProfiler {
+public:
+    static constexpr uint64_t SAMPLE_BUDGET = 256ULL << 20;
+
+    static bool profile(const std::string& image, ImageProfile& result, std::string& error) {
+        SquashfsReader reader;
+        std::vector<SquashfsEntry> entries;
+        if (!reader.open(image, error) || !reader.readTree(entries, error)) return false;
+
+        const SquashfsSuperblock& sb = reader.super();
+        result.image = image;
+        result.compressor = SquashfsReader::compressorName(sb.compression);
+        result.imageBytes = sb.bytesUsed;
+        result.metadataBytes = reader.metadataBytes();
+
+        std::map<std::string, std::string> owners = readPackageOwners(reader, entries);
+
+        // Tail bytes used per fragment, to split its compressed size
+        std::map<uint32_t, uint64_t> fragmentUsed;
+        std::set<std::tuple<uint64_t, uint64_t, uint32_t, uint32_t>> stored;
+        std::set<uint32_t> inodes;
+        std::vector<char> duplicate(entries.size(), 0);
+        for (size_t i = 0; i < entries.size(); i++) {
+            const SquashfsInode& in = entries[i].inode;
+            if (in.type != SquashfsReader::TYPE_FILE) continue;
+            bool newInode = inodes.insert(in.number).second;
+            bool newData = stored.insert(std::make_tuple(in.blocksStart, in.fileSize, in.fragment, in.fragmentOffset)).second;
+            if (!newInode || (!newData && in.fileSize > 0)) {
+                duplicate[i] = 1;
+                continue;
+            }
+            if (in.hasFragment()) fragmentUsed[in.fragment] += in.fileSize % sb.blockSize;
+        }
+
+        std::map<std::string, ProfileRow> dirs, packages;
+        std::vector<DataBlock> blocks;
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            const SquashfsEntry& e = entries[i];
+            if (e.inode.type != SquashfsReader::TYPE_FILE) continue;
+            size_t slash = e.path.find('/');
+            std::string top = slash == std::string::npos ? "/" : e.path.substr(0, slash);
+            auto owner = owners.find(e.path);
+            ProfileRow& dir = dirs[top];
+            ProfileRow& package = packages[owner == owners.end() ? "(unowned)" : owner->second];
+
+            uint64_t compressed = 0;
+            if (!duplicate[i]) {
+                uint64_t pos = e.inode.blocksStart;
+                for (uint32_t sizeWord : e.inode.blockSizes) {
+                    uint32_t size = sizeWord & (SquashfsReader::BLOCK_UNCOMPRESSED - 1);
+                    compressed += size;
+                    if (size > 0) blocks.push_back({pos, sizeWord, &dir, &package});
+                    pos += size;
+                }
+                if (e.inode.hasFragment()) {
+                    uint64_t start = 0;
+                    uint32_t sizeWord = 0;
+                    uint64_t used = fragmentUsed[e.inode.fragment];
+                    if (reader.fragmentEntry(e.inode.fragment, start, sizeWord) && used > 0) {
+                        uint64_t tail = e.inode.fileSize % sb.blockSize;
+                        compressed += (sizeWord & (SquashfsReader::BLOCK_UNCOMPRESSED - 1)) * tail / used;
+                    }
+                }
+            }
+
+            for (ProfileRow* row : {&dir, &package}) {
+                row->files++;
+                row->bytes += e.inode.fileSize;
+                row->compressed += compressed;
+                if (duplicate[i]) row->dedupSaved += e.inode.fileSize;
+            }
+        }
+
+        sampleCompression(reader, blocks, result);
+
+        // Groups without a sampled block use the image-wide rate
+        uint64_t sampledBytes = 0;
+        double sampledSeconds = 0;
+        for (const auto& kv : dirs) {
+            sampledBytes += kv.second.sampledBytes;
+            sampledSeconds += kv.second.sampledSeconds;
+        }
+        double globalRate = sampledBytes ? sampledSeconds / static_cast<double>(sampledBytes) : 0;
+        auto finish = [&](std::map<std::string, ProfileRow>& groups, std::vector<ProfileRow>& out) {
+            for (auto& kv : groups) {
+                ProfileRow& r = kv.second;
+                r.name = kv.first;
+                double rate = r.sampledBytes ? r.sampledSeconds / static_cast<double>(r.sampledBytes) : globalRate;
+                r.cpuSeconds = rate * static_cast<double>(r.bytes - r.dedupSaved);
+                out.push_back(r);
+            }
+            std::sort(out.begin(), out.end(), [](const ProfileRow& a, const ProfileRow& b) {
+                return a.compressed > b.compressed;
+            });
+        };
+        finish(dirs, result.dirs);
+        finish(packages, result.packages);
+        for (const auto& r : result.dirs) result.cpuSeconds += r.cpuSeconds;
+        return true;
+    }
+
+private:
+    struct DataBlock {
+        uint64_t pos;
+        uint32_t sizeWord;
+        ProfileRow* dir;
+        ProfileRow* package;
+    };
+
+    // Maps image paths to the package that installed them, from the pacman
+    // or dpkg database inside the image itself
+    static std::map<std::string, std::string> readPackageOwners(const SquashfsReader& reader,
+                                                                const std::vector<SquashfsEntry>& entries) {
+        std::map<std::string, std::string> owners;
+        for (const auto& e : entries) {
+            std::string package;
+            bool pacman = false;
+            if (e.path.compare(0, 21, "var/lib/pacman/local/") == 0 && e.path.size() > 27 &&
+                e.path.compare(e.path.size() - 6, 6, "/files") == 0) {
+                // Directory name is "name-pkgver-pkgrel"
+                package = e.path.substr(21, e.path.size() - 27);
+                for (int dashes = 0; dashes < 2 && package.rfind('-') != std::string::npos; dashes++) {
+                    package.erase(package.rfind('-'));
+                }
+                pacman = true;
+            } else if (e.path.compare(0, 18, "var/lib/dpkg/info/") == 0 && e.path.size() > 23 &&
+                e.path.compare(e.path.size() - 5, 5, ".list") == 0) {
+                package = e.path.substr(18, e.path.size() - 23);
+                package = package.substr(0, package.find(':'));
+            } else {
+                continue;
+            }
+
+            std::string text;
+            std::string error;
+            reader.readFile(e.inode, [&](const uint8_t* data, size_t len) {
+                text.append(reinterpret_cast<const char*>(data), len);
+                return true;
+            }, error);
+
+            std::istringstream lines(text);
+            std::string line;
+            bool inFiles = !pacman;
+            while (std::getline(lines, line)) {
+                if (pacman && line.size() > 1 && line[0] == '%') {
+                    inFiles = line == "%FILES%";
+                    continue;
+                }
+                if (!inFiles || line.empty()) continue;
+                if (line[0] == '/') line.erase(0, 1);
+                if (!line.empty() && line.back() == '/') continue;
+                owners.emplace(line, package);
+            }
+        }
+        return owners;
+    }
+
+    static double threadCpuSeconds() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+    }
+
+    struct Compressor {
+        uint16_t id;
+        int level;
+        uint32_t dictSize;
+        bool x86;
+
+        bool compress(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) const {
+            out.resize(in.size() + in.size() / 8 + 65536);
+            switch (id) {
+                case 1: {
+                    uLongf len = out.size();
+                    return compress2(out.data(), &len, in.data(), in.size(), level) == Z_OK;
+                }
+                case 2:
+                case 4: {
+                    lzma_options_lzma opt;
+                    lzma_lzma_preset(&opt, static_cast<uint32_t>(level));
+                    opt.dict_size = dictSize;
+                    lzma_filter filters[3];
+                    int f = 0;
+                    if (x86) filters[f++] = {LZMA_FILTER_X86, nullptr};
+                    filters[f++] = {LZMA_FILTER_LZMA2, &opt};
+                    filters[f] = {LZMA_VLI_UNKNOWN, nullptr};
+                    size_t pos = 0;
+                    return lzma_stream_buffer_encode(filters, LZMA_CHECK_CRC32, nullptr, in.data(), in.size(),
+                                                     out.data(), &pos, out.size()) == LZMA_OK;
+                }
+                case 5:
+                    return LZ4_compress_default(reinterpret_cast<const char*>(in.data()), reinterpret_cast<char*>(out.data()),
+                                                static_cast<int>(in.size()), static_cast<int>(out.size())) > 0;
+                case 6:
+                    return !ZSTD_isError(ZSTD_compress(out.data(), out.size(), in.data(), in.size(), level));
+                default:
+                    return false;
+            }
+        }
+    };
+
+    // mksquashfs only writes compressor options when they differ from its
+    // defaults, so the defaults are filled in here
+    static Compressor compressorFor(const SquashfsReader& reader) {
+        const SquashfsSuperblock& sb = reader.super();
+        Compressor c{sb.compression, 0, sb.blockSize, false};
+        std::vector<uint8_t> options = reader.compressorOptions();
+        int32_t a = 0, b = 0;
+        if (options.size() >= 4) memcpy(&a, options.data(), 4);
+        if (options.size() >= 8) memcpy(&b, options.data() + 4, 4);
+        switch (sb.compression) {
+            case 1: c.level = options.size() >= 4 ? a : 9; break;
+            case 2: c.level = 6; break;
+            case 4:
+                c.level = 6;
+                if (options.size() >= 8) {
+                    c.dictSize = static_cast<uint32_t>(a);
+                    c.x86 = (b & 0x1) != 0;
+                }
+                break;
+            case 6: c.level = options.size() >= 4 ? a : 15; break;
+            default: break;
+        }
+        return c;
+    }
+
+    static void sampleCompression(const SquashfsReader& reader, const std::vector<DataBlock>& blocks, ImageProfile& result) {
+        if (blocks.empty()) return;
+        uint64_t blockSize = reader.super().blockSize;
+        size_t stride = static_cast<size_t>(std::max<uint64_t>(1, blocks.size() * blockSize / SAMPLE_BUDGET));
+        std::vector<size_t> sample;
+        for (size_t i = 0; i < blocks.size(); i += stride) sample.push_back(i);
+        result.sampledFraction = static_cast<double>(sample.size()) / static_cast<double>(blocks.size());
+
+        Compressor compressor = compressorFor(reader);
+        std::vector<double> seconds(sample.size(), 0);
+        std::vector<uint64_t> sizes(sample.size(), 0);
+        std::atomic<size_t> next(0);
+
+        auto worker = [&]() {
+            std::vector<uint8_t> plain, packed;
+            std::string error;
+            size_t n;
+            while ((n = next.fetch_add(1)) < sample.size()) {
+                const auto& b = blocks[sample[n]];
+                if (!reader.readBlock(b.pos, b.sizeWord, plain, blockSize, error)) continue;
+                double start = threadCpuSeconds();
+                if (!compressor.compress(plain, packed)) continue;
+                seconds[n] = threadCpuSeconds() - start;
+                sizes[n] = plain.size();
+            }
+        };
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+        for (auto& t : pool) t.join();
+
+        for (size_t n = 0; n < sample.size(); n++) {
+            const auto& b = blocks[sample[n]];
+            for (ProfileRow* row : {b.dir, b.package}) {
+                row->sampledBytes += sizes[n];
+                row->sampledSeconds += seconds[n];
+            }
+        }
+    }
+};
+
+#endif
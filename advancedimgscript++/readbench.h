@@ -0,0 +1,184 @@
+#ifndef READBENCH_H
+#define READBENCH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// One read of a benchmark workload, relative to the mounted image root
+struct ReadOp {
+    std::string path;
+    uint64_t offset = 0;
+    uint32_t length = 0;
+};
+
+struct ReadBenchResult {
+    std::string phase;
+    size_t ops = 0;
+    size_t failed = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    double p50Us = 0;
+    double p99Us = 0;
+    double maxUs = 0;
+
+    double mbPerSec() const {
+        return seconds > 0 ? bytes / 1048576.0 / seconds : 0;
+    }
+};
+
+class ReadWorkload {
+public:
+    // Whole-file sequential reads of the files in a boot trace, in trace
+    // order; the list is NUL or newline separated like the tier lists
+    static std::vector<ReadOp> fromTrace(const std::string& root, const std::string& listFile, uint32_t chunk = 128u << 10) {
+        std::vector<ReadOp> ops;
+        std::ifstream in(listFile, std::ios::binary);
+        std::string all((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::replace(all.begin(), all.end(), '\n', '\0');
+        std::istringstream paths(all);
+        std::string path;
+        while (std::getline(paths, path, '\0')) {
+            while (path.compare(0, 2, "./") == 0) path.erase(0, 2);
+            if (path.empty()) continue;
+            struct stat st;
+            if (lstat((root + "/" + path).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            uint64_t size = static_cast<uint64_t>(st.st_size);
+            for (uint64_t off = 0; off < size; off += chunk) {
+                ops.push_back({path, off, static_cast<uint32_t>(std::min<uint64_t>(chunk, size - off))});
+            }
+        }
+        return ops;
+    }
+
+    // count 4 KiB and count 64 KiB reads at aligned random offsets of
+    // random files under subdir. The seed is fixed so every image gets
+    // the same workload when the trees match.
+    static std::vector<ReadOp> randomReads(const std::string& root, const std::string& subdir = "usr/lib",
+                                           size_t count = 2000, uint64_t seed = 42) {
+        std::vector<std::pair<std::string, uint64_t>> files;
+        collect(root, subdir, files, 0);
+        std::sort(files.begin(), files.end());
+        std::vector<ReadOp> ops;
+        if (files.empty()) return ops;
+
+        std::mt19937_64 rng(seed);
+        for (uint32_t size : {4096u, 65536u}) {
+            for (size_t i = 0; i < count; i++) {
+                const auto& [path, fileBytes] = files[rng() % files.size()];
+                uint64_t slots = std::max<uint64_t>(1, fileBytes / size);
+                ops.push_back({path, (rng() % slots) * size, size});
+            }
+        }
+        std::shuffle(ops.begin(), ops.end(), rng);
+        return ops;
+    }
+
+private:
+    static constexpr size_t MAX_FILES = 50000;
+
+    static void collect(const std::string& root, const std::string& rel, std::vector<std::pair<std::string, uint64_t>>& out,
+                        int depth) {
+        if (depth > 32 || out.size() >= MAX_FILES) return;
+        DIR* dir = opendir((root + "/" + rel).c_str());
+        if (!dir) return;
+        while (struct dirent* e = readdir(dir)) {
+            std::string name = e->d_name;
+            if (name == "." || name == "..") continue;
+            std::string child = rel + "/" + name;
+            struct stat st;
+            if (lstat((root + "/" + child).c_str(), &st) != 0) continue;
+            if (S_ISDIR(st.st_mode)) collect(root, child, out, depth + 1);
+            else if (S_ISREG(st.st_mode) && st.st_size >= 4096 && out.size() < MAX_FILES) {
+                out.emplace_back(child, static_cast<uint64_t>(st.st_size));
+            }
+        }
+        closedir(dir);
+    }
+};
+
+class ReadBench {
+public:
+    // Replays ops one at a time. A file is opened on its first read and
+    // kept open, so the first read of each file includes the lookup, as
+    // it does during boot.
+    static ReadBenchResult run(const std::string& root, const std::vector<ReadOp>& ops, const std::string& phase) {
+        ReadBenchResult result;
+        result.phase = phase;
+        std::map<std::string, int> fds;
+        std::vector<double> latencies;
+        latencies.reserve(ops.size());
+        std::vector<char> buf(1 << 20);
+
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& op : ops) {
+            if (op.length > buf.size()) buf.resize(op.length);
+            auto t0 = std::chrono::steady_clock::now();
+            auto it = fds.find(op.path);
+            if (it == fds.end()) {
+                it = fds.emplace(op.path, open((root + "/" + op.path).c_str(), O_RDONLY | O_CLOEXEC)).first;
+            }
+            ssize_t n = it->second >= 0 ? pread(it->second, buf.data(), op.length, static_cast<off_t>(op.offset)) : -1;
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+            result.ops++;
+            if (n < 0) {
+                result.failed++;
+                continue;
+            }
+            result.bytes += static_cast<uint64_t>(n);
+            latencies.push_back(us);
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (const auto& [path, fd] : fds) {
+            if (fd >= 0) close(fd);
+        }
+
+        if (!latencies.empty()) {
+            std::sort(latencies.begin(), latencies.end());
+            result.p50Us = latencies[latencies.size() / 2];
+            result.p99Us = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+            result.maxUs = latencies.back();
+        }
+        return result;
+    }
+
+    // Drops the image file from the page cache so the next mount starts
+    // cold; works without root for pages that are not dirty
+    static bool dropImageCache(const std::string& image) {
+        int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        fdatasync(fd);
+        bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        close(fd);
+        return ok;
+    }
+
+    static std::string table(const std::string& image, const std::string& format, const std::vector<ReadBenchResult>& results) {
+        std::ostringstream out;
+        out << image << " (" << format << ")\n";
+        out << std::left << std::setw(8) << "phase" << std::right << std::setw(9) << "reads" << std::setw(11) << "p50"
+        << std::setw(11) << "p99" << std::setw(11) << "max" << std::setw(11) << "MB/s" << "\n";
+        out << std::fixed << std::setprecision(1);
+        for (const auto& r : results) {
+            out << std::left << std::setw(8) << r.phase << std::right << std::setw(9) << r.ops
+            << std::setw(9) << r.p50Us << "us" << std::setw(9) << r.p99Us << "us" << std::setw(9) << r.maxUs << "us"
+            << std::setw(11) << r.mbPerSec();
+            if (r.failed) out << "  (" << r.failed << " failed)";
+            out << "\n";
+        }
+        return out.str();
+    }
+};
+
+#endif
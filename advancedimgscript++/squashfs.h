@@ -0,0 +1,736 @@
+#ifndef SQUASHFS_H
+#define SQUASHFS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <lzma.h>
+#include <lz4.h>
+#include <zstd.h>
+
+// Read-only access to squashfs 4.0 images straight from the file, without
+// mounting. Everything past open() is safe to call from several threads.
+struct SquashfsSuperblock {
+    uint32_t magic;
+    uint32_t inodeCount;
+    uint32_t mkfsTime;
+    uint32_t blockSize;
+    uint32_t fragmentCount;
+    uint16_t compression;
+    uint16_t blockLog;
+    uint16_t flags;
+    uint16_t idCount;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    uint64_t rootInode;
+    uint64_t bytesUsed;
+    uint64_t idTable;
+    uint64_t xattrIdTable;
+    uint64_t inodeTable;
+    uint64_t directoryTable;
+    uint64_t fragmentTable;
+    uint64_t exportTable;
+} __attribute__((packed));
+
+struct SquashfsInode {
+    uint16_t type = 0;          // basic type 1-7, extended types are folded in
+    uint16_t mode = 0;          // permission bits only
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint32_t mtime = 0;
+    uint32_t number = 0;
+    uint32_t nlink = 1;
+    uint32_t xattr = 0xFFFFFFFF;
+
+    // Regular files
+    uint64_t fileSize = 0;
+    uint64_t blocksStart = 0;
+    uint32_t fragment = 0xFFFFFFFF;
+    uint32_t fragmentOffset = 0;
+    std::vector<uint32_t> blockSizes;
+
+    // Directories
+    uint32_t dirBlock = 0;
+    uint32_t dirOffset = 0;
+    uint32_t dirSize = 0;
+
+    std::string target;         // symlinks
+    uint32_t rdev = 0;          // devices, squashfs encoding
+
+    bool hasFragment() const {
+        return fragment != 0xFFFFFFFF;
+    }
+
+    uint32_t devMajor() const {
+        return (rdev & 0xfff00) >> 8;
+    }
+
+    uint32_t devMinor() const {
+        return (rdev & 0xff) | ((rdev >> 12) & 0xfff00);
+    }
+};
+
+struct SquashfsEntry {
+    std::string path;           // relative to the image root, no leading slash
+    SquashfsInode inode;
+};
+
+class SquashfsReader {
+public:
+    static constexpr uint32_t MAGIC = 0x73717368;
+    static constexpr uint16_t TYPE_DIR = 1;
+    static constexpr uint16_t TYPE_FILE = 2;
+    static constexpr uint16_t TYPE_SYMLINK = 3;
+    static constexpr uint16_t TYPE_BLKDEV = 4;
+    static constexpr uint16_t TYPE_CHRDEV = 5;
+    static constexpr uint16_t TYPE_FIFO = 6;
+    static constexpr uint16_t TYPE_SOCKET = 7;
+    static constexpr uint32_t BLOCK_UNCOMPRESSED = 1u << 24;
+    static constexpr uint64_t NO_TABLE = 0xFFFFFFFFFFFFFFFFULL;
+    static constexpr size_t METADATA_SIZE = 8192;
+
+    SquashfsReader() = default;
+    SquashfsReader(const SquashfsReader&) = delete;
+    SquashfsReader& operator=(const SquashfsReader&) = delete;
+
+    ~SquashfsReader() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool open(const std::string& path, std::string& error) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st;
+        fstat(fd_, &st);
+        fileSize_ = static_cast<uint64_t>(st.st_size);
+
+        if (!readAt(0, &sb_, sizeof(sb_))) {
+            error = "short read on superblock";
+            return false;
+        }
+        if (sb_.magic != MAGIC) {
+            error = "not a squashfs image";
+            return false;
+        }
+        if (sb_.versionMajor != 4 || sb_.versionMinor != 0) {
+            error = "unsupported squashfs version " + std::to_string(sb_.versionMajor) + "." + std::to_string(sb_.versionMinor);
+            return false;
+        }
+        if (sb_.blockLog > 20 || sb_.blockSize != (1u << sb_.blockLog)) {
+            error = "block size and block log disagree";
+            return false;
+        }
+        if (sb_.bytesUsed > fileSize_) {
+            error = "image is truncated (" + std::to_string(fileSize_) + " of " + std::to_string(sb_.bytesUsed) + " bytes)";
+            return false;
+        }
+        if (compressorName(sb_.compression) == std::string("lzo")) {
+            error = "lzo images are not supported";
+            return false;
+        }
+        if (!(sb_.inodeTable < sb_.directoryTable && sb_.directoryTable <= sb_.bytesUsed)) {
+            error = "inode and directory table offsets are out of order";
+            return false;
+        }
+
+        if (!readLookupTable(sb_.idTable, sb_.idCount, 4, ids_, error)) {
+            error = "id table: " + error;
+            return false;
+        }
+        if (sb_.fragmentCount > 0 && !readLookupTable(sb_.fragmentTable, sb_.fragmentCount, 16, fragments_, error)) {
+            error = "fragment table: " + error;
+            return false;
+        }
+        if (!loadMetadata(sb_.inodeTable, sb_.directoryTable, inodes_, inodeIndex_, error)) {
+            error = "inode table: " + error;
+            return false;
+        }
+        uint64_t dirEnd = directoryTableEnd();
+        if (!loadMetadata(sb_.directoryTable, dirEnd, dirs_, dirIndex_, error)) {
+            error = "directory table: " + error;
+            return false;
+        }
+        if (sb_.xattrIdTable != NO_TABLE && !loadXattrTable(error)) {
+            error = "xattr table: " + error;
+            return false;
+        }
+        return true;
+    }
+
+    const SquashfsSuperblock& super() const {
+        return sb_;
+    }
+
+    static const char* compressorName(uint16_t id) {
+        switch (id) {
+            case 1: return "gzip";
+            case 2: return "lzma";
+            case 3: return "lzo";
+            case 4: return "xz";
+            case 5: return "lz4";
+            case 6: return "zstd";
+            default: return "unknown";
+        }
+    }
+
+    // Raw compressor options block written after the superblock when the
+    // image was made with non-default settings; empty otherwise.
+    std::vector<uint8_t> compressorOptions() const {
+        std::vector<uint8_t> options;
+        uint64_t next = 0;
+        std::string error;
+        if (!(sb_.flags & 0x0400) || !readMetadataBlock(sizeof(sb_), options, next, error)) options.clear();
+        return options;
+    }
+
+    // Bytes taken by the inode, directory, fragment and id tables
+    uint64_t metadataBytes() const {
+        return sb_.bytesUsed - sb_.inodeTable;
+    }
+
+    uint32_t id(uint32_t index) const {
+        uint32_t v = 0;
+        if (index < sb_.idCount) memcpy(&v, ids_.data() + index * 4, 4);
+        return v;
+    }
+
+    bool fragmentEntry(uint32_t index, uint64_t& start, uint32_t& sizeWord) const {
+        if (index >= sb_.fragmentCount) return false;
+        memcpy(&start, fragments_.data() + index * 16, 8);
+        memcpy(&sizeWord, fragments_.data() + index * 16 + 8, 4);
+        return true;
+    }
+
+    // Walks the whole directory tree. Entries come out parents first; the
+    // root itself is not included. Any inconsistency in the metadata is
+    // reported and stops the walk.
+    bool readTree(std::vector<SquashfsEntry>& out, std::string& error) const {
+        SquashfsInode root;
+        if (!readInode(sb_.rootInode, root, error)) return false;
+        if (root.type != TYPE_DIR) {
+            error = "root inode is not a directory";
+            return false;
+        }
+        std::set<uint32_t> active;
+        return walkDir(root, "", out, active, 0, error);
+    }
+
+    bool readInode(uint64_t ref, SquashfsInode& inode, std::string& error) const {
+        auto it = inodeIndex_.find(ref >> 16);
+        if (it == inodeIndex_.end() || (ref & 0xffff) >= METADATA_SIZE) {
+            error = "inode reference points outside the inode table";
+            return false;
+        }
+        Cursor c{inodes_, it->second + (ref & 0xffff)};
+        uint16_t type = 0, uidIdx = 0, gidIdx = 0;
+        if (!c.get(type) || !c.get(inode.mode) || !c.get(uidIdx) || !c.get(gidIdx) ||
+            !c.get(inode.mtime) || !c.get(inode.number)) {
+            error = "truncated inode header";
+            return false;
+        }
+        if (uidIdx >= sb_.idCount || gidIdx >= sb_.idCount) {
+            error = "inode " + std::to_string(inode.number) + " has an id index past the id table";
+            return false;
+        }
+        inode.mode &= 07777;
+        inode.uid = id(uidIdx);
+        inode.gid = id(gidIdx);
+        inode.type = type > 7 ? type - 7 : type;
+
+        bool ok = true;
+        switch (type) {
+            case 1: {
+                uint16_t size = 0, offset = 0;
+                uint32_t parent = 0;
+                ok = c.get(inode.dirBlock) && c.get(inode.nlink) && c.get(size) && c.get(offset) && c.get(parent);
+                inode.dirSize = size;
+                inode.dirOffset = offset;
+                break;
+            }
+            case 8: {
+                uint16_t indexCount = 0, offset = 0;
+                uint32_t parent = 0;
+                ok = c.get(inode.nlink) && c.get(inode.dirSize) && c.get(inode.dirBlock) && c.get(parent) &&
+                c.get(indexCount) && c.get(offset) && c.get(inode.xattr);
+                inode.dirOffset = offset;
+                break;
+            }
+            case 2: {
+                uint32_t start = 0, size = 0;
+                ok = c.get(start) && c.get(inode.fragment) && c.get(inode.fragmentOffset) && c.get(size);
+                inode.blocksStart = start;
+                inode.fileSize = size;
+                break;
+            }
+            case 9: {
+                uint64_t sparse = 0;
+                ok = c.get(inode.blocksStart) && c.get(inode.fileSize) && c.get(sparse) && c.get(inode.nlink) &&
+                c.get(inode.fragment) && c.get(inode.fragmentOffset) && c.get(inode.xattr);
+                break;
+            }
+            case 3:
+            case 10: {
+                uint32_t size = 0;
+                ok = c.get(inode.nlink) && c.get(size) && size <= 65535 && c.bytes(inode.target, size);
+                if (ok && type == 10) ok = c.get(inode.xattr);
+                break;
+            }
+            case 4: case 5: case 11: case 12:
+                ok = c.get(inode.nlink) && c.get(inode.rdev);
+                if (ok && type > 7) ok = c.get(inode.xattr);
+                break;
+            case 6: case 7: case 13: case 14:
+                ok = c.get(inode.nlink);
+                if (ok && type > 7) ok = c.get(inode.xattr);
+                break;
+            default:
+                error = "inode " + std::to_string(inode.number) + " has unknown type " + std::to_string(type);
+                return false;
+        }
+
+        if (ok && inode.type == TYPE_FILE) {
+            if (inode.hasFragment() && inode.fragment >= sb_.fragmentCount) {
+                error = "inode " + std::to_string(inode.number) + " uses fragment " + std::to_string(inode.fragment) +
+                " of " + std::to_string(sb_.fragmentCount);
+                return false;
+            }
+            uint64_t blocks = inode.hasFragment() ? inode.fileSize / sb_.blockSize
+            : (inode.fileSize + sb_.blockSize - 1) / sb_.blockSize;
+            if (blocks > (sb_.bytesUsed / 4) + 1) {
+                error = "inode " + std::to_string(inode.number) + " claims an impossible file size";
+                return false;
+            }
+            inode.blockSizes.resize(blocks);
+            for (auto& b : inode.blockSizes) {
+                if (!(ok = c.get(b))) break;
+            }
+        }
+        if (!ok) {
+            error = "truncated inode " + std::to_string(inode.number);
+            return false;
+        }
+        return true;
+    }
+
+    // Decompresses one data or fragment block. sizeWord is the on-disk size
+    // with the uncompressed bit; a zero size is a sparse block of zeros.
+    bool readBlock(uint64_t pos, uint32_t sizeWord, std::vector<uint8_t>& out, size_t expected, std::string& error) const {
+        uint32_t size = sizeWord & (BLOCK_UNCOMPRESSED - 1);
+        if (size == 0) {
+            out.assign(expected, 0);
+            return true;
+        }
+        if (size > sb_.blockSize + 1024 || pos + size > sb_.bytesUsed) {
+            error = "block at " + std::to_string(pos) + " runs past the end of the image";
+            return false;
+        }
+        std::vector<uint8_t> raw(size);
+        if (!readAt(pos, raw.data(), size)) {
+            error = "short read at " + std::to_string(pos);
+            return false;
+        }
+        if (sizeWord & BLOCK_UNCOMPRESSED) {
+            out.swap(raw);
+            return true;
+        }
+        out.resize(sb_.blockSize);
+        size_t outLen = 0;
+        if (!decompress(raw.data(), size, out.data(), out.size(), outLen)) {
+            error = std::string(compressorName(sb_.compression)) + " block at " + std::to_string(pos) + " does not decompress";
+            return false;
+        }
+        out.resize(outLen);
+        return true;
+    }
+
+    // Streams the contents of a regular file to sink in order.
+    bool readFile(const SquashfsInode& inode, const std::function<bool(const uint8_t*, size_t)>& sink,
+                  std::string& error) const {
+        std::vector<uint8_t> block;
+        uint64_t pos = inode.blocksStart;
+        uint64_t remaining = inode.fileSize;
+        for (uint32_t sizeWord : inode.blockSizes) {
+            size_t expected = static_cast<size_t>(std::min<uint64_t>(remaining, sb_.blockSize));
+            if (!readBlock(pos, sizeWord, block, expected, error)) return false;
+            if (block.size() != expected) {
+                error = "block at " + std::to_string(pos) + " holds " + std::to_string(block.size()) +
+                " bytes, expected " + std::to_string(expected);
+                return false;
+            }
+            if (!sink(block.data(), block.size())) return true;
+            pos += sizeWord & (BLOCK_UNCOMPRESSED - 1);
+            remaining -= expected;
+        }
+        if (inode.hasFragment() && remaining > 0) {
+            if (!readFragment(inode.fragment, block, error)) return false;
+            if (inode.fragmentOffset + remaining > block.size()) {
+                error = "file tail runs past the end of fragment " + std::to_string(inode.fragment);
+                return false;
+            }
+            sink(block.data() + inode.fragmentOffset, static_cast<size_t>(remaining));
+        } else if (remaining > 0) {
+            error = "file is shorter than its size";
+            return false;
+        }
+        return true;
+    }
+
+    // Extended attributes of an inode as full names ("security.capability")
+    // with their values; an inode without xattrs gives an empty list.
+    bool readXattrs(uint32_t index, std::vector<std::pair<std::string, std::string>>& out, std::string& error) const {
+        out.clear();
+        if (index == 0xFFFFFFFF) return true;
+        if (static_cast<uint64_t>(index) * 16 + 16 > xattrIds_.size()) {
+            error = "xattr id " + std::to_string(index) + " does not exist";
+            return false;
+        }
+        uint64_t ref;
+        uint32_t count;
+        memcpy(&ref, xattrIds_.data() + index * 16, 8);
+        memcpy(&count, xattrIds_.data() + index * 16 + 8, 4);
+        size_t pos;
+        if (!xattrPosition(ref, pos)) {
+            error = "xattr id " + std::to_string(index) + " points outside the xattr table";
+            return false;
+        }
+        static const char* prefixes[] = {"user.", "trusted.", "security."};
+        Cursor c{xattrs_, pos};
+        for (uint32_t i = 0; i < count; i++) {
+            uint16_t type = 0, nameLen = 0;
+            uint32_t valueLen = 0;
+            std::string name, value;
+            if (!c.get(type) || !c.get(nameLen) || !c.bytes(name, nameLen) || !c.get(valueLen) || (type & 0xff) > 2) {
+                error = "bad xattr entry in id " + std::to_string(index);
+                return false;
+            }
+            if (type & 0x100) {
+                // Value stored once elsewhere and referenced by location
+                uint64_t valueRef = 0;
+                size_t valuePos;
+                if (valueLen != 8 || !c.get(valueRef) || !xattrPosition(valueRef, valuePos)) {
+                    error = "bad out-of-line xattr value in id " + std::to_string(index);
+                    return false;
+                }
+                Cursor v{xattrs_, valuePos};
+                if (!v.get(valueLen) || !v.bytes(value, valueLen)) {
+                    error = "bad out-of-line xattr value in id " + std::to_string(index);
+                    return false;
+                }
+            } else if (!c.bytes(value, valueLen)) {
+                error = "xattr value runs past the xattr table";
+                return false;
+            }
+            out.emplace_back(prefixes[type & 0xff] + name, value);
+        }
+        return true;
+    }
+
+    bool readFragment(uint32_t index, std::vector<uint8_t>& out, std::string& error) const {
+        uint64_t start = 0;
+        uint32_t sizeWord = 0;
+        if (!fragmentEntry(index, start, sizeWord)) {
+            error = "fragment " + std::to_string(index) + " does not exist";
+            return false;
+        }
+        return readBlock(start, sizeWord, out, sb_.blockSize, error);
+    }
+
+private:
+    struct Cursor {
+        const std::vector<uint8_t>& buf;
+        size_t pos;
+
+        template <typename T>
+        bool get(T& v) {
+            if (pos + sizeof(T) > buf.size()) return false;
+            memcpy(&v, buf.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+
+        bool bytes(std::string& s, size_t n) {
+            if (pos + n > buf.size()) return false;
+            s.assign(reinterpret_cast<const char*>(buf.data() + pos), n);
+            pos += n;
+            return true;
+        }
+    };
+
+    int fd_ = -1;
+    uint64_t fileSize_ = 0;
+    SquashfsSuperblock sb_{};
+    std::vector<uint8_t> ids_;
+    std::vector<uint8_t> fragments_;
+    std::vector<uint8_t> inodes_;
+    std::vector<uint8_t> dirs_;
+    std::map<uint64_t, size_t> inodeIndex_;  // metadata block offset -> offset in inodes_
+    std::vector<uint8_t> xattrIds_;
+    std::vector<uint8_t> xattrs_;
+    std::map<uint64_t, size_t> xattrIndex_;
+    std::map<uint64_t, size_t> dirIndex_;
+
+    bool readAt(uint64_t pos, void* buf, size_t len) const {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(fd_, static_cast<char*>(buf) + done, len - done, static_cast<off_t>(pos + done));
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool decompress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outCap, size_t& outLen) const {
+        switch (sb_.compression) {
+            case 1: {
+                uLongf len = outCap;
+                if (uncompress(out, &len, in, inLen) != Z_OK) return false;
+                outLen = len;
+                return true;
+            }
+            case 2: {
+                lzma_stream strm = LZMA_STREAM_INIT;
+                if (lzma_alone_decoder(&strm, UINT64_MAX) != LZMA_OK) return false;
+                strm.next_in = in;
+                strm.avail_in = inLen;
+                strm.next_out = out;
+                strm.avail_out = outCap;
+                lzma_ret ret = lzma_code(&strm, LZMA_FINISH);
+                outLen = outCap - strm.avail_out;
+                lzma_end(&strm);
+                return ret == LZMA_STREAM_END || (ret == LZMA_OK && strm.avail_in == 0);
+            }
+            case 4: {
+                uint64_t memlimit = UINT64_MAX;
+                size_t inPos = 0;
+                outLen = 0;
+                return lzma_stream_buffer_decode(&memlimit, 0, nullptr, in, &inPos, inLen, out, &outLen, outCap) == LZMA_OK;
+            }
+            case 5: {
+                int n = LZ4_decompress_safe(reinterpret_cast<const char*>(in), reinterpret_cast<char*>(out),
+                                            static_cast<int>(inLen), static_cast<int>(outCap));
+                if (n < 0) return false;
+                outLen = static_cast<size_t>(n);
+                return true;
+            }
+            case 6: {
+                size_t n = ZSTD_decompress(out, outCap, in, inLen);
+                if (ZSTD_isError(n)) return false;
+                outLen = n;
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    bool readMetadataBlock(uint64_t pos, std::vector<uint8_t>& out, uint64_t& next, std::string& error) const {
+        uint16_t header = 0;
+        if (pos + 2 > sb_.bytesUsed || !readAt(pos, &header, 2)) {
+            error = "metadata block at " + std::to_string(pos) + " is outside the image";
+            return false;
+        }
+        size_t size = header & 0x7fff;
+        if (size == 0 || size > METADATA_SIZE || pos + 2 + size > sb_.bytesUsed) {
+            error = "metadata block at " + std::to_string(pos) + " has a bad length";
+            return false;
+        }
+        std::vector<uint8_t> raw(size);
+        if (!readAt(pos + 2, raw.data(), size)) {
+            error = "short read at " + std::to_string(pos);
+            return false;
+        }
+        next = pos + 2 + size;
+        if (header & 0x8000) {
+            out.swap(raw);
+            return true;
+        }
+        out.resize(METADATA_SIZE);
+        size_t outLen = 0;
+        if (!decompress(raw.data(), size, out.data(), out.size(), outLen)) {
+            error = "metadata block at " + std::to_string(pos) + " does not decompress";
+            return false;
+        }
+        out.resize(outLen);
+        return true;
+    }
+
+    // Reads the consecutive metadata blocks in [start, end) into one buffer
+    bool loadMetadata(uint64_t start, uint64_t end, std::vector<uint8_t>& buf, std::map<uint64_t, size_t>& index,
+                      std::string& error) const {
+        std::vector<uint8_t> block;
+        uint64_t pos = start;
+        while (pos < end) {
+            uint64_t next = 0;
+            if (!readMetadataBlock(pos, block, next, error)) return false;
+            index[pos - start] = buf.size();
+            buf.insert(buf.end(), block.begin(), block.end());
+            pos = next;
+        }
+        return true;
+    }
+
+    // Id, fragment and export tables are a list of metadata block pointers
+    bool readLookupTable(uint64_t tableStart, uint64_t count, size_t entrySize, std::vector<uint8_t>& out,
+                         std::string& error) const {
+        uint64_t bytes = count * entrySize;
+        uint64_t blocks = (bytes + METADATA_SIZE - 1) / METADATA_SIZE;
+        if (tableStart == NO_TABLE || tableStart + blocks * 8 > sb_.bytesUsed) {
+            error = "lookup table is outside the image";
+            return false;
+        }
+        std::vector<uint64_t> pointers(blocks);
+        if (blocks > 0 && !readAt(tableStart, pointers.data(), blocks * 8)) {
+            error = "short read on lookup table";
+            return false;
+        }
+        std::vector<uint8_t> block;
+        for (uint64_t p : pointers) {
+            uint64_t next = 0;
+            if (!readMetadataBlock(p, block, next, error)) return false;
+            out.insert(out.end(), block.begin(), block.end());
+        }
+        if (out.size() < bytes) {
+            error = "lookup table is shorter than its entry count";
+            return false;
+        }
+        out.resize(bytes);
+        return true;
+    }
+
+    // The xattr id table starts with the position of the key/value
+    // metadata, which runs up to the first block of the id list
+    bool loadXattrTable(std::string& error) {
+        uint64_t header[2] = {0, 0};
+        if (sb_.xattrIdTable + 16 > sb_.bytesUsed || !readAt(sb_.xattrIdTable, header, 16)) {
+            error = "header is outside the image";
+            return false;
+        }
+        uint64_t start = header[0];
+        uint32_t count = static_cast<uint32_t>(header[1]);
+        if (!readLookupTable(sb_.xattrIdTable + 16, count, 16, xattrIds_, error)) return false;
+        uint64_t end = sb_.xattrIdTable;
+        if (count > 0) readAt(sb_.xattrIdTable + 16, &end, 8);
+        if (start > end || end > sb_.bytesUsed) {
+            error = "key/value table is outside the image";
+            return false;
+        }
+        return loadMetadata(start, end, xattrs_, xattrIndex_, error);
+    }
+
+    bool xattrPosition(uint64_t ref, size_t& pos) const {
+        auto it = xattrIndex_.find(ref >> 16);
+        if (it == xattrIndex_.end() || (ref & 0xffff) >= METADATA_SIZE) return false;
+        pos = it->second + (ref & 0xffff);
+        return true;
+    }
+
+    // The directory table has no length of its own; it ends where the
+    // first metadata block of any later table begins.
+    uint64_t directoryTableEnd() const {
+        uint64_t end = sb_.bytesUsed;
+        auto consider = [&](uint64_t pointerPos) {
+            uint64_t first = 0;
+            if (pointerPos == NO_TABLE || pointerPos + 8 > sb_.bytesUsed || !readAt(pointerPos, &first, 8)) return;
+            if (first > sb_.directoryTable && first < end) end = first;
+            if (pointerPos > sb_.directoryTable && pointerPos < end) end = pointerPos;
+        };
+        consider(sb_.idTable);
+        if (sb_.fragmentCount > 0) consider(sb_.fragmentTable);
+        if (sb_.exportTable != NO_TABLE) consider(sb_.exportTable);
+        if (sb_.xattrIdTable != NO_TABLE) consider(sb_.xattrIdTable);
+        return end;
+    }
+
+    bool walkDir(const SquashfsInode& dir, const std::string& prefix, std::vector<SquashfsEntry>& out,
+                 std::set<uint32_t>& active, int depth, std::string& error) const {
+        if (depth > 256 || !active.insert(dir.number).second) {
+            error = "directory loop at /" + prefix;
+            return false;
+        }
+        // The stored size counts the "." and ".." entries that are not written
+        if (dir.dirSize <= 3) {
+            active.erase(dir.number);
+            return true;
+        }
+        auto it = dirIndex_.find(dir.dirBlock);
+        if (it == dirIndex_.end() || dir.dirOffset >= METADATA_SIZE) {
+            error = "directory /" + prefix + " points outside the directory table";
+            return false;
+        }
+        size_t begin = it->second + dir.dirOffset;
+        size_t end = begin + dir.dirSize - 3;
+        if (end > dirs_.size()) {
+            error = "directory /" + prefix + " runs past the directory table";
+            return false;
+        }
+
+        Cursor c{dirs_, begin};
+        std::string lastName;
+        std::vector<size_t> subdirs;
+        while (c.pos < end) {
+            uint32_t count = 0, start = 0, baseNumber = 0;
+            if (!c.get(count) || !c.get(start) || !c.get(baseNumber) || count >= 256) {
+                error = "bad directory header in /" + prefix;
+                return false;
+            }
+            for (uint32_t i = 0; i <= count; i++) {
+                uint16_t offset = 0, type = 0, nameSize = 0;
+                int16_t numberOffset = 0;
+                std::string name;
+                if (!c.get(offset) || !c.get(numberOffset) || !c.get(type) || !c.get(nameSize) ||
+                    !c.bytes(name, static_cast<size_t>(nameSize) + 1) || c.pos > end) {
+                    error = "truncated directory entry in /" + prefix;
+                    return false;
+                }
+                if (name == "." || name == ".." || name.find('/') != std::string::npos || name.find('\0') != std::string::npos) {
+                    error = "invalid name in /" + prefix;
+                    return false;
+                }
+                if (!lastName.empty() && name <= lastName) {
+                    error = "directory /" + prefix + " is not sorted at " + name;
+                    return false;
+                }
+                lastName = name;
+
+                SquashfsEntry entry;
+                entry.path = prefix.empty() ? name : prefix + "/" + name;
+                if (!readInode((static_cast<uint64_t>(start) << 16) | offset, entry.inode, error)) {
+                    error = entry.path + ": " + error;
+                    return false;
+                }
+                if (entry.inode.type != type) {
+                    error = entry.path + ": directory entry type " + std::to_string(type) +
+                    " does not match inode type " + std::to_string(entry.inode.type);
+                    return false;
+                }
+                if (entry.inode.number != static_cast<uint32_t>(static_cast<int64_t>(baseNumber) + numberOffset)) {
+                    error = entry.path + ": inode number does not match its directory entry";
+                    return false;
+                }
+                if (type == TYPE_DIR) subdirs.push_back(out.size());
+                out.push_back(std::move(entry));
+            }
+        }
+
+        for (size_t idx : subdirs) {
+            SquashfsInode child = out[idx].inode;
+            std::string path = out[idx].path;
+            if (!walkDir(child, path, out, active, depth + 1, error)) return false;
+        }
+        active.erase(dir.number);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef TARSTREAM_H
+#define TARSTREAM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+
+#include "squashfs.h"
+
+// One member of a tar stream; mode is permission bits only
+struct TarMember {
+    std::string path;
+    char type = '0';            // '0' file, '1' hardlink, '2' symlink, '3' chr, '4' blk, '5' dir, '6' fifo
+    uint32_t mode = 0644;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint64_t mtime = 0;
+    uint64_t size = 0;
+    std::string linkTarget;
+    uint32_t devMajor = 0;
+    uint32_t devMinor = 0;
+    std::vector<std::pair<std::string, std::string>> xattrs;
+};
+
+// Writes a POSIX (pax) tar stream to a file descriptor. Names, sizes and
+// ids that do not fit the ustar header, and all xattrs, go into a pax
+// extended header in front of the member, which GNU tar, mksquashfs -tar
+// and mkfs.erofs --tar all read.
+class TarWriter {
+public:
+    explicit TarWriter(int fd) : fd_(fd) {}
+
+    uint64_t bytesWritten = 0;
+
+    bool begin(const TarMember& m) {
+        std::string pax;
+        std::string name = m.type == '5' && !m.path.empty() && m.path.back() != '/' ? m.path + "/" : m.path;
+        if (name.size() > 100) pax += paxRecord("path", name);
+        if (m.linkTarget.size() > 100) pax += paxRecord("linkpath", m.linkTarget);
+        if (m.size >= (1ULL << 33)) pax += paxRecord("size", std::to_string(m.size));
+        if (m.uid >= (1u << 21)) pax += paxRecord("uid", std::to_string(m.uid));
+        if (m.gid >= (1u << 21)) pax += paxRecord("gid", std::to_string(m.gid));
+        if (m.mtime >= (1ULL << 33)) pax += paxRecord("mtime", std::to_string(m.mtime));
+        for (const auto& [key, value] : m.xattrs) pax += paxRecord("SCHILY.xattr." + key, value);
+
+        if (!pax.empty()) {
+            TarMember ext;
+            ext.type = 'x';
+            ext.path = "PaxHeaders/" + baseName(name);
+            ext.size = pax.size();
+            ext.mtime = m.mtime;
+            if (!writeHeader(ext, ext.path) || !data(pax.data(), pax.size()) || !end()) return false;
+        }
+        pending_ = m.type == '0' ? m.size : 0;
+        return writeHeader(m, name);
+    }
+
+    bool data(const void* buf, size_t len) {
+        pending_ -= std::min<uint64_t>(pending_, len);
+        return writeAll(buf, len);
+    }
+
+    // Pads the member to a whole block; a file that came up short is an error
+    bool end() {
+        if (pending_ != 0) return false;
+        size_t pad = static_cast<size_t>((512 - (bytesWritten % 512)) % 512);
+        static const char zeros[512] = {};
+        return writeAll(zeros, pad);
+    }
+
+    bool finish() {
+        static const char zeros[1024] = {};
+        return writeAll(zeros, sizeof(zeros));
+    }
+
+    static std::string paxRecord(const std::string& key, const std::string& value) {
+        // The length prefix counts itself, so grow it until it is stable
+        size_t body = key.size() + value.size() + 3;
+        size_t len = body + 1;
+        while (std::to_string(len).size() + body != len) len = std::to_string(len).size() + body;
+        return std::to_string(len) + " " + key + "=" + value + "\n";
+    }
+
+    // Zero-padded octal in width - 1 digits plus a NUL. Callers mask values
+    // to the field; going through a buffer that holds any 64-bit value is
+    // what keeps -Wformat-truncation from flagging every call.
+    static void octal(char* field, size_t width, uint64_t value) {
+        char digits[24];
+        int len = snprintf(digits, sizeof(digits), "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+        memcpy(field, digits + (static_cast<size_t>(len) - (width - 1)), width);
+    }
+
+    static void checksum(char* h) {
+        memset(h + 148, ' ', 8);
+        unsigned sum = 0;
+        for (int i = 0; i < 512; i++) sum += static_cast<unsigned char>(h[i]);
+        snprintf(h + 148, 8, "%06o", sum);
+    }
+
+private:
+    int fd_;
+    uint64_t pending_ = 0;
+
+    static std::string baseName(const std::string& path) {
+        std::string trimmed = path;
+        while (trimmed.size() > 1 && trimmed.back() == '/') trimmed.pop_back();
+        size_t slash = trimmed.rfind('/');
+        std::string base = slash == std::string::npos ? trimmed : trimmed.substr(slash + 1);
+        return base.substr(0, 80);
+    }
+
+    bool writeHeader(const TarMember& m, const std::string& name) {
+        char h[512] = {};
+        memcpy(h, name.data(), std::min<size_t>(name.size(), 100));
+        octal(h + 100, 8, m.mode & 07777);
+        octal(h + 108, 8, m.uid & 07777777);
+        octal(h + 116, 8, m.gid & 07777777);
+        octal(h + 124, 12, m.type == '0' || m.type == 'x' ? m.size & 077777777777ULL : 0);
+        octal(h + 136, 12, m.mtime & 077777777777ULL);
+        h[156] = m.type;
+        memcpy(h + 157, m.linkTarget.data(), std::min<size_t>(m.linkTarget.size(), 100));
+        memcpy(h + 257, "ustar", 6);
+        memcpy(h + 263, "00", 2);
+        // Linux majors have 12 bits and minors 20, so both always fit
+        octal(h + 329, 8, m.devMajor & 07777777);
+        octal(h + 337, 8, m.devMinor & 07777777);
+        checksum(h);
+        return writeAll(h, sizeof(h));
+    }
+
+    bool writeAll(const void* buf, size_t len) {
+        const char* p = static_cast<const char*>(buf);
+        while (len > 0) {
+            ssize_t n = write(fd_, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+            bytesWritten += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+};
+
+// Sets every directory in a tar stream to one mtime. A directory goes into
+// each shard that holds something below it and its date moves with any of
+// them, so shard keys leave it out; pinning it here keeps a cached shard
+// byte-identical to a fresh one. Reads what GNU tar --posix or --format=gnu
+// writes and drops the mtime record of a directory's pax header. A stream
+// that ends before its end-of-archive blocks is an error, since that is
+// how a killed tar shows up on the far side of a pipe.
+class TarDirectoryTimes {
+public:
+    static bool filter(int in, int out, uint64_t mtime, std::string& error) {
+        std::vector<std::vector<char>> pending;    // 'x', 'L' and 'K' members waiting for theirs
+        std::vector<char> block(512);
+        while (true) {
+            if (!readAll(in, block.data(), 512)) {
+                error = "tar stream ended without an end-of-archive marker";
+                return false;
+            }
+            if (std::all_of(block.begin(), block.end(), [](char c) { return c == 0; })) {
+                // End of archive: pass it and the record padding through
+                if (!pending.empty()) {
+                    error = "tar stream ended inside an extended header";
+                    return false;
+                }
+                return writeAll(out, block.data(), 512) && copyRest(in, out, error);
+            }
+            char type = block[156];
+            uint64_t size = number(block.data() + 124, 12);
+            uint64_t padded = (size + 511) / 512 * 512;
+
+            if (type == 'x' || type == 'L' || type == 'K') {
+                std::vector<char> member(block);
+                member.resize(512 + padded);
+                if (!readAll(in, member.data() + 512, padded)) {
+                    error = "tar stream ended inside an extended header";
+                    return false;
+                }
+                pending.push_back(std::move(member));
+                continue;
+            }
+
+            if (type == '5') {
+                for (auto& member : pending) {
+                    if (member[156] == 'x') pinTimes(member, mtime);
+                }
+                TarWriter::octal(block.data() + 136, 12, mtime);
+                TarWriter::checksum(block.data());
+            }
+            for (const auto& member : pending) {
+                if (!writeAll(out, member.data(), member.size())) return writeFailed(error);
+            }
+            pending.clear();
+            if (!writeAll(out, block.data(), 512)) return writeFailed(error);
+
+            // Member data, streamed; directories and links have none
+            std::vector<char> chunk(1 << 20);
+            while (padded > 0) {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(padded, chunk.size()));
+                if (!readAll(in, chunk.data(), n)) {
+                    error = "tar stream ended inside a member";
+                    return false;
+                }
+                if (!writeAll(out, chunk.data(), n)) return writeFailed(error);
+                padded -= n;
+            }
+        }
+    }
+
+private:
+    // Octal, or base-256 when the top bit is set (GNU tar for large values)
+    static uint64_t number(const char* field, size_t width) {
+        if (static_cast<unsigned char>(field[0]) & 0x80) {
+            uint64_t value = static_cast<unsigned char>(field[0]) & 0x7f;
+            for (size_t i = 1; i < width; i++) value = (value << 8) | static_cast<unsigned char>(field[i]);
+            return value;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < width && field[i] >= '0' && field[i] <= '7'; i++) value = value * 8 + uint64_t(field[i] - '0');
+        return value;
+    }
+
+    // Rewrites a pax header without its mtime record (and the atime and
+    // ctime ones GNU tar --posix adds), so the ustar field is what counts;
+    // the pax header's own ustar block carries the directory's date as well
+    static void pinTimes(std::vector<char>& member, uint64_t mtime) {
+        std::string records(member.data() + 512, static_cast<size_t>(number(member.data() + 124, 12)));
+        std::string kept;
+        size_t pos = 0;
+        while (pos < records.size()) {
+            size_t space = records.find(' ', pos);
+            if (space == std::string::npos) break;
+            size_t len = std::strtoull(records.c_str() + pos, nullptr, 10);
+            if (len == 0 || pos + len > records.size()) break;
+            std::string key = records.substr(space + 1, records.find('=', space) - space - 1);
+            if (key != "mtime" && key != "atime" && key != "ctime") kept += records.substr(pos, len);
+            pos += len;
+        }
+        TarWriter::octal(member.data() + 136, 12, mtime);
+        if (pos != records.size()) {
+            // Not well-formed; leave the records alone
+            TarWriter::checksum(member.data());
+            return;
+        }
+        member.assign(member.begin(), member.begin() + 512);
+        member.insert(member.end(), kept.begin(), kept.end());
+        member.resize(512 + (kept.size() + 511) / 512 * 512, 0);
+        TarWriter::octal(member.data() + 124, 12, kept.size());
+        TarWriter::checksum(member.data());
+    }
+
+    static bool copyRest(int in, int out, std::string& error) {
+        std::vector<char> chunk(1 << 16);
+        while (true) {
+            ssize_t n = read(in, chunk.data(), chunk.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                error = std::string("read failed: ") + strerror(errno);
+                return false;
+            }
+            if (n == 0) return true;
+            if (!writeAll(out, chunk.data(), static_cast<size_t>(n))) return writeFailed(error);
+        }
+    }
+
+    static bool readAll(int fd, char* p, size_t len) {
+        while (len > 0) {
+            ssize_t n = read(fd, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool writeAll(int fd, const char* p, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool writeFailed(std::string& error) {
+        error = std::string("write failed: ") + strerror(errno);
+        return false;
+    }
+};
+
+// Turns a squashfs image into a tar stream without extracting it, keeping
+// ownership, modes, times, device numbers, hardlinks and xattrs
+class SquashfsTarStream {
+public:
+    uint64_t files = 0;
+    uint64_t dataBytes = 0;
+
+    bool write(const SquashfsReader& reader, int fd, std::string& error) {
+        std::vector<SquashfsEntry> entries;
+        if (!reader.readTree(entries, error)) return false;
+
+        TarWriter tar(fd);
+        std::map<uint32_t, std::string> linked;     // inode number -> first path
+        for (const auto& e : entries) {
+            const SquashfsInode& in = e.inode;
+            TarMember m;
+            m.path = e.path;
+            m.mode = in.mode & 07777;
+            m.uid = in.uid;
+            m.gid = in.gid;
+            m.mtime = in.mtime;
+            if (!reader.readXattrs(in.xattr, m.xattrs, error)) {
+                error = e.path + ": " + error;
+                return false;
+            }
+
+            bool content = false;
+            switch (in.type) {
+                case SquashfsReader::TYPE_DIR: m.type = '5'; break;
+                case SquashfsReader::TYPE_SYMLINK: m.type = '2'; m.linkTarget = in.target; break;
+                case SquashfsReader::TYPE_CHRDEV: m.type = '3'; break;
+                case SquashfsReader::TYPE_BLKDEV: m.type = '4'; break;
+                case SquashfsReader::TYPE_FIFO: m.type = '6'; break;
+                case SquashfsReader::TYPE_SOCKET: continue;    // tar cannot hold sockets
+                default: {
+                    auto first = in.nlink > 1 ? linked.find(in.number) : linked.end();
+                    if (first != linked.end()) {
+                        m.type = '1';
+                        m.linkTarget = first->second;
+                        m.xattrs.clear();
+                    } else {
+                        if (in.nlink > 1) linked[in.number] = e.path;
+                        m.type = '0';
+                        m.size = in.fileSize;
+                        content = true;
+                    }
+                }
+            }
+            if (m.type == '3' || m.type == '4') {
+                m.devMajor = in.devMajor();
+                m.devMinor = in.devMinor();
+            }
+
+            if (!tar.begin(m)) {
+                error = "write failed at " + e.path + ": " + strerror(errno);
+                return false;
+            }
+            if (content) {
+                bool written = true;
+                if (!reader.readFile(in, [&](const uint8_t* p, size_t n) {
+                    written = tar.data(p, n);
+                    return written;
+                }, error)) {
+                    error = e.path + ": " + error;
+                    return false;
+                }
+                if (!written) {
+                    error = "write failed at " + e.path + ": " + strerror(errno);
+                    return false;
+                }
+                files++;
+                dataBytes += in.fileSize;
+            }
+            if (!tar.end()) {
+                error = e.path + ": file is shorter than its size";
+                return false;
+            }
+        }
+        if (!tar.finish()) {
+            error = std::string("write failed: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef TIERS_H
+#define TIERS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "layers.h"
+
+// Split of a tree into the files read while booting (hot) and the rest
+// (cold). Both lists are ready for "tar --null --no-recursion -T"; the hot
+// list carries the parent directories of its files so the top overlay
+// layer keeps their real ownership and modes.
+struct HotSet {
+    std::vector<std::string> hot;
+    std::vector<std::string> cold;
+    uint64_t hotBytes = 0;
+    uint64_t coldBytes = 0;
+    size_t seeded = 0;
+    size_t libraries = 0;
+    size_t traced = 0;
+    size_t skipped = 0;        // boot files left cold because of the size limit
+    bool traceIgnored = false; // most of the tree was read since boot, so atimes say nothing
+};
+
+class HotSetPlanner {
+public:
+    // Paths needed before the desktop is up on the systems cmi clones.
+    // A trailing slash matches a whole directory.
+    static std::vector<std::string> defaultSeeds() {
+        return {
+            "etc/",
+            "usr/lib/systemd/",
+            "usr/lib/udev/",
+            "usr/lib/os-release",
+            "usr/lib/modprobe.d/",
+            "usr/lib/sysctl.d/",
+            "usr/lib/tmpfiles.d/",
+            "usr/lib/sysusers.d/",
+            "usr/lib/environment.d/",
+            "usr/lib/dbus-1.0/",
+            "usr/share/dbus-1/",
+            "usr/share/polkit-1/",
+            "usr/share/X11/xkb/",
+            "usr/share/fonts/TTF/DejaVuSans.ttf",
+            "usr/lib/xorg/",
+            "usr/lib/sddm/",
+            "usr/share/sddm/",
+            "usr/lib/plymouth/",
+            "usr/bin/bash",
+            "usr/bin/sh",
+            "usr/bin/mount",
+            "usr/bin/login",
+            "usr/bin/agetty",
+            "usr/bin/dbus-daemon",
+            "usr/bin/dbus-broker",
+            "usr/bin/dbus-broker-launch",
+            "usr/bin/systemctl",
+            "usr/bin/udevadm",
+            "usr/bin/sddm",
+            "usr/bin/sddm-greeter",
+            "usr/bin/sddm-greeter-qt6",
+            "usr/bin/gdm",
+            "usr/bin/lightdm",
+            "usr/bin/Xorg",
+            "usr/lib/Xorg",
+            "usr/bin/Xwayland",
+            "usr/bin/startplasma-x11",
+            "usr/bin/startplasma-wayland",
+            "usr/bin/plasmashell",
+            "usr/bin/kwin_x11",
+            "usr/bin/kwin_wayland",
+            "usr/bin/NetworkManager",
+            "usr/bin/polkitd",
+            "usr/lib/polkit-1/polkitd"
+        };
+    }
+
+    // accessedSince > 0 also marks every file with an access time after it
+    // (the boot time when cloning the running system) as hot. Files are
+    // taken in order seeds, their libraries, traced files until limitBytes.
+    static HotSet plan(const std::string& root, const TreeManifest& manifest, const std::vector<std::string>& seeds,
+                       uint64_t limitBytes, time_t accessedSince) {
+        HotSet result;
+        std::set<std::string> hot;
+        auto take = [&](const std::string& rel, size_t& counter) {
+            auto it = manifest.entries.find(rel);
+            if (it == manifest.entries.end() || it->second.type == 'd' || hot.count(rel)) return false;
+            uint64_t size = it->second.type == 'f' ? it->second.size : 0;
+            if (result.hotBytes + size > limitBytes) {
+                result.skipped++;
+                return false;
+            }
+            hot.insert(rel);
+            result.hotBytes += size;
+            counter++;
+            return true;
+        };
+
+        std::vector<std::string> elfQueue;
+        for (const auto& kv : manifest.entries) {
+            if (kv.second.type != 'd' && matches(kv.first, seeds) && take(kv.first, result.seeded) && kv.second.type == 'f') {
+                elfQueue.push_back(kv.first);
+            }
+        }
+
+        // Shared libraries of everything hot, followed through symlinks
+        std::set<std::string> scanned;
+        while (!elfQueue.empty()) {
+            std::string rel = elfQueue.back();
+            elfQueue.pop_back();
+            if (!scanned.insert(rel).second) continue;
+            for (const auto& needed : neededLibraries(root + "/" + rel)) {
+                for (const auto& lib : resolveLibrary(manifest, needed)) {
+                    take(lib, result.libraries);
+                    auto it = manifest.entries.find(lib);
+                    if (it != manifest.entries.end() && it->second.type == 'f' && hot.count(lib)) elfQueue.push_back(lib);
+                }
+            }
+        }
+
+        if (accessedSince > 0) {
+            std::vector<std::pair<time_t, std::string>> accessed;
+            for (const auto& kv : manifest.entries) {
+                if (kv.second.type != 'f' || hot.count(kv.first)) continue;
+                struct stat st;
+                if (lstat((root + "/" + kv.first).c_str(), &st) == 0 && st.st_atime >= accessedSince) {
+                    accessed.push_back({st.st_atime, kv.first});
+                }
+            }
+            size_t files = 0;
+            for (const auto& kv : manifest.entries) files += kv.second.type == 'f';
+            // A backup or an earlier build since boot touches nearly everything
+            result.traceIgnored = accessed.size() * 10 > files * 6;
+            if (!result.traceIgnored) {
+                // Earliest reads are the ones closest to boot
+                std::sort(accessed.begin(), accessed.end());
+                for (const auto& a : accessed) take(a.second, result.traced);
+            }
+        }
+
+        std::set<std::string> parents;
+        for (const auto& rel : hot) {
+            for (size_t slash = rel.find('/'); slash != std::string::npos; slash = rel.find('/', slash + 1)) {
+                parents.insert(rel.substr(0, slash));
+            }
+        }
+        for (const auto& kv : manifest.entries) {
+            if (hot.count(kv.first) || parents.count(kv.first)) result.hot.push_back(kv.first);
+            if (!hot.count(kv.first)) {
+                result.cold.push_back(kv.first);
+                if (kv.second.type == 'f') result.coldBytes += kv.second.size;
+            }
+        }
+        return result;
+    }
+
+    static bool matches(const std::string& rel, const std::vector<std::string>& seeds) {
+        for (const auto& s : seeds) {
+            if (s.empty()) continue;
+            if (s.back() == '/' ? rel.compare(0, s.size(), s) == 0 : rel == s) return true;
+        }
+        return false;
+    }
+
+    // One seed per line; blank lines and # comments are ignored
+    static std::vector<std::string> readSeeds(const std::string& path) {
+        std::vector<std::string> seeds;
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            while (!line.empty() && (line.back() == ' ' || line.back() == '\r')) line.pop_back();
+            size_t start = line.find_first_not_of(" \t/");
+            if (start == std::string::npos || line[start] == '#') continue;
+            seeds.push_back(line.substr(start));
+        }
+        return seeds;
+    }
+
+    // DT_NEEDED names and the interpreter of a 64-bit little-endian ELF
+    static std::vector<std::string> neededLibraries(const std::string& path) {
+        std::vector<std::string> needed;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return needed;
+        Elf64_Ehdr eh;
+        if (pread(fd, &eh, sizeof(eh), 0) != static_cast<ssize_t>(sizeof(eh)) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+            eh.e_ident[EI_CLASS] != ELFCLASS64 || eh.e_ident[EI_DATA] != ELFDATA2LSB || eh.e_phentsize != sizeof(Elf64_Phdr) ||
+            eh.e_phnum > 256) {
+            close(fd);
+            return needed;
+        }
+        std::vector<Elf64_Phdr> ph(eh.e_phnum);
+        size_t phBytes = ph.size() * sizeof(Elf64_Phdr);
+        if (pread(fd, ph.data(), phBytes, static_cast<off_t>(eh.e_phoff)) != static_cast<ssize_t>(phBytes)) {
+            close(fd);
+            return needed;
+        }
+
+        auto fileOffset = [&](uint64_t vaddr, uint64_t& off) {
+            for (const auto& p : ph) {
+                if (p.p_type == PT_LOAD && vaddr >= p.p_vaddr && vaddr < p.p_vaddr + p.p_filesz) {
+                    off = vaddr - p.p_vaddr + p.p_offset;
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        for (const auto& p : ph) {
+            if (p.p_type == PT_INTERP && p.p_filesz > 1 && p.p_filesz < 4096) {
+                std::string interp(p.p_filesz, '\0');
+                if (pread(fd, interp.data(), interp.size(), static_cast<off_t>(p.p_offset)) == static_cast<ssize_t>(interp.size())) {
+                    needed.push_back(interp.c_str());
+                }
+            }
+            if (p.p_type != PT_DYNAMIC || p.p_filesz > (1 << 20)) continue;
+            std::vector<Elf64_Dyn> dyn(p.p_filesz / sizeof(Elf64_Dyn));
+            size_t dynBytes = dyn.size() * sizeof(Elf64_Dyn);
+            if (pread(fd, dyn.data(), dynBytes, static_cast<off_t>(p.p_offset)) != static_cast<ssize_t>(dynBytes)) continue;
+
+            uint64_t strtab = 0, strsz = 0;
+            for (const auto& d : dyn) {
+                if (d.d_tag == DT_STRTAB) strtab = d.d_un.d_ptr;
+                if (d.d_tag == DT_STRSZ) strsz = d.d_un.d_val;
+            }
+            uint64_t strOff = 0;
+            if (strsz == 0 || strsz > (16 << 20) || !fileOffset(strtab, strOff)) continue;
+            std::vector<char> strings(strsz + 1, '\0');
+            if (pread(fd, strings.data(), strsz, static_cast<off_t>(strOff)) != static_cast<ssize_t>(strsz)) continue;
+            for (const auto& d : dyn) {
+                if (d.d_tag == DT_NEEDED && d.d_un.d_val < strsz) needed.push_back(strings.data() + d.d_un.d_val);
+            }
+        }
+        close(fd);
+        return needed;
+    }
+
+private:
+    // The symlink chain and final file for a library name in the usual
+    // library directories, as manifest paths
+    static std::vector<std::string> resolveLibrary(const TreeManifest& manifest, const std::string& name) {
+        std::vector<std::string> candidates;
+        if (!name.empty() && name[0] == '/') {
+            candidates.push_back(name.substr(1));
+            // /lib and /lib64 are symlinks into /usr/lib on merged-usr systems
+            if (name.compare(0, 5, "/lib/") == 0 || name.compare(0, 7, "/lib64/") == 0) {
+                candidates.push_back("usr/lib/" + name.substr(name.find('/', 1) + 1));
+            }
+        } else {
+            for (const char* dir : {"usr/lib/", "usr/lib64/", "usr/lib/x86_64-linux-gnu/", "lib/x86_64-linux-gnu/"}) {
+                candidates.push_back(dir + name);
+            }
+        }
+
+        std::vector<std::string> chain;
+        for (std::string rel : candidates) {
+            for (int depth = 0; depth < 8; depth++) {
+                auto it = manifest.entries.find(rel);
+                if (it == manifest.entries.end()) break;
+                chain.push_back(rel);
+                if (it->second.type != 'l') return chain;
+                const std::string& target = it->second.link;
+                rel = target[0] == '/' ? target.substr(1) : rel.substr(0, rel.rfind('/') + 1) + target;
+            }
+            if (!chain.empty()) return chain;
+        }
+        return chain;
+    }
+};
+
+// One boot of a live image as reported by systemd-analyze
+struct BootTimeSample {
+    std::string layout;        // single, layered or tiered
+    std::string label;
+    double kernel = 0;
+    double initrd = 0;
+    double userspace = 0;
+    double graphical = 0;      // graphical.target reached
+    double desktop = 0;        // uptime when the sample was recorded
+
+    double total() const {
+        return kernel + initrd + userspace;
+    }
+};
+
+class BootTimeLog {
+public:
+    // Seconds from a systemd timespan such as "1min 2.345s" or "850ms"
+    static double parseSpan(const std::string& text) {
+        double seconds = 0;
+        std::istringstream in(text);
+        std::string token;
+        while (in >> token) {
+            char* end = nullptr;
+            double value = std::strtod(token.c_str(), &end);
+            if (end == token.c_str()) break;
+            std::string unit(end);
+            if (unit == "ms") seconds += value / 1000;
+            else if (unit == "us" || unit == "µs") seconds += value / 1e6;
+            else if (unit == "min") seconds += value * 60;
+            else if (unit == "h") seconds += value * 3600;
+            else if (unit == "s") seconds += value;
+            else break;
+        }
+        return seconds;
+    }
+
+    // Fills in the phases from "systemd-analyze time" output
+    static bool parseAnalyze(const std::string& text, BootTimeSample& sample) {
+        auto phase = [&](const std::string& name) {
+            size_t paren = text.find("(" + name + ")");
+            if (paren == std::string::npos) return 0.0;
+            // "Startup finished in 2.1s (kernel) + 1min 4.5s (userspace) = ..."
+            size_t in = text.rfind(" in ", paren);
+            size_t plus = text.rfind(" + ", paren);
+            size_t start = 0;
+            if (in != std::string::npos) start = in + 4;
+            if (plus != std::string::npos && plus + 3 > start) start = plus + 3;
+            return parseSpan(text.substr(start, paren - start));
+        };
+        sample.kernel = phase("kernel");
+        sample.initrd = phase("initrd");
+        sample.userspace = phase("userspace");
+        size_t graphical = text.find("graphical.target reached after ");
+        if (graphical != std::string::npos) {
+            size_t start = graphical + std::strlen("graphical.target reached after ");
+            sample.graphical = parseSpan(text.substr(start, text.find(" in userspace", start) - start));
+        }
+        return sample.userspace > 0;
+    }
+
+    static bool append(const std::string& path, const BootTimeSample& s) {
+        std::ofstream out(path, std::ios::app);
+        if (!out.is_open()) return false;
+        out << std::fixed << std::setprecision(3) << s.layout << '\t' << s.kernel << '\t' << s.initrd << '\t'
+        << s.userspace << '\t' << s.graphical << '\t' << s.desktop << '\t' << s.label << '\n';
+        return out.good();
+    }
+
+    static std::vector<BootTimeSample> load(const std::string& path) {
+        std::vector<BootTimeSample> samples;
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream fields(line);
+            BootTimeSample s;
+            if (!(fields >> s.layout >> s.kernel >> s.initrd >> s.userspace >> s.graphical >> s.desktop)) continue;
+            std::getline(fields >> std::ws, s.label);
+            samples.push_back(s);
+        }
+        return samples;
+    }
+
+    // Median of each phase per layout, and how each layout compares with
+    // the single-image one
+    static std::string report(const std::vector<BootTimeSample>& samples) {
+        std::map<std::string, std::vector<BootTimeSample>> byLayout;
+        for (const auto& s : samples) byLayout[s.layout].push_back(s);
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2);
+        out << std::left << std::setw(10) << "Layout" << std::right << std::setw(6) << "Boots" << std::setw(10) << "Kernel"
+        << std::setw(10) << "Initrd" << std::setw(11) << "Userspace" << std::setw(11) << "Graphical" << std::setw(10) << "Desktop" << "\n";
+        std::map<std::string, double> desktop;
+        for (const auto& kv : byLayout) {
+            auto median = [&](double BootTimeSample::*field) {
+                std::vector<double> v;
+                for (const auto& s : kv.second) v.push_back(s.*field);
+                std::sort(v.begin(), v.end());
+                return v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+            };
+            desktop[kv.first] = median(&BootTimeSample::desktop);
+            out << std::left << std::setw(10) << kv.first << std::right << std::setw(6) << kv.second.size()
+            << std::setw(9) << median(&BootTimeSample::kernel) << "s" << std::setw(9) << median(&BootTimeSample::initrd) << "s"
+            << std::setw(10) << median(&BootTimeSample::userspace) << "s" << std::setw(10) << median(&BootTimeSample::graphical) << "s"
+            << std::setw(9) << desktop[kv.first] << "s\n";
+        }
+        auto single = desktop.find("single");
+        if (single != desktop.end() && single->second > 0) {
+            for (const auto& kv : desktop) {
+                if (kv.first == "single") continue;
+                double change = (kv.second - single->second) / single->second * 100;
+                out << kv.first << " vs single: " << (change <= 0 ? "" : "+") << std::setprecision(1) << change
+                << "% boot-to-desktop\n" << std::setprecision(2);
+            }
+        }
+        return out.str();
+    }
+};
+
+#endif
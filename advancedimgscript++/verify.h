@@ -0,0 +1,299 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <ctime>
+#include <tuple>
+#include <cstdint>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "layers.h"
+#include "squashfs.h"
+
+// Content hashes of the regular files in a TreeManifest, stored next to it
+// as "hash<TAB>path" lines.
+class ContentHashes {
+public:
+    std::map<std::string, uint64_t> hashes;
+
+    bool save(const std::string& path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out.is_open()) return false;
+        out << "# cmi content hashes v1\n";
+        for (const auto& kv : hashes) {
+            out << XXH64::hex(kv.second) << '\t' << TreeManifest::escape(kv.first) << '\n';
+        }
+        return out.good();
+    }
+
+    bool load(const std::string& path) {
+        hashes.clear();
+        std::ifstream in(path);
+        if (!in.is_open()) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            size_t tab = line.find('\t');
+            if (tab == std::string::npos) continue;
+            hashes[TreeManifest::unescape(line.substr(tab + 1))] = std::strtoull(line.substr(0, tab).c_str(), nullptr, 16);
+        }
+        return true;
+    }
+};
+
+struct VerifyReport {
+    uint64_t entries = 0;
+    uint64_t files = 0;
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
+    std::vector<std::string> errors;
+    std::vector<std::string> changedDuringBuild;
+
+    bool ok() const {
+        return errors.empty();
+    }
+};
+
+// Checks finished images against the manifest recorded from the source:
+// every metadata and data block must decompress, the metadata must be
+// consistent, and every entry must match the manifest.
+class ImageVerifier {
+public:
+    static constexpr size_t MAX_ERRORS = 50;
+
+    // complete: the images together must hold every manifest entry.
+    // Otherwise each image only has to agree with the manifest for the
+    // paths it contains (delta layers), and 0:0 whiteouts are allowed.
+    // sourceRoot is re-checked for mismatches so files that changed on the
+    // running system during the build are reported, not failed.
+    // pinnedTime is the date mksquashfs -all-time gave every inode, if any;
+    // shards keep the source dates, so either is accepted.
+    static VerifyReport verify(const std::vector<std::string>& images, const TreeManifest& manifest,
+                               const ContentHashes& hashes, bool complete, const std::string& sourceRoot,
+                               time_t pinnedTime = 0) {
+        VerifyReport report;
+        std::set<std::string> seen;
+
+        for (const auto& image : images) {
+            SquashfsReader reader;
+            std::string error;
+            std::vector<SquashfsEntry> entries;
+            if (!reader.open(image, error) || !reader.readTree(entries, error)) {
+                report.errors.push_back(image + ": " + error);
+                continue;
+            }
+
+            std::set<uint32_t> inodeNumbers;
+            for (const auto& e : entries) inodeNumbers.insert(e.inode.number);
+            // The root directory is the one inode not reached through an entry
+            if (inodeNumbers.size() + 1 != reader.super().inodeCount) {
+                report.errors.push_back(image + ": " + std::to_string(inodeNumbers.size() + 1) +
+                " inodes reachable, superblock says " + std::to_string(reader.super().inodeCount));
+            }
+
+            std::vector<uint64_t> contentHash(entries.size(), 0);
+            checkData(reader, image, entries, contentHash, report);
+
+            for (size_t i = 0; i < entries.size(); i++) {
+                const SquashfsEntry& e = entries[i];
+                seen.insert(e.path);
+                report.entries++;
+                compareEntry(e, contentHash[i], manifest, hashes, complete, sourceRoot, pinnedTime, report);
+            }
+        }
+
+        if (complete) {
+            for (const auto& kv : manifest.entries) {
+                if (seen.count(kv.first)) continue;
+                if (changedSince(sourceRoot, kv.first, &kv.second)) {
+                    report.changedDuringBuild.push_back(kv.first);
+                } else {
+                    addError(report, kv.first + ": missing from the image");
+                }
+            }
+        }
+        return report;
+    }
+
+private:
+    static void addError(VerifyReport& report, const std::string& error) {
+        if (report.errors.size() < MAX_ERRORS) report.errors.push_back(error);
+        else if (report.errors.size() == MAX_ERRORS) report.errors.push_back("... further errors suppressed");
+    }
+
+    static char typeChar(uint16_t type) {
+        switch (type) {
+            case SquashfsReader::TYPE_DIR: return 'd';
+            case SquashfsReader::TYPE_FILE: return 'f';
+            case SquashfsReader::TYPE_SYMLINK: return 'l';
+            case SquashfsReader::TYPE_BLKDEV: return 'b';
+            case SquashfsReader::TYPE_CHRDEV: return 'c';
+            case SquashfsReader::TYPE_FIFO: return 'p';
+            default: return 's';
+        }
+    }
+
+    // True when the source no longer looks like its manifest entry, i.e.
+    // the running system touched it while the image was being made.
+    static bool changedSince(const std::string& root, const std::string& rel, const ManifestEntry* recorded) {
+        struct stat st;
+        bool exists = lstat((root + "/" + rel).c_str(), &st) == 0;
+        if (!recorded) return exists;
+        if (!exists) return true;
+        return st.st_mtime != recorded->mtime || (S_ISREG(st.st_mode) && static_cast<uint64_t>(st.st_size) != recorded->size) ||
+        (st.st_mode & 07777) != recorded->mode || st.st_uid != recorded->uid || st.st_gid != recorded->gid;
+    }
+
+    static void compareEntry(const SquashfsEntry& e, uint64_t contentHash, const TreeManifest& manifest,
+                             const ContentHashes& hashes, bool complete, const std::string& sourceRoot,
+                             time_t pinnedTime, VerifyReport& report) {
+        const SquashfsInode& in = e.inode;
+        auto it = manifest.entries.find(e.path);
+        if (it == manifest.entries.end()) {
+            bool whiteout = in.type == SquashfsReader::TYPE_CHRDEV && in.rdev == 0;
+            if (whiteout && !complete) return;
+            if (changedSince(sourceRoot, e.path, nullptr)) report.changedDuringBuild.push_back(e.path);
+            else addError(report, e.path + ": in the image but not in the manifest");
+            return;
+        }
+
+        const ManifestEntry& m = it->second;
+        std::string what;
+        if (typeChar(in.type) != m.type) what = "type";
+        else if (in.mode != m.mode) what = "mode";
+        else if (in.uid != m.uid || in.gid != m.gid) what = "owner";
+        else if (in.mtime != static_cast<uint32_t>(m.mtime) && (!pinnedTime || in.mtime != static_cast<uint32_t>(pinnedTime))) {
+            what = "mtime";
+        }
+        else if (in.type == SquashfsReader::TYPE_SYMLINK && in.target != m.link) what = "symlink target";
+        else if ((in.type == SquashfsReader::TYPE_CHRDEV || in.type == SquashfsReader::TYPE_BLKDEV) &&
+            std::to_string(in.devMajor()) + ":" + std::to_string(in.devMinor()) != m.link) what = "device number";
+        else if (in.type == SquashfsReader::TYPE_FILE) {
+            auto h = hashes.hashes.find(e.path);
+            if (in.fileSize != m.size) what = "size";
+            else if (h != hashes.hashes.end() && h->second != contentHash) what = "content";
+        }
+        if (what.empty()) return;
+
+        if (changedSince(sourceRoot, e.path, &m)) report.changedDuringBuild.push_back(e.path);
+        else addError(report, e.path + ": " + what + " differs from the source");
+    }
+
+    // Decompresses every data block and fragment on all cores. Files that
+    // end in the same fragment are handled together so each fragment is
+    // decompressed once; files sharing the same blocks (duplicates) are
+    // read once.
+    static void checkData(const SquashfsReader& reader, const std::string& image, const std::vector<SquashfsEntry>& entries,
+                          std::vector<uint64_t>& contentHash, VerifyReport& report) {
+        std::map<uint32_t, std::vector<size_t>> byFragment;
+        std::vector<std::vector<size_t>> work;
+        std::map<std::tuple<uint64_t, uint64_t, uint32_t, uint32_t>, size_t> firstWithData;
+        std::vector<std::pair<size_t, size_t>> duplicates;
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            const SquashfsInode& in = entries[i].inode;
+            if (in.type != SquashfsReader::TYPE_FILE) continue;
+            auto key = std::make_tuple(in.blocksStart, in.fileSize, in.fragment, in.fragmentOffset);
+            auto first = firstWithData.find(key);
+            if (first != firstWithData.end() && in.fileSize > 0) {
+                duplicates.push_back({i, first->second});
+                continue;
+            }
+            firstWithData[key] = i;
+            if (in.hasFragment()) byFragment[in.fragment].push_back(i);
+            else work.push_back({i});
+        }
+        for (auto& kv : byFragment) work.push_back(std::move(kv.second));
+
+        // Large files first so one big file does not finish last on its own
+        std::sort(work.begin(), work.end(), [&](const std::vector<size_t>& a, const std::vector<size_t>& b) {
+            return entries[a[0]].inode.fileSize > entries[b[0]].inode.fileSize;
+        });
+
+        std::atomic<size_t> next(0);
+        std::atomic<uint64_t> blocks(0), bytes(0), files(0);
+        std::mutex errorLock;
+
+        auto worker = [&]() {
+            std::vector<uint8_t> fragment;
+            size_t w;
+            while ((w = next.fetch_add(1)) < work.size()) {
+                uint32_t loadedFragment = 0xFFFFFFFF;
+                for (size_t i : work[w]) {
+                    const SquashfsInode& in = entries[i].inode;
+                    std::string error;
+                    XXH64 h;
+                    uint64_t pos = in.blocksStart;
+                    uint64_t remaining = in.fileSize;
+                    std::vector<uint8_t> block;
+                    bool ok = true;
+
+                    for (uint32_t sizeWord : in.blockSizes) {
+                        size_t expected = static_cast<size_t>(std::min<uint64_t>(remaining, reader.super().blockSize));
+                        if (!reader.readBlock(pos, sizeWord, block, expected, error)) {
+                            ok = false;
+                            break;
+                        }
+                        if (block.size() != expected) {
+                            error = "block at " + std::to_string(pos) + " holds " + std::to_string(block.size()) +
+                            " bytes, expected " + std::to_string(expected);
+                            ok = false;
+                            break;
+                        }
+                        h.update(block.data(), block.size());
+                        pos += sizeWord & (SquashfsReader::BLOCK_UNCOMPRESSED - 1);
+                        remaining -= expected;
+                        blocks++;
+                    }
+
+                    if (ok && in.hasFragment() && remaining > 0) {
+                        if (loadedFragment != in.fragment) {
+                            ok = reader.readFragment(in.fragment, fragment, error);
+                            loadedFragment = ok ? in.fragment : 0xFFFFFFFF;
+                            if (ok) blocks++;
+                        }
+                        if (ok && in.fragmentOffset + remaining > fragment.size()) {
+                            error = "tail runs past the end of fragment " + std::to_string(in.fragment);
+                            ok = false;
+                        }
+                        if (ok) h.update(fragment.data() + in.fragmentOffset, static_cast<size_t>(remaining));
+                    } else if (ok && remaining > 0) {
+                        error = "file is shorter than its size";
+                        ok = false;
+                    }
+
+                    if (!ok) {
+                        std::lock_guard<std::mutex> lock(errorLock);
+                        addError(report, image + ": " + entries[i].path + ": " + error);
+                        continue;
+                    }
+                    contentHash[i] = h.digest();
+                    bytes += in.fileSize;
+                    files++;
+                }
+            }
+        };
+
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+        for (auto& t : pool) t.join();
+
+        for (const auto& d : duplicates) contentHash[d.first] = contentHash[d.second];
+        report.blocks += blocks;
+        report.bytes += bytes;
+        report.files += files + duplicates.size();
+    }
+};
+
+#endif
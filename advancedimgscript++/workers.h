@@ -0,0 +1,720 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "hash.h"
+
+// Line-oriented framing over a pair of file descriptors (a socket, or the
+// stdin/stdout of a process behind ssh). Headers are text lines, payloads
+// follow as raw bytes of the announced length.
+class WireChannel {
+public:
+    WireChannel(int in, int out) : in_(in), out_(out) {}
+
+    bool writeAll(const void* data, size_t len) {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t n = write(out_, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool writeLine(const std::string& line) {
+        std::string framed = line + "\n";
+        return writeAll(framed.data(), framed.size());
+    }
+
+    bool readLine(std::string& line, size_t maxLength = 4096) {
+        line.clear();
+        for (;;) {
+            if (pos_ == buf_.size() && !fill()) return false;
+            char c = buf_[pos_++];
+            if (c == '\n') return true;
+            if (line.size() >= maxLength) return false;
+            line += c;
+        }
+    }
+
+    bool readExact(void* data, size_t len) {
+        char* p = static_cast<char*>(data);
+        while (len > 0) {
+            if (pos_ == buf_.size() && !fill()) return false;
+            size_t n = std::min(len, buf_.size() - pos_);
+            memcpy(p, buf_.data() + pos_, n);
+            pos_ += n;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // Copies len payload bytes into fd (which may be -1 to discard them)
+    // and hashes them on the way
+    bool readInto(int fd, uint64_t len, XXH64* hash) {
+        std::vector<char> chunk(1 << 16);
+        bool sinkOk = true;
+        while (len > 0) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(len, chunk.size()));
+            if (!readExact(chunk.data(), n)) return false;
+            if (hash) hash->update(chunk.data(), n);
+            if (fd >= 0 && sinkOk) sinkOk = writeFd(fd, chunk.data(), n);
+            len -= n;
+        }
+        return sinkOk;
+    }
+
+    static bool writeFd(int fd, const char* p, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Sends a file as "<header> <size> <hash>" followed by its bytes
+    bool sendFile(const std::string& header, const std::string& path) {
+        uint64_t hash = 0;
+        if (!XXH64::ofFile(path, hash)) return false;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return false;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        bool ok = writeLine(header + " " + std::to_string(st.st_size) + " " + XXH64::hex(hash));
+        std::vector<char> chunk(1 << 16);
+        uint64_t left = static_cast<uint64_t>(st.st_size);
+        while (ok && left > 0) {
+            ssize_t n = read(fd, chunk.data(), static_cast<size_t>(std::min<uint64_t>(left, chunk.size())));
+            if (n <= 0) ok = false;
+            else {
+                ok = writeAll(chunk.data(), static_cast<size_t>(n));
+                left -= static_cast<uint64_t>(n);
+            }
+        }
+        close(fd);
+        return ok;
+    }
+
+private:
+    int in_;
+    int out_;
+    std::vector<char> buf_;
+    size_t pos_ = 0;
+
+    bool fill() {
+        buf_.resize(1 << 16);
+        for (;;) {
+            ssize_t n = read(in_, buf_.data(), buf_.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                buf_.clear();
+                pos_ = 0;
+                return false;
+            }
+            buf_.resize(static_cast<size_t>(n));
+            pos_ = 0;
+            return true;
+        }
+    }
+};
+
+// The worker side: receives tar streams for shards, runs mksquashfs on
+// them and sends the images back. Finished images are kept in cacheDir
+// (when set) so a shard the coordinator asks for again costs no transfer.
+//
+//   -> AUTH <token>\n                                (when the worker has one)
+//   <- AUTH OK\n  |  DENIED\n
+//   -> SHARD <index> <key> <argsLength>\n<args>
+//   <- HIT <index> <size> <hash>\n<image>            (cached)
+//   <- NEED <index>\n
+//   -> DATA <length>\n<tar bytes> ... END\n          (or ABORT\n)
+//   <- OK <index> <size> <hash>\n<image>  |  ERR <index> <message>\n
+//   -> BYE\n
+class CompressionWorker {
+public:
+    static constexpr const char* HELLO = "CMIWORKER 1";
+
+    std::string cacheDir;
+    uint64_t cacheBytes = 20ULL << 30;
+    std::string resourceArgs;   // this machine's -processors/-mem, appended to every job
+    std::string token;          // shared secret a coordinator must send before any shard
+
+    int serve(int in, int out) {
+        WireChannel wire(in, out);
+        char host[256] = "unknown";
+        gethostname(host, sizeof(host) - 1);
+        if (!wire.writeLine(std::string(HELLO) + " " + host)) return 1;
+
+        std::string line;
+        if (!token.empty()) {
+            if (!wire.readLine(line) || line.compare(0, 5, "AUTH ") != 0 || !sameToken(line.substr(5), token)) {
+                wire.writeLine("DENIED");
+                return 1;
+            }
+            if (!wire.writeLine("AUTH OK")) return 1;
+        }
+        while (wire.readLine(line)) {
+            std::istringstream fields(line);
+            std::string verb, index, key;
+            size_t argsLength = 0;
+            fields >> verb;
+            if (verb == "BYE") return 0;
+            if (verb == "AUTH") {
+                // Nothing to check on a worker without a token
+                if (!wire.writeLine("AUTH OK")) return 1;
+                continue;
+            }
+            if (verb != "SHARD" || !(fields >> index >> key >> argsLength) || argsLength > 4096 || !safeKey(key)) return 1;
+            std::string args(argsLength, '\0');
+            if (!wire.readExact(args.data(), argsLength)) return 1;
+            if (!serveShard(wire, index, key, args)) return 1;
+        }
+        return 0;
+    }
+
+    // Serves every connection on address:port in its own process. Without
+    // a token anyone who can connect could plant images under any key, so
+    // the cache is only used when clients have to authenticate.
+    int listenOn(const std::string& address, int port) {
+        if (token.empty()) cacheDir.clear();
+        addrinfo hints{}, *res = nullptr;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+        if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return 1;
+        int fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            freeaddrinfo(res);
+            return 1;
+        }
+        int on = 1, off = 0;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (res->ai_family == AF_INET6) setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        bool bound = bind(fd, res->ai_addr, res->ai_addrlen) == 0 && ::listen(fd, 16) == 0;
+        freeaddrinfo(res);
+        if (!bound) {
+            close(fd);
+            return 1;
+        }
+        signal(SIGCHLD, SIG_IGN);
+        for (;;) {
+            int conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (conn < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fork() == 0) {
+                close(fd);
+                signal(SIGCHLD, SIG_DFL);
+                _exit(serve(conn, conn));
+            }
+            close(conn);
+        }
+        close(fd);
+        return 1;
+    }
+
+    // Only mksquashfs options may come over the wire; they are passed as
+    // separate arguments, never through a shell
+    static bool safeArgs(const std::string& args) {
+        for (char c : args) {
+            if (!isalnum(static_cast<unsigned char>(c)) && !strchr(" -_.%+", c)) return false;
+        }
+        return true;
+    }
+
+    static bool isLoopback(const std::string& address) {
+        return address == "::1" || address.compare(0, 4, "127.") == 0;
+    }
+
+    // Compares without stopping at the first differing byte
+    static bool sameToken(const std::string& offered, const std::string& expected) {
+        unsigned char diff = offered.size() != expected.size();
+        for (size_t i = 0; i < offered.size(); i++) diff |= offered[i] ^ expected[i % expected.size()];
+        return diff == 0;
+    }
+
+    static bool safeKey(const std::string& key) {
+        if (key.empty() || key.size() > 128) return false;
+        for (char c : key) {
+            if (!isalnum(static_cast<unsigned char>(c))) return false;
+        }
+        return true;
+    }
+
+private:
+    bool serveShard(WireChannel& wire, const std::string& index, const std::string& key, const std::string& args) {
+        std::string cached = cacheDir.empty() ? "" : cacheDir + "/" + key + ".sfs";
+        if (!cached.empty() && access(cached.c_str(), R_OK) == 0) {
+            utimes(cached.c_str(), nullptr);
+            return wire.sendFile("HIT " + index, cached);
+        }
+        if (!wire.writeLine("NEED " + index)) return false;
+
+        std::string dir = cacheDir.empty() ? "/tmp" : cacheDir;
+        std::string tmp = dir + "/.cmi-shard-XXXXXX";
+        int tmpFd = mkstemp(tmp.data());
+        if (tmpFd >= 0) close(tmpFd);
+
+        std::vector<std::string> argv = {"mksquashfs", "-", tmp, "-tar", "-noappend", "-quiet"};
+        std::istringstream split(args + " " + resourceArgs);
+        std::string a;
+        while (split >> a) argv.push_back(a);
+        pid_t pid = -1;
+        int pipeFd = tmpFd >= 0 && safeArgs(args) ? spawnWithStdin(argv, pid) : -1;
+
+        // Drain the whole stream even after a failure so the channel stays in step
+        std::string line;
+        bool aborted = false;
+        for (;;) {
+            if (!wire.readLine(line)) {
+                if (pipeFd >= 0) close(pipeFd);
+                if (pid > 0) waitpid(pid, nullptr, 0);
+                unlink(tmp.c_str());
+                return false;
+            }
+            if (line == "END") break;
+            if (line == "ABORT") {
+                aborted = true;
+                break;
+            }
+            uint64_t length = 0;
+            if (sscanf(line.c_str(), "DATA %" SCNu64, &length) != 1) return false;
+            if (!wire.readInto(pipeFd, length, nullptr) && pipeFd >= 0) {
+                close(pipeFd);
+                pipeFd = -1;
+            }
+        }
+
+        int status = -1;
+        if (pipeFd >= 0) close(pipeFd);
+        if (pid > 0) {
+            if (aborted) kill(pid, SIGTERM);
+            waitpid(pid, &status, 0);
+        }
+        if (aborted || pid <= 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            unlink(tmp.c_str());
+            std::string why = aborted ? "stream aborted" : pid <= 0 ? "cannot run mksquashfs" : "mksquashfs failed";
+            return wire.writeLine("ERR " + index + " " + why);
+        }
+
+        bool sent = wire.sendFile("OK " + index, tmp);
+        if (!cached.empty() && rename(tmp.c_str(), cached.c_str()) == 0) trimCache();
+        else unlink(tmp.c_str());
+        return sent;
+    }
+
+    static int spawnWithStdin(const std::vector<std::string>& args, pid_t& pid) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+        pid = fork();
+        if (pid == 0) {
+            dup2(fds[0], 0);
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) {
+                dup2(devnull, 1);
+                dup2(devnull, 2);
+            }
+            std::vector<char*> argv;
+            for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+            argv.push_back(nullptr);
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        close(fds[0]);
+        if (pid < 0) {
+            close(fds[1]);
+            return -1;
+        }
+        return fds[1];
+    }
+
+    // Oldest images go first once the cache is over its size
+    void trimCache() {
+        std::vector<std::pair<time_t, std::pair<std::string, uint64_t>>> objects;
+        uint64_t total = 0;
+        DIR* d = opendir(cacheDir.c_str());
+        if (!d) return;
+        while (struct dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() < 5 || name.compare(name.size() - 4, 4, ".sfs") != 0) continue;
+            struct stat st;
+            std::string path = cacheDir + "/" + name;
+            if (stat(path.c_str(), &st) != 0) continue;
+            objects.push_back({st.st_mtime, {path, static_cast<uint64_t>(st.st_size)}});
+            total += static_cast<uint64_t>(st.st_size);
+        }
+        closedir(d);
+        std::sort(objects.begin(), objects.end());
+        for (const auto& o : objects) {
+            if (total <= cacheBytes) break;
+            unlink(o.second.first.c_str());
+            total -= o.second.second;
+        }
+    }
+};
+
+// A shard the coordinator wants compressed somewhere
+struct ShardJob {
+    size_t index = 0;
+    std::string key;
+    std::string args;           // compressor options, identical on every worker
+    std::string tarCommand;     // writes the shard's tar stream to stdout
+    std::string output;         // where the finished image goes
+    uint64_t bytes = 0;
+    int attempts = 0;
+    bool done = false;
+    std::string worker;         // who built it, for the affinity map
+};
+
+struct WorkerStats {
+    std::string name;
+    size_t shards = 0;
+    size_t cacheHits = 0;
+    uint64_t bytesSent = 0;
+    size_t failures = 0;
+    bool dead = false;
+};
+
+// Hands shard jobs to workers named "local", "ssh:[user@]host" or
+// "tcp:host:port". Neighbouring small shards are batched so one worker
+// reads one directory region, shards go back to the worker that built
+// them last time (it may still have the image), failed shards are retried
+// elsewhere, and results land at job.output whatever order they finish in.
+class WorkerPool {
+public:
+    static constexpr int MAX_ATTEMPTS = 3;
+    static constexpr int MAX_CONNECT_FAILURES = 2;
+
+    std::string selfPath;                 // binary started for local workers
+    std::string localCacheArgs = "--no-cache";
+    std::string token;                    // sent to tcp: workers, ssh and local ones need none
+    uint64_t batchBytes = 512ULL << 20;
+    std::map<std::string, std::string> affinity;   // shard key -> worker name
+    std::function<void(const ShardJob&, const std::string&)> onProgress;
+    size_t retries = 0;
+
+    // Expands "local:3,ssh:builder,tcp:10.0.0.5:7500" into worker names
+    static std::vector<std::string> parseSpec(const std::string& spec) {
+        std::vector<std::string> workers;
+        std::stringstream in(spec);
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            item.erase(0, item.find_first_not_of(' '));
+            item.erase(item.find_last_not_of(' ') + 1);
+            if (item.empty()) continue;
+            if (item.compare(0, 5, "local") == 0) {
+                int count = item.size() > 6 && item[5] == ':' ? std::max(1, std::atoi(item.c_str() + 6)) : 1;
+                for (int i = 0; i < count; i++) workers.push_back("local#" + std::to_string(i));
+            } else if (item.compare(0, 4, "ssh:") == 0 || item.compare(0, 4, "tcp:") == 0) {
+                workers.push_back(item);
+            }
+        }
+        return workers;
+    }
+
+    // Runs every job it can; returns the per-worker stats. Jobs still
+    // marked !done afterwards need a local build.
+    std::vector<WorkerStats> run(std::vector<ShardJob>& jobs, const std::vector<std::string>& workers) {
+        struct sigaction ignore{}, previous{};
+        ignore.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignore, &previous);
+
+        // Batches are runs of consecutive shards, which the planner laid
+        // out in directory order
+        batches_.clear();
+        std::vector<size_t> current;
+        uint64_t currentBytes = 0;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (!current.empty() && (currentBytes + jobs[i].bytes > batchBytes ||
+                affinityOf(jobs[current[0]]) != affinityOf(jobs[i]))) {
+                batches_.push_back(current);
+                current.clear();
+                currentBytes = 0;
+            }
+            current.push_back(i);
+            currentBytes += jobs[i].bytes;
+        }
+        if (!current.empty()) batches_.push_back(current);
+
+        localWorkers_ = std::max<size_t>(1, std::count_if(workers.begin(), workers.end(), [](const std::string& w) {
+            return w.compare(0, 6, "local#") == 0;
+        }));
+        std::vector<WorkerStats> stats(workers.size());
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < workers.size(); w++) {
+            stats[w].name = workers[w];
+            threads.emplace_back([&, w]() { drive(jobs, workers[w], stats[w]); });
+        }
+        for (auto& t : threads) t.join();
+        sigaction(SIGPIPE, &previous, nullptr);
+        return stats;
+    }
+
+private:
+    std::mutex lock_;
+    std::deque<std::vector<size_t>> batches_;
+    size_t inFlight_ = 0;
+    size_t localWorkers_ = 1;
+
+    std::string affinityOf(const ShardJob& job) const {
+        auto it = affinity.find(job.key);
+        return it == affinity.end() ? "" : it->second;
+    }
+
+    // Prefers a batch this worker built before, then the oldest one
+    // Waits while other workers still hold batches that may come back
+    bool takeBatch(const std::vector<ShardJob>& jobs, const std::string& worker, std::vector<size_t>& batch) {
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                if (!batches_.empty()) break;
+                if (inFlight_ == 0) return false;
+            }
+            usleep(50000);
+        }
+        std::lock_guard<std::mutex> guard(lock_);
+        if (batches_.empty()) return false;
+        auto pick = batches_.begin();
+        for (auto it = batches_.begin(); it != batches_.end(); ++it) {
+            if (affinityOf(jobs[(*it)[0]]) == worker) {
+                pick = it;
+                break;
+            }
+        }
+        batch = *pick;
+        batches_.erase(pick);
+        inFlight_++;
+        return true;
+    }
+
+    void giveBack(std::vector<ShardJob>& jobs, const std::vector<size_t>& batch) {
+        std::lock_guard<std::mutex> guard(lock_);
+        inFlight_--;
+        std::vector<size_t> retry;
+        for (size_t i : batch) {
+            if (jobs[i].done) continue;
+            if (++jobs[i].attempts < MAX_ATTEMPTS) {
+                retry.push_back(i);
+                retries++;
+            }
+        }
+        if (!retry.empty()) batches_.push_back(retry);
+    }
+
+    void drive(std::vector<ShardJob>& jobs, const std::string& worker, WorkerStats& stats) {
+        int connectFailures = 0;
+        while (connectFailures < MAX_CONNECT_FAILURES) {
+            int in = -1, out = -1;
+            pid_t pid = -1;
+            if (!connect(worker, in, out, pid)) {
+                connectFailures++;
+                continue;
+            }
+            WireChannel wire(in, out);
+            std::string hello;
+            bool healthy = wire.readLine(hello) && hello.compare(0, strlen(CompressionWorker::HELLO), CompressionWorker::HELLO) == 0;
+            if (healthy && !token.empty() && worker.compare(0, 4, "tcp:") == 0) {
+                std::string reply;
+                healthy = wire.writeLine("AUTH " + token) && wire.readLine(reply) && reply == "AUTH OK";
+            }
+            if (!healthy) connectFailures++;
+
+            std::vector<size_t> batch;
+            while (healthy && takeBatch(jobs, worker, batch)) {
+                for (size_t i : batch) {
+                    std::string error;
+                    if (!runJob(wire, jobs[i], stats, error)) {
+                        if (onProgress) onProgress(jobs[i], worker + ": " + error);
+                        stats.failures++;
+                        healthy = error.compare(0, 7, "worker:") == 0;
+                        if (!healthy) break;
+                        continue;
+                    }
+                    jobs[i].worker = worker;
+                    if (onProgress) onProgress(jobs[i], "");
+                }
+                giveBack(jobs, batch);
+                if (!healthy) connectFailures++;
+                else connectFailures = 0;
+            }
+            if (healthy) {
+                wire.writeLine("BYE");
+                disconnect(in, out, pid);
+                return;
+            }
+            disconnect(in, out, pid);
+        }
+        stats.dead = true;
+    }
+
+    // Errors starting with "worker:" leave the connection usable
+    bool runJob(WireChannel& wire, ShardJob& job, WorkerStats& stats, std::string& error) {
+        std::string idx = std::to_string(job.index);
+        if (!wire.writeLine("SHARD " + idx + " " + job.key + " " + std::to_string(job.args.size())) ||
+            !wire.writeAll(job.args.data(), job.args.size())) {
+            error = "connection lost";
+            return false;
+        }
+        std::string line;
+        if (!wire.readLine(line)) {
+            error = "connection lost";
+            return false;
+        }
+        bool hit = line.compare(0, 4, "HIT ") == 0;
+        if (!hit) {
+            if (line != "NEED " + idx) {
+                error = "unexpected reply: " + line;
+                return false;
+            }
+            if (!streamTar(wire, job, stats)) {
+                error = "connection lost while sending";
+                return false;
+            }
+            if (!wire.readLine(line)) {
+                error = "connection lost";
+                return false;
+            }
+        }
+
+        std::istringstream fields(line);
+        std::string verb, index, hashHex;
+        uint64_t size = 0;
+        fields >> verb >> index;
+        if (verb == "ERR") {
+            std::string message;
+            std::getline(fields >> std::ws, message);
+            error = "worker: " + message;
+            return false;
+        }
+        if ((verb != "OK" && verb != "HIT") || index != idx || !(fields >> size >> hashHex)) {
+            error = "unexpected reply: " + line;
+            return false;
+        }
+
+        int fd = open(job.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        XXH64 hash;
+        bool stored = wire.readInto(fd, size, &hash);
+        if (fd >= 0) stored = close(fd) == 0 && stored;
+        if (!stored && fd >= 0) {
+            // The payload was consumed, so only the file is bad
+            error = "worker: cannot write " + job.output;
+            return false;
+        }
+        if (fd < 0 || XXH64::hex(hash.digest()) != hashHex) {
+            unlink(job.output.c_str());
+            error = fd < 0 ? "worker: cannot write " + job.output : "worker: image hash mismatch";
+            return false;
+        }
+        job.done = true;
+        stats.shards++;
+        if (hit) stats.cacheHits++;
+        return true;
+    }
+
+    static bool streamTar(WireChannel& wire, const ShardJob& job, WorkerStats& stats) {
+        FILE* tar = popen(job.tarCommand.c_str(), "r");
+        if (!tar) return wire.writeLine("ABORT");
+        std::vector<char> chunk(1 << 20);
+        bool ok = true;
+        size_t n;
+        while (ok && (n = fread(chunk.data(), 1, chunk.size(), tar)) > 0) {
+            ok = wire.writeLine("DATA " + std::to_string(n)) && wire.writeAll(chunk.data(), n);
+            stats.bytesSent += n;
+        }
+        int status = pclose(tar);
+        if (!ok) return false;
+        return wire.writeLine(status == 0 ? "END" : "ABORT");
+    }
+
+    bool connect(const std::string& worker, int& in, int& out, pid_t& pid) {
+        if (worker.compare(0, 4, "tcp:") == 0) {
+            size_t colon = worker.rfind(':');
+            std::string host = worker.substr(4, colon - 4);
+            std::string port = worker.substr(colon + 1);
+            addrinfo hints{}, *res = nullptr;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return false;
+            int fd = -1;
+            for (addrinfo* a = res; a && fd < 0; a = a->ai_next) {
+                fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+                if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            freeaddrinfo(res);
+            if (fd < 0) return false;
+            in = fd;
+            out = dup(fd);
+            return true;
+        }
+
+        std::vector<std::string> args;
+        if (worker.compare(0, 4, "ssh:") == 0) {
+            args = {"ssh", "-o", "BatchMode=yes", worker.substr(4), "cmiimg worker --stdio"};
+        } else {
+            // Local workers split this machine's CPUs between them
+            args = {selfPath, "worker", "--stdio", "--share", std::to_string(localWorkers_), localCacheArgs};
+        }
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return false;
+        pid = fork();
+        if (pid == 0) {
+            dup2(sv[1], 0);
+            dup2(sv[1], 1);
+            std::vector<char*> argv;
+            for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+            argv.push_back(nullptr);
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        close(sv[1]);
+        if (pid < 0) {
+            close(sv[0]);
+            return false;
+        }
+        in = sv[0];
+        out = dup(sv[0]);
+        return true;
+    }
+
+    static void disconnect(int in, int out, pid_t pid) {
+        close(out);
+        close(in);
+        if (pid > 0) waitpid(pid, nullptr, 0);
+    }
+};
+
+#endif
@@ -51,6 +51,8 @@ anlyze this script #include <QApplication>
 #include <iomanip>
 #include <QTemporaryFile>
 
+#include "isowriter.h"
+
 // Forward declarations
 void saveConfig();
 void execute_command(const std::string& cmd, bool continueOnError = false);
@@ -610,30 +612,74 @@ std::string expandPath(const std::string& path) {
     return result;
 }
 
-// Consolidated ISO creation command
-std::string getXorrisoCommand(const std::string& buildDir, const std::string& outputPath) {
-    return "sudo xorriso -as mkisofs "
-    "--modification-date=\"$(date +%Y%m%d%H%M%S00)\" "
-    "--protective-msdos-label "
-    "-volid \"" + config.isoTag + "\" "
-    "-appid \"claudemods Linux Live/Rescue CD\" "
-    "-publisher \"claudemods claudemods101@gmail.com >\" "
-    "-preparer \"Prepared by user\" "
-    "-r -graft-points -no-pad "
-    "--sort-weight 0 / "
-    "--sort-weight 1 /boot "
-    "--grub2-mbr " + buildDir + "/boot/grub/i386-pc/boot_hybrid.img "
-    "-partition_offset 16 "
-    "-b boot/grub/i386-pc/eltorito.img "
-    "-c boot.catalog "
-    "-no-emul-boot -boot-load-size 4 -boot-info-table --grub2-boot-info "
-    "-eltorito-alt-boot "
-    "-append_partition 2 0xef " + buildDir + "/boot/efi.img "
-    "-e --interval:appended_partition_2:all:: "
-    "-no-emul-boot "
-    "-iso-level 3 "
-    "-o \"" + outputPath + "\" " +
-    buildDir;
+std::string selfExecutable() {
+    char path[4096];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0) return "/proc/self/exe";
+    path[len] = '\0';
+    return path;
+}
+
+// Runs as "sudo <self> write-iso <tree> <iso> <volid>": the build tree has
+// root-owned 0600 files such as the initramfs. Progress goes to stdout as
+// "progress <done> <total>" lines for the GUI.
+int runWriteIso(const std::string& buildDir, const std::string& outputPath, const std::string& volumeId) {
+    IsoWriter writer;
+    writer.progress = [](uint64_t done, uint64_t total) {
+        std::cout << "progress " << done << " " << total << std::endl;
+    };
+    if (writer.write(IsoLayout::grub2(buildDir, volumeId), outputPath)) return 0;
+    std::cerr << writer.error << std::endl;
+    return 1;
+}
+
+// Consolidated ISO creation; the boot layout is shared with the console tool.
+// The writer runs as a sudo child and the ISO is handed back to the user.
+// One ISO at a time: libisofs keeps process-wide state and the outputs
+// would compete for the disk anyway.
+bool writeIso(const std::string& buildDir, const std::string& outputPath, std::string& error,
+              std::function<void(uint64_t, uint64_t)> progress = nullptr) {
+    static std::mutex isoMutex;
+    std::lock_guard<std::mutex> lock(isoMutex);
+    if (!PASSWORD_VALIDATED) {
+        error = "sudo password required";
+        return false;
+    }
+
+    QProcess process;
+    process.start("sudo", QStringList() << "-S" << "-p" << "" << QString::fromStdString(selfExecutable()) << "write-iso"
+    << QString::fromStdString(buildDir) << QString::fromStdString(outputPath) << QString::fromStdString(config.isoTag));
+    process.write(SUDO_PASSWORD.c_str());
+    process.write("\n");
+    process.closeWriteChannel();
+    if (!process.waitForStarted()) {
+        error = "failed to start the ISO writer";
+        return false;
+    }
+    while (process.state() != QProcess::NotRunning) {
+        process.waitForReadyRead(1000);
+        while (process.canReadLine()) {
+            QStringList fields = QString::fromUtf8(process.readLine()).trimmed().split(' ');
+            if (fields.size() == 3 && fields[0] == "progress" && progress) {
+                progress(fields[1].toULongLong(), fields[2].toULongLong());
+            }
+        }
+    }
+    process.waitForFinished(-1);
+    if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+        error = QString::fromUtf8(process.readAllStandardError()).trimmed().toStdString();
+        if (error.empty()) error = "the ISO writer failed";
+        return false;
+    }
+
+    QProcess chown;
+    chown.start("sudo", QStringList() << "-S" << "chown" << QString::fromStdString(USERNAME + ":" + USERNAME)
+    << QString::fromStdString(outputPath));
+    chown.write(SUDO_PASSWORD.c_str());
+    chown.write("\n");
+    chown.closeWriteChannel();
+    chown.waitForFinished(-1);
+    return true;
 }
 
 bool createISO() {
@@ -654,12 +700,16 @@ bool createISO() {
     std::string buildDir = "/home/" + USERNAME + "/.config/cmi/build-image-arch-img";
     std::string outputPath = expandedOutputDir + "/" + config.isoName;
 
-    std::string xorrisoCmd = getXorrisoCommand(buildDir, outputPath);
-    execute_command(xorrisoCmd, true);
+    if (!PASSWORD_VALIDATED && !requestSudoPassword()) {
+        QMessageBox::critical(nullptr, "Error", "Sudo password required for creating ISO!");
+        return false;
+    }
 
-    // Change ownership of the created ISO to the current user
-    std::string chownCmd = "sudo chown " + USERNAME + ":" + USERNAME + " \"" + outputPath + "\"";
-    execute_command(chownCmd, true);
+    std::string error;
+    if (!writeIso(buildDir, outputPath, error)) {
+        QMessageBox::critical(nullptr, "Error", QString("ISO creation failed: %1").arg(QString::fromStdString(error)));
+        return false;
+    }
 
     QMessageBox::information(nullptr, "Success", QString("ISO created successfully at %1").arg(QString::fromStdString(outputPath)));
     return true;
@@ -1276,21 +1326,26 @@ private slots:
         progressBar->setValue(50);
 
         std::string expandedOutputDir = expandPath(config.outputDir);
-        worker->executeCommand("mkdir -p " + QString::fromStdString(expandedOutputDir), true);
+        QDir().mkpath(QString::fromStdString(expandedOutputDir));
 
         // FIXED: Build directory path uses actual username
         std::string buildDir = "/home/" + USERNAME + "/.config/cmi/build-image-arch-img";
         std::string outputPath = expandedOutputDir + "/" + config.isoName;
 
-        std::string xorrisoCmd = getXorrisoCommand(buildDir, outputPath);
-        worker->executeCommand(QString::fromStdString(xorrisoCmd), true);
-
-        // Change ownership of the created ISO to the current user
-        std::string chownCmd = "sudo chown " + USERNAME + ":" + USERNAME + " \"" + outputPath + "\"";
-        worker->executeCommand(QString::fromStdString(chownCmd), true);
-
-        logOutputText("ISO created successfully at " + QString::fromStdString(outputPath) + "\n", "green");
-        logOutputText("Ownership changed to current user: " + QString::fromStdString(USERNAME) + "\n", "cyan");
+        // Written off the GUI thread; the progress bar follows the bytes written
+        QThread* isoThread = QThread::create([this, buildDir, outputPath]() {
+            std::string error;
+            bool ok = writeIso(buildDir, outputPath, error, [this](uint64_t done, uint64_t total) {
+                int percent = total ? static_cast<int>(50 + done * 50 / total) : 50;
+                QMetaObject::invokeMethod(progressBar, [this, percent]() { progressBar->setValue(percent); }, Qt::QueuedConnection);
+            });
+            QMetaObject::invokeMethod(this, [this, ok, error, outputPath]() {
+                if (ok) logOutputText("ISO created successfully at " + QString::fromStdString(outputPath) + "\n", "green");
+                else logOutputText("ISO creation failed: " + QString::fromStdString(error) + "\n", "red");
+            }, Qt::QueuedConnection);
+        });
+        connect(isoThread, &QThread::finished, isoThread, &QObject::deleteLater);
+        isoThread->start();
     }
 
     void onShowDiskUsage() {
@@ -1948,6 +2003,8 @@ private:
 };
 
 int main(int argc, char *argv[]) {
+    if (argc == 5 && std::string(argv[1]) == "write-iso") return runWriteIso(argv[2], argv[3], argv[4]);
+
     QApplication app(argc, argv);
 
     // Initialize Qt application for resource system
@@ -7,6 +7,9 @@ TEMPLATE = app
 
 SOURCES += main.cpp
 
-HEADERS +=
+INCLUDEPATH += $$PWD/../../shared
+HEADERS += $$PWD/../../shared/isowriter.h
 
 RESOURCES +=
+
+LIBS += -lisofs
@@ -0,0 +1,593 @@
+#ifndef ISOWRITER_H
+#define ISOWRITER_H
+
+#include <string>
+#include <functional>
+#include <chrono>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <linux/fs.h>
+
+#define LIBISOFS_WITHOUT_LIBBURN yes
+#include <libisofs/libisofs.h>
+
+// Boot setup of a hybrid ISO: the El Torito BIOS and EFI entries plus the
+// MBR (and GPT) that make the same file boot from a USB stick. Paths of
+// boot images inside the tree are relative to the tree.
+struct IsoLayout {
+    enum class Boot { Grub2, Isolinux };
+
+    Boot boot = Boot::Grub2;
+    std::string tree;
+    std::string volumeId;
+    std::string applicationId = "claudemods Linux Live/Rescue CD";
+    std::string publisherId = "claudemods claudemods101@gmail.com >";
+    std::string preparerId = "Prepared by user";
+    std::string mbrImage;       // system area: GRUB2 boot_hybrid.img or SYSLINUX isohdpfx.bin
+    std::string biosImage;      // El Torito BIOS boot image
+    std::string catalog;        // El Torito boot catalog
+    std::string efiImage;       // GRUB2: FAT image appended as partition 2, ISOLINUX: image in the tree
+    std::vector<std::string> overlays;  // directories laid over the tree, later ones win
+    std::string persistImage;   // filesystem image appended as partition 3 for the live overlay
+    time_t timestamp = 0;       // every date in the image, for reproducible builds; 0 means now
+
+    // Same layout as xorriso -as mkisofs --grub2-mbr boot_hybrid.img
+    // --protective-msdos-label -partition_offset 16 -append_partition 2 0xef
+    static IsoLayout grub2(const std::string& tree, const std::string& volumeId) {
+        IsoLayout layout;
+        layout.boot = Boot::Grub2;
+        layout.tree = tree;
+        layout.volumeId = volumeId;
+        layout.mbrImage = tree + "/boot/grub/i386-pc/boot_hybrid.img";
+        layout.biosImage = "boot/grub/i386-pc/eltorito.img";
+        layout.catalog = "boot.catalog";
+        layout.efiImage = tree + "/boot/efi.img";
+        return layout;
+    }
+
+    // Same layout as xorriso -as mkisofs -isohybrid-mbr isohdpfx.bin
+    // -b isolinux/isolinux.bin -e <efiImage> -isohybrid-gpt-basdat
+    static IsoLayout isolinux(const std::string& tree, const std::string& volumeId, const std::string& mbrImage,
+                              const std::string& efiImage) {
+        IsoLayout layout;
+        layout.boot = Boot::Isolinux;
+        layout.tree = tree;
+        layout.volumeId = volumeId;
+        layout.mbrImage = mbrImage;
+        layout.biosImage = "isolinux/isolinux.bin";
+        layout.catalog = "isolinux/boot.cat";
+        layout.efiImage = efiImage;
+        return layout;
+    }
+};
+
+// Writes a hybrid ISO with libisofs. The image is produced as one stream
+// that is copied to the output in large aligned writes, so the size is
+// known up front and progress is exact.
+//
+// The largest file of the tree (the squashfs) is placed right after the
+// boot files. libisofs only gets a stub stream of the same size for it, so
+// the payload is never read through the image stream; its range is filled
+// in afterwards. When it lands on a 4 KiB boundary and the output is on
+// the same filesystem, its bytes are cloned from the source with
+// FICLONERANGE, so on btrfs and XFS only the ISO metadata is written.
+// Elsewhere the payload is copied with copy_file_range.
+class IsoWriter {
+public:
+    size_t bufferSize = 4 << 20;
+
+    uint64_t totalBytes = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t reflinkedBytes = 0;    // payload bytes shared with the source file
+    uint64_t copiedPayloadBytes = 0; // payload bytes copied because cloning was not possible
+    double seconds = 0;
+    std::string error;
+
+    // Called after every buffer with the bytes written and the final size
+    std::function<void(uint64_t, uint64_t)> progress;
+
+    bool write(const IsoLayout& layout, const std::string& output) {
+        auto start = std::chrono::steady_clock::now();
+        int rc = iso_init();
+        if (rc < 0) return fail("cannot initialise libisofs", rc);
+        // Failures come back as error codes; only print what is worse
+        iso_set_msgs_severities(const_cast<char*>("NEVER"), const_cast<char*>("FAILURE"), const_cast<char*>("isowriter"));
+
+        Payload payload = findPayload(layout, output);
+        std::string padDir;
+        Result result = Result::Failed;
+        // A payload on a 2 KiB boundary is moved by one sector with a pad
+        // file and the image written again; only metadata and boot files
+        // come before it, so the retry is short
+        for (int attempt = 0; attempt < 2; attempt++) {
+            std::string pad;
+            if (attempt == 1) {
+                char tmpl[] = "/tmp/cmi-iso-XXXXXX";
+                if (!mkdtemp(tmpl)) break;
+                padDir = tmpl;
+                pad = padDir + "/.align";
+                FILE* f = fopen(pad.c_str(), "wb");
+                static const char zeros[2048] = {};
+                bool padOk = f && fwrite(zeros, 1, sizeof(zeros), f) == sizeof(zeros);
+                if (f) fclose(f);
+                if (!padOk) break;
+            }
+            bytesWritten = reflinkedBytes = copiedPayloadBytes = 0;
+
+            IsoImage* image = nullptr;
+            IsoWriteOpts* opts = nullptr;
+            burn_source* source = nullptr;
+            bool ok = prepare(layout, payload, pad, image, opts);
+            if (ok) {
+                rc = iso_image_create_burn_source(image, opts, &source);
+                ok = rc >= 0 || fail("cannot start writing the image", rc);
+            }
+            result = ok ? stream(source, output, payload, attempt == 0) : Result::Failed;
+            // Freeing the source stops the writer thread if it is still running
+            if (source) {
+                source->free_data(source);
+                free(source);
+            }
+            if (opts) iso_write_opts_free(opts);
+            if (image) iso_image_unref(image);
+            if (result != Result::Misaligned) break;
+        }
+        if (!padDir.empty()) {
+            unlink((padDir + "/.align").c_str());
+            rmdir(padDir.c_str());
+        }
+        if (payload.fd >= 0) close(payload.fd);
+        iso_finish();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (result != Result::Done) unlink(output.c_str());
+        return result == Result::Done;
+    }
+
+private:
+    static constexpr uint64_t CLONE_BLOCK = 4096;
+    static constexpr uint64_t MIN_PAYLOAD = 64ULL << 20;
+
+    enum class Result { Done, Failed, Misaligned };
+
+    struct Payload {
+        std::string path;       // inside the tree, empty when nothing is cloned
+        int fd = -1;
+        uint64_t size = 0;
+        std::vector<unsigned char> marker;  // random first sector of the stub stream
+    };
+
+    // Stands in for the payload: the marker sector, then zeros
+    struct StubStream {
+        uint64_t size;
+        uint64_t pos;
+        std::vector<unsigned char> marker;
+    };
+
+    bool fail(const std::string& what, int rc = 0) {
+        error = what;
+        if (rc < 0) error += std::string(": ") + iso_error_to_msg(rc);
+        return false;
+    }
+
+    // The largest file of the tree, if it is worth cloning, the output is
+    // on the same filesystem and no overlay replaces it
+    static Payload findPayload(const IsoLayout& layout, const std::string& output) {
+        Payload payload;
+        std::string best;
+        uint64_t bestSize = 0;
+        largestFile(layout.tree, "", best, bestSize, 0);
+        std::string outputDir = output.find('/') == std::string::npos ? "." : output.substr(0, output.rfind('/'));
+        struct stat payloadSt, outSt;
+        if (bestSize < MIN_PAYLOAD || stat(outputDir.empty() ? "/" : outputDir.c_str(), &outSt) != 0) return payload;
+        for (const auto& overlay : layout.overlays) {
+            if (access((overlay + "/" + best).c_str(), F_OK) == 0) return payload;
+        }
+        payload.fd = open((layout.tree + "/" + best).c_str(), O_RDONLY | O_CLOEXEC);
+        if (payload.fd < 0) return payload;
+        payload.marker.resize(2048);
+        if (fstat(payload.fd, &payloadSt) != 0 || payloadSt.st_dev != outSt.st_dev ||
+            static_cast<uint64_t>(payloadSt.st_size) != bestSize ||
+            getrandom(payload.marker.data(), payload.marker.size(), 0) != 2048) {
+            close(payload.fd);
+            payload.fd = -1;
+            return payload;
+        }
+        payload.path = best;
+        payload.size = bestSize;
+        return payload;
+    }
+
+    static int stubOpen(IsoStream* stream) {
+        static_cast<StubStream*>(stream->data)->pos = 0;
+        return 1;
+    }
+
+    static int stubClose(IsoStream*) {
+        return 1;
+    }
+
+    static off_t stubSize(IsoStream* stream) {
+        return static_cast<off_t>(static_cast<StubStream*>(stream->data)->size);
+    }
+
+    static int stubRead(IsoStream* stream, void* buf, size_t count) {
+        StubStream* stub = static_cast<StubStream*>(stream->data);
+        size_t n = static_cast<size_t>(std::min<uint64_t>(count, stub->size - stub->pos));
+        unsigned char* out = static_cast<unsigned char*>(buf);
+        memset(out, 0, n);
+        if (stub->pos < stub->marker.size()) {
+            memcpy(out, stub->marker.data() + stub->pos, std::min<uint64_t>(n, stub->marker.size() - stub->pos));
+        }
+        stub->pos += n;
+        return static_cast<int>(n);
+    }
+
+    static int stubRepeatable(IsoStream*) {
+        return 1;
+    }
+
+    // Any id no file source uses; there is only ever one stub
+    static void stubId(IsoStream*, unsigned int* fsId, dev_t* devId, ino_t* inoId) {
+        *fsId = 0x434d4950;
+        *devId = 0;
+        *inoId = 1;
+    }
+
+    static void stubFree(IsoStream* stream) {
+        delete static_cast<StubStream*>(stream->data);
+    }
+
+    // Puts a stub stream with the payload's size and attributes where the
+    // payload was, so libisofs lays it out without reading it
+    bool stubPayload(IsoImage* image, const Payload& payload) {
+        static IsoStreamIface stubClass = {0, {'c', 'm', 'i', 'p'}, stubOpen, stubClose, stubSize, stubRead,
+            stubRepeatable, stubId, stubFree, nullptr, nullptr, nullptr, nullptr};
+        IsoNode* node = nullptr;
+        if (iso_tree_path_to_node(image, ("/" + payload.path).c_str(), &node) != 1) {
+            return fail("cannot find " + payload.path + " in the image");
+        }
+        IsoDir* parent = iso_node_get_parent(node);
+        std::string name = iso_node_get_name(node);
+        mode_t mode = iso_node_get_permissions(node);
+        uid_t uid = iso_node_get_uid(node);
+        gid_t gid = iso_node_get_gid(node);
+        time_t atime = iso_node_get_atime(node), mtime = iso_node_get_mtime(node), ctime = iso_node_get_ctime(node);
+        int rc = iso_node_remove(node);
+        if (rc < 0) return fail("cannot replace " + payload.path, rc);
+
+        IsoStream* stream = static_cast<IsoStream*>(malloc(sizeof(IsoStream)));
+        if (!stream) return fail("out of memory");
+        *stream = IsoStream{&stubClass, 1, new StubStream{payload.size, 0, payload.marker}};
+        IsoFile* file = nullptr;
+        rc = iso_tree_add_new_file(parent, name.c_str(), stream, &file);
+        if (rc < 0) {
+            iso_stream_unref(stream);
+            return fail("cannot add the stub for " + payload.path, rc);
+        }
+        node = reinterpret_cast<IsoNode*>(file);
+        iso_node_set_permissions(node, mode);
+        iso_node_set_uid(node, uid);
+        iso_node_set_gid(node, gid);
+        iso_node_set_atime(node, atime);
+        iso_node_set_mtime(node, mtime);
+        iso_node_set_ctime(node, ctime);
+        iso_node_set_sort_weight(node, 1);
+        return true;
+    }
+
+    static bool allZero(const unsigned char* p, size_t len) {
+        static const unsigned char zeros[4096] = {};
+        for (size_t at = 0; at < len; at += sizeof(zeros)) {
+            if (memcmp(p + at, zeros, std::min(sizeof(zeros), len - at)) != 0) return false;
+        }
+        return true;
+    }
+
+    static void largestFile(const std::string& tree, const std::string& rel, std::string& best, uint64_t& bestSize, int depth) {
+        if (depth > 16) return;
+        DIR* dir = opendir((tree + "/" + rel).c_str());
+        if (!dir) return;
+        while (struct dirent* e = readdir(dir)) {
+            std::string name = e->d_name;
+            if (name == "." || name == "..") continue;
+            std::string child = rel.empty() ? name : rel + "/" + name;
+            struct stat st;
+            if (lstat((tree + "/" + child).c_str(), &st) != 0) continue;
+            if (S_ISDIR(st.st_mode)) {
+                largestFile(tree, child, best, bestSize, depth + 1);
+            } else if (S_ISREG(st.st_mode) && static_cast<uint64_t>(st.st_size) > bestSize) {
+                best = child;
+                bestSize = static_cast<uint64_t>(st.st_size);
+            }
+        }
+        closedir(dir);
+    }
+
+    bool prepare(const IsoLayout& layout, const Payload& payload, const std::string& pad, IsoImage*& image, IsoWriteOpts*& opts) {
+        int rc = iso_image_new(layout.volumeId.c_str(), &image);
+        if (rc < 0) return fail("cannot create image", rc);
+        iso_image_set_application_id(image, layout.applicationId.c_str());
+        iso_image_set_publisher_id(image, layout.publisherId.c_str());
+        iso_image_set_data_preparer_id(image, layout.preparerId.c_str());
+
+        IsoDir* root = iso_image_get_root(image);
+        rc = iso_tree_add_dir_rec(image, root, layout.tree.c_str());
+        if (rc < 0) return fail("cannot add " + layout.tree, rc);
+        // Boot files first on the disc, like --sort-weight 1 /boot, then the
+        // payload so little comes before it
+        IsoNode* node = nullptr;
+        if (iso_tree_path_to_node(image, "/boot", &node) == 1) iso_node_set_sort_weight(node, 2);
+        if (!payload.path.empty() && !stubPayload(image, payload)) return false;
+        for (const auto& overlay : layout.overlays) {
+            if (!addOverlay(image, overlay, "", root)) return false;
+        }
+        if (!pad.empty()) {
+            rc = iso_tree_add_node(image, root, pad.c_str(), &node);
+            if (rc < 0) return fail("cannot add the alignment pad", rc);
+            iso_node_set_sort_weight(node, 2);
+        }
+
+        bool grub2 = layout.boot == IsoLayout::Boot::Grub2;
+        ElToritoBootImage* bios = nullptr;
+        rc = iso_image_set_boot_image(image, ("/" + layout.biosImage).c_str(), ELTORITO_NO_EMUL,
+                                      ("/" + layout.catalog).c_str(), &bios);
+        if (rc < 0) return fail("cannot use " + layout.biosImage + " as BIOS boot image", rc);
+        el_torito_set_load_size(bios, 4);
+        // bit0 boot info table, bit1 isohybrid, bit9 GRUB2 boot info
+        el_torito_set_isolinux_options(bios, grub2 ? (1 | (1 << 9)) : (1 | (1 << 1)), 0);
+
+        ElToritoBootImage* efi = nullptr;
+        std::string efiPath = grub2 ? "--interval:appended_partition_2:all::" : "/" + layout.efiImage;
+        rc = iso_image_add_boot_image(image, efiPath.c_str(), ELTORITO_NO_EMUL, 0, &efi);
+        if (rc < 0) return fail("cannot use " + layout.efiImage + " as EFI boot image", rc);
+        el_torito_set_boot_platform_id(efi, 0xef);
+        // bits 2-7: list the EFI image in the GPT as a basic data partition
+        if (!grub2) el_torito_set_isolinux_options(efi, 1 << 2, 0);
+
+        rc = iso_write_opts_new(&opts, 1);
+        if (rc < 0) return fail("cannot create write options", rc);
+        iso_write_opts_set_iso_level(opts, 3);
+        iso_write_opts_set_sort_files(opts, 1);
+        iso_write_opts_set_rockridge(opts, 1);
+        // -r: owner and group 0, permissions as on disk
+        iso_write_opts_set_replace_mode(opts, 0, 0, 1, 1);
+
+        char systemArea[32768] = {};
+        FILE* mbr = fopen(layout.mbrImage.c_str(), "rb");
+        if (!mbr) return fail("cannot read " + layout.mbrImage + ": " + strerror(errno));
+        size_t mbrBytes = fread(systemArea, 1, sizeof(systemArea), mbr);
+        fclose(mbr);
+        if (mbrBytes < 512) return fail(layout.mbrImage + " is too short for an MBR");
+        // GRUB2: bit0 protective MBR partition, bit14 GRUB2 MBR patching;
+        // ISOLINUX: bit1 isohybrid MBR
+        rc = iso_write_opts_set_system_area(opts, systemArea, grub2 ? (1 | (1 << 14)) : (1 << 1), 0);
+        if (rc < 0) return fail("cannot set up the MBR from " + layout.mbrImage, rc);
+
+        if (grub2) {
+            rc = iso_write_opts_set_part_offset(opts, 16, 0, 0);
+            if (rc < 0) return fail("cannot set the partition offset", rc);
+            rc = iso_write_opts_set_partition_img(opts, 2, 0xef, const_cast<char*>(layout.efiImage.c_str()), 0);
+            if (rc < 0) return fail("cannot append " + layout.efiImage, rc);
+        }
+        if (!layout.persistImage.empty()) {
+            rc = iso_write_opts_set_partition_img(opts, 3, 0x83, const_cast<char*>(layout.persistImage.c_str()), 0);
+            if (rc < 0) return fail("cannot append " + layout.persistImage, rc);
+        }
+
+        // The volume modification time doubles as the UUID GRUB searches for
+        time_t now = layout.timestamp ? layout.timestamp : time(nullptr);
+        char uuid[17];
+        strftime(uuid, sizeof(uuid), "%Y%m%d%H%M%S", layout.timestamp ? gmtime(&now) : localtime(&now));
+        strcat(uuid, "00");
+        iso_write_opts_set_pvd_times(opts, now, now, 0, now, uuid);
+        if (layout.timestamp) {
+            // File dates, the time zone and the GPT disk GUID are the other
+            // inputs that differ between two builds of the same tree
+            iso_write_opts_set_always_gmt(opts, 1);
+            iso_write_opts_set_replace_timestamps(opts, 2);
+            iso_write_opts_set_default_timestamp(opts, layout.timestamp);
+            uint8_t guid[16] = {0};
+            iso_write_opts_set_gpt_guid(opts, guid, 2);
+        }
+        return true;
+    }
+
+    // Adds the files of an overlay directory, replacing what the tree has
+    // at the same path and creating missing directories
+    bool addOverlay(IsoImage* image, const std::string& overlay, const std::string& rel, IsoDir* parent) {
+        std::string dirPath = rel.empty() ? overlay : overlay + "/" + rel;
+        DIR* dir = opendir(dirPath.c_str());
+        if (!dir) return fail("cannot read overlay " + dirPath + ": " + strerror(errno));
+        std::vector<std::string> names;
+        while (struct dirent* e = readdir(dir)) {
+            std::string name = e->d_name;
+            if (name != "." && name != "..") names.push_back(name);
+        }
+        closedir(dir);
+
+        for (const auto& name : names) {
+            std::string child = rel.empty() ? name : rel + "/" + name;
+            struct stat st;
+            if (lstat((overlay + "/" + child).c_str(), &st) != 0) return fail("cannot read overlay " + overlay + "/" + child);
+            IsoNode* existing = nullptr;
+            bool exists = iso_tree_path_to_node(image, ("/" + child).c_str(), &existing) == 1;
+            if (S_ISDIR(st.st_mode)) {
+                IsoDir* target = nullptr;
+                if (exists && iso_node_get_type(existing) == LIBISO_DIR) {
+                    target = reinterpret_cast<IsoDir*>(existing);
+                } else {
+                    if (exists) iso_node_remove(existing);
+                    int rc = iso_tree_add_new_dir(parent, name.c_str(), &target);
+                    if (rc < 0) return fail("cannot add overlay directory " + child, rc);
+                }
+                if (!addOverlay(image, overlay, child, target)) return false;
+                continue;
+            }
+            if (exists) iso_node_remove(existing);
+            IsoNode* node = nullptr;
+            int rc = iso_tree_add_node(image, parent, (overlay + "/" + child).c_str(), &node);
+            if (rc < 0) return fail("cannot add overlay file " + child, rc);
+        }
+        return true;
+    }
+
+    Result stream(burn_source* source, const std::string& output, const Payload& payload, bool mayRetry) {
+        off_t size = source->get_size(source);
+        totalBytes = size > 0 ? static_cast<uint64_t>(size) : 0;
+
+        int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fail("cannot create " + output + ": " + strerror(errno));
+            return Result::Failed;
+        }
+        void* buffer = nullptr;
+        if (posix_memalign(&buffer, 4096, bufferSize) != 0) {
+            close(fd);
+            fail("out of memory");
+            return Result::Failed;
+        }
+        unsigned char* data = static_cast<unsigned char*>(buffer);
+
+        Result result = Result::Done;
+        bool searching = payload.fd >= 0;
+        uint64_t payloadAt = 0, skip = 0;
+        bool skipped = false;
+        while (result == Result::Done) {
+            int n = source->read_xt(source, data, static_cast<int>(bufferSize));
+            if (n == 0) break;
+            if (n < 0) {
+                fail("libisofs stopped after " + std::to_string(bytesWritten) + " bytes; see the messages above");
+                result = Result::Failed;
+                break;
+            }
+            size_t len = static_cast<size_t>(n), pos = 0;
+            while (pos < len && result == Result::Done) {
+                if (skip > 0) {
+                    // Past the marker sector the stub only produces zeros;
+                    // anything else means the range is not the payload
+                    size_t step = static_cast<size_t>(std::min<uint64_t>(skip, len - pos));
+                    uint64_t into = payload.size - skip;
+                    size_t markerPart = into < 2048 ? static_cast<size_t>(std::min<uint64_t>(2048 - into, step)) : 0;
+                    if (!allZero(data + pos + markerPart, step - markerPart)) {
+                        fail("the image stream does not match the payload stub at byte " + std::to_string(bytesWritten));
+                        result = Result::Failed;
+                        break;
+                    }
+                    skip -= step;
+                    pos += step;
+                    bytesWritten += step;
+                    continue;
+                }
+                // Files start on 2 KiB sectors; look for the payload's first sector
+                size_t end = len;
+                if (searching) {
+                    for (size_t at = pos + (2048 - (bytesWritten % 2048)) % 2048; at + 2048 <= len; at += 2048) {
+                        if (memcmp(data + at, payload.marker.data(), 2048) != 0) continue;
+                        searching = false;
+                        uint64_t offset = bytesWritten + (at - pos);
+                        if (offset % CLONE_BLOCK != 0 && mayRetry) {
+                            result = Result::Misaligned;
+                            break;
+                        }
+                        // The stub's bytes are never written; a misaligned
+                        // payload is copied instead of cloned
+                        payloadAt = offset;
+                        skip = payload.size;
+                        skipped = true;
+                        end = at;
+                        break;
+                    }
+                }
+                if (result != Result::Done) break;
+                if (!writeAt(fd, data + pos, end - pos, bytesWritten, output)) {
+                    result = Result::Failed;
+                    break;
+                }
+                bytesWritten += end - pos;
+                pos = end;
+            }
+            if (result == Result::Done && progress) progress(bytesWritten, totalBytes);
+        }
+        free(buffer);
+
+        if (result == Result::Done && (searching || skip > 0)) {
+            fail("the payload stub " + std::string(searching ? "never appeared in" : "was cut short in") + " the image stream");
+            result = Result::Failed;
+        }
+        if (result == Result::Done && skipped && !clonePayload(payload, fd, payloadAt, output)) result = Result::Failed;
+        if (result == Result::Done && ftruncate(fd, static_cast<off_t>(bytesWritten)) != 0) {
+            fail("cannot size " + output + ": " + strerror(errno));
+            result = Result::Failed;
+        }
+        if (result == Result::Done && fdatasync(fd) != 0) {
+            fail("cannot flush " + output + ": " + strerror(errno));
+            result = Result::Failed;
+        }
+        if (close(fd) != 0 && result == Result::Done) {
+            fail("cannot close " + output + ": " + strerror(errno));
+            result = Result::Failed;
+        }
+        return result;
+    }
+
+    bool writeAt(int fd, const unsigned char* data, size_t len, uint64_t offset, const std::string& output) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t w = pwrite(fd, data + done, len - done, static_cast<off_t>(offset + done));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return fail("write to " + output + " failed: " + strerror(errno));
+            done += static_cast<size_t>(w);
+        }
+        return true;
+    }
+
+    // Fills the skipped payload range: whole blocks by reflink, the rest
+    // (or everything, if the filesystem cannot clone) by copying
+    bool clonePayload(const Payload& payload, int fd, uint64_t offset, const std::string& output) {
+        uint64_t aligned = payload.size / CLONE_BLOCK * CLONE_BLOCK;
+        uint64_t from = 0;
+        if (aligned > 0 && offset % CLONE_BLOCK == 0) {
+            struct file_clone_range range = {};
+            range.src_fd = payload.fd;
+            range.src_offset = 0;
+            range.src_length = aligned;
+            range.dest_offset = offset;
+            if (ioctl(fd, FICLONERANGE, &range) == 0) {
+                reflinkedBytes = aligned;
+                from = aligned;
+            }
+        }
+        copiedPayloadBytes = payload.size - from;
+        while (from < payload.size) {
+            loff_t in = static_cast<loff_t>(from), out = static_cast<loff_t>(offset + from);
+            ssize_t n = copy_file_range(payload.fd, &in, fd, &out, payload.size - from, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            from += static_cast<uint64_t>(n);
+        }
+        // copy_file_range is not available everywhere; finish with plain reads
+        std::vector<unsigned char> buf(1 << 20);
+        while (from < payload.size) {
+            ssize_t n = pread(payload.fd, buf.data(), std::min<uint64_t>(buf.size(), payload.size - from), static_cast<off_t>(from));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return fail("cannot read " + payload.path + ": " + strerror(errno));
+            if (!writeAt(fd, buf.data(), static_cast<size_t>(n), offset + from, output)) return false;
+            from += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+};
+
+#endif